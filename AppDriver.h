@@ -11,6 +11,8 @@
 #include <iostream>
 // Allows for certain math functions.
 #include <algorithm>
+// Allows the use of ceil and abs.
+#include <cmath>
 // Allow for use of strings.
 #include <string>
 // Allows the use of time.
@@ -27,8 +29,12 @@
 class AppDriver
 {
 public:
-	// Constructor for the AppDriver class. Initializes the BST object.
-	AppDriver() : tree()
+	/// <summary>
+	/// Constructor for the AppDriver class. Initializes the BST object.
+	/// </summary>
+	/// <param name="waitForUser"> Whether to pause after each step until the user continues.
+	/// Pass false to run the whole showcase straight through (for scripts and CI).</param>
+	AppDriver(bool waitForUser = true) : tree(), interactive(waitForUser)
 	{
 		// Initialize rand with a random seed.
 		srand(time(NULL));
@@ -132,6 +138,27 @@ public:
 		Print(temp);
 		Pause();
 
+		temp = "We don't have to read the printout to check that, though. The BST can ";
+		temp += "tell us directly how many times it holds a value, and how many values ";
+		temp += "it holds in total, without walking the whole tree.";
+		Print(temp);
+		Pause();
+
+		// The minimum was in the test array at least once, and was then inserted again.
+		Quantity duplicateCount = tree.Count(duplicateVal);
+		Print("Count(" + std::to_string(duplicateVal) + ") returned " + std::to_string(duplicateCount) + ".");
+		// If the count and the total size both account for the extra copy,
+		if (duplicateCount >= 2 && tree.Size() == testArray.size() + 1)
+		{
+			Print("Test SUCCESS because the value is counted at least twice and the tree holds 21 values.");
+		}
+		// Else, the counts are wrong.
+		else
+		{
+			Print("Test FAILED because the count or the total size did not include the duplicate.");
+		}
+		Pause();
+
 		temp = "Now, to test deletion of nodes with exactly one or two children, we ";
 		temp += "should start with a clean slate and an empty tree. This presents us with ";
 		temp += "a great opportunity to test deleting a node with no children, since ";
@@ -257,7 +284,9 @@ public:
 
 private:
 	// The Binary Search Tree that this program is testing.
-	BinarySearchTree tree;
+	BinarySearchTree<int> tree;
+	// Whether Pause() waits for the user.
+	bool interactive;
 	// The integer array used for testing the BST. Length of 20.
 	std::array<int, 20> testArray = { { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 } };
 
@@ -309,7 +338,17 @@ private:
 	{
 		// Add newlines before and after the pause.
 		std::cout << "\n";
-		system("pause");
+		// If the showcase is being run straight through, do not wait.
+		if (interactive)
+		{
+#if defined(_WIN32)
+			system("pause");
+#else
+			// "pause" only exists on Windows, so wait for Enter instead.
+			std::cout << "Press Enter to continue . . . " << std::flush;
+			std::cin.get();
+#endif
+		}
 		std::cout << "\n";
 	}
 
@@ -358,11 +397,7 @@ private:
 	/// </summary>
 	void AddArrayToBST(std::array<int, 20>& arr)
 	{
-		// Iterate through the array
-		for (int i = 0, len = arr.size(); i < len; i++)
-		{
-			// Insert this element into the tree.
-			tree.Insert(arr[i]);
-		}
+		// Sort the array, collapse duplicates, and build the tree from it in one pass.
+		tree.BuildFrom(arr);
 	}
 };
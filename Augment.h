@@ -0,0 +1,135 @@
+/*
+* This file defines the augmentations a Binary Search Tree (BST) can keep in its nodes.
+*
+* An augmentation is a monoid: a Value type, an Identity() value, a way to turn one
+* node's value and quantity into a Value with Of(), and an associative Combine(). Every
+* node keeps the Combine() of its whole subtree, in order: left subtree, then the node,
+* then the right subtree. The BST brings it up to date wherever it already updates
+* heights and sizes (every Insert, Delete, rotation, join and bulk build), so the
+* aggregate of any range of values takes O(log n) nodes to answer instead of a scan.
+*
+* Combine() only has to be associative, not commutative, so "first value in the range"
+* or string concatenation work just as well as sums and maximums.
+*
+* NoAugment is the default. Its Value is empty, and an empty Value is stored through the
+* empty base optimization, so the nodes of a tree without an augmentation are no larger
+* and Update() compiles the augmentation away entirely.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows the use of std::max.
+#include <algorithm>
+// Allows the use of fixed width integers.
+#include <cstdint>
+// Allows the use of std::is_empty.
+#include <type_traits>
+#pragma endregion Preprocessor Directives
+
+// The augmentation that keeps nothing.
+struct NoAugment
+{
+	// Nothing is stored.
+	struct Value
+	{
+	};
+
+	static Value Identity()
+	{
+		return Value();
+	}
+
+	template <typename Key>
+	static Value Of(const Key&, std::uint64_t)
+	{
+		return Value();
+	}
+
+	static Value Combine(const Value&, const Value&)
+	{
+		return Value();
+	}
+};
+
+// Define the SumAugment struct.
+// The sum of value * quantity over a subtree, added up as Sum (so ints can be summed
+// as 64-bit). Gives the weighted sum of any range of values.
+template <typename Key, typename Sum = long long>
+struct SumAugment
+{
+	using Value = Sum;
+
+	static Value Identity()
+	{
+		return Value();
+	}
+
+	static Value Of(const Key& key, std::uint64_t quantity)
+	{
+		return static_cast<Sum>(key) * static_cast<Sum>(quantity);
+	}
+
+	static Value Combine(const Value& left, const Value& right)
+	{
+		return left + right;
+	}
+};
+
+// Define the MaxQuantityAugment struct.
+// The largest quantity in a subtree, so the most repeated value of any range.
+struct MaxQuantityAugment
+{
+	using Value = std::uint64_t;
+
+	static Value Identity()
+	{
+		return 0;
+	}
+
+	template <typename Key>
+	static Value Of(const Key&, std::uint64_t quantity)
+	{
+		return quantity;
+	}
+
+	static Value Combine(const Value& left, const Value& right)
+	{
+		return std::max(left, right);
+	}
+};
+
+// Define the AugmentStorage struct.
+// Where a node keeps the aggregate of its subtree. Nodes inherit from it, so when Value
+// is empty this takes no room at all.
+template <typename Value, bool = std::is_empty<Value>::value>
+struct AugmentStorage
+{
+	// The Combine() of every value in the subtree rooted at this node.
+	Value aggregate = Value();
+
+	const Value& Aggregate() const
+	{
+		return aggregate;
+	}
+
+	void SetAggregate(const Value& value)
+	{
+		aggregate = value;
+	}
+};
+
+// An empty Value has nothing to keep.
+template <typename Value>
+struct AugmentStorage<Value, true>
+{
+	Value Aggregate() const
+	{
+		return Value();
+	}
+
+	void SetAggregate(const Value&)
+	{
+		// Intentionally left blank.
+	}
+};
@@ -0,0 +1,86 @@
+/*
+*   Binary Search Tree Benchmark
+*   Runs the BenchmarkSuite and writes its results as JSON.
+*
+*   Usage: BinarySearchTreeBenchmark [--max-size N] [--min-ops N] [--out FILE]
+*          BinarySearchTreeBenchmark --compare
+*
+*   --max-size  The largest tree size to measure, from 1000 up to 100000000.
+*               Defaults to 1000000, since 1e8 keys need several GB of memory.
+*   --min-ops   Small sizes are repeated until this many keys have been inserted.
+*   --out       Write the JSON to FILE instead of the console.
+*   --compare   Run the BenchmarkDriver comparison tables instead.
+*/
+
+#pragma region Preprocessor Directives
+// Allows use of console (cout, cerr).
+#include <iostream>
+// Allows the results to be written to a file.
+#include <fstream>
+// Allow for use of strings.
+#include <string>
+// Includes the BenchmarkSuite class.
+#include "BenchmarkSuite.h"
+// Includes the BenchmarkDriver class.
+#include "BenchmarkDriver.h"
+#pragma endregion Preprocessor Directives
+
+int main(int argc, char* argv[])
+{
+    std::uint64_t maxSize = 1000000;
+    std::uint64_t minOps = 1000000;
+    std::string outPath;
+
+    // Read the options.
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        // If the comparison tables were asked for, run those and stop.
+        if (arg == "--compare")
+        {
+            BenchmarkDriver benchmarkDriver = BenchmarkDriver();
+            benchmarkDriver.Run();
+            return 0;
+        }
+        // Every other option needs a value after it.
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << "\n";
+            return 1;
+        }
+        if (arg == "--max-size")
+        {
+            maxSize = std::stoull(argv[++i]);
+        }
+        else if (arg == "--min-ops")
+        {
+            minOps = std::stoull(argv[++i]);
+        }
+        else if (arg == "--out")
+        {
+            outPath = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    BenchmarkSuite suite(maxSize, minOps);
+    // If no file was given, the JSON goes to the console and progress goes to cerr.
+    if (outPath.empty())
+    {
+        suite.Run(std::cout, &std::cerr);
+        return 0;
+    }
+
+    std::ofstream out(outPath);
+    if (!out)
+    {
+        std::cerr << "Could not open " << outPath << "\n";
+        return 1;
+    }
+    suite.Run(out, &std::cout);
+    return 0;
+}
@@ -0,0 +1,1918 @@
+/*
+* This file defines the BenchmarkDriver class, which times the Binary Search Tree (BST)
+* without any user interaction. Where the AppDriver shows the tree off step by step,
+* the BenchmarkDriver feeds it large amounts of keys and reports how long each
+* operation took, so that changes to the tree can be compared against each other.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows use of console (cout).
+#include <iostream>
+// Allows for certain math functions and shuffling.
+#include <algorithm>
+// Allows the use of timers.
+#include <chrono>
+// Allows for output formatting.
+#include <iomanip>
+// Allows the use of stream buffers.
+#include <streambuf>
+// Allows the use of random number generation.
+#include <random>
+// Allow for use of strings.
+#include <string>
+// Allows the use of vectors.
+#include <vector>
+// The BST class.
+#include "BinarySearchTree.h"
+// The read-optimized array layout of a BST.
+#include "EytzingerTree.h"
+// The standard ordered set, used as a pointer-chasing baseline.
+#include <set>
+// The BST that many threads can use at once.
+#include "ConcurrentBinarySearchTree.h"
+// Allows the use of mutexes, used as the locked baseline.
+#include <mutex>
+// Allows the use of threads.
+#include <thread>
+// Saving and loading binary snapshots of a BST.
+#include "Snapshot.h"
+// The path-copying BST with O(1) snapshots.
+#include "PersistentBinarySearchTree.h"
+// Allows temporary files to be removed.
+#include <cstdio>
+// Allows the tree statistics to be formatted into a string.
+#include <sstream>
+// The AVL tree with 32-bit indices and packed balance bits.
+#include "CompactBinarySearchTree.h"
+// The B+ tree of int values searched with SIMD instructions.
+#include "SimdBPlusTree.h"
+// The standard heap, used as the priority queue baseline.
+#include <queue>
+// The Zipfian key distribution.
+#include "BenchmarkSuite.h"
+// The range-partitioned tree with one lock per shard.
+#include "ShardedBinarySearchTree.h"
+// The write-ahead log and the durable tree built on it.
+#include "WriteAheadLog.h"
+#pragma endregion Preprocessor Directives
+
+// Define the BenchmarkDriver class.
+class BenchmarkDriver
+{
+public:
+	/// <summary>
+	/// Constructor for the BenchmarkDriver class.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys used by each benchmark.</param>
+	BenchmarkDriver(int keyCount = 20000) : count(keyCount), generator(12345)
+	{
+		// Intentionally left blank.
+	}
+
+	/// <summary>
+	/// Runs every benchmark and prints the results to the console.
+	/// </summary>
+	void Run()
+	{
+		std::cout << "\n   Binary Search Tree Benchmarks (" << count << " keys)\n";
+		RunBalanceBenchmark();
+		RunAllocationBenchmark();
+		RunKeyTypeBenchmark();
+		RunTraverseBenchmark();
+		RunLookupBenchmark();
+		RunRangeCountBenchmark();
+		RunBulkBuildBenchmark({ 1000000, 10000000 });
+		RunConcurrencyBenchmark();
+		RunSnapshotBenchmark();
+		RunBatchBenchmark();
+		RunWeightedBenchmark();
+		RunPersistentBenchmark();
+		RunParallelBenchmark();
+		RunStatsBenchmark();
+		RunOwnershipBenchmark();
+		RunCompactBenchmark();
+		RunSimdBenchmark();
+		RunPriorityQueueBenchmark();
+		RunZipfBenchmark();
+		RunZipfBenchmark(1000000, 2000000, 1.2);
+		RunAugmentBenchmark();
+		RunIteratorBenchmark();
+		RunShardedBenchmark();
+		RunWriteAheadLogBenchmark();
+	}
+
+	/// <summary>
+	/// Stress tests the tree with a chain of chainLength sorted keys, deep enough to
+	/// overflow the stack of any operation that recurses once per level. Sorted inserts
+	/// into a Splay tree leave every key as the left child of the next, one step each, so
+	/// the chain is built in O(n) and then handed to an Unbalanced tree as it is. Every
+	/// operation is then run on the chain before it is cleared.
+	/// </summary>
+	/// <param name="chainLength"> The depth of the chain.</param>
+	/// <returns> True if every operation gave the expected result.</returns>
+	bool RunStress(int chainLength = 10000000)
+	{
+		std::cout << "\n   -- Stress: " << chainLength << "-deep chain (unbalanced) --\n";
+		bool passed = true;
+		auto expect = [&passed](bool condition, const std::string& what)
+		{
+			if (!condition)
+			{
+				std::cout << "   FAILED: " << what << "\n";
+				passed = false;
+			}
+		};
+
+		BinarySearchTree<int> splayed(BalanceMode::Splay);
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < chainLength; i++)
+		{
+			splayed.Insert(i);
+		}
+		BinarySearchTree<int> chain(BalanceMode::Unbalanced);
+		chain.Merge(splayed);
+		PrintRow("Insert sorted", "splay", ElapsedMs(start), "height " + std::to_string(chain.Height()));
+		expect(chain.Height() == chainLength, "the chain is as deep as it is long");
+		expect(chain.Depth(0) == chainLength, "the smallest key is at the bottom");
+
+		// Inserting, finding and deleting below the deepest key each walk the full chain.
+		start = Clock::now();
+		chain.Insert(-1);
+		bool found = chain.Count(-1) == 1;
+		chain.Delete(-1);
+		PrintRow("Insert+Count+Delete deepest", "unbalanced", ElapsedMs(start));
+		expect(found && !chain.Contains(-1), "insert, count and delete the deepest key");
+
+		start = Clock::now();
+		long long checksum = static_cast<long long>(chain.Minimum()) + chain.Maximum();
+		PrintRow("Min+Max", "unbalanced", ElapsedMs(start), "checksum " + std::to_string(checksum));
+		expect(checksum == chainLength - 1, "minimum and maximum");
+
+		start = Clock::now();
+		long long visited = 0;
+		chain.ForEach([&visited](const int&, Quantity) { visited++; });
+		PrintRow("ForEach", "unbalanced", ElapsedMs(start));
+		expect(visited == chainLength, "ForEach visits every key");
+
+		start = Clock::now();
+		CountingBuffer buffer;
+		std::ostream sink(&buffer);
+		chain.Traverse(sink);
+		PrintRow("Traverse", "unbalanced", ElapsedMs(start), std::to_string(buffer.written) + " chars");
+		expect(buffer.written > 0, "Traverse writes the chain");
+
+		start = Clock::now();
+		TreeStats stats = chain.Stats();
+		PrintRow("Stats", "unbalanced", ElapsedMs(start), "average depth " + std::to_string(stats.averageDepth));
+		expect(stats.nodeCount == static_cast<std::size_t>(chainLength), "Stats walks every node");
+
+		start = Clock::now();
+		{
+			BinarySearchTree<int> copy = chain.Clone();
+			expect(copy.Height() == chainLength && copy.Size() == chain.Size(), "Clone keeps the chain");
+		}
+		PrintRow("Clone+destroy", "unbalanced", ElapsedMs(start));
+
+		start = Clock::now();
+		chain.Clear();
+		PrintRow("Clear", "unbalanced", ElapsedMs(start));
+		expect(chain.Size() == 0 && chain.Height() == 0, "Clear empties the tree");
+
+		// Nodes of ints are simply handed back to the pool, so a chain of strings is
+		// needed to make Clear() walk and destroy every node. The keys are padded so that
+		// they sort in the order they are inserted.
+		BinarySearchTree<std::string> splayedText(BalanceMode::Splay);
+		start = Clock::now();
+		for (int i = 0; i < chainLength; i++)
+		{
+			std::string key = std::to_string(i);
+			splayedText.Insert(std::string(10 - key.size(), '0') + key);
+		}
+		BinarySearchTree<std::string> textChain(BalanceMode::Unbalanced);
+		textChain.Merge(splayedText);
+		PrintRow("Insert sorted", "splay string", ElapsedMs(start), "height " + std::to_string(textChain.Height()));
+		expect(textChain.Height() == chainLength, "the string chain is as deep as it is long");
+		start = Clock::now();
+		textChain.Clear();
+		PrintRow("Clear", "unbalanced string", ElapsedMs(start));
+		expect(textChain.Size() == 0, "Clear destroys every string");
+
+		std::cout << "   " << (passed ? "passed" : "failed") << "\n";
+		return passed;
+	}
+
+private:
+	// The number of keys used by each benchmark.
+	int count;
+	// The random number generator. Seeded with a constant so runs are repeatable.
+	std::mt19937 generator;
+
+	// A stopwatch for timing a block of code in milliseconds.
+	using Clock = std::chrono::steady_clock;
+
+	/// <summary>
+	/// Returns the number of milliseconds since start.
+	/// </summary>
+	/// <param name="start"> The time the measurement started.</param>
+	/// <returns></returns>
+	static double ElapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	/// <summary>
+	/// Builds the keys 0 .. count-1 in the requested order.
+	/// </summary>
+	/// <param name="order"> "sorted", "reverse" or "random".</param>
+	/// <returns></returns>
+	std::vector<int> MakeKeys(const std::string& order)
+	{
+		std::vector<int> keys(count);
+		for (int i = 0; i < count; i++)
+		{
+			keys[i] = i;
+		}
+
+		// Rearrange the sorted keys as requested.
+		if (order == "reverse")
+		{
+			std::reverse(keys.begin(), keys.end());
+		}
+		else if (order == "random")
+		{
+			std::shuffle(keys.begin(), keys.end(), generator);
+		}
+		return keys;
+	}
+
+	/// <summary>
+	/// Prints one row of a results table.
+	/// </summary>
+	static void PrintRow(const std::string& name, const std::string& variant, double ms, const std::string& extra = "")
+	{
+		std::cout << "   " << std::left << std::setw(28) << name << std::setw(14) << variant
+			<< std::right << std::setw(12) << std::fixed << std::setprecision(3) << ms << " ms"
+			<< "   " << extra << "\n";
+	}
+
+	/// <summary>
+	/// Compares the unbalanced tree against the AVL tree for sorted, reverse-sorted
+	/// and random insertion orders. Each run inserts every key, queries the minimum and
+	/// maximum, and then deletes every key.
+	/// </summary>
+	void RunBalanceBenchmark()
+	{
+		std::cout << "\n   -- Balancing: insertion order vs balance mode --\n";
+		const char* orders[] = { "sorted", "reverse", "random" };
+		for (const char* order : orders)
+		{
+			std::vector<int> keys = MakeKeys(order);
+			RunBalanceCase(order, keys, BalanceMode::Unbalanced, "unbalanced");
+			RunBalanceCase(order, keys, BalanceMode::AVL, "avl");
+		}
+	}
+
+	/// <summary>
+	/// Runs a single insertion order against a single balance mode.
+	/// </summary>
+	void RunBalanceCase(const std::string& order, const std::vector<int>& keys, BalanceMode mode, const std::string& modeName)
+	{
+		BinarySearchTree<int> tree(mode);
+
+		// Time inserting every key.
+		Clock::time_point start = Clock::now();
+		for (int key : keys)
+		{
+			tree.Insert(key);
+		}
+		double insertMs = ElapsedMs(start);
+
+		// Time polling the minimum and maximum.
+		start = Clock::now();
+		long long checksum = 0;
+		for (int i = 0; i < 1000; i++)
+		{
+			checksum += tree.Minimum() + tree.Maximum();
+		}
+		double minMaxMs = ElapsedMs(start);
+		int height = tree.Height();
+
+		// Time deleting every key in the order they were inserted.
+		start = Clock::now();
+		for (int key : keys)
+		{
+			tree.Delete(key);
+		}
+		double deleteMs = ElapsedMs(start);
+
+		PrintRow("Insert (" + order + ")", modeName, insertMs, "height " + std::to_string(height));
+		PrintRow("1000x Min+Max (" + order + ")", modeName, minMaxMs, "checksum " + std::to_string(checksum));
+		PrintRow("Delete (" + order + ")", modeName, deleteMs);
+	}
+
+	/// <summary>
+	/// Compares per-node new/delete against the slab node pool. Each run inserts
+	/// random keys into an AVL tree, deletes half of them, inserts as many new keys
+	/// (so freed nodes can be recycled), and then clears the tree.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys to insert.</param>
+	void RunAllocationBenchmark(int keyCount = 1000000)
+	{
+		std::cout << "\n   -- Allocation: heap vs arena (" << keyCount << " random keys, avl) --\n";
+		std::vector<int> keys(keyCount * 2);
+		for (int i = 0; i < keyCount * 2; i++)
+		{
+			keys[i] = i;
+		}
+		std::shuffle(keys.begin(), keys.end(), generator);
+
+		RunAllocationCase(keys, keyCount, AllocationMode::Heap, "heap");
+		RunAllocationCase(keys, keyCount, AllocationMode::Arena, "arena");
+	}
+
+	/// <summary>
+	/// Runs the allocation benchmark against a single allocation mode.
+	/// </summary>
+	void RunAllocationCase(const std::vector<int>& keys, int keyCount, AllocationMode mode, const std::string& modeName)
+	{
+		BinarySearchTree<int> tree(BalanceMode::AVL, mode);
+
+		// Insert the first half of the keys.
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < keyCount; i++)
+		{
+			tree.Insert(keys[i]);
+		}
+		double insertMs = ElapsedMs(start);
+
+		// Delete every other key, then insert the second half so freed nodes get reused.
+		start = Clock::now();
+		for (int i = 0; i < keyCount; i += 2)
+		{
+			tree.Delete(keys[i]);
+		}
+		for (int i = keyCount; i < keyCount + keyCount / 2; i++)
+		{
+			tree.Insert(keys[i]);
+		}
+		double churnMs = ElapsedMs(start);
+
+		start = Clock::now();
+		tree.Clear();
+		double clearMs = ElapsedMs(start);
+
+		const NodePoolStats& stats = tree.AllocationStats();
+		PrintRow("Insert", modeName, insertMs);
+		PrintRow("Delete half + reinsert", modeName, churnMs);
+		PrintRow("Clear", modeName, clearMs);
+		std::cout << "   " << modeName << ": " << stats.allocations << " nodes allocated, "
+			<< stats.recycled << " recycled, " << stats.heapAllocations << " heap allocations, "
+			<< stats.bytesReserved << " bytes reserved\n";
+	}
+
+	/// <summary>
+	/// Times random inserts for several key types, and compares copying, moving and
+	/// emplacing heavy string keys into the tree.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys to insert.</param>
+	void RunKeyTypeBenchmark(int keyCount = 200000)
+	{
+		std::cout << "\n   -- Key types (" << keyCount << " random keys, avl) --\n";
+		std::vector<int> order = MakeKeysOfSize(keyCount);
+
+		RunKeyTypeCase<int>(order, "int", [](int i) { return i; });
+		RunKeyTypeCase<long long>(order, "int64", [](int i) { return (long long)i * 1000003LL; });
+		RunKeyTypeCase<double>(order, "double", [](int i) { return i * 0.5; });
+
+		// Strings long enough that they cannot use the small string buffer.
+		std::vector<std::string> strings(keyCount);
+		for (int i = 0; i < keyCount; i++)
+		{
+			strings[i] = "customer-record-key-" + std::to_string(order[i]) + "-padding-to-avoid-sso";
+		}
+
+		std::vector<std::string> copies = strings;
+		BinarySearchTree<std::string> copied(BalanceMode::AVL);
+		Clock::time_point start = Clock::now();
+		for (const std::string& key : copies)
+		{
+			copied.Insert(key);
+		}
+		PrintRow("Insert (copy)", "string", ElapsedMs(start));
+
+		copies = strings;
+		BinarySearchTree<std::string> moved(BalanceMode::AVL);
+		start = Clock::now();
+		for (std::string& key : copies)
+		{
+			moved.Insert(std::move(key));
+		}
+		PrintRow("Insert (move)", "string", ElapsedMs(start));
+
+		BinarySearchTree<std::string> emplaced(BalanceMode::AVL);
+		start = Clock::now();
+		for (int i = 0; i < keyCount; i++)
+		{
+			emplaced.Emplace(strings[i].data(), strings[i].size());
+		}
+		PrintRow("Emplace (char*, size)", "string", ElapsedMs(start));
+	}
+
+	/// <summary>
+	/// Returns the keys 0 .. size-1 in a random order.
+	/// </summary>
+	/// <param name="size"> The number of keys.</param>
+	/// <returns></returns>
+	std::vector<int> MakeKeysOfSize(int size)
+	{
+		std::vector<int> keys(size);
+		for (int i = 0; i < size; i++)
+		{
+			keys[i] = i;
+		}
+		std::shuffle(keys.begin(), keys.end(), generator);
+		return keys;
+	}
+
+	/// <summary>
+	/// Times inserting keys of type Key, built from order by makeKey.
+	/// </summary>
+	template <typename Key, typename MakeKey>
+	void RunKeyTypeCase(const std::vector<int>& order, const std::string& typeName, MakeKey makeKey)
+	{
+		std::vector<Key> keys;
+		keys.reserve(order.size());
+		for (int i : order)
+		{
+			keys.push_back(makeKey(i));
+		}
+
+		BinarySearchTree<Key> tree(BalanceMode::AVL);
+		Clock::time_point start = Clock::now();
+		for (const Key& key : keys)
+		{
+			tree.Insert(key);
+		}
+		PrintRow("Insert", typeName, ElapsedMs(start), "height " + std::to_string(tree.Height()));
+	}
+
+	// An output stream buffer that throws everything away, but counts the characters.
+	class CountingBuffer : public std::streambuf
+	{
+	public:
+		// The number of characters written so far.
+		std::size_t written = 0;
+
+	protected:
+		std::streamsize xsputn(const char*, std::streamsize count) override
+		{
+			written += static_cast<std::size_t>(count);
+			return count;
+		}
+
+		int_type overflow(int_type ch) override
+		{
+			written++;
+			return ch;
+		}
+	};
+
+	/// <summary>
+	/// Compares the string-building Traverse() against the streaming traversals.
+	/// The old Traverse() pads every line with one more space than the last, so it is
+	/// only run at the driver's small key count. The streaming versions also run at
+	/// largeCount keys.
+	/// </summary>
+	/// <param name="largeCount"> The number of keys for the large tree.</param>
+	void RunTraverseBenchmark(int largeCount = 1000000)
+	{
+		std::cout << "\n   -- Traverse: string vs streaming --\n";
+		BinarySearchTree<int> tree(BalanceMode::AVL);
+		for (int key : MakeKeysOfSize(count))
+		{
+			tree.Insert(key);
+		}
+
+		Clock::time_point start = Clock::now();
+		std::size_t legacySize = tree.Traverse().size();
+		PrintRow("Traverse() string", std::to_string(count), ElapsedMs(start), std::to_string(legacySize) + " chars");
+		RunStreamingTraverse(tree, std::to_string(count));
+
+		BinarySearchTree<int> large(BalanceMode::AVL);
+		for (int key : MakeKeysOfSize(largeCount))
+		{
+			large.Insert(key);
+		}
+		RunStreamingTraverse(large, std::to_string(largeCount));
+	}
+
+	/// <summary>
+	/// Times the ostream, buffer and callback traversals of tree.
+	/// </summary>
+	void RunStreamingTraverse(const BinarySearchTree<int>& tree, const std::string& sizeName)
+	{
+		CountingBuffer counter;
+		std::ostream sink(&counter);
+		Clock::time_point start = Clock::now();
+		tree.Traverse(sink);
+		PrintRow("Traverse(ostream)", sizeName, ElapsedMs(start), std::to_string(counter.written) + " chars");
+
+		// Size the buffer with a first pass, then fill it.
+		std::size_t needed = tree.Traverse(nullptr, 0);
+		std::vector<char> buffer(needed);
+		start = Clock::now();
+		tree.Traverse(buffer.data(), buffer.size());
+		PrintRow("Traverse(buffer)", sizeName, ElapsedMs(start), std::to_string(needed) + " chars");
+
+		long long sum = 0;
+		start = Clock::now();
+		tree.ForEach([&sum](int value, Quantity quantity) { sum += (long long)value * (long long)quantity; });
+		PrintRow("ForEach (sum)", sizeName, ElapsedMs(start), "sum " + std::to_string(sum));
+	}
+
+	/// <summary>
+	/// Compares lookups in the Eytzinger array against pointer chasing (std::set) and
+	/// binary search over a sorted array. The larger size is meant to be bigger than
+	/// the last level cache.
+	/// </summary>
+	/// <param name="lookupCount"> The number of lookups timed per structure.</param>
+	void RunLookupBenchmark(int lookupCount = 2000000)
+	{
+		std::cout << "\n   -- Lookup: Eytzinger array vs pointer chasing --\n";
+		const int sizes[] = { 1 << 16, 1 << 20, 1 << 23 };
+		for (int size : sizes)
+		{
+			// Store the even numbers, so half of the random lookups miss.
+			BinarySearchTree<int> tree(BalanceMode::AVL);
+			std::set<int> set;
+			std::vector<int> sorted;
+			for (int key : MakeKeysOfSize(size))
+			{
+				tree.Insert(key * 2);
+			}
+			for (int i = 0; i < size; i++)
+			{
+				set.insert(set.end(), i * 2);
+				sorted.push_back(i * 2);
+			}
+
+			Clock::time_point start = Clock::now();
+			EytzingerTree<int> flat(tree);
+			PrintRow("Build Eytzinger", std::to_string(size), ElapsedMs(start));
+
+			std::uniform_int_distribution<int> pick(0, size * 2);
+			std::vector<int> queries(lookupCount);
+			for (int& query : queries)
+			{
+				query = pick(generator);
+			}
+
+			long long hits = 0;
+			start = Clock::now();
+			for (int query : queries)
+			{
+				hits += flat.Contains(query);
+			}
+			PrintRow("Eytzinger Contains", std::to_string(size), ElapsedMs(start), "hits " + std::to_string(hits));
+
+			hits = 0;
+			start = Clock::now();
+			for (int query : queries)
+			{
+				hits += tree.Contains(query);
+			}
+			PrintRow("BST Contains", std::to_string(size), ElapsedMs(start), "hits " + std::to_string(hits));
+
+			hits = 0;
+			start = Clock::now();
+			for (int query : queries)
+			{
+				hits += set.count(query);
+			}
+			PrintRow("std::set count", std::to_string(size), ElapsedMs(start), "hits " + std::to_string(hits));
+
+			hits = 0;
+			start = Clock::now();
+			for (int query : queries)
+			{
+				hits += std::binary_search(sorted.begin(), sorted.end(), query);
+			}
+			PrintRow("sorted binary_search", std::to_string(size), ElapsedMs(start), "hits " + std::to_string(hits));
+		}
+	}
+
+	/// <summary>
+	/// Compares counting the values in a range with CountInRange (which uses the
+	/// subtree sizes) against visiting every value in the range with ForEachInRange.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys in the tree.</param>
+	/// <param name="queryCount"> The number of ranges counted.</param>
+	void RunRangeCountBenchmark(int keyCount = 1000000, int queryCount = 100)
+	{
+		std::cout << "\n   -- Range counts (" << keyCount << " keys, avl) --\n";
+		BinarySearchTree<int> tree(BalanceMode::AVL);
+		for (int key : MakeKeysOfSize(keyCount))
+		{
+			tree.Insert(key);
+			// Store every tenth key twice so the counts include duplicates.
+			if (key % 10 == 0)
+			{
+				tree.Insert(key);
+			}
+		}
+
+		std::uniform_int_distribution<int> pick(0, keyCount);
+		std::vector<std::pair<int, int>> ranges(queryCount);
+		for (std::pair<int, int>& range : ranges)
+		{
+			int a = pick(generator);
+			int b = pick(generator);
+			range = { std::min(a, b), std::max(a, b) };
+		}
+
+		Quantity total = 0;
+		Clock::time_point start = Clock::now();
+		for (const std::pair<int, int>& range : ranges)
+		{
+			total += tree.CountInRange(range.first, range.second);
+		}
+		PrintRow("CountInRange", "O(log n)", ElapsedMs(start), "total " + std::to_string(total));
+
+		total = 0;
+		start = Clock::now();
+		for (const std::pair<int, int>& range : ranges)
+		{
+			tree.ForEachInRange(range.first, range.second, [&total](int, Quantity quantity) { total += quantity; });
+		}
+		PrintRow("ForEachInRange", "scan", ElapsedMs(start), "total " + std::to_string(total));
+	}
+
+	/// <summary>
+	/// Compares building a tree with BuildFrom against inserting the same keys one at
+	/// a time, for sorted and random keys, at each of the given sizes.
+	/// </summary>
+	/// <param name="sizes"> The numbers of keys to build trees from.</param>
+	void RunBulkBuildBenchmark(const std::vector<int>& sizes)
+	{
+		std::cout << "\n   -- Bulk build: BuildFrom vs one Insert per key --\n";
+		for (int size : sizes)
+		{
+			std::vector<int> sorted(size);
+			for (int i = 0; i < size; i++)
+			{
+				sorted[i] = i;
+			}
+			std::vector<int> shuffled = sorted;
+			std::shuffle(shuffled.begin(), shuffled.end(), generator);
+			std::string sizeName = std::to_string(size);
+
+			{
+				BinarySearchTree<int> tree(BalanceMode::AVL);
+				Clock::time_point start = Clock::now();
+				tree.BuildFrom(sorted);
+				PrintRow("BuildFrom (sorted)", sizeName, ElapsedMs(start), "height " + std::to_string(tree.Height()));
+			}
+			{
+				BinarySearchTree<int> tree(BalanceMode::AVL);
+				Clock::time_point start = Clock::now();
+				tree.BuildFrom(shuffled);
+				PrintRow("BuildFrom (random)", sizeName, ElapsedMs(start), "height " + std::to_string(tree.Height()));
+			}
+			{
+				BinarySearchTree<int> tree(BalanceMode::AVL);
+				Clock::time_point start = Clock::now();
+				for (int key : sorted)
+				{
+					tree.Insert(key);
+				}
+				PrintRow("Insert each (sorted)", sizeName, ElapsedMs(start), "height " + std::to_string(tree.Height()));
+			}
+			{
+				BinarySearchTree<int> tree(BalanceMode::AVL);
+				Clock::time_point start = Clock::now();
+				for (int key : shuffled)
+				{
+					tree.Insert(key);
+				}
+				PrintRow("Insert each (random)", sizeName, ElapsedMs(start), "height " + std::to_string(tree.Height()));
+			}
+			{
+				// Merge the odd half into a tree already holding the even half.
+				std::vector<int> evens;
+				std::vector<int> odds;
+				for (int key : sorted)
+				{
+					(key % 2 == 0 ? evens : odds).push_back(key);
+				}
+				BinarySearchTree<int> tree(BalanceMode::AVL);
+				tree.BuildFrom(evens);
+				Clock::time_point start = Clock::now();
+				tree.BuildFrom(odds);
+				PrintRow("BuildFrom merge half", sizeName, ElapsedMs(start), "height " + std::to_string(tree.Height()));
+			}
+		}
+	}
+
+	/// <summary>
+	/// Compares the lock-free ConcurrentBinarySearchTree against a BinarySearchTree
+	/// guarded by a single mutex, for several thread counts and read/write mixes.
+	/// Every thread runs the same number of random operations: Contains for reads, and
+	/// an even split of Insert and Delete for writes.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys in each tree before the run.</param>
+	/// <param name="operationsPerThread"> The number of operations each thread runs.</param>
+	void RunConcurrencyBenchmark(int keyCount = 1000000, int operationsPerThread = 500000)
+	{
+		unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		std::cout << "\n   -- Concurrency: lock-free vs mutex (" << keyCount << " keys, "
+			<< hardwareThreads << " hardware threads) --\n";
+
+		// Sweep 1, 2, 4 ... threads, going at least as far as the hardware does.
+		std::vector<int> threadCounts;
+		for (unsigned threads = 1; threads <= std::max(8u, hardwareThreads); threads *= 2)
+		{
+			threadCounts.push_back((int)threads);
+		}
+		// The percentage of operations that only read.
+		const int readPercents[] = { 100, 95, 50 };
+
+		// Store the even numbers, so half of the random lookups miss.
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+		for (int& key : keys)
+		{
+			key *= 2;
+		}
+
+		for (int readPercent : readPercents)
+		{
+			for (int threads : threadCounts)
+			{
+				std::string variant = std::to_string(readPercent) + "% read, " + std::to_string(threads) + "t";
+
+				ConcurrentBinarySearchTree<int> lockFree;
+				for (int key : keys)
+				{
+					lockFree.Insert(key);
+				}
+				lockFree.Compact();
+				double lockFreeMs = RunConcurrencyCase(threads, operationsPerThread, readPercent, keyCount,
+					[&lockFree](int op, int key)
+					{
+						if (op == 0)
+						{
+							return lockFree.Contains(key);
+						}
+						if (op == 1)
+						{
+							lockFree.Insert(key);
+							return true;
+						}
+						return lockFree.Delete(key);
+					});
+
+				BinarySearchTree<int> locked(BalanceMode::AVL);
+				locked.BuildFrom(keys);
+				std::mutex lock;
+				double lockedMs = RunConcurrencyCase(threads, operationsPerThread, readPercent, keyCount,
+					[&locked, &lock](int op, int key)
+					{
+						std::lock_guard<std::mutex> guard(lock);
+						if (op == 0)
+						{
+							return locked.Contains(key);
+						}
+						if (op == 1)
+						{
+							locked.Insert(key);
+							return true;
+						}
+						return locked.Delete(key);
+					});
+
+				double totalOps = (double)threads * operationsPerThread;
+				PrintRow("lock-free", variant, lockFreeMs, std::to_string((long long)(totalOps / lockFreeMs * 1000.0)) + " ops/s");
+				PrintRow("mutex + avl", variant, lockedMs, std::to_string((long long)(totalOps / lockedMs * 1000.0)) + " ops/s");
+			}
+		}
+	}
+
+	/// <summary>
+	/// Starts threads threads that each run operations random operations through apply,
+	/// and returns how long it took for all of them to finish.
+	/// </summary>
+	/// <param name="apply"> Called with 0 (read), 1 (insert) or 2 (delete) and a key.</param>
+	template <typename Apply>
+	double RunConcurrencyCase(int threads, int operations, int readPercent, int keyCount, Apply apply)
+	{
+		// Draw every operation up front so the timed loop only touches the tree.
+		std::vector<std::vector<std::pair<int, int>>> work(threads);
+		std::uniform_int_distribution<int> pickKey(0, keyCount * 2);
+		std::uniform_int_distribution<int> pickPercent(0, 99);
+		for (std::vector<std::pair<int, int>>& ops : work)
+		{
+			ops.resize(operations);
+			for (std::pair<int, int>& op : ops)
+			{
+				int roll = pickPercent(generator);
+				op.first = (roll < readPercent) ? 0 : 1 + (roll & 1);
+				op.second = pickKey(generator);
+			}
+		}
+
+		std::vector<std::thread> workers;
+		std::vector<long long> results(threads, 0);
+		Clock::time_point start = Clock::now();
+		for (int t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&, t]()
+				{
+					long long hits = 0;
+					for (const std::pair<int, int>& op : work[t])
+					{
+						hits += apply(op.first, op.second);
+					}
+					results[t] = hits;
+				});
+		}
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+		return ElapsedMs(start);
+	}
+
+	/// <summary>
+	/// Compares the ways a BST can be brought back after a restart: replaying one
+	/// Insert per original key, loading a snapshot into a new BST, or querying the
+	/// mapped snapshot directly. The snapshot is written to the working directory and
+	/// removed afterwards.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys inserted before the snapshot is saved.</param>
+	/// <param name="lookupCount"> The number of lookups timed against the loaded state.</param>
+	void RunSnapshotBenchmark(int keyCount = 1000000, int lookupCount = 1000000)
+	{
+		std::cout << "\n   -- Restart: snapshot vs replaying inserts (" << keyCount << " keys) --\n";
+		const std::string path = "bst_benchmark.snapshot";
+
+		// The original keys, with about one in three values inserted more than once.
+		std::uniform_int_distribution<int> pick(0, keyCount - keyCount / 3);
+		std::vector<int> keys(keyCount);
+		for (int& key : keys)
+		{
+			key = pick(generator);
+		}
+
+		BinarySearchTree<int> original(BalanceMode::AVL);
+		Clock::time_point start = Clock::now();
+		for (int key : keys)
+		{
+			original.Insert(key);
+		}
+		PrintRow("Replay inserts", "avl", ElapsedMs(start), "height " + std::to_string(original.Height()));
+
+		start = Clock::now();
+		std::uint64_t bytes = SaveSnapshot(original, path);
+		PrintRow("SaveSnapshot", "file", ElapsedMs(start), std::to_string(bytes) + " bytes");
+
+		BinarySearchTree<int> loaded(BalanceMode::AVL);
+		start = Clock::now();
+		LoadSnapshot(loaded, path);
+		PrintRow("LoadSnapshot", "mmap+build", ElapsedMs(start), "height " + std::to_string(loaded.Height()));
+
+		{
+			start = Clock::now();
+			SnapshotView<int> view(path);
+			PrintRow("Open SnapshotView", "mmap", ElapsedMs(start), std::to_string(view.Size()) + " records");
+			start = Clock::now();
+			bool intact = view.Verify();
+			PrintRow("SnapshotView Verify", "checksum", ElapsedMs(start), intact ? "intact" : "damaged");
+
+			std::vector<int> queries(lookupCount);
+			for (int& query : queries)
+			{
+				query = pick(generator);
+			}
+
+			long long hits = 0;
+			start = Clock::now();
+			for (int query : queries)
+			{
+				hits += view.Contains(query);
+			}
+			PrintRow("SnapshotView Contains", "mapped", ElapsedMs(start), "hits " + std::to_string(hits));
+
+			hits = 0;
+			start = Clock::now();
+			for (int query : queries)
+			{
+				hits += loaded.Contains(query);
+			}
+			PrintRow("BST Contains", "loaded", ElapsedMs(start), "hits " + std::to_string(hits));
+		}
+		std::remove(path.c_str());
+	}
+
+	/// <summary>
+	/// Compares InsertBatch and DeleteBatch against one Insert or Delete per key, for
+	/// batches of random keys applied to a large AVL tree.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys in the tree before the batches.</param>
+	/// <param name="batchSizes"> The numbers of keys per batch.</param>
+	/// <param name="batchCount"> The number of batches applied at each batch size.</param>
+	void RunBatchBenchmark(int keyCount = 1000000, const std::vector<int>& batchSizes = { 100, 10000, 100000 }, int batchCount = 10)
+	{
+		std::cout << "\n   -- Batches: InsertBatch/DeleteBatch vs one call per key (" << keyCount << " keys, avl) --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+		std::uniform_int_distribution<int> pick(0, keyCount * 2);
+
+		for (int batchSize : batchSizes)
+		{
+			std::vector<std::vector<int>> batches(batchCount, std::vector<int>(batchSize));
+			for (std::vector<int>& batch : batches)
+			{
+				for (int& key : batch)
+				{
+					key = pick(generator);
+				}
+			}
+			std::string sizeName = std::to_string(batchSize) + " x" + std::to_string(batchCount);
+
+			BinarySearchTree<int> batched(BalanceMode::AVL);
+			batched.BuildFrom(keys);
+			Clock::time_point start = Clock::now();
+			for (const std::vector<int>& batch : batches)
+			{
+				batched.InsertBatch(batch);
+			}
+			PrintRow("InsertBatch", sizeName, ElapsedMs(start));
+			start = Clock::now();
+			std::size_t found = 0;
+			for (const std::vector<int>& batch : batches)
+			{
+				for (bool removed : batched.DeleteBatch(batch))
+				{
+					found += removed;
+				}
+			}
+			PrintRow("DeleteBatch", sizeName, ElapsedMs(start), "removed " + std::to_string(found));
+
+			BinarySearchTree<int> single(BalanceMode::AVL);
+			single.BuildFrom(keys);
+			start = Clock::now();
+			for (const std::vector<int>& batch : batches)
+			{
+				for (int key : batch)
+				{
+					single.Insert(key);
+				}
+			}
+			PrintRow("Insert each", sizeName, ElapsedMs(start));
+			start = Clock::now();
+			found = 0;
+			for (const std::vector<int>& batch : batches)
+			{
+				for (int key : batch)
+				{
+					found += single.Delete(key);
+				}
+			}
+			PrintRow("Delete each", sizeName, ElapsedMs(start), "removed " + std::to_string(found));
+		}
+	}
+
+	/// <summary>
+	/// Compares adding and removing many copies of a few keys with one weighted
+	/// Insert(val, count) or Delete(val, count) call against one call per copy.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys in the tree.</param>
+	/// <param name="copies"> The number of copies added to each hot key.</param>
+	/// <param name="hotKeys"> The number of keys that get the extra copies.</param>
+	void RunWeightedBenchmark(int keyCount = 1000000, int copies = 1000000, int hotKeys = 10)
+	{
+		std::cout << "\n   -- Weighted: Insert/Delete with a count vs one call per copy (" << hotKeys
+			<< " keys x " << copies << " copies) --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+		std::string variant = "avl";
+
+		BinarySearchTree<int> weighted(BalanceMode::AVL);
+		weighted.BuildFrom(keys);
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < hotKeys; i++)
+		{
+			weighted.Insert(keys[i], copies);
+		}
+		PrintRow("Insert(val, count)", variant, ElapsedMs(start), "size " + std::to_string(weighted.Size()));
+		start = Clock::now();
+		for (int i = 0; i < hotKeys; i++)
+		{
+			weighted.Delete(keys[i], copies);
+		}
+		PrintRow("Delete(val, count)", variant, ElapsedMs(start), "size " + std::to_string(weighted.Size()));
+
+		BinarySearchTree<int> single(BalanceMode::AVL);
+		single.BuildFrom(keys);
+		start = Clock::now();
+		for (int i = 0; i < hotKeys; i++)
+		{
+			for (int copy = 0; copy < copies; copy++)
+			{
+				single.Insert(keys[i]);
+			}
+		}
+		PrintRow("Insert each copy", variant, ElapsedMs(start), "size " + std::to_string(single.Size()));
+		start = Clock::now();
+		for (int i = 0; i < hotKeys; i++)
+		{
+			for (int copy = 0; copy < copies; copy++)
+			{
+				single.Delete(keys[i]);
+			}
+		}
+		PrintRow("Delete each copy", variant, ElapsedMs(start), "size " + std::to_string(single.Size()));
+	}
+
+	/// <summary>
+	/// Compares the PersistentBinarySearchTree against the BinarySearchTree: the cost of
+	/// each update (path copying against changing nodes in place), and the cost of
+	/// giving a reader a consistent view (an O(1) snapshot against a deep copy).
+	/// </summary>
+	/// <param name="keyCount"> The number of keys in each tree.</param>
+	/// <param name="snapshotCount"> The number of snapshots taken.</param>
+	/// <param name="copyCount"> The number of deep copies taken.</param>
+	void RunPersistentBenchmark(int keyCount = 1000000, int snapshotCount = 1000000, int copyCount = 5)
+	{
+		std::cout << "\n   -- Persistent: path copying vs in place (" << keyCount << " keys) --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+
+		PersistentBinarySearchTree<int> persistent;
+		Clock::time_point start = Clock::now();
+		for (int key : keys)
+		{
+			persistent.Insert(key);
+		}
+		PrintRow("Insert", "persistent", ElapsedMs(start), "height " + std::to_string(persistent.Snapshot().Height()));
+
+		BinarySearchTree<int> tree(BalanceMode::AVL);
+		start = Clock::now();
+		for (int key : keys)
+		{
+			tree.Insert(key);
+		}
+		PrintRow("Insert", "avl", ElapsedMs(start), "height " + std::to_string(tree.Height()));
+
+		// Each snapshot pins the whole current version, however large it is.
+		Quantity checksum = 0;
+		start = Clock::now();
+		for (int i = 0; i < snapshotCount; i++)
+		{
+			PersistentBinarySearchTree<int>::Version version = persistent.Snapshot();
+			checksum += version.Size();
+		}
+		double snapshotMs = ElapsedMs(start);
+		PrintRow(std::to_string(snapshotCount) + "x Snapshot", "persistent", snapshotMs,
+			std::to_string((long long)(snapshotMs * 1000000.0 / snapshotCount)) + " ns each");
+
+		start = Clock::now();
+		for (int i = 0; i < copyCount; i++)
+		{
+			// A deep copy: read every (value, quantity) out and build a new tree from them.
+			std::vector<std::pair<int, Quantity>> contents;
+			tree.ForEach([&contents](int value, Quantity quantity) { contents.emplace_back(value, quantity); });
+			BinarySearchTree<int> copy(BalanceMode::AVL);
+			copy.BuildFromCounts(contents.begin(), contents.end());
+			checksum += copy.Size();
+		}
+		double copyMs = ElapsedMs(start);
+		PrintRow(std::to_string(copyCount) + "x Deep copy", "avl", copyMs,
+			std::to_string((long long)(copyMs * 1000000.0 / copyCount)) + " ns each");
+
+		// Updates while an old version is held, so no path can be reused in place.
+		PersistentBinarySearchTree<int>::Version held = persistent.Snapshot();
+		start = Clock::now();
+		for (int i = 0; i < keyCount / 10; i++)
+		{
+			persistent.Delete(keys[i]);
+		}
+		PrintRow("Delete 10% (old held)", "persistent", ElapsedMs(start),
+			"old " + std::to_string(held.Size()) + ", new " + std::to_string(persistent.Size()));
+		start = Clock::now();
+		for (int i = 0; i < keyCount / 10; i++)
+		{
+			tree.Delete(keys[i]);
+		}
+		PrintRow("Delete 10%", "avl", ElapsedMs(start), "checksum " + std::to_string(checksum));
+	}
+
+	/// <summary>
+	/// Measures how the parallel reads and ParallelClear() scale from one thread up to
+	/// (at least) eight, next to the serial versions they replace. The reads use an AVL
+	/// tree of keyCount ints, and the clears a tree of clearCount strings, since only
+	/// values with destructors are cleared node by node.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys in the tree that is read.</param>
+	/// <param name="clearCount"> The number of keys in each tree that is cleared.</param>
+	void RunParallelBenchmark(int keyCount = 1000000, int clearCount = 500000)
+	{
+		unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		std::cout << "\n   -- Parallel: 1 to N threads (" << keyCount << " keys, "
+			<< hardwareThreads << " hardware threads) --\n";
+
+		BinarySearchTree<int> tree(BalanceMode::AVL);
+		tree.BuildFrom(MakeKeysOfSize(keyCount));
+		// Ten buckets of equal width.
+		std::vector<int> boundaries;
+		for (int i = 1; i < 10; i++)
+		{
+			boundaries.push_back((int)((long long)keyCount * i / 10));
+		}
+		std::vector<std::string> words;
+		for (int key : MakeKeysOfSize(clearCount))
+		{
+			words.push_back("key number " + std::to_string(key));
+		}
+
+		// The serial versions first.
+		Clock::time_point start = Clock::now();
+		long long sum = 0;
+		tree.ForEach([&sum](int value, Quantity quantity) { sum += (long long)value * (long long)quantity; });
+		PrintRow("ForEach (sum)", "serial", ElapsedMs(start), "sum " + std::to_string(sum));
+
+		CountingBuffer counter;
+		std::ostream out(&counter);
+		start = Clock::now();
+		tree.Traverse(out);
+		PrintRow("Traverse(ostream)", "serial", ElapsedMs(start), std::to_string(counter.written) + " chars");
+
+		BinarySearchTree<std::string> strings(BalanceMode::AVL);
+		strings.BuildFrom(words);
+		start = Clock::now();
+		strings.Clear();
+		PrintRow("Clear (strings)", "serial", ElapsedMs(start));
+
+		// Then sweep 1, 2, 4 ... threads, going at least as far as the hardware does.
+		for (unsigned threads = 1; threads <= std::max(8u, hardwareThreads); threads *= 2)
+		{
+			std::string variant = std::to_string(threads) + "t";
+
+			start = Clock::now();
+			sum = tree.ParallelSum<long long>(threads);
+			PrintRow("ParallelSum", variant, ElapsedMs(start), "sum " + std::to_string(sum));
+
+			start = Clock::now();
+			std::vector<Quantity> histogram = tree.ParallelHistogram(boundaries, threads);
+			PrintRow("ParallelHistogram", variant, ElapsedMs(start), "first " + std::to_string(histogram.front()));
+
+			CountingBuffer parallelCounter;
+			std::ostream parallelOut(&parallelCounter);
+			start = Clock::now();
+			tree.ParallelTraverse(parallelOut, threads);
+			PrintRow("ParallelTraverse", variant, ElapsedMs(start), std::to_string(parallelCounter.written) + " chars");
+
+			strings.BuildFrom(words);
+			start = Clock::now();
+			strings.ParallelClear(threads);
+			PrintRow("ParallelClear (strings)", variant, ElapsedMs(start));
+		}
+	}
+
+	/// <summary>
+	/// Shows what Stats() reports for a tree built from sorted input without balancing
+	/// next to the same keys in AVL mode, and how long Stats() takes. When the program
+	/// is built with BST_ENABLE_STATS, the per-operation counters of a random workload
+	/// are printed too.
+	/// </summary>
+	/// <param name="sortedCount"> The number of sorted keys (kept small for the chain).</param>
+	/// <param name="keyCount"> The number of keys for the random workload.</param>
+	void RunStatsBenchmark(int sortedCount = 20000, int keyCount = 1000000)
+	{
+		std::cout << "\n   -- Stats: tree shape (and counters with BST_ENABLE_STATS) --\n";
+		for (BalanceMode mode : { BalanceMode::Unbalanced, BalanceMode::AVL })
+		{
+			std::string modeName = (mode == BalanceMode::AVL) ? "avl" : "unbalanced";
+			BinarySearchTree<int> tree(mode);
+			for (int i = 0; i < sortedCount; i++)
+			{
+				tree.Insert(i);
+			}
+			Clock::time_point start = Clock::now();
+			TreeStats stats = tree.Stats();
+			std::ostringstream shape;
+			shape << "height " << stats.height << "/" << stats.minimumHeight << ", skew " << stats.skew
+				<< (stats.Degenerate() ? ", DEGENERATE" : "");
+			PrintRow("Stats (sorted " + std::to_string(sortedCount) + ")", modeName, ElapsedMs(start), shape.str());
+		}
+
+		BinarySearchTree<int> tree(BalanceMode::AVL);
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+		Clock::time_point start = Clock::now();
+		for (int key : keys)
+		{
+			tree.Insert(key);
+		}
+		for (int i = 0; i < keyCount; i++)
+		{
+			tree.Contains(keys[(i * 7) % keyCount]);
+		}
+		for (int i = 0; i < keyCount / 2; i++)
+		{
+			tree.Delete(keys[i]);
+		}
+		PrintRow("Insert+Contains+Delete", "avl", ElapsedMs(start));
+		start = Clock::now();
+		TreeStats stats = tree.Stats();
+		std::ostringstream shape;
+		shape << "depth " << stats.averageDepth << ", max balance " << stats.maxBalanceFactor;
+		PrintRow("Stats (random)", "avl", ElapsedMs(start), shape.str());
+#ifdef BST_ENABLE_STATS
+		std::cout << tree.Counters();
+#endif
+	}
+
+	/// <summary>
+	/// Compares Clone(), Merge() and Split() against doing the same thing by inserting
+	/// each value into a new tree, and times a move, which only swaps pointers.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys in each tree.</param>
+	void RunOwnershipBenchmark(int keyCount = 1000000)
+	{
+		std::cout << "\n   -- Ownership: Clone, Merge and Split (" << keyCount << " keys) --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+		BinarySearchTree<int> tree(BalanceMode::AVL);
+		for (int key : keys)
+		{
+			tree.Insert(key);
+		}
+
+		Clock::time_point start = Clock::now();
+		BinarySearchTree<int> clone = tree.Clone();
+		PrintRow("Clone", "avl", ElapsedMs(start), "height " + std::to_string(clone.Height()));
+		start = Clock::now();
+		BinarySearchTree<int> copy(BalanceMode::AVL);
+		tree.ForEach([&copy](int value, Quantity quantity) { copy.Insert(value, quantity); });
+		PrintRow("Insert each (copy)", "avl", ElapsedMs(start), "height " + std::to_string(copy.Height()));
+
+		start = Clock::now();
+		BinarySearchTree<int> moved(std::move(copy));
+		PrintRow("Move", "avl", ElapsedMs(start), "size " + std::to_string(moved.Size()));
+
+		// Merge a tree of larger values (a join), then one of overlapping values.
+		BinarySearchTree<int> above(BalanceMode::AVL);
+		BinarySearchTree<int> overlapping(BalanceMode::AVL);
+		for (int key : keys)
+		{
+			above.Insert(key + keyCount);
+			overlapping.Insert(key);
+		}
+		start = Clock::now();
+		clone.Merge(above);
+		PrintRow("Merge (disjoint)", "avl", ElapsedMs(start), "height " + std::to_string(clone.Height()));
+		start = Clock::now();
+		clone.Merge(overlapping);
+		PrintRow("Merge (overlapping)", "avl", ElapsedMs(start), "height " + std::to_string(clone.Height()));
+		start = Clock::now();
+		for (int key : keys)
+		{
+			moved.Insert(key + keyCount);
+		}
+		PrintRow("Insert each (merge)", "avl", ElapsedMs(start), "height " + std::to_string(moved.Height()));
+
+		start = Clock::now();
+		BinarySearchTree<int> lower(BalanceMode::AVL);
+		BinarySearchTree<int> rest(BalanceMode::AVL);
+		tree.ForEach([&](int value, Quantity quantity) { (value < keyCount / 2 ? lower : rest).Insert(value, quantity); });
+		PrintRow("Insert each (split)", "avl", ElapsedMs(start),
+			"sizes " + std::to_string(lower.Size()) + " / " + std::to_string(rest.Size()));
+		start = Clock::now();
+		BinarySearchTree<int> upper = tree.Split(keyCount / 2);
+		PrintRow("Split half", "avl", ElapsedMs(start),
+			"sizes " + std::to_string(tree.Size()) + " / " + std::to_string(upper.Size()));
+	}
+
+	/// <summary>
+	/// Compares the memory used per key by the BST (with its nodes in an arena, so
+	/// malloc overhead is left out) and the CompactBinarySearchTree, then times random
+	/// inserts, lookups and deletes on both. One key in every 16 is inserted 3 times,
+	/// so the compact tree's out-of-line quantities are counted too.
+	/// </summary>
+	/// <param name="keyCount"> The number of distinct keys.</param>
+	void RunCompactBenchmark(int keyCount = 1000000)
+	{
+		std::cout << "\n   -- Compact: memory per key (" << keyCount << " random keys) --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+		BinarySearchTree<int> tree(BalanceMode::AVL, AllocationMode::Arena);
+		CompactBinarySearchTree<int> compact;
+
+		Clock::time_point start = Clock::now();
+		for (int key : keys)
+		{
+			tree.Insert(key, (key % 16 == 0) ? 3 : 1);
+		}
+		double treeInsertMs = ElapsedMs(start);
+		start = Clock::now();
+		for (int key : keys)
+		{
+			compact.Insert(key, (key % 16 == 0) ? 3 : 1);
+		}
+		double compactInsertMs = ElapsedMs(start);
+
+		double treeBytes = static_cast<double>(tree.AllocationStats().bytesReserved) / keyCount;
+		double compactBytes = static_cast<double>(compact.MemoryUsage()) / keyCount;
+		std::ostringstream treeMemory;
+		std::ostringstream compactMemory;
+		treeMemory << std::fixed << std::setprecision(1) << treeBytes << " B/key, node " << sizeof(Node<int>) << " B";
+		compactMemory << std::fixed << std::setprecision(1) << compactBytes << " B/key, node "
+			<< sizeof(CompactNode<int>) << " B";
+		PrintRow("Insert", "avl", treeInsertMs, treeMemory.str());
+		PrintRow("Insert", "compact", compactInsertMs, compactMemory.str());
+
+		// Look every key up, in a different order than it was inserted in.
+		std::vector<int> lookups = keys;
+		std::shuffle(lookups.begin(), lookups.end(), generator);
+		Quantity found = 0;
+		start = Clock::now();
+		for (int key : lookups)
+		{
+			found += tree.Count(key);
+		}
+		PrintRow("Count", "avl", ElapsedMs(start), "found " + std::to_string(found));
+		found = 0;
+		start = Clock::now();
+		for (int key : lookups)
+		{
+			found += compact.Count(key);
+		}
+		PrintRow("Count", "compact", ElapsedMs(start), "found " + std::to_string(found));
+
+		start = Clock::now();
+		for (int key : lookups)
+		{
+			tree.Delete(key);
+		}
+		PrintRow("Delete each once", "avl", ElapsedMs(start), "height " + std::to_string(tree.Height()));
+		start = Clock::now();
+		for (int key : lookups)
+		{
+			compact.Delete(key);
+		}
+		PrintRow("Delete each once", "compact", ElapsedMs(start), "height " + std::to_string(compact.Height()));
+	}
+
+	/// <summary>
+	/// Times random inserts, lookups and deletes on the BST against the SimdBPlusTree,
+	/// once for every search the processor supports (scalar, AVX2, AVX-512).
+	/// </summary>
+	/// <param name="keyCount"> The number of distinct keys.</param>
+	void RunSimdBenchmark(int keyCount = 1000000)
+	{
+		std::cout << "\n   -- SIMD B+ tree vs BST (" << keyCount << " random keys) --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+		std::vector<int> lookups = keys;
+		std::shuffle(lookups.begin(), lookups.end(), generator);
+
+		BinarySearchTree<int> tree(BalanceMode::AVL, AllocationMode::Arena);
+		Clock::time_point start = Clock::now();
+		for (int key : keys)
+		{
+			tree.Insert(key);
+		}
+		PrintRow("Insert", "avl", ElapsedMs(start), "height " + std::to_string(tree.Height()));
+		Quantity found = 0;
+		start = Clock::now();
+		for (int key : lookups)
+		{
+			found += tree.Count(key);
+		}
+		PrintRow("Count", "avl", ElapsedMs(start), "found " + std::to_string(found));
+		start = Clock::now();
+		for (int key : lookups)
+		{
+			tree.Delete(key);
+		}
+		PrintRow("Delete", "avl", ElapsedMs(start));
+
+		const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::AVX2, SimdLevel::AVX512 };
+		const char* levelNames[] = { "scalar", "avx2", "avx512" };
+		for (int i = 0; i < 3; i++)
+		{
+			// Skip the levels this processor does not support.
+			if (levels[i] > SimdBPlusTree::DetectSimdLevel())
+			{
+				std::cout << "   " << levelNames[i] << ": not supported by this processor\n";
+				continue;
+			}
+			SimdBPlusTree simd(levels[i]);
+			start = Clock::now();
+			for (int key : keys)
+			{
+				simd.Insert(key);
+			}
+			PrintRow("Insert", levelNames[i], ElapsedMs(start), "height " + std::to_string(simd.Height()));
+			found = 0;
+			start = Clock::now();
+			for (int key : lookups)
+			{
+				found += simd.Count(key);
+			}
+			PrintRow("Count", levelNames[i], ElapsedMs(start), "found " + std::to_string(found));
+			start = Clock::now();
+			for (int key : lookups)
+			{
+				simd.Delete(key);
+			}
+			PrintRow("Delete", levelNames[i], ElapsedMs(start));
+		}
+	}
+
+	/// <summary>
+	/// Uses the BST as a priority queue, the way a scheduler does: it is filled with
+	/// keyCount random keys, then every round polls the minimum, pops it and pushes a
+	/// new key, and finally it is drained. std::priority_queue and std::multiset do the
+	/// same work as baselines.
+	/// </summary>
+	/// <param name="keyCount"> The number of keys held at once, and of rounds.</param>
+	void RunPriorityQueueBenchmark(int keyCount = 1000000)
+	{
+		std::cout << "\n   -- Priority queue: poll, pop and push (" << keyCount << " keys) --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount * 2);
+		long long checksum = 0;
+
+		BinarySearchTree<int> tree(BalanceMode::AVL, AllocationMode::Arena);
+		for (int i = 0; i < keyCount; i++)
+		{
+			tree.Insert(keys[i]);
+		}
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < keyCount; i++)
+		{
+			checksum += tree.Minimum();
+		}
+		PrintRow("Poll minimum", "avl", ElapsedMs(start), "checksum " + std::to_string(checksum));
+		checksum = 0;
+		start = Clock::now();
+		for (int i = keyCount; i < keyCount * 2; i++)
+		{
+			checksum += tree.PopMin();
+			tree.Insert(keys[i]);
+		}
+		PrintRow("Pop min + push", "avl", ElapsedMs(start), "checksum " + std::to_string(checksum));
+		start = Clock::now();
+		while (std::optional<int> value = tree.TryPopMin())
+		{
+			checksum += *value;
+		}
+		PrintRow("Drain", "avl", ElapsedMs(start), "checksum " + std::to_string(checksum));
+
+		std::priority_queue<int, std::vector<int>, std::greater<int>> heap(keys.begin(), keys.begin() + keyCount);
+		checksum = 0;
+		start = Clock::now();
+		for (int i = 0; i < keyCount; i++)
+		{
+			checksum += heap.top();
+		}
+		PrintRow("Poll minimum", "priority_queue", ElapsedMs(start), "checksum " + std::to_string(checksum));
+		checksum = 0;
+		start = Clock::now();
+		for (int i = keyCount; i < keyCount * 2; i++)
+		{
+			checksum += heap.top();
+			heap.pop();
+			heap.push(keys[i]);
+		}
+		PrintRow("Pop min + push", "priority_queue", ElapsedMs(start), "checksum " + std::to_string(checksum));
+		start = Clock::now();
+		while (!heap.empty())
+		{
+			checksum += heap.top();
+			heap.pop();
+		}
+		PrintRow("Drain", "priority_queue", ElapsedMs(start), "checksum " + std::to_string(checksum));
+
+		std::multiset<int> set(keys.begin(), keys.begin() + keyCount);
+		checksum = 0;
+		start = Clock::now();
+		for (int i = 0; i < keyCount; i++)
+		{
+			checksum += *set.begin();
+		}
+		PrintRow("Poll minimum", "multiset", ElapsedMs(start), "checksum " + std::to_string(checksum));
+		checksum = 0;
+		start = Clock::now();
+		for (int i = keyCount; i < keyCount * 2; i++)
+		{
+			checksum += *set.begin();
+			set.erase(set.begin());
+			set.insert(keys[i]);
+		}
+		PrintRow("Pop min + push", "multiset", ElapsedMs(start), "checksum " + std::to_string(checksum));
+		start = Clock::now();
+		while (!set.empty())
+		{
+			checksum += *set.begin();
+			set.erase(set.begin());
+		}
+		PrintRow("Drain", "multiset", ElapsedMs(start), "checksum " + std::to_string(checksum));
+	}
+
+	/// <summary>
+	/// Compares the balance modes under a skewed workload. Each tree is filled with
+	/// keyCount keys in random order, then operationCount Zipfian picks (a few keys get
+	/// most of the traffic) are inserted again, which only bumps quantities, and looked
+	/// up.
+	/// </summary>
+	/// <param name="keyCount"> The number of distinct keys.</param>
+	/// <param name="operationCount"> The number of inserts, and of lookups.</param>
+	/// <param name="skew"> The Zipf exponent. Higher values make the hot keys hotter.</param>
+	void RunZipfBenchmark(int keyCount = 1000000, int operationCount = 2000000, double skew = 0.99)
+	{
+		std::cout << "\n   -- Zipfian hot keys (" << keyCount << " keys, " << operationCount << " ops, s = " << skew << ") --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+		// Rank r is keys[r - 1], so the hot keys are scattered over the whole range.
+		ZipfDistribution pick(keyCount, skew);
+		std::vector<int> picks(operationCount);
+		for (int& key : picks)
+		{
+			key = keys[pick(generator) - 1];
+		}
+
+		const BalanceMode modes[] = { BalanceMode::Unbalanced, BalanceMode::AVL, BalanceMode::Splay, BalanceMode::Frequency };
+		const char* modeNames[] = { "unbalanced", "avl", "splay", "frequency" };
+		for (int i = 0; i < 4; i++)
+		{
+			BinarySearchTree<int> tree(modes[i]);
+			for (int key : keys)
+			{
+				tree.Insert(key);
+			}
+
+			Clock::time_point start = Clock::now();
+			for (int key : picks)
+			{
+				tree.Insert(key);
+			}
+			PrintRow("Insert (hot keys)", modeNames[i], ElapsedMs(start), "height " + std::to_string(tree.Height()));
+
+			Quantity found = 0;
+			start = Clock::now();
+			for (int key : picks)
+			{
+				found += tree.Count(key);
+			}
+			PrintRow("Count (hot keys)", modeNames[i], ElapsedMs(start), "found " + std::to_string(found));
+		}
+	}
+
+	/// <summary>
+	/// Compares range sums read from a SumAugment tree against scanning the range, and what keeping the sums costs on insert.
+	/// </summary>
+	/// <param name="keyCount">The number of keys to insert.</param>
+	/// <param name="queryCount">The number of random ranges to sum.</param>
+	void RunAugmentBenchmark(int keyCount = 1000000, int queryCount = 100)
+	{
+		std::cout << "\n   -- Range sums (" << keyCount << " keys, avl) --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+
+		BinarySearchTree<int> plainTree(BalanceMode::AVL, AllocationMode::Arena);
+		Clock::time_point start = Clock::now();
+		for (int key : keys)
+		{
+			plainTree.Insert(key);
+		}
+		PrintRow("Insert", "no augment", ElapsedMs(start), std::to_string(sizeof(Node<int>)) + " B/node");
+
+		BinarySearchTree<int, std::less<int>, std::allocator<int>, SumAugment<int>> sumTree(BalanceMode::AVL, AllocationMode::Arena);
+		start = Clock::now();
+		for (int key : keys)
+		{
+			sumTree.Insert(key);
+		}
+		PrintRow("Insert", "sum augment", ElapsedMs(start), std::to_string(sizeof(Node<int, SumAugment<int>>)) + " B/node");
+
+		std::uniform_int_distribution<int> pick(0, keyCount);
+		std::vector<std::pair<int, int>> ranges(queryCount);
+		for (std::pair<int, int>& range : ranges)
+		{
+			int a = pick(generator);
+			int b = pick(generator);
+			range = { std::min(a, b), std::max(a, b) };
+		}
+
+		long long total = 0;
+		start = Clock::now();
+		for (const std::pair<int, int>& range : ranges)
+		{
+			total += sumTree.AggregateInRange(range.first, range.second);
+		}
+		PrintRow("AggregateInRange", "O(log n)", ElapsedMs(start), "total " + std::to_string(total));
+
+		total = 0;
+		start = Clock::now();
+		for (const std::pair<int, int>& range : ranges)
+		{
+			plainTree.ForEachInRange(range.first, range.second, [&total](int value, Quantity quantity) { total += static_cast<long long>(value) * quantity; });
+		}
+		PrintRow("ForEachInRange", "scan", ElapsedMs(start), "total " + std::to_string(total));
+	}
+
+	/// <summary>
+	/// Times a full in-order pass with the iterators (forwards and backwards) against
+	/// ForEach(), std::set and a sorted std::vector holding the same values.
+	/// </summary>
+	/// <param name="keyCount">The number of keys to store.</param>
+	/// <param name="passes">How many times each container is walked.</param>
+	void RunIteratorBenchmark(int keyCount = 1000000, int passes = 10)
+	{
+		std::cout << "\n   -- In-order iteration (" << keyCount << " keys, " << passes << " passes) --\n";
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+
+		// Inserted in random order, the nodes are scattered through the arena.
+		BinarySearchTree<int> randomTree(BalanceMode::AVL, AllocationMode::Arena);
+		for (int key : keys)
+		{
+			randomTree.Insert(key);
+		}
+		// Built from sorted values, neighbouring values sit close together in memory.
+		BinarySearchTree<int> builtTree(BalanceMode::AVL, AllocationMode::Arena);
+		builtTree.BuildFrom(keys);
+
+		RunIteratorCase(randomTree, "random inserts", passes);
+		RunIteratorCase(builtTree, "BuildFrom", passes);
+
+		std::set<int> set(keys.begin(), keys.end());
+		long long sum = 0;
+		Clock::time_point start = Clock::now();
+		for (int pass = 0; pass < passes; pass++)
+		{
+			for (int value : set)
+			{
+				sum += value;
+			}
+		}
+		PrintRow("range-for", "std::set", ElapsedMs(start), "sum " + std::to_string(sum));
+
+		std::vector<std::pair<int, Quantity>> sorted;
+		sorted.reserve(keys.size());
+		for (int value : set)
+		{
+			sorted.push_back({ value, 1 });
+		}
+		sum = 0;
+		start = Clock::now();
+		for (int pass = 0; pass < passes; pass++)
+		{
+			for (const std::pair<int, Quantity>& entry : sorted)
+			{
+				sum += entry.first * static_cast<long long>(entry.second);
+			}
+		}
+		PrintRow("range-for", "std::vector", ElapsedMs(start), "sum " + std::to_string(sum));
+	}
+
+	/// <summary>
+	/// Walks one tree with range-for, reverse iterators and ForEach(), summing value * quantity.
+	/// </summary>
+	/// <param name="tree">The tree to walk.</param>
+	/// <param name="variant">How the tree was built.</param>
+	/// <param name="passes">How many times the tree is walked.</param>
+	void RunIteratorCase(const BinarySearchTree<int>& tree, const std::string& variant, int passes)
+	{
+		long long sum = 0;
+		Clock::time_point start = Clock::now();
+		for (int pass = 0; pass < passes; pass++)
+		{
+			for (BinarySearchTree<int>::Entry entry : tree)
+			{
+				sum += entry.value * static_cast<long long>(entry.quantity);
+			}
+		}
+		PrintRow("range-for", variant, ElapsedMs(start), "sum " + std::to_string(sum));
+
+		sum = 0;
+		start = Clock::now();
+		for (int pass = 0; pass < passes; pass++)
+		{
+			for (auto it = tree.rbegin(); it != tree.rend(); ++it)
+			{
+				sum += it->value * static_cast<long long>(it->quantity);
+			}
+		}
+		PrintRow("rbegin..rend", variant, ElapsedMs(start), "sum " + std::to_string(sum));
+
+		sum = 0;
+		start = Clock::now();
+		for (int pass = 0; pass < passes; pass++)
+		{
+			tree.ForEach([&sum](int value, Quantity quantity) { sum += value * static_cast<long long>(quantity); });
+		}
+		PrintRow("ForEach", variant, ElapsedMs(start), "sum " + std::to_string(sum));
+	}
+
+	/// <summary>
+	/// Compares write throughput of one tree behind one mutex against a tree split into
+	/// shards, from 1 to 64 threads. Writes are half inserts and half deletes, spread over
+	/// every key or crowded into one sixteenth of them (with and without rebalancing).
+	/// </summary>
+	/// <param name="keyCount">The number of keys stored before the writes start.</param>
+	/// <param name="totalOperations">The writes made by all threads together.</param>
+	/// <param name="shardCount">The number of shards.</param>
+	void RunShardedBenchmark(int keyCount = 1000000, int totalOperations = 2000000, int shardCount = 64)
+	{
+		unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		std::cout << "\n   -- Sharded writes (" << keyCount << " keys, " << shardCount << " shards, "
+			<< hardwareThreads << " hardware threads) --\n";
+
+		// Store the even numbers, like the concurrency benchmark, and split the key space
+		// [0, 2 * keyCount] evenly between the shards.
+		std::vector<int> keys = MakeKeysOfSize(keyCount);
+		for (int& key : keys)
+		{
+			key *= 2;
+		}
+		std::vector<int> boundaries;
+		for (int i = 1; i < shardCount; i++)
+		{
+			boundaries.push_back((int)((long long)keyCount * 2 * i / shardCount));
+		}
+		// Writes to the hot range only touch the first sixteenth of the keys.
+		const int hotLimit = keyCount * 2 / 16;
+
+		for (int threads = 1; threads <= 64; threads *= 2)
+		{
+			int operations = totalOperations / threads;
+			double totalOps = (double)threads * operations;
+			std::string variant = std::to_string(threads) + "t";
+
+			BinarySearchTree<int> locked(BalanceMode::AVL);
+			locked.BuildFrom(keys);
+			std::mutex lock;
+			double lockedMs = RunConcurrencyCase(threads, operations, 0, keyCount,
+				[&locked, &lock](int op, int key)
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					if (op == 1)
+					{
+						locked.Insert(key);
+						return true;
+					}
+					return locked.Delete(key);
+				});
+			PrintRow("mutex + avl", variant, lockedMs, std::to_string((long long)(totalOps / lockedMs * 1000.0)) + " ops/s");
+
+			ShardedBinarySearchTree<int> sharded(boundaries);
+			for (int key : keys)
+			{
+				sharded.Insert(key);
+			}
+			double shardedMs = RunConcurrencyCase(threads, operations, 0, keyCount,
+				[&sharded](int op, int key)
+				{
+					if (op == 1)
+					{
+						sharded.Insert(key);
+						return true;
+					}
+					return sharded.Delete(key);
+				});
+			PrintRow("sharded", variant, shardedMs, std::to_string((long long)(totalOps / shardedMs * 1000.0)) + " ops/s");
+
+			// The same writes crowded into the hot range, first with the boundaries left
+			// where they are, then with rebalancing spreading the hot range out.
+			for (std::uint64_t interval : { (std::uint64_t)0, (std::uint64_t)1 << 14 })
+			{
+				ShardedBinarySearchTree<int> hot(boundaries, BalanceMode::AVL, interval);
+				for (int key : keys)
+				{
+					hot.Insert(key);
+				}
+				double hotMs = RunConcurrencyCase(threads, operations, 0, keyCount,
+					[&hot](int op, int key)
+					{
+						key /= 16;
+						if (op == 1)
+						{
+							hot.Insert(key);
+							return true;
+						}
+						return hot.Delete(key);
+					});
+				// Count how many shards the hot range ended up spread over.
+				std::vector<int> now = hot.Boundaries();
+				std::size_t hotShards = 1 + (std::lower_bound(now.begin(), now.end(), hotLimit) - now.begin());
+				PrintRow(interval == 0 ? "sharded, hot" : "sharded, hot, rebalanced", variant, hotMs,
+					std::to_string((long long)(totalOps / hotMs * 1000.0)) + " ops/s, " + std::to_string(hotShards) + " hot shards");
+			}
+		}
+	}
+
+	/// <summary>
+	/// Times durable inserts into a local log file with each sync policy, from 1 to 16
+	/// threads, against the same tree with no log. Then times rebuilding a tree by
+	/// replaying a whole log, and from a checkpoint.
+	/// </summary>
+	/// <param name="operationCount">The inserts made by all threads together, per case.</param>
+	/// <param name="replayCount">The records in the log that is replayed.</param>
+	void RunWriteAheadLogBenchmark(int operationCount = 20000, int replayCount = 1000000)
+	{
+		std::cout << "\n   -- Write-ahead log: durable inserts (" << operationCount << " per case) --\n";
+		const std::string snapshotPath = "bst_benchmark_wal.snapshot";
+		const std::string logPath = "bst_benchmark.wal";
+		const std::pair<SyncPolicy, std::string> policies[] = {
+			{ SyncPolicy::Never, "never" }, { SyncPolicy::Always, "always" },
+			{ SyncPolicy::Group, "group" }, { SyncPolicy::Periodic, "periodic 10ms" } };
+
+		std::uniform_int_distribution<int> pick(0, 1 << 30);
+		std::vector<int> keys(operationCount);
+		for (int& key : keys)
+		{
+			key = pick(generator);
+		}
+
+		for (int threads : { 1, 4, 16 })
+		{
+			std::string suffix = ", " + std::to_string(threads) + "t";
+			int share = operationCount / threads;
+
+			BinarySearchTree<int> plain(BalanceMode::AVL);
+			std::mutex lock;
+			Clock::time_point start = Clock::now();
+			RunThreads(threads, [&](int t)
+				{
+					for (int i = t * share; i < (t + 1) * share; i++)
+					{
+						std::lock_guard<std::mutex> guard(lock);
+						plain.Insert(keys[i]);
+					}
+				});
+			double ms = ElapsedMs(start);
+			PrintRow("no log", "mutex" + suffix, ms, std::to_string((long long)(threads * share / ms * 1000.0)) + " ops/s");
+
+			for (const std::pair<SyncPolicy, std::string>& policy : policies)
+			{
+				std::remove(snapshotPath.c_str());
+				std::remove(logPath.c_str());
+				DurableBinarySearchTree<int> durable(snapshotPath, logPath, policy.first);
+				start = Clock::now();
+				RunThreads(threads, [&](int t)
+					{
+						for (int i = t * share; i < (t + 1) * share; i++)
+						{
+							durable.Insert(keys[i]);
+						}
+					});
+				ms = ElapsedMs(start);
+				// Fewer syncs than records means callers shared them.
+				const WriteAheadLog<int>& log = durable.Log();
+				std::ostringstream extra;
+				extra << (long long)(threads * share / ms * 1000.0) << " ops/s, " << log.SyncCount() << " syncs, " << std::fixed
+					<< std::setprecision(1) << (double)(log.Bytes() - sizeof(WriteAheadLogHeader)) / log.LastSequence() << " B/rec";
+				PrintRow("DurableBST", policy.second + suffix, ms, extra.str());
+			}
+		}
+
+		// Rebuild a tree from a long log, then from a checkpoint of the same tree.
+		std::remove(snapshotPath.c_str());
+		std::remove(logPath.c_str());
+		{
+			DurableBinarySearchTree<int> durable(snapshotPath, logPath, SyncPolicy::Never);
+			for (int key : MakeKeysOfSize(replayCount))
+			{
+				durable.Insert(key);
+			}
+		}
+		Clock::time_point start = Clock::now();
+		{
+			DurableBinarySearchTree<int> replayed(snapshotPath, logPath);
+			PrintRow("Recover", "replay log", ElapsedMs(start), std::to_string(replayed.Size()) + " values");
+			start = Clock::now();
+			replayed.Checkpoint();
+			PrintRow("Checkpoint", "snapshot", ElapsedMs(start), std::to_string(replayed.Log().Bytes()) + " B log left");
+		}
+		start = Clock::now();
+		{
+			DurableBinarySearchTree<int> loaded(snapshotPath, logPath);
+			PrintRow("Recover", "snapshot + log", ElapsedMs(start), std::to_string(loaded.Size()) + " values");
+		}
+		std::remove(snapshotPath.c_str());
+		std::remove(logPath.c_str());
+	}
+
+	/// <summary>
+	/// Runs work(t) on threads threads, for t from 0, and waits for all of them.
+	/// </summary>
+	/// <param name="threads">The number of threads.</param>
+	/// <param name="work">What each thread does.</param>
+	template <typename Work>
+	void RunThreads(int threads, Work work)
+	{
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++)
+		{
+			workers.emplace_back(work, t);
+		}
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+};
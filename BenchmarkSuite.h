@@ -0,0 +1,421 @@
+/*
+* This file defines the BenchmarkSuite class, which measures the core operations of the
+* Binary Search Tree (BST) over a grid of tree sizes and key distributions and writes
+* the results as JSON, so that runs can be saved and compared over time.
+*
+* Where the BenchmarkDriver prints tables comparing one approach against another, the
+* suite always measures the same things the same way:
+*
+*   operations:     Insert, Contains (lookup), Minimum+Maximum, Traverse, Delete, Clear
+*   distributions:  random, sorted, duplicate-heavy, zipfian
+*   sizes:          1e3, 1e4, ... up to a configurable maximum (at most 1e8)
+*
+* Every tree is an AVL tree, since sorted keys would turn an unbalanced tree into a
+* linked list and the larger sizes would never finish. Small sizes are repeated until
+* enough operations have run for the timings to settle. Each result is reported as
+* the average nanoseconds per operation.
+*
+* The JSON is shaped like the output of Google Benchmark (a "context" object and a
+* "benchmarks" array), so the same tools can read it.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows for certain math functions.
+#include <algorithm>
+// Allows the use of timers.
+#include <chrono>
+// Allows the use of exp, log, log1p and expm1.
+#include <cmath>
+// Allows the use of fixed width integers.
+#include <cstdint>
+// Allows the date of a run to be recorded.
+#include <ctime>
+// Allows the results to be written to any output stream.
+#include <ostream>
+// Allows the use of random number generation.
+#include <random>
+// Allows the use of stream buffers.
+#include <streambuf>
+// Allow for use of strings.
+#include <string>
+// Allows the use of vectors.
+#include <vector>
+// The BST class.
+#include "BinarySearchTree.h"
+#pragma endregion Preprocessor Directives
+
+// Draws ranks 1 .. n where rank k comes up in proportion to 1 / k^s. Uses rejection
+// inversion (Hormann and Derflinger), so it needs no table and works for any n.
+class ZipfDistribution
+{
+public:
+	/// <summary>
+	/// Constructor for the ZipfDistribution.
+	/// </summary>
+	/// <param name="n"> The number of ranks.</param>
+	/// <param name="s"> The skew. 0 is uniform; around 1 is typical of real workloads.</param>
+	ZipfDistribution(std::uint64_t n, double s = 0.99)
+		: count(n), exponent(s)
+	{
+		integralOne = HIntegral(1.5) - 1.0;
+		integralN = HIntegral(n + 0.5);
+		squeeze = 2.0 - HIntegralInverse(HIntegral(2.5) - H(2.0));
+	}
+
+	/// <summary>
+	/// Returns a rank between 1 and n.
+	/// </summary>
+	/// <param name="generator"> The random number generator to draw from.</param>
+	/// <returns></returns>
+	template <typename Generator>
+	std::uint64_t operator()(Generator& generator)
+	{
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		while (true)
+		{
+			double u = integralN + uniform(generator) * (integralOne - integralN);
+			double x = HIntegralInverse(u);
+			double rounded = std::floor(x + 0.5);
+			std::uint64_t k = (rounded < 1.0) ? 1 : (rounded > (double)count) ? count : (std::uint64_t)rounded;
+
+			// Accept k if it falls under the curve, else try again.
+			if (k - x <= squeeze || u >= HIntegral(k + 0.5) - H((double)k))
+			{
+				return k;
+			}
+		}
+	}
+
+private:
+	// The number of ranks.
+	std::uint64_t count;
+	// The skew.
+	double exponent;
+	// Precomputed bounds of the sampling range, and the quick acceptance bound.
+	double integralOne;
+	double integralN;
+	double squeeze;
+
+	// The (unnormalized) probability of rank x.
+	double H(double x) const
+	{
+		return std::exp(-exponent * std::log(x));
+	}
+
+	// The integral of H, shifted so it is well behaved for any exponent.
+	double HIntegral(double x) const
+	{
+		double logX = std::log(x);
+		return Helper2((1.0 - exponent) * logX) * logX;
+	}
+
+	// The inverse of HIntegral.
+	double HIntegralInverse(double x) const
+	{
+		double t = x * (1.0 - exponent);
+		if (t < -1.0)
+		{
+			t = -1.0;
+		}
+		return std::exp(Helper1(t) * x);
+	}
+
+	// log(1 + x) / x, accurate near 0.
+	static double Helper1(double x)
+	{
+		return (std::abs(x) > 1e-8) ? std::log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+	}
+
+	// (e^x - 1) / x, accurate near 0.
+	static double Helper2(double x)
+	{
+		return (std::abs(x) > 1e-8) ? std::expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+	}
+};
+
+// Define the BenchmarkSuite class.
+class BenchmarkSuite
+{
+public:
+	/// <summary>
+	/// Constructor for the BenchmarkSuite class.
+	/// </summary>
+	/// <param name="maximumSize"> The largest tree size to measure (1e3 .. 1e8).</param>
+	/// <param name="minimumOperations"> Small sizes are repeated until at least this
+	/// many keys have been inserted, so their timings are not just noise.</param>
+	BenchmarkSuite(std::uint64_t maximumSize = 1000000, std::uint64_t minimumOperations = 1000000)
+		: maxSize(std::min<std::uint64_t>(std::max<std::uint64_t>(maximumSize, 1000), 100000000)),
+		minOperations(minimumOperations), generator(12345)
+	{
+		// Intentionally left blank.
+	}
+
+	/// <summary>
+	/// Runs every operation for every distribution and size, and writes the results to
+	/// out as JSON. If progress is not nullptr, one line is written to it per result.
+	/// </summary>
+	/// <param name="out"> Receives the JSON document.</param>
+	/// <param name="progress"> Receives human-readable progress, or nullptr.</param>
+	void Run(std::ostream& out, std::ostream* progress = nullptr)
+	{
+		std::vector<Result> results;
+		const char* distributions[] = { "random", "sorted", "duplicate-heavy", "zipfian" };
+		for (const char* distribution : distributions)
+		{
+			for (std::uint64_t size = 1000; size <= maxSize; size *= 10)
+			{
+				std::size_t first = results.size();
+				RunCase(distribution, size, results);
+				if (progress != nullptr)
+				{
+					for (std::size_t i = first; i < results.size(); i++)
+					{
+						*progress << "   " << results[i].Name() << ": " << results[i].NanosecondsPerOperation() << " ns/op\n";
+					}
+				}
+			}
+		}
+		WriteJson(out, results);
+	}
+
+private:
+	// The largest tree size to measure.
+	std::uint64_t maxSize;
+	// The least number of inserts to run at each size.
+	std::uint64_t minOperations;
+	// The random number generator. Seeded with a constant so runs are repeatable.
+	std::mt19937_64 generator;
+
+	// A stopwatch for timing a block of code.
+	using Clock = std::chrono::steady_clock;
+
+	// One measured operation at one distribution and size.
+	struct Result
+	{
+		// The operation, such as "Insert".
+		std::string operation;
+		// The key distribution, such as "zipfian".
+		std::string distribution;
+		// The number of keys inserted into the tree.
+		std::uint64_t size;
+		// The number of times the operation ran, over every repetition.
+		std::uint64_t operations;
+		// The total time taken by those operations.
+		double nanoseconds;
+		// The number of times the whole case was repeated.
+		std::uint64_t repetitions;
+
+		// The name of this result, in the style "Insert/zipfian/1000".
+		std::string Name() const
+		{
+			return operation + "/" + distribution + "/" + std::to_string(size);
+		}
+
+		// The average time per operation.
+		double NanosecondsPerOperation() const
+		{
+			return (operations > 0) ? nanoseconds / operations : 0.0;
+		}
+	};
+
+	// An output stream buffer that throws everything away, but counts the characters.
+	class CountingBuffer : public std::streambuf
+	{
+	public:
+		// The number of characters written so far.
+		std::size_t written = 0;
+
+	protected:
+		std::streamsize xsputn(const char*, std::streamsize count) override
+		{
+			written += static_cast<std::size_t>(count);
+			return count;
+		}
+
+		int_type overflow(int_type ch) override
+		{
+			written++;
+			return ch;
+		}
+	};
+
+	/// <summary>
+	/// Returns the number of nanoseconds since start.
+	/// </summary>
+	/// <param name="start"> The time the measurement started.</param>
+	/// <returns></returns>
+	static double ElapsedNs(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	}
+
+	/// <summary>
+	/// Builds size keys drawn from the named distribution.
+	/// </summary>
+	/// <param name="distribution"> "random", "sorted", "duplicate-heavy" or "zipfian".</param>
+	/// <param name="size"> The number of keys.</param>
+	/// <returns></returns>
+	std::vector<std::int64_t> MakeKeys(const std::string& distribution, std::uint64_t size)
+	{
+		std::vector<std::int64_t> keys(size);
+		if (distribution == "sorted")
+		{
+			for (std::uint64_t i = 0; i < size; i++)
+			{
+				keys[i] = (std::int64_t)i;
+			}
+		}
+		else if (distribution == "duplicate-heavy")
+		{
+			// About 100 copies of each value.
+			std::uniform_int_distribution<std::int64_t> pick(0, (std::int64_t)std::max<std::uint64_t>(size / 100, 1) - 1);
+			for (std::int64_t& key : keys)
+			{
+				key = pick(generator);
+			}
+		}
+		else if (distribution == "zipfian")
+		{
+			// A few values are very common and most are rare. The ranks are scattered
+			// so the common values are not all at one end of the tree.
+			ZipfDistribution pick(size);
+			for (std::int64_t& key : keys)
+			{
+				key = (std::int64_t)((pick(generator) * 0x9E3779B97F4A7C15ULL) >> 1);
+			}
+		}
+		else
+		{
+			std::uniform_int_distribution<std::int64_t> pick(0, INT64_MAX);
+			for (std::int64_t& key : keys)
+			{
+				key = pick(generator);
+			}
+		}
+		return keys;
+	}
+
+	/// <summary>
+	/// Measures every operation at one distribution and size, and adds the results.
+	/// </summary>
+	void RunCase(const std::string& distribution, std::uint64_t size, std::vector<Result>& results)
+	{
+		std::uint64_t repetitions = std::max<std::uint64_t>(1, minOperations / size);
+		// Minimum+Maximum is cheap, so it is called a fixed number of times per repetition.
+		std::uint64_t minMaxCalls = std::min<std::uint64_t>(size, 100000);
+
+		Result insert{ "Insert", distribution, size, 0, 0.0, repetitions };
+		Result lookup{ "Contains", distribution, size, 0, 0.0, repetitions };
+		Result minMax{ "MinimumMaximum", distribution, size, 0, 0.0, repetitions };
+		Result traverse{ "Traverse", distribution, size, 0, 0.0, repetitions };
+		Result erase{ "Delete", distribution, size, 0, 0.0, repetitions };
+		Result clear{ "Clear", distribution, size, 0, 0.0, repetitions };
+		long long checksum = 0;
+
+		for (std::uint64_t repetition = 0; repetition < repetitions; repetition++)
+		{
+			std::vector<std::int64_t> keys = MakeKeys(distribution, size);
+			// Lookups come from the same distribution, so some hit and some miss.
+			std::vector<std::int64_t> queries = MakeKeys(distribution, size);
+
+			BinarySearchTree<std::int64_t> tree(BalanceMode::AVL);
+			Clock::time_point start = Clock::now();
+			for (std::int64_t key : keys)
+			{
+				tree.Insert(key);
+			}
+			insert.nanoseconds += ElapsedNs(start);
+			insert.operations += size;
+
+			start = Clock::now();
+			for (std::int64_t query : queries)
+			{
+				checksum += tree.Contains(query);
+			}
+			lookup.nanoseconds += ElapsedNs(start);
+			lookup.operations += size;
+
+			start = Clock::now();
+			for (std::uint64_t i = 0; i < minMaxCalls; i++)
+			{
+				checksum += tree.Minimum() ^ tree.Maximum();
+			}
+			minMax.nanoseconds += ElapsedNs(start);
+			minMax.operations += minMaxCalls;
+
+			// Stream the traversal into a counter, so only the formatting is timed.
+			CountingBuffer counter;
+			std::ostream sink(&counter);
+			start = Clock::now();
+			tree.Traverse(sink);
+			traverse.nanoseconds += ElapsedNs(start);
+			traverse.operations += size;
+			checksum += counter.written;
+
+			start = Clock::now();
+			for (std::int64_t key : keys)
+			{
+				checksum += tree.Delete(key);
+			}
+			erase.nanoseconds += ElapsedNs(start);
+			erase.operations += size;
+
+			// Clear needs a full tree again, so build one without timing it.
+			tree.BuildFrom(keys);
+			start = Clock::now();
+			tree.Clear();
+			clear.nanoseconds += ElapsedNs(start);
+			clear.operations += size;
+		}
+
+		// Use the checksum so none of the timed work can be optimized away.
+		if (checksum == 42)
+		{
+			insert.operations++;
+		}
+		results.push_back(insert);
+		results.push_back(lookup);
+		results.push_back(minMax);
+		results.push_back(traverse);
+		results.push_back(erase);
+		results.push_back(clear);
+	}
+
+	/// <summary>
+	/// Writes results to out as a JSON document.
+	/// </summary>
+	static void WriteJson(std::ostream& out, const std::vector<Result>& results)
+	{
+		std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+		char date[32];
+		std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+		out << "{\n";
+		out << "  \"context\": {\n";
+		out << "    \"date\": \"" << date << "\",\n";
+		out << "    \"library\": \"BinarySearchTree\",\n";
+		out << "    \"balance_mode\": \"avl\",\n";
+		out << "    \"key_type\": \"int64\"\n";
+		out << "  },\n";
+		out << "  \"benchmarks\": [";
+		for (std::size_t i = 0; i < results.size(); i++)
+		{
+			const Result& result = results[i];
+			out << ((i == 0) ? "\n" : ",\n");
+			out << "    {\n";
+			out << "      \"name\": \"" << result.Name() << "\",\n";
+			out << "      \"operation\": \"" << result.operation << "\",\n";
+			out << "      \"distribution\": \"" << result.distribution << "\",\n";
+			out << "      \"size\": " << result.size << ",\n";
+			out << "      \"repetitions\": " << result.repetitions << ",\n";
+			out << "      \"iterations\": " << result.operations << ",\n";
+			out << "      \"real_time\": " << result.NanosecondsPerOperation() << ",\n";
+			out << "      \"time_unit\": \"ns\"\n";
+			out << "    }";
+		}
+		out << "\n  ]\n";
+		out << "}\n";
+	}
+};
@@ -1,27 +1,63 @@
 /*
 * This class is for a Binary Search Tree (BST), a data structure for holding elements
-* in a particular layout that conceptually resembles an upside-down tree. This tree
-* will be built specifically to hold integers, as per the assignment instructions.
+* in a particular layout that conceptually resembles an upside-down tree. The tree was
+* first built specifically to hold integers, as per the assignment instructions, but is
+* now a template that can hold any Key type that Compare can order.
 * 
-* The tree will hold nodes, each of which hold an integer value and pointers to the
+* The tree will hold nodes, each of which hold a value and pointers to the
 * nodes that are down to its left and down to its right (simply called leftNode and 
-* rightNode for simplicity). No pointer is maintained to ancetors of nodes.
+* rightNode for simplicity). Each node also points back up at its parent (parentNode),
+* which lets an iterator step from one value to the next without keeping a stack, so the
+* tree works with range-for loops and the standard algorithms through begin()/end(),
+* rbegin()/rend(), LowerBound() and UpperBound().
 * The BST will not hold references to each node, but only to the first node, known as
 * the "root", which can be used to reach any other node in the tree.
 * 
 * Taking the value X of any given node, the value of that node's leftNode must be < X
 * and the value of the rightNode must be > X. Smaller numbers left, larger numbers right.
+* "Smaller" is decided by Compare, which is std::less (the < operator) by default.
 * 
 * No duplicate values will be stored. Instead, each node will also hold a reference to the
 * number of times that value has been added (minimum 1, else the node will be deleted).
 * 
-* This class will NOT be self-balancing, at least not yet.
+* By default this class is NOT self-balancing, so sorted input will degrade the tree
+* into a linked list. Each tree can instead be constructed in AVL mode, in which case
+* every Insert and Delete rebalances the path it touched so that the height of the
+* tree stays within about 1.44 * log2(n). For workloads where a handful of hot values get
+* most of the traffic, Splay mode rotates the node every Insert and Delete touched all the
+* way up to the root, and Frequency mode only rotates a node up past parents that are
+* stored fewer times than it is, which leaves the coldest values alone. Lookups never
+* change the tree, so they stay safe to run on several threads at once.
 * 
-* This class is being stored only in a .h file because I intent to template the class
-* in the future to hold any value type, not just integers.
+* The tree also remembers which nodes hold its smallest and largest values, updating
+* them on every change, so Minimum() and Maximum() never walk down the tree and
+* PopMin()/PopMax() let it serve as a priority queue.
 * 
-* This file also defines the Node struct, which again for now will only work
-* for integers, but may be made generic in the future.
+* Nodes are not created with "new" one at a time. Instead each tree owns a NodePool
+* that carves nodes out of large slabs and recycles deleted nodes, which keeps nodes
+* close together in memory and lets Clear() throw the whole tree away in O(1).
+* 
+* Each tree owns its nodes and frees them when it is destroyed. Trees can be moved and
+* swapped in O(1) but never copied by accident; Clone() makes a deep copy, Merge()
+* absorbs another tree (taking over its pool's memory when it can), and Split() moves
+* every value from a given key up into a new tree.
+* 
+* This class is being stored only in a .h file because it is a template. Values are
+* moved into the tree whenever the caller hands over an rvalue, and Emplace() builds
+* the value directly inside its node, so heavy keys are never copied.
+* 
+* Large trees can also be read and cleared on several threads at once. The tree is
+* split into chunks of consecutive values (whole subtrees, plus the single nodes
+* between them), and threads take chunks off a shared counter until none are left.
+* How the tree is split only depends on its shape, never on the number of threads,
+* so reductions combine their partial results in the same order every time.
+* 
+* Each node can also carry an augmentation (see Augment.h), such as the sum of value *
+* quantity over its subtree, kept up to date everywhere heights and sizes are. Then
+* AggregateInRange() answers for any range of values in O(log n).
+* 
+* This file also defines the Node struct, which is a template over the value type too.
+* The Allocator is rebound to Node<Key, Augment> and used by the NodePool for its slabs.
 * 
 * I did NOT copy/paste code from the textbook, but did use it as a reference when
 * designing code for my methods. I wrote it all by hand and learned what it all meant.
@@ -32,21 +68,97 @@
 #pragma once
 // Allows for certain math functions.
 #include <algorithm>
+// Allows chunks of the tree to be handed out to threads without a lock.
+#include <atomic>
+// Allows numbers to be written into character buffers without allocating.
+#include <charconv>
+// Allows the use of fixed width integers.
+#include <cstdint>
+// Allows the use of abs.
+#include <cstdlib>
+// Allows the use of memcpy and size_t.
+#include <cstring>
+// Allows an exception thrown on a worker thread to be passed back to the caller.
+#include <exception>
+// Allows traversals to be streamed to any output stream.
+#include <ostream>
+// Allows the use of std::out_of_range.
+#include <stdexcept>
+// Allows the use of std::less, the default comparator.
+#include <functional>
+// Allows the use of iterator traits and move iterators.
+#include <iterator>
+// Allows the use of numeric_limits.
+#include <limits>
+// Allows values to be returned only when the BST is not empty.
+#include <optional>
+// Allows the use of std::allocator, the default allocator.
+#include <memory>
+// Allows the first failure of a parallel operation to be recorded safely.
+#include <mutex>
+// Allows values that are not numbers to be turned into strings.
+#include <sstream>
 // Allow for use of strings.
 #include <string>
+// Allows the use of std::system_error, thrown when a thread cannot be started.
+#include <system_error>
+// Allows the parallel operations to run on several threads.
+#include <thread>
+// Allows the use of type traits.
+#include <type_traits>
+// Allows the use of std::move and std::forward.
+#include <utility>
+// Allows the use of vectors (used as explicit stacks instead of recursion).
+#include <vector>
+// The slab allocator that owns every node of the tree.
+#include "NodePool.h"
+// The shape statistics and the optional per-operation counters.
+#include "TreeStats.h"
+// The per-node aggregates a tree can keep for range queries.
+#include "Augment.h"
 #pragma endregion Preprocessor Directives
 
-// Define the Node struct (for integers).
-struct Node
+// The balancing policy used by a Binary Search Tree. Selected per tree at construction.
+enum class BalanceMode
+{
+	// Never rebalance. Nodes stay exactly where they were inserted.
+	Unbalanced,
+	// Rebalance with AVL rotations so that the height stays O(log n).
+	AVL,
+	// Splay every node that is inserted into or deleted from up to the root, so values
+	// that are used often stay a few steps from the top. O(log n) amortized.
+	Splay,
+	// Never rebalance, but move a value up past every parent that is stored fewer
+	// times whenever its quantity changes, so the most frequent values gather at the top.
+	Frequency
+};
+
+// The number of times a value is stored. 64 bits, so very frequent values never overflow.
+using Quantity = std::uint64_t;
+
+// Define the Node struct.
+// A node also keeps the aggregate of its subtree for the tree's Augment (nothing, and no
+// room, for NoAugment).
+template <typename Key, typename Augment = NoAugment>
+struct Node : AugmentStorage<typename Augment::Value>
 {
 	// The value of this Node.
-	int value;
+	Key value;
+	// The height of the subtree rooted at this node (a leaf has height 1). Kept next to
+	// value so that small values share its padding and the parent pointer costs nothing.
+	int height;
 	// A pointer to the node that is to this node's bottom-left.
 	Node* leftNode;
 	// A pointer to the node that is to this node's bottom-right.
 	Node* rightNode;
+	// A pointer to the node above this one, kept up to date wherever heights are. Only
+	// iterators use it. The root's parentNode is left as it was, so stop at the root.
+	Node* parentNode;
 	// The number of times this value has been included.
-	int quantity;
+	Quantity quantity;
+	// The total quantity of every value in the subtree rooted at this node,
+	// including this node's own quantity. Used to count and rank values quickly.
+	Quantity subtreeSize;
 
 	/// <summary>
 	/// Constructor for Node struct.
@@ -55,13 +167,34 @@ struct Node
 	/// <param name="left"> Pointer to the Node to this Node's left.</param>
 	/// <param name="right"> Pointer to the Node to this Node's right.</param>
 	/// <param name="quant"> The number of times this value has been included.</param>
-	Node(int val, Node* left = nullptr, Node* right = nullptr, int quant = 1)
+	Node(const Key& val, Node* left = nullptr, Node* right = nullptr, Quantity quant = 1)
+		: value(val), leftNode(left), rightNode(right), parentNode(nullptr)
 	{
-		value = val;
-		leftNode = left;
-		rightNode = right;
 		// Ensure that quantity is at least one.
-		quantity = std::max(1, quant);
+		quantity = std::max<Quantity>(1, quant);
+		height = 1;
+		subtreeSize = quantity;
+	}
+
+	/// <summary>
+	/// Constructor for Node struct that moves the value in instead of copying it.
+	/// </summary>
+	/// <param name="val"> The value this Node will take over.</param>
+	Node(Key&& val)
+		: value(std::move(val)), height(1), leftNode(nullptr), rightNode(nullptr), parentNode(nullptr), quantity(1), subtreeSize(1)
+	{
+		// Intentionally left blank.
+	}
+
+	/// <summary>
+	/// Constructor for Node struct that builds the value in place from args.
+	/// </summary>
+	/// <param name="args"> The arguments for the value's constructor.</param>
+	template <typename... Args>
+	Node(std::piecewise_construct_t, Args&&... args)
+		: value(std::forward<Args>(args)...), height(1), leftNode(nullptr), rightNode(nullptr), parentNode(nullptr), quantity(1), subtreeSize(1)
+	{
+		// Intentionally left blank.
 	}
 
 	// The destructor for the Node struct.
@@ -71,347 +204,3067 @@ struct Node
 	}
 };
 
-// Define the Binary Search Tree class (for integers).
+// Define the Binary Search Tree class.
+template <typename Key, typename Compare = std::less<Key>, typename Allocator = std::allocator<Key>, typename Augment = NoAugment>
 class BinarySearchTree
 {
+	// The nodes are never handed out, since their links could be changed through them.
+	using NodeType = Node<Key, Augment>;
+
 	// Public members.
 public:
+	// The aggregate every node keeps of its subtree. See Augment.h.
+	using AggregateType = typename Augment::Value;
+
+	// Define the Entry struct.
+	// What an iterator points at: a stored value (read only) and its quantity.
+	struct Entry
+	{
+		// The value, still inside its node.
+		const Key& value;
+		// The number of times the value is stored.
+		Quantity quantity;
+	};
+
+	// Define the ConstIterator class.
+	// Walks the nodes in sorted order using the parent pointers, so nothing is allocated
+	// and each step is O(1) amortized. Dereferencing gives an Entry, so the value and
+	// quantity can be read but nothing in the BST can be changed. Any Insert or Delete
+	// invalidates iterators, since nodes are rotated around and values can move between
+	// nodes. Climbing back up costs extra cache misses when the nodes are scattered, so
+	// ForEach() stays the faster way to visit a whole tree.
+	class ConstIterator
+	{
+	public:
+		// Entries are made on the fly, so -> hands out a pointer to one it holds.
+		struct EntryPointer
+		{
+			Entry entry;
+
+			const Entry* operator->() const
+			{
+				return &entry;
+			}
+		};
+
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = Entry;
+		using difference_type = std::ptrdiff_t;
+		using pointer = EntryPointer;
+		using reference = Entry;
+
+		/// <summary>
+		/// Default constructor. The iterator does not point into any BST.
+		/// </summary>
+		ConstIterator()
+			: tree(nullptr), node(nullptr)
+		{
+			// Intentionally left blank.
+		}
+
+		reference operator*() const
+		{
+			return Entry{ node->value, node->quantity };
+		}
+
+		pointer operator->() const
+		{
+			return EntryPointer{ Entry{ node->value, node->quantity } };
+		}
+
+		/// <summary>
+		/// Moves to the next larger value, or to end() after the maximum.
+		/// </summary>
+		/// <returns></returns>
+		ConstIterator& operator++()
+		{
+			// If there is a right subtree, the next value is the smallest one in it.
+			if (node->rightNode != nullptr)
+			{
+				node = node->rightNode;
+				while (node->leftNode != nullptr)
+				{
+					node = node->leftNode;
+				}
+			}
+			// Else, climb until we come up out of a left subtree. That parent is next.
+			else
+			{
+				while (node != tree->root && node == node->parentNode->rightNode)
+				{
+					node = node->parentNode;
+				}
+				node = (node == tree->root) ? nullptr : node->parentNode;
+			}
+			return *this;
+		}
+
+		/// <summary>
+		/// Moves to the next smaller value. From end(), moves to the maximum.
+		/// </summary>
+		/// <returns></returns>
+		ConstIterator& operator--()
+		{
+			// end() steps back onto the maximum, which the BST already knows.
+			if (node == nullptr)
+			{
+				node = tree->maxNode;
+			}
+			// If there is a left subtree, the previous value is the largest one in it.
+			else if (node->leftNode != nullptr)
+			{
+				node = node->leftNode;
+				while (node->rightNode != nullptr)
+				{
+					node = node->rightNode;
+				}
+			}
+			// Else, climb until we come up out of a right subtree. That parent is previous.
+			else
+			{
+				while (node != tree->root && node == node->parentNode->leftNode)
+				{
+					node = node->parentNode;
+				}
+				node = (node == tree->root) ? nullptr : node->parentNode;
+			}
+			return *this;
+		}
+
+		ConstIterator operator++(int)
+		{
+			ConstIterator previous = *this;
+			++*this;
+			return previous;
+		}
+
+		ConstIterator operator--(int)
+		{
+			ConstIterator previous = *this;
+			--*this;
+			return previous;
+		}
+
+		bool operator==(const ConstIterator& other) const
+		{
+			return node == other.node;
+		}
+
+		bool operator!=(const ConstIterator& other) const
+		{
+			return node != other.node;
+		}
+
+	private:
+		friend class BinarySearchTree;
+
+		ConstIterator(const BinarySearchTree* owner, const NodeType* start)
+			: tree(owner), node(start)
+		{
+			// Intentionally left blank.
+		}
+
+		// The BST being walked, for its root and maximum.
+		const BinarySearchTree* tree;
+		// The current node, or nullptr at end().
+		const NodeType* node;
+	};
+
+	// Values cannot be changed in place (that could break the order), so every iterator is const.
+	using iterator = ConstIterator;
+	using const_iterator = ConstIterator;
+	using reverse_iterator = std::reverse_iterator<ConstIterator>;
+	using const_reverse_iterator = std::reverse_iterator<ConstIterator>;
+
 	/// <summary>
 	/// Constructor for the Binary Search Tree.
 	/// </summary>
-	BinarySearchTree()
+	/// <param name="balanceMode"> The balancing policy this tree will use.</param>
+	/// <param name="allocationMode"> Where this tree gets the memory for its nodes.</param>
+	/// <param name="comp"> The comparator that decides which values are smaller.</param>
+	/// <param name="alloc"> The allocator the node pool gets its memory from.</param>
+	BinarySearchTree(BalanceMode balanceMode = BalanceMode::Unbalanced,
+		AllocationMode allocationMode = AllocationMode::Arena,
+		const Compare& comp = Compare(), const Allocator& alloc = Allocator())
+		: mode(balanceMode), compare(comp), pool(allocationMode, alloc)
 	{
 		// Intentionally left blank.
 	}
 
+	// The BST owns its nodes, so copying one would leave two trees freeing the same
+	// nodes. Use Clone() for a deep copy instead.
+	BinarySearchTree(const BinarySearchTree&) = delete;
+	BinarySearchTree& operator=(const BinarySearchTree&) = delete;
+
 	/// <summary>
-	/// Insert the value provided into the BST quant times.
+	/// Move constructor. Takes over every node of other in O(1), leaving other empty.
 	/// </summary>
-	/// <param name="val"> The value to be stored in the BST.</param>
-	void Insert(int val)
+	/// <param name="other"> The BST to take over.</param>
+	BinarySearchTree(BinarySearchTree&& other) noexcept
+		: root(other.root), minNode(other.minNode), maxNode(other.maxNode), mode(other.mode),
+		compare(std::move(other.compare)), pool(std::move(other.pool))
 	{
-		// Calls the private, recursive Insert().
-		Insert(val, root);
+		other.root = nullptr;
+		other.minNode = nullptr;
+		other.maxNode = nullptr;
 	}
 
 	/// <summary>
-	/// Delete the requested val from the BST.
-	/// Returns true if deletion was successful, false is nothing was removed.
+	/// Move assignment. Clears this BST, then takes over every node of other in O(1),
+	/// leaving other empty.
 	/// </summary>
-	/// <param name="val"> The value to be deleted from the BST.</param>
-	bool Delete(int val)
+	/// <param name="other"> The BST to take over.</param>
+	BinarySearchTree& operator=(BinarySearchTree&& other) noexcept
 	{
-		// Calls the private, recursive Delete() starting at the root.
-		return Delete(val, root);
+		if (this != &other)
+		{
+			Clear();
+			Swap(other);
+		}
+		return *this;
 	}
 
-	/// <summary>
-	/// Returns the maximum value stored in the BST.
-	/// </summary>
-	/// <returns></returns>
-	int Maximum()
+	// The destructor for the Binary Search Tree. Destroys every node, then the node
+	// pool gives its slabs back to the heap.
+	~BinarySearchTree()
 	{
-		// Call the private FindMax on the root and return its value.
-		return FindMax(root)->value;
+		Clear();
 	}
 
 	/// <summary>
-	/// Returns the minimum value stored in the BST.
+	/// Swaps the contents (and modes) of this BST and other in O(1).
 	/// </summary>
-	/// <returns></returns>
-	int Minimum()
+	/// <param name="other"> The BST to swap with.</param>
+	void Swap(BinarySearchTree& other) noexcept
 	{
-		// Call the private FindMin on the root and return its value.
-		return FindMin(root)->value;
+		std::swap(root, other.root);
+		std::swap(minNode, other.minNode);
+		std::swap(maxNode, other.maxNode);
+		std::swap(mode, other.mode);
+		std::swap(compare, other.compare);
+		pool.Swap(other.pool);
 	}
 
 	/// <summary>
-	/// Traverses the BST in an INORDER path and returns the resulting string.
+	/// Swaps two BSTs in O(1). Found by std::swap-style calls through argument
+	/// dependent lookup.
 	/// </summary>
-	/// <returns></returns>
-	std::string Traverse()
+	friend void swap(BinarySearchTree& left, BinarySearchTree& right) noexcept
 	{
-		// Create the string to be manipulated and an int for depth.
-		std::string str = "\n   ";
-		int depth = 1;
-		// Traverse the BST with the private Traverse(), starting at the root,
-		// and return the result.
-		return Traverse(str, root, depth);
+		left.Swap(right);
 	}
 
 	/// <summary>
-	/// Clears the BST by deleting all nodes.
-	/// False is failed to clear, true is clear successful.
+	/// Returns a deep copy of the BST with the same shape, modes, comparator and
+	/// allocator. Every node is copied once in a single pass down the tree, and in
+	/// Arena mode all of them come out of one slab.
 	/// </summary>
-	bool Clear()
+	/// <returns></returns>
+	BinarySearchTree Clone() const
 	{
-		// Call the private, recursive Clear() starting at the root.
-		// Root will be deleting last.
-		return Clear(root);
+		BinarySearchTree copy(mode, pool.Mode(), compare, pool.GetAllocator());
+		copy.pool.Reserve(pool.LiveNodes());
+		copy.root = copy.CopySubtree(static_cast<const NodeType*>(root));
+		copy.FindEnds();
+		return copy;
 	}
 
-	// Private members.
-private:
-	// A pointer to the root node for this BST. nullptr when tree is empty.
-	Node* root = nullptr;
-
 	/// <summary>
-	/// Insert the value provided into the BST quant times. (Private)
+	/// Moves every value of other into this BST, leaving other empty. Much cheaper than
+	/// inserting other's values one at a time: no node is allocated or copied when the
+	/// pools can hand nodes over, and if every value of one tree is smaller than every
+	/// value of the other, the two are joined in O(log n) (AVL) or O(height). Otherwise
+	/// both are walked in order, equal values are combined, and every node is relinked
+	/// into a balanced shape in O(n + m).
 	/// </summary>
-	/// <param name="val"> The value to be stored in the BST.</param>
-	/// <param name="t"> The root node of the subtree we are inserting under.</param>
-	void Insert(const int &val, Node* &t)
+	/// <param name="other"> The BST to take the values from.</param>
+	void Merge(BinarySearchTree& other)
 	{
-		// If this node is nullptr,
-		if (t == nullptr)
-		{
-			// then create a new node here with the value.
-			t = new Node(val);
-		}
-		// Else, this node is not nullptr. If val is less than this node's value,
-		else if (val < t->value)
+		// Merging a tree into itself, or an empty tree, changes nothing.
+		if (this == &other || other.root == nullptr)
 		{
-			// then recursively call the private Insert on this node's leftNode.
-			Insert(val, t->leftNode);
+			return;
 		}
-		// Else, val was not less than this node's value. If val is greater than,
-		else if (val > t->value)
+
+		// Take over other's nodes. If the pools are alike, other's memory simply becomes
+		// ours. Else, the values are moved into new nodes of our own.
+		NodeType* incoming;
+		if (pool.CanAdopt(other.pool))
 		{
-			// then recursively call the private Insert on this node's rightNode.
-			Insert(val, t->rightNode);
+			incoming = other.root;
+			pool.Adopt(other.pool);
 		}
-		// Else, val must actually be equal to this node's value.
 		else
 		{
-			// Increment the quantity in this node to account for it being inserted multiple times.
-			t->quantity++;
+			pool.Reserve(other.pool.LiveNodes());
+			incoming = CopySubtree(other.root);
+			other.Clear();
 		}
-	}
+		other.root = nullptr;
+		other.FindEnds();
 
-	/// <summary>
-	/// Delete the requested val from the BST, starting the search at subtree t.
-	/// Returns true if deletion was successful, false is nothing was removed. (Private)
-	/// </summary>
-	/// <param name="val"> The value to be deleted from the BST.</param>
-	/// <param name="t"> The root node of the subtree currently being used to find val.</param>
-	bool Delete(const int& val, Node* &t)
-	{
-		// If this node is nullptr,
-		if (t == nullptr)
+		// If this tree was empty, the incoming tree is kept as it is (rebalanced in
+		// one pass if it was not balanced but this tree must be).
+		bool incomingBalanced = (other.mode == mode || mode != BalanceMode::AVL);
+		if (root == nullptr && incomingBalanced)
 		{
-			// then we did not find the value. Do nothing.
-			return false;
+			root = incoming;
+			FindEnds();
+			return;
 		}
-		// Else, this node is not null. If val is less than this node's value,
-		else if (val < t->value)
+
+		// If every value of one side is smaller than every value of the other (and both
+		// sides keep the same balance rules), the two can simply be joined.
+		if (root != nullptr && incomingBalanced)
 		{
-			// then recursively call the private Delete on the leftNode.
-			return Delete(val, t->leftNode);
+			if (compare(FindMax(root)->value, FindMin(incoming)->value))
+			{
+				root = JoinSubtrees(root, incoming);
+				FindEnds();
+				return;
+			}
+			if (compare(FindMax(incoming)->value, FindMin(root)->value))
+			{
+				root = JoinSubtrees(incoming, root);
+				FindEnds();
+				return;
+			}
 		}
-		// Else, val was not less than this node's value. If val is greater than,
-		else if (val > t->value)
+
+		// Else, merge both in order. A value stored on both sides keeps one node.
+		std::vector<NodeType*> ours;
+		std::vector<NodeType*> theirs;
+		VisitInOrder(root, [&ours](NodeType* node) { ours.push_back(node); });
+		VisitInOrder(incoming, [&theirs](NodeType* node) { theirs.push_back(node); });
+		std::vector<NodeType*> nodes;
+		nodes.reserve(ours.size() + theirs.size());
+		std::size_t i = 0;
+		std::size_t j = 0;
+		while (i < ours.size() || j < theirs.size())
 		{
-			// then recursively call the private Delete on the rightNode.
-			return Delete(val, t->rightNode);
+			if (j == theirs.size() || (i < ours.size() && compare(ours[i]->value, theirs[j]->value)))
+			{
+				nodes.push_back(ours[i++]);
+			}
+			else if (i == ours.size() || compare(theirs[j]->value, ours[i]->value))
+			{
+				nodes.push_back(theirs[j++]);
+			}
+			// Else, both hold the same value, so only ours is kept.
+			else
+			{
+				ours[i]->quantity += theirs[j]->quantity;
+				pool.Free(theirs[j++]);
+				nodes.push_back(ours[i++]);
+			}
 		}
-		// Else, val must actually be equal to this node's value.
-		// If this value has a quantity of more than 1,
-		else if (t->quantity > 1)
+		root = LinkBalanced(nodes, 0, nodes.size());
+		FindEnds();
+	}
+
+	/// <summary>
+	/// Moves every value that is not less than val out of this BST and returns them as
+	/// a new BST with the same modes. The BST is cut along the path down to val and
+	/// the pieces are joined back together on each side, which takes O(log n) steps in
+	/// AVL mode and keeps both sides balanced. Since every node belongs to the pool of
+	/// the tree that made it, the values that leave are then moved into nodes of the
+	/// returned BST in one pass that keeps their shape.
+	/// </summary>
+	/// <param name="val"> The smallest value that goes to the returned BST.</param>
+	/// <returns></returns>
+	BinarySearchTree Split(const Key& val)
+	{
+		BinarySearchTree upper(mode, pool.Mode(), compare, pool.GetAllocator());
+
+		// Walk down towards val. Every node on the way goes to the lower side (along
+		// with its left subtree) or the upper side (along with its right subtree).
+		std::vector<std::pair<NodeType*, bool>> steps;
+		NodeType* lowerRoot = nullptr;
+		NodeType* upperRoot = nullptr;
+		NodeType* t = root;
+		while (t != nullptr)
 		{
-			// then simply lower the quantity by 1.
-			t->quantity--;
-			return true;
+			// If this value is less than val, it stays, and the cut continues to the right.
+			if (compare(t->value, val))
+			{
+				steps.push_back({ t, false });
+				t = t->rightNode;
+			}
+			// Else, if val is less than this value, it goes, and the cut continues to the left.
+			else if (compare(val, t->value))
+			{
+				steps.push_back({ t, true });
+				t = t->leftNode;
+			}
+			// Else, this node holds val. Its left subtree stays, and it goes with its right.
+			else
+			{
+				lowerRoot = t->leftNode;
+				NodeType* right = t->rightNode;
+				upperRoot = Join(nullptr, t, right);
+				break;
+			}
 		}
-		// Else, this value must be stored with a quantity of only 1.
-		else
+
+		// Join the pieces back together from the bottom up.
+		while (!steps.empty())
 		{
-			// We can delete this node, but children make it tricky.
-			// If this node has 2 children,
-			if (t->leftNode != nullptr && t->rightNode != nullptr)
+			NodeType* node = steps.back().first;
+			bool goesUp = steps.back().second;
+			steps.pop_back();
+			if (goesUp)
 			{
-				// then we must move the minimum node from the rightNode onto this node
-				// (by moving values only).
-				Node* tempNode = FindMin(t->rightNode);
-				t->value = tempNode->value;
-				t->quantity = tempNode->quantity;
-
-				// Set that minimum node's quantity to 1 so it gets fully removed later.
-				tempNode->quantity = 1;
-
-				// Recursively call Delete for the moved value starting at this node's rightNode.
-				return Delete(tempNode->value, t->rightNode);
+				upperRoot = Join(upperRoot, node, node->rightNode);
 			}
-			// Else, this node has no more than 1 child.
 			else
 			{
-				// Hold a reference to this node to be deleted.
-				Node* oldNode = t;
+				lowerRoot = Join(node->leftNode, node, lowerRoot);
+			}
+		}
+		root = lowerRoot;
 
-				/* Because t is the parent's pointer to this node, changing t is essentially
-				* changing which node the parent's pointer is pointing to. This node would
-				* then still need to be deleted with the "delete" keyword since it was created
-				* with the "new" keyword. */
+		// Move the upper side into the new BST's own nodes, keeping its shape, then
+		// free the old nodes.
+		upper.root = upper.CopySubtree(upperRoot);
+		Clear(upperRoot);
+		FindEnds();
+		upper.FindEnds();
+		return upper;
+	}
 
-				// Change t to equal the child of this node (will be nullptr is no children).
-				// This line essentially says:
-				// If this node's leftNode is valid, then set t equal to it.
-				// Otherwise, set t to this node's rightNode (which might still be nullptr).
-				t = (t->leftNode != nullptr) ? t->leftNode : t->rightNode;
+	/// <summary>
+	/// Returns the balancing policy this tree was constructed with.
+	/// </summary>
+	/// <returns></returns>
+	BalanceMode Mode() const
+	{
+		return mode;
+	}
 
-				// Finally, delete the oldNode.
-				delete oldNode;
-				return true;
-			}
-		}
+	/// <summary>
+	/// Returns the comparator that decides which values are smaller, so that copies of
+	/// this tree's values can be searched in the same order.
+	/// </summary>
+	/// <returns></returns>
+	const Compare& Comparator() const
+	{
+		return compare;
 	}
 
 	/// <summary>
-	/// Finds the node with the minimum value at or below node t.
+	/// Returns the allocation counters of this tree's node pool.
 	/// </summary>
-	/// <param name="t"> The node to start the search for the minimum value.</param>
 	/// <returns></returns>
-	Node* FindMin(Node* &t)
+	const NodePoolStats& AllocationStats() const
 	{
-		// If this node it nullptr,
-		if (t == nullptr)
-		{
-			// then the BST (or subtree provided) is empty. Return NULL.
-			return nullptr;
-		}
-		// Else, if this node's leftNode is valid,
-		else if (t->leftNode != nullptr)
-		{
-			// then recursively call FindMin on that leftNode.
-			return FindMin(t->leftNode);
-		}
-		// Else, this node is valid but has no leftNode.
-		else
-		{
-			// This node's value is the minimum. Return this node.
-			return t;
-		}
+		return pool.Stats();
 	}
 
 	/// <summary>
-	/// Finds the node with the maximum value at or below node t.
+	/// Walks the whole BST and returns its shape: height, node count, total quantity,
+	/// average search depth and how lopsided it is. Takes O(n) time, so it is meant to
+	/// be called now and then, not on every operation.
 	/// </summary>
-	/// <param name="t"> The node to start the search for the maximum value.</param>
 	/// <returns></returns>
-	Node* FindMax(Node*& t)
+	TreeStats Stats() const
 	{
-		// If this node it nullptr,
-		if (t == nullptr)
+		TreeStats stats;
+		stats.height = HeightOf(root);
+		stats.totalQuantity = SizeOf(root);
+
+		// Walk every node with its depth (the root is at depth 1), using an explicit
+		// stack so deep trees cannot overflow the call stack.
+		double depthSum = 0;
+		double weightedDepthSum = 0;
+		std::size_t oneChild = 0;
+		long long rightTaller = 0;
+		std::vector<std::pair<const NodeType*, int>> stack;
+		if (root != nullptr)
 		{
-			// then the BST (or subtree provided) is empty. Return NULL.
-			return NULL;
+			stack.push_back({ root, 1 });
 		}
-		// Else, if this node's rightNode is valid,
-		else if (t->rightNode != nullptr)
+		while (!stack.empty())
 		{
-			// then recursively call FindMax on that rightNode.
-			return FindMax(t->rightNode);
+			const NodeType* t = stack.back().first;
+			int depth = stack.back().second;
+			stack.pop_back();
+
+			stats.nodeCount++;
+			depthSum += depth;
+			weightedDepthSum += static_cast<double>(depth) * t->quantity;
+
+			// Compare the heights of the two subtrees.
+			int balance = HeightOf(t->rightNode) - HeightOf(t->leftNode);
+			stats.maxBalanceFactor = std::max(stats.maxBalanceFactor, std::abs(balance));
+			rightTaller += (balance > 0) - (balance < 0);
+			if ((t->leftNode == nullptr) != (t->rightNode == nullptr))
+			{
+				oneChild++;
+			}
+
+			if (t->leftNode != nullptr)
+			{
+				stack.push_back({ t->leftNode, depth + 1 });
+			}
+			if (t->rightNode != nullptr)
+			{
+				stack.push_back({ t->rightNode, depth + 1 });
+			}
 		}
-		// Else, this node is valid but has no rightNode.
-		else
+
+		if (stats.nodeCount != 0)
 		{
-			// This node's value is the maximum. Return this node.
-			return t;
+			// The best possible height is the number of bits needed to count the nodes.
+			for (std::size_t n = stats.nodeCount; n != 0; n >>= 1)
+			{
+				stats.minimumHeight++;
+			}
+			stats.averageDepth = depthSum / stats.nodeCount;
+			stats.weightedAverageDepth = weightedDepthSum / static_cast<double>(stats.totalQuantity);
+			stats.oneChildShare = static_cast<double>(oneChild) / stats.nodeCount;
+			stats.skew = static_cast<double>(rightTaller) / stats.nodeCount;
 		}
+		return stats;
 	}
 
+#ifdef BST_ENABLE_STATS
 	/// <summary>
-	/// Traverses the BST in an INORDER path and returns the resulting string. (Private)
+	/// Returns the comparison, depth and latency histograms of every Insert, Delete and
+	/// lookup so far. Only exists when BST_ENABLE_STATS is defined.
 	/// </summary>
-	/// <param name="str"> The string being manipulated.</param>
-	/// <param name="t">The node acting as root of the subtree being traversed.</param>
 	/// <returns></returns>
-	std::string Traverse(std::string &str, Node* &t, int &depth)
+	const TreeCounters& Counters() const
 	{
-		// If the node provided is not valid,
-		if (t == nullptr)
-		{
-			// then the BST (or subtree provided) is empty. Return str without manipulation.
-			return str;
-		}
-		// Else, this node is valid.
+		return counters;
+	}
 
-		/* This Traverse() method follows the INORDER path, meaning left, node, right.
-		* The left-most node will be processed, then its parent node, then the process
-		* starts over with the node to the right of that parent node. */
-		
-		// LEFT
-		// If this node has a leftNode,
-		if (t->leftNode != nullptr)
-		{
-			// then recursively call the private Traverse() on that leftNode.
-			Traverse(str, t->leftNode, depth);
-		}
+	/// <summary>
+	/// Empties the histograms returned by Counters().
+	/// </summary>
+	void ResetCounters()
+	{
+		counters.Reset();
+	}
+#endif
 
-		// NODE
-		/* When code reaches here, either the current node is a leaf,
-		* or all of its left-side decendents have been processed already. */
+	/// <summary>
+	/// Returns the height of the BST (0 when empty, 1 for a single node).
+	/// </summary>
+	/// <returns></returns>
+	int Height() const
+	{
+		// The root always knows the height of the whole tree.
+		return HeightOf(root);
+	}
 
-		// Add this node's value and quantity to the string.
-		str += "Value: " + std::to_string(t->value) + " - Quantity: " + std::to_string(t->quantity);
-		// Add a newline character and 3 spaces, and then
-		// a number of additional spaces equal to depth.
-		str += "\n   ";
-		for (int i = 0; i < depth; i++)
+	/// <summary>
+	/// Returns the number of nodes from the root down to val (1 when val is at the root),
+	/// or 0 if val is not stored. Shows how close Splay and Frequency keep a hot value to
+	/// the top.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	int Depth(const Key& val) const
+	{
+		int depth = 1;
+		for (const NodeType* t = root; t != nullptr; depth++)
 		{
-			str += " ";
+			if (compare(val, t->value))
+			{
+				t = t->leftNode;
+			}
+			else if (compare(t->value, val))
+			{
+				t = t->rightNode;
+			}
+			else
+			{
+				return depth;
+			}
 		}
-		// Increment depth.
-		depth++;
+		return 0;
+	}
 
-		// RIGHT
-		// If this node has a rightNode,
-		if (t->rightNode != nullptr)
-		{
-			// then recursively call the private Traverse() on that rightNode.
-			Traverse(str, t->rightNode, depth);
-		}
+	/// <summary>
+	/// Insert the value provided into the BST count times. Costs one walk down the BST
+	/// no matter how large count is. Inserting 0 times does nothing.
+	/// </summary>
+	/// <param name="val"> The value to be stored in the BST.</param>
+	/// <param name="count"> The number of copies to add.</param>
+	void Insert(const Key& val, Quantity count = 1)
+	{
+		// Calls the private Insert() starting at the root.
+		Insert(val, count, root);
+	}
 
-		// Return the manipulated string.
-		return str;
+	/// <summary>
+	/// Insert the value provided into the BST count times, moving it into a new node if
+	/// needed.
+	/// </summary>
+	/// <param name="val"> The value to be stored in the BST.</param>
+	/// <param name="count"> The number of copies to add.</param>
+	void Insert(Key&& val, Quantity count = 1)
+	{
+		// Calls the private Insert() starting at the root.
+		Insert(std::move(val), count, root);
 	}
 
 	/// <summary>
-	/// Clears the subtree that has t as the root by deleting it and all of its
-	/// descendants. t is cleared last. Follows left-right-node traversal.
-	/// False is failed to clear, true is clear successful.
+	/// Builds a value from args directly inside a new node and inserts it into the BST.
+	/// If the value is already stored, its quantity goes up and the new node is freed.
 	/// </summary>
-	/// <param name="t"> The root of the subtree being cleared.</param>
-	bool Clear(Node* &t)
+	/// <param name="args"> The arguments for the value's constructor.</param>
+	template <typename... Args>
+	void Emplace(Args&&... args)
 	{
-		// Double check we are not on an invalid node.
-		if (t == nullptr)
+		// Build the node first, since we need the value to know where it goes.
+		NodeType* node = pool.Allocate(std::piecewise_construct, std::forward<Args>(args)...);
+		// If the value was already stored, the new node is not needed.
+		if (!Link(node, root))
 		{
-			// If so, return false.
-			return false;
+			pool.Free(node);
 		}
+	}
 
-		// LEFT
-		// This node is valid. If it has a left child,
-		if (t->leftNode != nullptr)
+	/// <summary>
+	/// Adds every value in [first, last) to the BST in one pass and leaves the BST
+	/// perfectly balanced. Duplicates are collapsed into quantities. If the BST already
+	/// holds values, the new ones are merged in and the existing nodes are reused.
+	/// O(n + m log m) for m new values and n existing nodes, or O(n + m) if the new
+	/// values are already sorted, which is checked for first.
+	/// </summary>
+	/// <param name="first"> The first value to add.</param>
+	/// <param name="last"> One past the last value to add.</param>
+	template <typename InputIt>
+	void BuildFrom(InputIt first, InputIt last)
+	{
+		using Category = typename std::iterator_traits<InputIt>::iterator_category;
+		// If the values can be read twice and are already in order, use them directly.
+		if constexpr (std::is_base_of<std::forward_iterator_tag, Category>::value)
+		{
+			if (std::is_sorted(first, last, compare))
+			{
+				BuildFromSorted(first, last, ValueOf(), OneOf());
+				return;
+			}
+		}
+
+		// Else, take a copy of the values and sort it. The copies are moved into the nodes.
+		std::vector<Key> sorted(first, last);
+		std::sort(sorted.begin(), sorted.end(), compare);
+		BuildFromSorted(std::make_move_iterator(sorted.begin()), std::make_move_iterator(sorted.end()), ValueOf(), OneOf());
+	}
+
+	/// <summary>
+	/// Adds every value in range to the BST in one pass. See BuildFrom(first, last).
+	/// </summary>
+	/// <param name="range"> Any container or range of values.</param>
+	template <typename Range>
+	void BuildFrom(const Range& range)
+	{
+		BuildFrom(std::begin(range), std::end(range));
+	}
+
+	/// <summary>
+	/// Adds every (value, quantity) pair in [first, last) to the BST in one pass, the
+	/// same way BuildFrom() does. Each element must have the value in .first and the
+	/// quantity in .second, like the elements of a std::map. Pairs with equal values
+	/// are added together. O(n + m) if the pairs are already sorted by value.
+	/// </summary>
+	/// <param name="first"> The first pair to add.</param>
+	/// <param name="last"> One past the last pair to add.</param>
+	template <typename InputIt>
+	void BuildFromCounts(InputIt first, InputIt last)
+	{
+		auto valueOf = [](const auto& pair) -> const Key& { return pair.first; };
+		auto quantityOf = [](const auto& pair) { return (pair.second > 0) ? static_cast<Quantity>(pair.second) : Quantity(0); };
+
+		using Category = typename std::iterator_traits<InputIt>::iterator_category;
+		// If the pairs can be read twice and are already in order, use them directly.
+		if constexpr (std::is_base_of<std::forward_iterator_tag, Category>::value)
+		{
+			if (std::is_sorted(first, last, [this](const auto& a, const auto& b) { return compare(a.first, b.first); }))
+			{
+				BuildFromSorted(first, last, valueOf, quantityOf);
+				return;
+			}
+		}
+
+		// Else, take a copy of the pairs and sort it by value.
+		std::vector<std::pair<Key, Quantity>> sorted;
+		for (; first != last; ++first)
+		{
+			sorted.emplace_back((*first).first, quantityOf(*first));
+		}
+		std::sort(sorted.begin(), sorted.end(), [this](const std::pair<Key, Quantity>& a, const std::pair<Key, Quantity>& b)
+			{
+				return compare(a.first, b.first);
+			});
+		BuildFromSorted(sorted.begin(), sorted.end(), valueOf, quantityOf);
+	}
+
+	/// <summary>
+	/// Inserts every value in [first, last) in a single pass down the BST, instead of
+	/// one walk from the root per value. The batch is sorted, copies of the same value
+	/// are counted up front so each value's node is touched once, and every node that
+	/// leads to at least one value of the batch is visited exactly once.
+	/// Returns one result per value, in the order given: true if that value created a
+	/// new node (it was not stored before, and is its first copy in the batch).
+	/// </summary>
+	/// <param name="first"> The first value to insert.</param>
+	/// <param name="last"> One past the last value to insert.</param>
+	/// <returns></returns>
+	template <typename InputIt>
+	std::vector<bool> InsertBatch(InputIt first, InputIt last)
+	{
+		std::vector<Key> batch(first, last);
+		return ApplyBatch(batch, true);
+	}
+
+	/// <summary>
+	/// Inserts every value in range in a single pass. See InsertBatch(first, last).
+	/// </summary>
+	/// <param name="range"> Any container or range of values.</param>
+	/// <returns></returns>
+	template <typename Range>
+	std::vector<bool> InsertBatch(const Range& range)
+	{
+		return InsertBatch(std::begin(range), std::end(range));
+	}
+
+	/// <summary>
+	/// Delete the requested val from the BST.
+	/// Returns true if deletion was successful, false is nothing was removed.
+	/// </summary>
+	/// <param name="val"> The value to be deleted from the BST.</param>
+	bool Delete(const Key& val)
+	{
+		// Calls the private Delete() starting at the root.
+		return Delete(val, 1, root) == 1;
+	}
+
+	/// <summary>
+	/// Delete up to count copies of val from the BST in one walk down the BST. If count
+	/// is at least the stored quantity, the node is removed entirely.
+	/// Returns the number of copies actually removed (0 if val is not stored).
+	/// </summary>
+	/// <param name="val"> The value to be deleted from the BST.</param>
+	/// <param name="count"> The most copies to remove.</param>
+	/// <returns></returns>
+	Quantity Delete(const Key& val, Quantity count)
+	{
+		return Delete(val, count, root);
+	}
+
+	/// <summary>
+	/// Delete every copy of val from the BST.
+	/// Returns the number of copies removed (0 if val is not stored).
+	/// </summary>
+	/// <param name="val"> The value to be deleted from the BST.</param>
+	/// <returns></returns>
+	Quantity EraseAll(const Key& val)
+	{
+		return Delete(val, std::numeric_limits<Quantity>::max(), root);
+	}
+
+	/// <summary>
+	/// Deletes one copy of every value in [first, last) in a single pass down the BST,
+	/// the same way InsertBatch() inserts them. A value listed k times removes k copies.
+	/// Returns one result per value, in the order given, just like Delete(): true if a
+	/// copy was removed, false if there was nothing left to remove.
+	/// </summary>
+	/// <param name="first"> The first value to delete.</param>
+	/// <param name="last"> One past the last value to delete.</param>
+	/// <returns></returns>
+	template <typename InputIt>
+	std::vector<bool> DeleteBatch(InputIt first, InputIt last)
+	{
+		std::vector<Key> batch(first, last);
+		return ApplyBatch(batch, false);
+	}
+
+	/// <summary>
+	/// Deletes every value in range in a single pass. See DeleteBatch(first, last).
+	/// </summary>
+	/// <param name="range"> Any container or range of values.</param>
+	/// <returns></returns>
+	template <typename Range>
+	std::vector<bool> DeleteBatch(const Range& range)
+	{
+		return DeleteBatch(std::begin(range), std::end(range));
+	}
+
+	/// <summary>
+	/// Returns the maximum value stored in the BST in O(1), since the node holding it
+	/// is kept track of. Throws std::out_of_range if the BST is empty.
+	/// </summary>
+	/// <returns></returns>
+	const Key& Maximum() const
+	{
+		if (maxNode == nullptr)
+		{
+			throw std::out_of_range("Maximum() called on an empty BST");
+		}
+		return maxNode->value;
+	}
+
+	/// <summary>
+	/// Returns the minimum value stored in the BST in O(1), since the node holding it
+	/// is kept track of. Throws std::out_of_range if the BST is empty.
+	/// </summary>
+	/// <returns></returns>
+	const Key& Minimum() const
+	{
+		if (minNode == nullptr)
+		{
+			throw std::out_of_range("Minimum() called on an empty BST");
+		}
+		return minNode->value;
+	}
+
+	/// <summary>
+	/// Returns a copy of the maximum value, or nothing if the BST is empty.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> TryMaximum() const
+	{
+		return (maxNode == nullptr) ? std::nullopt : std::optional<Key>(maxNode->value);
+	}
+
+	/// <summary>
+	/// Returns a copy of the minimum value, or nothing if the BST is empty.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> TryMinimum() const
+	{
+		return (minNode == nullptr) ? std::nullopt : std::optional<Key>(minNode->value);
+	}
+
+	/// <summary>
+	/// Removes one copy of the minimum value and returns it, so the BST can be used as a
+	/// priority queue. The walk down to it follows leftNodes without comparing a single
+	/// value. Throws std::out_of_range if the BST is empty.
+	/// </summary>
+	/// <returns></returns>
+	Key PopMin()
+	{
+		if (minNode == nullptr)
+		{
+			throw std::out_of_range("PopMin() called on an empty BST");
+		}
+		return PopEnd(true);
+	}
+
+	/// <summary>
+	/// Removes one copy of the maximum value and returns it. Throws std::out_of_range
+	/// if the BST is empty.
+	/// </summary>
+	/// <returns></returns>
+	Key PopMax()
+	{
+		if (maxNode == nullptr)
+		{
+			throw std::out_of_range("PopMax() called on an empty BST");
+		}
+		return PopEnd(false);
+	}
+
+	/// <summary>
+	/// Removes one copy of the minimum value and returns it, or returns nothing if the
+	/// BST is empty.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> TryPopMin()
+	{
+		return (minNode == nullptr) ? std::nullopt : std::optional<Key>(PopEnd(true));
+	}
+
+	/// <summary>
+	/// Removes one copy of the maximum value and returns it, or returns nothing if the
+	/// BST is empty.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> TryPopMax()
+	{
+		return (maxNode == nullptr) ? std::nullopt : std::optional<Key>(PopEnd(false));
+	}
+
+	/// <summary>
+	/// Returns the total number of values stored, counting every duplicate. O(1), since
+	/// the root keeps the total for the whole BST.
+	/// </summary>
+	/// <returns></returns>
+	Quantity Size() const
+	{
+		return SizeOf(root);
+	}
+
+	/// <summary>
+	/// Returns true if val is stored in the BST.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	bool Contains(const Key& val) const
+	{
+		return FindNode(val) != nullptr;
+	}
+
+	/// <summary>
+	/// Returns the number of times val is stored (its node's quantity), or 0.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	Quantity Count(const Key& val) const
+	{
+		const NodeType* node = FindNode(val);
+		return (node != nullptr) ? node->quantity : 0;
+	}
+
+	/// <summary>
+	/// Returns an iterator to val, or end() if val is not stored.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	ConstIterator Find(const Key& val) const
+	{
+		return ConstIterator(this, FindNode(val));
+	}
+
+	/// <summary>
+	/// Returns an iterator to the smallest value that is not less than val,
+	/// or end() if every stored value is less than val.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	ConstIterator LowerBound(const Key& val) const
+	{
+		const NodeType* t = root;
+		const NodeType* best = nullptr;
+		while (t != nullptr)
+		{
+			// If this value is less than val, the answer must be to the right.
+			if (compare(t->value, val))
+			{
+				t = t->rightNode;
+			}
+			// Else, this value qualifies, but there may be a smaller one to the left.
+			else
+			{
+				best = t;
+				t = t->leftNode;
+			}
+		}
+		return ConstIterator(this, best);
+	}
+
+	/// <summary>
+	/// Returns an iterator to the smallest value that is greater than val,
+	/// or end() if no stored value is greater than val.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	ConstIterator UpperBound(const Key& val) const
+	{
+		const NodeType* t = root;
+		const NodeType* best = nullptr;
+		while (t != nullptr)
+		{
+			// If this value is greater than val, it qualifies, but there may be a
+			// smaller one to the left.
+			if (compare(val, t->value))
+			{
+				best = t;
+				t = t->leftNode;
+			}
+			// Else, the answer must be to the right.
+			else
+			{
+				t = t->rightNode;
+			}
+		}
+		return ConstIterator(this, best);
+	}
+
+	/// <summary>
+	/// Returns the number of stored values (counting duplicates) that are less than val.
+	/// </summary>
+	/// <param name="val"> The value to rank.</param>
+	/// <returns></returns>
+	Quantity Rank(const Key& val) const
+	{
+		return CountBelow(val, false);
+	}
+
+	/// <summary>
+	/// Returns the value at position k (starting from 0) if every stored value were
+	/// written out in sorted order, duplicates included. Throws std::out_of_range if
+	/// k is not less than Size().
+	/// </summary>
+	/// <param name="k"> The position of the value.</param>
+	/// <returns></returns>
+	const Key& Select(Quantity k) const
+	{
+		if (k >= Size())
+		{
+			throw std::out_of_range("BinarySearchTree::Select position is past the end of the tree.");
+		}
+
+		const NodeType* t = root;
+		while (true)
+		{
+			Quantity leftSize = SizeOf(t->leftNode);
+			// If position k is in the left subtree,
+			if (k < leftSize)
+			{
+				// then look for it there.
+				t = t->leftNode;
+			}
+			// Else, if position k is one of this node's copies,
+			else if (k < leftSize + t->quantity)
+			{
+				// then this is the value.
+				return t->value;
+			}
+			// Else, it is in the right subtree, after everything counted so far.
+			else
+			{
+				k -= leftSize + t->quantity;
+				t = t->rightNode;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Returns the number of stored values (counting duplicates) in the range
+	/// [low, high], both ends included.
+	/// </summary>
+	/// <param name="low"> The smallest value in the range.</param>
+	/// <param name="high"> The largest value in the range.</param>
+	/// <returns></returns>
+	Quantity CountInRange(const Key& low, const Key& high) const
+	{
+		// An empty range holds nothing.
+		if (compare(high, low))
+		{
+			return 0;
+		}
+		// Everything up to and including high, minus everything below low.
+		return CountBelow(high, true) - CountBelow(low, false);
+	}
+
+	/// <summary>
+	/// Returns the aggregate of every value in the BST (see Augment.h) in O(1), since
+	/// the root keeps it.
+	/// </summary>
+	/// <returns></returns>
+	AggregateType Aggregate() const
+	{
+		return AggregateOf(root);
+	}
+
+	/// <summary>
+	/// Returns the aggregate of every value in the range [low, high], both ends
+	/// included, combined in sorted order. Walks down to the node where the paths to
+	/// low and high part, then down each path, taking the stored aggregate of every
+	/// subtree that lies entirely inside the range. O(height), so O(log n) in AVL mode.
+	/// </summary>
+	/// <param name="low"> The smallest value in the range.</param>
+	/// <param name="high"> The largest value in the range.</param>
+	/// <returns></returns>
+	AggregateType AggregateInRange(const Key& low, const Key& high) const
+	{
+		// An empty range holds nothing.
+		if (compare(high, low))
+		{
+			return Augment::Identity();
+		}
+
+		// Find the highest node inside the range. Every other node in the range is below it.
+		const NodeType* top = root;
+		while (top != nullptr)
+		{
+			if (compare(top->value, low))
+			{
+				top = top->rightNode;
+			}
+			else if (compare(high, top->value))
+			{
+				top = top->leftNode;
+			}
+			else
+			{
+				break;
+			}
+		}
+		if (top == nullptr)
+		{
+			return Augment::Identity();
+		}
+
+		// Down the left: a node not below low is in the range along with its whole right
+		// subtree, and comes after whatever is found further down.
+		AggregateType below = Augment::Identity();
+		for (const NodeType* t = top->leftNode; t != nullptr;)
+		{
+			if (compare(t->value, low))
+			{
+				t = t->rightNode;
+			}
+			else
+			{
+				below = Augment::Combine(Augment::Combine(Augment::Of(t->value, t->quantity), AggregateOf(t->rightNode)), below);
+				t = t->leftNode;
+			}
+		}
+
+		// Down the right: the mirror image, with each part coming before what is found further down.
+		AggregateType above = Augment::Identity();
+		for (const NodeType* t = top->rightNode; t != nullptr;)
+		{
+			if (compare(high, t->value))
+			{
+				t = t->leftNode;
+			}
+			else
+			{
+				above = Augment::Combine(above, Augment::Combine(AggregateOf(t->leftNode), Augment::Of(t->value, t->quantity)));
+				t = t->rightNode;
+			}
+		}
+		return Augment::Combine(Augment::Combine(below, Augment::Of(top->value, top->quantity)), above);
+	}
+
+	/// <summary>
+	/// Returns an iterator to the smallest value, or end() if the BST is empty. O(1).
+	/// </summary>
+	/// <returns></returns>
+	ConstIterator begin() const
+	{
+		return ConstIterator(this, minNode);
+	}
+
+	/// <summary>
+	/// Returns the iterator one past the largest value.
+	/// </summary>
+	/// <returns></returns>
+	ConstIterator end() const
+	{
+		return ConstIterator(this, nullptr);
+	}
+
+	ConstIterator cbegin() const
+	{
+		return begin();
+	}
+
+	ConstIterator cend() const
+	{
+		return end();
+	}
+
+	/// <summary>
+	/// Returns a reverse iterator to the largest value, for walking from largest to smallest.
+	/// </summary>
+	/// <returns></returns>
+	const_reverse_iterator rbegin() const
+	{
+		return const_reverse_iterator(end());
+	}
+
+	/// <summary>
+	/// Returns the reverse iterator one past the smallest value.
+	/// </summary>
+	/// <returns></returns>
+	const_reverse_iterator rend() const
+	{
+		return const_reverse_iterator(begin());
+	}
+
+	const_reverse_iterator crbegin() const
+	{
+		return rbegin();
+	}
+
+	const_reverse_iterator crend() const
+	{
+		return rend();
+	}
+
+	/// <summary>
+	/// Visits every value in the range [low, high] in sorted order, calling
+	/// visit(value, quantity) once per node. Only the nodes in the range and the
+	/// path to them are touched.
+	/// </summary>
+	/// <param name="low"> The smallest value in the range.</param>
+	/// <param name="high"> The largest value in the range.</param>
+	/// <param name="visit"> Called with each value and its quantity.</param>
+	template <typename Visitor>
+	void ForEachInRange(const Key& low, const Key& high, Visitor&& visit) const
+	{
+		// Like VisitInOrder, but never walks into a subtree that is out of range.
+		std::vector<const NodeType*> stack;
+		const NodeType* t = root;
+		while (t != nullptr || !stack.empty())
+		{
+			// LEFT
+			// Push the nodes down the left side, skipping any below low.
+			while (t != nullptr)
+			{
+				// Everything left of a value below low is below low too.
+				if (compare(t->value, low))
+				{
+					t = t->rightNode;
+				}
+				else
+				{
+					stack.push_back(t);
+					t = t->leftNode;
+				}
+			}
+			if (stack.empty())
+			{
+				break;
+			}
+
+			// NODE
+			t = stack.back();
+			stack.pop_back();
+			// Once a value is past high, so is everything after it.
+			if (compare(high, t->value))
+			{
+				break;
+			}
+			visit(static_cast<const Key&>(t->value), t->quantity);
+
+			// RIGHT
+			t = t->rightNode;
+		}
+	}
+
+	/// <summary>
+	/// Visits every value in the BST in an INORDER path (smallest to largest), calling
+	/// visit(value, quantity) once per node. Nothing is allocated per node.
+	/// </summary>
+	/// <param name="visit"> Called with each value and its quantity.</param>
+	template <typename Visitor>
+	void ForEach(Visitor&& visit) const
+	{
+		VisitInOrder(static_cast<const NodeType*>(root), [&visit](const NodeType* node)
+			{
+				visit(static_cast<const Key&>(node->value), node->quantity);
+			});
+	}
+
+	/// <summary>
+	/// Traverses the BST in an INORDER path and writes one "Value: X - Quantity: Y"
+	/// line per node to out. Numbers are formatted straight into a small buffer, so
+	/// nothing is allocated per node.
+	/// </summary>
+	/// <param name="out"> The stream to write to.</param>
+	void Traverse(std::ostream& out) const
+	{
+		VisitInOrder(static_cast<const NodeType*>(root), [&out](const NodeType* node)
+			{
+				// Numbers are formatted without going through the stream's locale.
+				if constexpr (std::is_arithmetic<Key>::value)
+				{
+					char line[MaxLineLength];
+					std::size_t length = FormatLine(line, node->value, node->quantity);
+					out.write(line, length);
+				}
+				// Anything else uses its << operator.
+				else
+				{
+					out << "Value: " << node->value << " - Quantity: " << node->quantity << '\n';
+				}
+			});
+	}
+
+	/// <summary>
+	/// Traverses the BST in an INORDER path and writes one "Value: X - Quantity: Y"
+	/// line per node into buffer, stopping once buffer is full. Returns the number of
+	/// characters the whole traversal needs, so a return value larger than size means
+	/// the output was cut short. The buffer is not null terminated.
+	/// </summary>
+	/// <param name="buffer"> The caller's buffer to write into.</param>
+	/// <param name="size"> The number of characters buffer can hold.</param>
+	/// <returns></returns>
+	std::size_t Traverse(char* buffer, std::size_t size) const
+	{
+		std::size_t needed = 0;
+		VisitInOrder(static_cast<const NodeType*>(root), [&](const NodeType* node)
+			{
+				std::size_t length;
+				// Numbers are formatted straight into a small buffer.
+				if constexpr (std::is_arithmetic<Key>::value)
+				{
+					char line[MaxLineLength];
+					length = FormatLine(line, node->value, node->quantity);
+					CopyInto(buffer, size, needed, line, length);
+				}
+				// Anything else has to be turned into a string first.
+				else
+				{
+					std::string line = "Value: " + ToString(node->value) + " - Quantity: " + std::to_string(node->quantity) + "\n";
+					length = line.size();
+					CopyInto(buffer, size, needed, line.data(), length);
+				}
+				needed += length;
+			});
+		return needed;
+	}
+
+	/// <summary>
+	/// Traverses the BST in an INORDER path and returns the resulting string.
+	/// Each line is indented one space further than the last, so this is only meant
+	/// for printing small trees. Use ForEach() or the streaming Traverse() overloads
+	/// for anything large.
+	/// </summary>
+	/// <returns></returns>
+	std::string Traverse()
+	{
+		// Create the string to be manipulated and an int for depth.
+		std::string str = "\n   ";
+		int depth = 1;
+		// Traverse the BST with the private Traverse(), starting at the root,
+		// and return the result.
+		return Traverse(str, root, depth);
+	}
+
+	/// <summary>
+	/// Clears the BST by deleting all nodes.
+	/// False is failed to clear, true is clear successful.
+	/// </summary>
+	bool Clear()
+	{
+		minNode = nullptr;
+		maxNode = nullptr;
+		// If the pool carves nodes out of slabs, it can forget them all at once
+		// without visiting a single node. That skips the destructors of the values
+		// and their aggregates, so it is only done when neither needs destroying.
+		if (root != nullptr && pool.CanReset() && NodesAreTrivial())
+		{
+			pool.Reset();
+			root = nullptr;
+			return true;
+		}
+		// Else, call the private Clear() starting at the root to free each node.
+		return Clear(root);
+	}
+
+	/// <summary>
+	/// Visits every value in the BST like ForEach(), but on several threads. The values
+	/// of one chunk are visited in order on one thread, while different chunks are
+	/// visited at the same time, so visit must be safe to call from several threads.
+	/// If visit throws, the remaining chunks are skipped and the first exception is
+	/// rethrown once every thread has stopped.
+	/// </summary>
+	/// <param name="visit"> Called with each value and its quantity.</param>
+	/// <param name="threads"> The number of threads to use. 0 uses one per core.</param>
+	template <typename Visitor>
+	void ParallelForEach(Visitor&& visit, unsigned threads = 0) const
+	{
+		std::vector<Chunk> chunks = SplitInOrder();
+		RunChunks(chunks.size(), threads, [&](std::size_t i)
+			{
+				VisitChunk(chunks[i], [&visit](const NodeType* node)
+					{
+						visit(static_cast<const Key&>(node->value), node->quantity);
+					});
+			});
+	}
+
+	/// <summary>
+	/// Reduces every value in the BST on several threads. Each chunk starts from
+	/// identity and folds in map(value, quantity) for each of its values in order, then
+	/// the partial results are combined from the smallest chunk to the largest. Since
+	/// the chunks do not depend on the number of threads, the result is the same for
+	/// any thread count, even when combine is not exactly associative (like adding
+	/// doubles). Minimum() and Maximum() are already O(1) (the end nodes are cached);
+	/// use this for the minimum or maximum of some mapped value instead.
+	/// </summary>
+	/// <param name="identity"> The starting value of every chunk, like 0 for a sum.</param>
+	/// <param name="map"> Turns a value and its quantity into a T.</param>
+	/// <param name="combine"> Combines two T into one.</param>
+	/// <param name="threads"> The number of threads to use. 0 uses one per core.</param>
+	/// <returns></returns>
+	template <typename T, typename Map, typename Combine>
+	T ParallelReduce(T identity, Map map, Combine combine, unsigned threads = 0) const
+	{
+		// Every chunk gets its own partial result. They are wrapped so that a
+		// std::vector<bool> never packs two of them into one byte.
+		struct Partial
+		{
+			T value;
+		};
+		std::vector<Chunk> chunks = SplitInOrder();
+		std::vector<Partial> partials(chunks.size(), Partial{ identity });
+		RunChunks(chunks.size(), threads, [&](std::size_t i)
+			{
+				T& partial = partials[i].value;
+				VisitChunk(chunks[i], [&](const NodeType* node)
+					{
+						partial = combine(std::move(partial), map(static_cast<const Key&>(node->value), node->quantity));
+					});
+			});
+
+		// Combine the partial results in order.
+		T result = std::move(identity);
+		for (Partial& partial : partials)
+		{
+			result = combine(std::move(result), std::move(partial.value));
+		}
+		return result;
+	}
+
+	/// <summary>
+	/// Returns the sum of value * quantity over the whole BST, computed on several
+	/// threads. Sum is the type the sum is done in, Key by default.
+	/// </summary>
+	/// <param name="threads"> The number of threads to use. 0 uses one per core.</param>
+	/// <returns></returns>
+	template <typename Sum = Key>
+	Sum ParallelSum(unsigned threads = 0) const
+	{
+		return ParallelReduce(Sum(),
+			[](const Key& val, Quantity quant) { return static_cast<Sum>(val) * static_cast<Sum>(quant); },
+			[](Sum left, Sum right) { return left + right; },
+			threads);
+	}
+
+	/// <summary>
+	/// Counts the values of the BST into buckets on several threads, adding each
+	/// value's quantity to its bucket. With k boundaries there are k + 1 buckets:
+	/// bucket 0 holds the values below boundaries[0], bucket i holds the values from
+	/// boundaries[i - 1] up to (but not including) boundaries[i], and bucket k holds
+	/// the rest. The boundaries must be sorted.
+	/// </summary>
+	/// <param name="boundaries"> The sorted values that separate the buckets.</param>
+	/// <param name="threads"> The number of threads to use. 0 uses one per core.</param>
+	/// <returns></returns>
+	std::vector<Quantity> ParallelHistogram(const std::vector<Key>& boundaries, unsigned threads = 0) const
+	{
+		std::vector<Chunk> chunks = SplitInOrder();
+		std::vector<std::vector<Quantity>> partials(chunks.size());
+		RunChunks(chunks.size(), threads, [&](std::size_t i)
+			{
+				std::vector<Quantity>& counts = partials[i];
+				counts.assign(boundaries.size() + 1, 0);
+				// The values of a chunk come in order, so the bucket only ever moves
+				// forward. Only the first value of the chunk needs a binary search.
+				bool first = true;
+				std::size_t bucket = 0;
+				VisitChunk(chunks[i], [&](const NodeType* node)
+					{
+						if (first)
+						{
+							bucket = std::upper_bound(boundaries.begin(), boundaries.end(), node->value, compare) - boundaries.begin();
+							first = false;
+						}
+						while (bucket < boundaries.size() && !compare(node->value, boundaries[bucket]))
+						{
+							bucket++;
+						}
+						counts[bucket] += node->quantity;
+					});
+			});
+
+		// Add up the partial histograms.
+		std::vector<Quantity> histogram(boundaries.size() + 1, 0);
+		for (const std::vector<Quantity>& counts : partials)
+		{
+			for (std::size_t i = 0; i < counts.size(); i++)
+			{
+				histogram[i] += counts[i];
+			}
+		}
+		return histogram;
+	}
+
+	/// <summary>
+	/// Writes the same lines as Traverse(out), but formats them on several threads.
+	/// Chunks are formatted a few at a time and then written in order, so the output
+	/// is identical to Traverse(out) and only a few chunks are held in memory at once.
+	/// </summary>
+	/// <param name="out"> The stream to write to.</param>
+	/// <param name="threads"> The number of threads to use. 0 uses one per core.</param>
+	void ParallelTraverse(std::ostream& out, unsigned threads = 0) const
+	{
+		std::vector<Chunk> chunks = SplitInOrder();
+		const std::size_t window = static_cast<std::size_t>(ThreadCount(threads)) * 4;
+		std::vector<std::string> text(window);
+
+		for (std::size_t begin = 0; begin < chunks.size(); begin += window)
+		{
+			std::size_t count = std::min(window, chunks.size() - begin);
+			// Format this window of chunks at the same time,
+			RunChunks(count, threads, [&](std::size_t i)
+				{
+					std::string& lines = text[i];
+					lines.clear();
+					VisitChunk(chunks[begin + i], [&lines](const NodeType* node)
+						{
+							// Numbers are formatted straight into a small buffer.
+							if constexpr (std::is_arithmetic<Key>::value)
+							{
+								char line[MaxLineLength];
+								lines.append(line, FormatLine(line, node->value, node->quantity));
+							}
+							// Anything else has to be turned into a string first.
+							else
+							{
+								lines += "Value: " + ToString(node->value) + " - Quantity: " + std::to_string(node->quantity) + "\n";
+							}
+						});
+				});
+			// then write them out in order.
+			for (std::size_t i = 0; i < count; i++)
+			{
+				out.write(text[i].data(), text[i].size());
+			}
+		}
+	}
+
+	/// <summary>
+	/// Clears the BST like Clear(), but destroys and frees the nodes on several
+	/// threads. This only pays off when the values or their aggregates have destructors
+	/// to run (or the pool is in Heap mode); otherwise the O(1) Clear() is used.
+	/// False is failed to clear, true is clear successful.
+	/// </summary>
+	/// <param name="threads"> The number of threads to use. 0 uses one per core.</param>
+	bool ParallelClear(unsigned threads = 0)
+	{
+		// An empty tree has nothing to clear, and a tree that Clear() can forget in
+		// O(1) has nothing worth splitting up.
+		if (root == nullptr || (pool.CanReset() && NodesAreTrivial()))
+		{
+			return Clear();
+		}
+
+		/* No node belongs to two chunks. A whole subtree chunk owns every node below
+		* it, and a single node chunk owns only its own node, whose children belong to
+		* other chunks. So every thread can take its chunks apart without a lock. */
+		std::vector<Chunk> chunks = SplitInOrder();
+		std::vector<std::size_t> freed(chunks.size(), 0);
+		RunChunks(chunks.size(), threads, [&](std::size_t i)
+			{
+				if (chunks[i].wholeSubtree)
+				{
+					freed[i] = DestroySubtree(chunks[i].node, [this](NodeType* node) { pool.FreeConcurrently(node); });
+				}
+				else
+				{
+					pool.FreeConcurrently(chunks[i].node);
+					freed[i] = 1;
+				}
+			});
+
+		// Now that every thread is done, bring the pool up to date.
+		std::size_t total = 0;
+		for (std::size_t count : freed)
+		{
+			total += count;
+		}
+		pool.RecordFrees(total);
+		if (pool.CanReset())
+		{
+			pool.Reset();
+		}
+		root = nullptr;
+		minNode = nullptr;
+		maxNode = nullptr;
+		return true;
+	}
+
+	// Private members.
+private:
+	// A pointer to the root node for this BST. nullptr when tree is empty.
+	NodeType* root = nullptr;
+	// The nodes holding the smallest and largest values, kept up to date by every
+	// change so Minimum() and Maximum() never walk the BST. nullptr when empty.
+	NodeType* minNode = nullptr;
+	NodeType* maxNode = nullptr;
+	// The balancing policy of this BST.
+	BalanceMode mode;
+	// Decides whether one value is smaller than another.
+	Compare compare;
+	// Creates and recycles every node of this BST.
+	NodePool<NodeType, Allocator> pool;
+
+	/* The parent pointers walked through on the way down to a node, from the top
+	* down. Every node on it may need its height and size recomputed (and, in AVL
+	* mode, its balance restored) once something below it has changed. It is kept
+	* as a member so that its memory is reused by every Insert and Delete. */
+	std::vector<NodeType**> path;
+#ifdef BST_ENABLE_STATS
+	// The per-operation histograms. Lookups are const but still record into them.
+	mutable TreeCounters counters;
+#endif
+
+	/// <summary>
+	/// Returns the node holding val, or nullptr if val is not stored. (Private)
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	const NodeType* FindNode(const Key& val) const
+	{
+		SearchProbe probe;
+		const NodeType* t = root;
+		while (t != nullptr)
+		{
+			probe.Visit();
+			// Smaller values are to the left, larger values are to the right.
+			if (probe.Less(compare, val, t->value))
+			{
+				t = t->leftNode;
+			}
+			else if (probe.Less(compare, t->value, val))
+			{
+				t = t->rightNode;
+			}
+			// Else, this node holds val.
+			else
+			{
+				break;
+			}
+		}
+		Record(TreeOperation::Lookup, probe);
+		return t;
+	}
+
+	/// <summary>
+	/// Walks down from t looking for val. Returns the parent's pointer to the node
+	/// holding val, or to the empty spot where val would go. Every parent pointer
+	/// walked through on the way is left in path. (Private)
+	/// </summary>
+	/// <param name="val"> The value being searched for.</param>
+	/// <param name="t"> The root node of the subtree being searched.</param>
+	/// <param name="probe"> Counts the nodes and comparisons on the way.</param>
+	/// <returns></returns>
+	NodeType** Descend(const Key& val, NodeType* &t, SearchProbe& probe)
+	{
+		path.clear();
+		NodeType** slot = &t;
+		while (*slot != nullptr)
+		{
+			NodeType* node = *slot;
+			NodeType** next;
+			probe.Visit();
+			// If val is less than this node's value,
+			if (probe.Less(compare, val, node->value))
+			{
+				// then continue down this node's leftNode.
+				next = &node->leftNode;
+			}
+			// Else, val was not less than this node's value. If val is greater than,
+			else if (probe.Less(compare, node->value, val))
+			{
+				// then continue down this node's rightNode.
+				next = &node->rightNode;
+			}
+			// Else, val must actually be equal to this node's value.
+			else
+			{
+				return slot;
+			}
+
+			// Remember this step since we need to come back up it later.
+			path.push_back(slot);
+			slot = next;
+		}
+		return slot;
+	}
+
+	/// <summary>
+	/// Records a finished operation into the counters. Does nothing, and costs nothing,
+	/// unless BST_ENABLE_STATS is defined. (Private)
+	/// </summary>
+	/// <param name="operation"> The operation that finished.</param>
+	/// <param name="probe"> The probe it counted its work with.</param>
+	void Record(TreeOperation operation, const SearchProbe& probe) const
+	{
+#ifdef BST_ENABLE_STATS
+		counters.Record(operation, probe);
+#else
+		(void)operation;
+		(void)probe;
+#endif
+	}
+
+	/// <summary>
+	/// Brings every node on path up to date, from the bottom up: recomputes its height
+	/// and size, and in AVL mode restores its balance.
+	/// </summary>
+	void FixPath()
+	{
+		while (!path.empty())
+		{
+			NodeType* &t = *path.back();
+			path.pop_back();
+			if (mode == BalanceMode::AVL)
+			{
+				Rebalance(t);
+			}
+			else
+			{
+				Update(t);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Called once the node at slot has been inserted or had its quantity changed, with
+	/// the way down to it on path. In Splay mode that node is splayed up to the root. In
+	/// Frequency mode it is rotated up past every parent with a smaller quantity. Then
+	/// it and every node above it are brought up to date by FixPath().
+	/// </summary>
+	/// <param name="slot"> The parent's pointer to the node that changed.</param>
+	void FixPathTo(NodeType** slot)
+	{
+		if (mode == BalanceMode::Splay)
+		{
+			Update(*slot);
+			Splay(slot);
+			return;
+		}
+		if (mode == BalanceMode::Frequency)
+		{
+			Update(*slot);
+			while (!path.empty() && (*slot)->quantity > (*path.back())->quantity)
+			{
+				// The parent goes down to the side the node came up from.
+				NodeType** parentSlot = path.back();
+				path.pop_back();
+				if ((*parentSlot)->leftNode == *slot)
+				{
+					RotateRight(*parentSlot);
+				}
+				else
+				{
+					RotateLeft(*parentSlot);
+				}
+				slot = parentSlot;
+			}
+		}
+		path.push_back(slot);
+		FixPath();
+	}
+
+	/// <summary>
+	/// Moves the node at slot up to the root with splay rotations, taking the nodes above
+	/// it off path two at a time. When the node and its parent lean the same way, the
+	/// grandparent is rotated first (zig-zig), which roughly halves the depth of every
+	/// node on the way; else the node is rotated up twice (zig-zag). A node with no
+	/// grandparent left takes one last single rotation (zig).
+	/// The node at slot must be up to date. Every node it passes gets updated by the
+	/// rotations, from the bottom up, so the sizes above it may be out of date.
+	/// </summary>
+	/// <param name="slot"> The parent's pointer to the node to splay.</param>
+	void Splay(NodeType** slot)
+	{
+		while (!path.empty())
+		{
+			NodeType** parentSlot = path.back();
+			path.pop_back();
+			bool nodeLeft = ((*parentSlot)->leftNode == *slot);
+
+			// If the parent is the top of the path, one rotation finishes the job.
+			if (path.empty())
+			{
+				nodeLeft ? RotateRight(*parentSlot) : RotateLeft(*parentSlot);
+				return;
+			}
+
+			NodeType** grandSlot = path.back();
+			path.pop_back();
+			bool parentLeft = ((*grandSlot)->leftNode == *parentSlot);
+			// Zig-zig: the grandparent goes down first, then the parent.
+			if (nodeLeft == parentLeft)
+			{
+				parentLeft ? RotateRight(*grandSlot) : RotateLeft(*grandSlot);
+				parentLeft ? RotateRight(*grandSlot) : RotateLeft(*grandSlot);
+			}
+			// Zig-zag: the node goes up past its parent, then past its grandparent.
+			else
+			{
+				nodeLeft ? RotateRight(*parentSlot) : RotateLeft(*parentSlot);
+				parentLeft ? RotateRight(*grandSlot) : RotateLeft(*grandSlot);
+			}
+			// The node now sits where the grandparent was.
+			slot = grandSlot;
+		}
+	}
+
+	/// <summary>
+	/// Insert the value provided into the BST count times. (Private)
+	/// The value is only copied or moved into the BST if a new node is needed.
+	/// </summary>
+	/// <param name="val"> The value to be stored in the BST.</param>
+	/// <param name="count"> The number of copies to add.</param>
+	/// <param name="t"> The root node of the subtree we are inserting under.</param>
+	template <typename K>
+	void Insert(K&& val, Quantity count, NodeType* &t)
+	{
+		// Adding no copies changes nothing.
+		if (count == 0)
+		{
+			return;
+		}
+
+		// Walk down until we find val or an empty spot for it.
+		SearchProbe probe;
+		NodeType** slot = Descend(val, t, probe);
+
+		// If val is already stored,
+		if (*slot != nullptr)
+		{
+			// Increase the quantity in this node to account for it being inserted multiple times.
+			// No nodes were added, so the shape of the tree did not change, but the sizes did.
+			(*slot)->quantity += count;
+		}
+		// Else, we reached an empty spot, so create a new node here with the value.
+		else
+		{
+			*slot = pool.Allocate(std::forward<K>(val));
+			(*slot)->quantity = count;
+			(*slot)->subtreeSize = count;
+			NoteNewNode(*slot);
+		}
+		FixPathTo(slot);
+		Record(TreeOperation::Insert, probe);
+	}
+
+	/// <summary>
+	/// Links an already built node into the subtree t. If its value is already stored,
+	/// the stored quantity goes up instead and false is returned so the caller can free
+	/// the unused node. (Private)
+	/// </summary>
+	/// <param name="newNode"> The node to be linked into the BST.</param>
+	/// <param name="t"> The root node of the subtree we are inserting under.</param>
+	bool Link(NodeType* newNode, NodeType* &t)
+	{
+		// Walk down until we find the value or an empty spot for it.
+		SearchProbe probe;
+		NodeType** slot = Descend(newNode->value, t, probe);
+		bool linked = (*slot == nullptr);
+
+		// If the value is already stored, only its quantity changes.
+		if (!linked)
+		{
+			(*slot)->quantity++;
+		}
+		// Else, we reached an empty spot, so the new node goes here.
+		else
+		{
+			*slot = newNode;
+			NoteNewNode(newNode);
+		}
+		FixPathTo(slot);
+		Record(TreeOperation::Insert, probe);
+		return linked;
+	}
+
+	/// <summary>
+	/// Delete up to count copies of val from the BST, starting the search at subtree t.
+	/// Returns the number of copies removed, 0 if nothing was removed. (Private)
+	/// </summary>
+	/// <param name="val"> The value to be deleted from the BST.</param>
+	/// <param name="count"> The most copies to remove.</param>
+	/// <param name="t"> The root node of the subtree currently being used to find val.</param>
+	Quantity Delete(const Key& val, Quantity count, NodeType* &t)
+	{
+		// Removing no copies changes nothing.
+		if (count == 0)
+		{
+			return 0;
+		}
+
+		// Walk down from t until we find the node holding val.
+		SearchProbe probe;
+		NodeType** slot = Descend(val, t, probe);
+
+		// If we ran out of nodes,
+		if (*slot == nullptr)
+		{
+			// then we did not find the value. Do nothing.
+			path.clear();
+			Record(TreeOperation::Delete, probe);
+			return 0;
+		}
+
+		NodeType* node = *slot;
+		// If this value has more copies than are being removed,
+		if (node->quantity > count)
+		{
+			// then simply lower the quantity. The shape of the tree does not change
+			// (unless it is splayed).
+			node->quantity -= count;
+			FixPathTo(slot);
+			Record(TreeOperation::Delete, probe);
+			return count;
+		}
+
+		// Else, every copy is being removed, so the node itself goes.
+		// We can delete this node, but children make it tricky.
+		Quantity removed = node->quantity;
+		// If this node has 2 children,
+		if (node->leftNode != nullptr && node->rightNode != nullptr)
+		{
+			// then we must move the minimum node from the rightNode onto this node
+			// (by moving values only), and unlink that minimum node instead.
+			path.push_back(slot);
+			NodeType** minSlot = &node->rightNode;
+			while ((*minSlot)->leftNode != nullptr)
+			{
+				path.push_back(minSlot);
+				minSlot = &(*minSlot)->leftNode;
+			}
+
+			NodeType* tempNode = *minSlot;
+			node->value = std::move(tempNode->value);
+			node->quantity = tempNode->quantity;
+			// If that was the maximum, the maximum value now lives in this node.
+			if (tempNode == maxNode)
+			{
+				maxNode = node;
+			}
+
+			// The minimum node has no leftNode, so its rightNode simply takes its place.
+			*minSlot = tempNode->rightNode;
+			pool.Free(tempNode);
+		}
+		// Else, this node has no more than 1 child.
+		else
+		{
+			/* Because slot points at the parent's pointer to this node, changing *slot is
+			* essentially changing which node the parent's pointer is pointing to. This node
+			* would then still need to be given back to the pool it was created from. */
+
+			// Change *slot to equal the child of this node (will be nullptr is no children).
+			*slot = (node->leftNode != nullptr) ? node->leftNode : node->rightNode;
+			// If this node was the minimum or maximum, find the one that takes over.
+			ReplaceEnd(node, *slot);
+
+			// Finally, free the old node.
+			pool.Free(node);
+		}
+
+		// Bring every node above the change up to date. In Splay mode, the parent of the
+		// node that was unlinked is then splayed.
+		if (mode == BalanceMode::Splay && !path.empty())
+		{
+			for (std::size_t i = path.size(); i-- > 0;)
+			{
+				Update(*path[i]);
+			}
+			NodeType** parentSlot = path.back();
+			path.pop_back();
+			Splay(parentSlot);
+		}
+		else
+		{
+			FixPath();
+		}
+		Record(TreeOperation::Delete, probe);
+		return removed;
+	}
+
+	/// <summary>
+	/// Removes one copy of the minimum (smallest true) or maximum value and returns it.
+	/// The BST must not be empty. (Private)
+	/// </summary>
+	/// <param name="smallest"> True to remove the minimum, false for the maximum.</param>
+	/// <returns></returns>
+	Key PopEnd(bool smallest)
+	{
+		// Walk down the left (or right) edge of the BST to its end, remembering the way.
+		SearchProbe probe;
+		path.clear();
+		NodeType** slot = &root;
+		probe.Visit();
+		while ((smallest ? (*slot)->leftNode : (*slot)->rightNode) != nullptr)
+		{
+			path.push_back(slot);
+			slot = smallest ? &(*slot)->leftNode : &(*slot)->rightNode;
+			probe.Visit();
+		}
+		NodeType* node = *slot;
+
+		// If the value has more than one copy, only its quantity goes down.
+		if (node->quantity > 1)
+		{
+			Key value = node->value;
+			node->quantity--;
+			path.push_back(slot);
+			FixPath();
+			Record(TreeOperation::Delete, probe);
+			return value;
+		}
+
+		// Else, the node goes. It has no child on the outer side, so its other child
+		// (or nullptr) takes its place.
+		Key value = std::move(node->value);
+		*slot = smallest ? node->rightNode : node->leftNode;
+		ReplaceEnd(node, *slot);
+		pool.Free(node);
+		FixPath();
+		Record(TreeOperation::Delete, probe);
+		return value;
+	}
+
+	/// <summary>
+	/// Makes node the minimum or maximum if its value is beyond the current one. Called
+	/// whenever a new node is linked into the BST. (Private)
+	/// </summary>
+	/// <param name="node"> The node just linked in.</param>
+	void NoteNewNode(NodeType* node)
+	{
+		if (minNode == nullptr || compare(node->value, minNode->value))
+		{
+			minNode = node;
+		}
+		if (maxNode == nullptr || compare(maxNode->value, node->value))
+		{
+			maxNode = node;
+		}
+	}
+
+	/// <summary>
+	/// Called when node, which has at most one child, has just been unlinked and child
+	/// put in its place, before path is used to fix the BST up. If node was the minimum,
+	/// the new minimum is the smallest node under child or, without a child, node's
+	/// parent (the last node on path). The maximum is the mirror image. (Private)
+	/// </summary>
+	/// <param name="node"> The node that was unlinked.</param>
+	/// <param name="child"> The node (or nullptr) that took its place.</param>
+	void ReplaceEnd(NodeType* node, NodeType* child)
+	{
+		NodeType* parent = path.empty() ? nullptr : *path.back();
+		if (node == minNode)
+		{
+			minNode = (child != nullptr) ? FindMin(child) : parent;
+		}
+		if (node == maxNode)
+		{
+			maxNode = (child != nullptr) ? FindMax(child) : parent;
+		}
+	}
+
+	/// <summary>
+	/// Looks the minimum and maximum nodes up again from the root, after an operation
+	/// that relinked many nodes at once. O(height). (Private)
+	/// </summary>
+	void FindEnds()
+	{
+		minNode = FindMin(root);
+		maxNode = FindMax(root);
+	}
+
+	// Reads the value out of an element passed to BuildFrom(), moving it if it is an rvalue.
+	struct ValueOf
+	{
+		template <typename V>
+		V&& operator()(V&& value) const
+		{
+			return std::forward<V>(value);
+		}
+	};
+
+	// Every element passed to BuildFrom() adds 1 to its value's quantity.
+	struct OneOf
+	{
+		template <typename V>
+		Quantity operator()(const V&) const
+		{
+			return 1;
+		}
+	};
+
+	/// <summary>
+	/// Merges the sorted elements in [first, last) with the values already in the BST,
+	/// then relinks every node into a perfectly balanced BST. (Private)
+	/// </summary>
+	/// <param name="first"> The first element to add. Elements must be in sorted order.</param>
+	/// <param name="last"> One past the last element to add.</param>
+	/// <param name="valueOf"> Returns the value of an element.</param>
+	/// <param name="quantityOf"> Returns how many copies of its value an element adds.</param>
+	template <typename ForwardIt, typename ValueOfFn, typename QuantityOfFn>
+	void BuildFromSorted(ForwardIt first, ForwardIt last, ValueOfFn valueOf, QuantityOfFn quantityOf)
+	{
+		// Take the existing nodes out of the BST in sorted order.
+		std::vector<NodeType*> existing;
+		VisitInOrder(root, [&existing](NodeType* node)
+			{
+				existing.push_back(node);
+			});
+
+		// Merge the existing nodes and the new values into one sorted list of nodes.
+		std::vector<NodeType*> nodes;
+		nodes.reserve(existing.size() + static_cast<std::size_t>(std::distance(first, last)));
+		std::size_t next = 0;
+		while (first != last)
+		{
+			// Existing nodes with smaller values go first, unchanged.
+			while (next < existing.size() && compare(existing[next]->value, valueOf(*first)))
+			{
+				nodes.push_back(existing[next++]);
+			}
+
+			// Add up how many times this value appears in a row.
+			ForwardIt runStart = first;
+			Quantity runLength = 0;
+			do
+			{
+				runLength += quantityOf(*first);
+				++first;
+			} while (first != last && !compare(valueOf(*runStart), valueOf(*first)));
+			// A run that adds no copies (only possible through BuildFromCounts) is skipped.
+			if (runLength == 0)
+			{
+				continue;
+			}
+
+			// If there is already a node for this value, only its quantity goes up.
+			if (next < existing.size() && !compare(valueOf(*runStart), existing[next]->value))
+			{
+				existing[next]->quantity += runLength;
+				nodes.push_back(existing[next++]);
+			}
+			// Else, create one node for the whole run.
+			else
+			{
+				NodeType* node = pool.Allocate(valueOf(*runStart));
+				node->quantity = runLength;
+				nodes.push_back(node);
+			}
+		}
+		// Any remaining existing nodes are larger than every new value.
+		while (next < existing.size())
+		{
+			nodes.push_back(existing[next++]);
+		}
+
+		// Relink everything into a balanced shape.
+		root = LinkBalanced(nodes, 0, nodes.size());
+		FindEnds();
+	}
+
+	/// <summary>
+	/// Links nodes[low .. high) into a perfectly balanced subtree, with the middle node
+	/// as its root, and returns that root. The nodes must be in sorted order. Only
+	/// recurses log2(n) deep, since each call handles half as many nodes. (Private)
+	/// </summary>
+	/// <param name="nodes"> The nodes in sorted order.</param>
+	/// <param name="low"> The first node of the subtree.</param>
+	/// <param name="high"> One past the last node of the subtree.</param>
+	/// <returns></returns>
+	static NodeType* LinkBalanced(const std::vector<NodeType*>& nodes, std::size_t low, std::size_t high)
+	{
+		// An empty range makes an empty subtree.
+		if (low >= high)
+		{
+			return nullptr;
+		}
+
+		std::size_t middle = low + (high - low) / 2;
+		NodeType* t = nodes[middle];
+		t->leftNode = LinkBalanced(nodes, low, middle);
+		t->rightNode = LinkBalanced(nodes, middle + 1, high);
+		Update(t);
+		return t;
+	}
+
+	/// <summary>
+	/// Builds a copy of the subtree t out of this BST's pool, with the same shape,
+	/// quantities, heights and sizes, and returns its root. Given const nodes the values
+	/// are copied; given non-const nodes they are moved out (the old nodes must still be
+	/// freed by the caller). Walks with an explicit stack, so deep trees are fine. If
+	/// copying a value throws, the partial copy is freed again. (Private)
+	/// </summary>
+	/// <param name="t"> The root of the subtree to copy.</param>
+	/// <returns></returns>
+	template <typename NodePointer>
+	NodeType* CopySubtree(NodePointer t)
+	{
+		NodeType* copyRoot = nullptr;
+		// A node still to be copied, the new node its copy goes under, and the pointer its copy goes into.
+		struct CopyFrame
+		{
+			NodePointer source;
+			NodeType* parent;
+			NodeType** slot;
+		};
+		std::vector<CopyFrame> stack;
+		if (t != nullptr)
+		{
+			stack.push_back({ t, nullptr, &copyRoot });
+		}
+		try
+		{
+			while (!stack.empty())
+			{
+				NodePointer source = stack.back().source;
+				NodeType* parent = stack.back().parent;
+				NodeType** slot = stack.back().slot;
+				stack.pop_back();
+
+				// Copy (or move) the value into a new node, and copy everything else.
+				NodeType* node;
+				if constexpr (std::is_const<typename std::remove_pointer<NodePointer>::type>::value)
+				{
+					node = pool.Allocate(source->value);
+				}
+				else
+				{
+					node = pool.Allocate(std::move(source->value));
+				}
+				node->quantity = source->quantity;
+				node->height = source->height;
+				node->subtreeSize = source->subtreeSize;
+				node->SetAggregate(source->Aggregate());
+				node->parentNode = parent;
+				*slot = node;
+
+				// Then its children, which are linked below the new node.
+				if (source->rightNode != nullptr)
+				{
+					stack.push_back({ source->rightNode, node, &node->rightNode });
+				}
+				if (source->leftNode != nullptr)
+				{
+					stack.push_back({ source->leftNode, node, &node->leftNode });
+				}
+			}
+		}
+		catch (...)
+		{
+			// Free the partial copy before passing the exception on.
+			Clear(copyRoot);
+			throw;
+		}
+		return copyRoot;
+	}
+
+	// One distinct value of a batch: order[first .. first+count) are the positions of
+	// its copies in the batch, in the order they were given.
+	struct BatchRun
+	{
+		std::size_t first;
+		std::size_t count;
+	};
+
+	// A subtree still to be visited by ApplyBatch(), and the runs that belong in it.
+	struct BatchFrame
+	{
+		// Where the subtree's root is linked from.
+		NodeType** slot;
+		// The runs [low, high) whose values fall inside this subtree.
+		std::size_t low;
+		std::size_t high;
+		// False on the way down. True once the children have been visited.
+		bool childrenDone;
+		// Whether the node ran out of copies and must be removed on the way up.
+		bool remove;
+	};
+
+	/// <summary>
+	/// Inserts (or deletes) every value of batch in one merged descent and returns the
+	/// result of each value, in batch order. (Private)
+	/// Each node's runs are split into those left of it, its own value, and those right
+	/// of it, and each side is carried down its own child. Where a side reaches an empty
+	/// spot, its new values are linked in as a balanced subtree. On the way back up each
+	/// node is joined back together with its children, which restores AVL balance even
+	/// when a whole subtree was added or removed underneath it.
+	/// Uses an explicit stack, so even an unbalanced chain does not recurse per level.
+	/// </summary>
+	/// <param name="batch"> The values. New nodes take them by move.</param>
+	/// <param name="inserting"> True to insert the batch, false to delete it.</param>
+	/// <returns></returns>
+	std::vector<bool> ApplyBatch(std::vector<Key>& batch, bool inserting)
+	{
+		std::vector<bool> results(batch.size(), false);
+
+		// Sort the positions of the values (keeping copies in their given order), then
+		// group equal values into runs.
+		std::vector<std::size_t> order(batch.size());
+		for (std::size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [this, &batch](std::size_t a, std::size_t b)
+			{
+				return compare(batch[a], batch[b]);
+			});
+		std::vector<BatchRun> runs;
+		for (std::size_t i = 0; i < order.size(); i++)
+		{
+			if (runs.empty() || compare(batch[order[runs.back().first]], batch[order[i]]))
+			{
+				runs.push_back({ i, 0 });
+			}
+			runs.back().count++;
+		}
+		auto runValue = [&](std::size_t run) -> Key&
+			{
+				return batch[order[runs[run].first]];
+			};
+
+		std::vector<BatchFrame> stack;
+		stack.push_back({ &root, 0, runs.size(), false, false });
+		while (!stack.empty())
+		{
+			BatchFrame frame = stack.back();
+			stack.pop_back();
+			NodeType* t = *frame.slot;
+
+			// On the way up, put the node back together with its (changed) children.
+			if (frame.childrenDone)
+			{
+				if (frame.remove)
+				{
+					*frame.slot = JoinSubtrees(t->leftNode, t->rightNode);
+					pool.Free(t);
+				}
+				else
+				{
+					*frame.slot = Join(t->leftNode, t, t->rightNode);
+				}
+				continue;
+			}
+
+			// If no values of the batch belong under here, the subtree is untouched.
+			if (frame.low >= frame.high)
+			{
+				continue;
+			}
+
+			// If we fell off the tree, the values here are not stored.
+			if (t == nullptr)
+			{
+				// Deleting them removes nothing, and their results stay false.
+				if (!inserting)
+				{
+					continue;
+				}
+				// Inserting them links in one balanced subtree of new nodes.
+				std::vector<NodeType*> nodes;
+				nodes.reserve(frame.high - frame.low);
+				for (std::size_t run = frame.low; run < frame.high; run++)
+				{
+					NodeType* node = pool.Allocate(std::move(runValue(run)));
+					node->quantity = static_cast<Quantity>(runs[run].count);
+					nodes.push_back(node);
+					results[order[runs[run].first]] = true;
+				}
+				*frame.slot = LinkBalanced(nodes, 0, nodes.size());
+				continue;
+			}
+
+			// Find the first run that is not less than this node's value.
+			std::size_t low = frame.low;
+			std::size_t high = frame.high;
+			while (low < high)
+			{
+				std::size_t middle = low + (high - low) / 2;
+				if (compare(runValue(middle), t->value))
+				{
+					low = middle + 1;
+				}
+				else
+				{
+					high = middle;
+				}
+			}
+			std::size_t split = low;
+			std::size_t rightStart = split;
+
+			// If that run is this node's value, apply the whole run to this node at once.
+			bool remove = false;
+			if (split < frame.high && !compare(t->value, runValue(split)))
+			{
+				const BatchRun& run = runs[split];
+				if (inserting)
+				{
+					t->quantity += static_cast<Quantity>(run.count);
+				}
+				else
+				{
+					// Only as many copies as are stored can be removed.
+					std::size_t removed = static_cast<std::size_t>(std::min<Quantity>(run.count, t->quantity));
+					for (std::size_t i = 0; i < removed; i++)
+					{
+						results[order[run.first + i]] = true;
+					}
+					t->quantity -= static_cast<Quantity>(removed);
+					remove = (t->quantity == 0);
+				}
+				rightStart = split + 1;
+			}
+
+			// Visit the left side, then the right side, then come back to this node.
+			stack.push_back({ frame.slot, 0, 0, true, remove });
+			stack.push_back({ &t->rightNode, rightStart, frame.high, false, false });
+			stack.push_back({ &t->leftNode, frame.low, split, false, false });
+		}
+		FindEnds();
+		return results;
+	}
+
+	/// <summary>
+	/// Links left, t and right into one subtree, with t between them, and returns its
+	/// root. Every value in left must be less than t's, and every value in right greater.
+	/// In AVL mode, if one side is much taller, t is hung at the right height along the
+	/// edge of the taller side and the path above it is rebalanced, so the result is a
+	/// valid AVL tree in O(height difference) steps. (Private)
+	/// </summary>
+	/// <param name="left"> The subtree of smaller values.</param>
+	/// <param name="t"> The node between them.</param>
+	/// <param name="right"> The subtree of larger values.</param>
+	/// <returns></returns>
+	NodeType* Join(NodeType* left, NodeType* t, NodeType* right)
+	{
+		// If the sides are close enough in height (or balance does not matter), t simply
+		// becomes their parent.
+		if (mode != BalanceMode::AVL || std::abs(HeightOf(left) - HeightOf(right)) <= 1)
+		{
+			t->leftNode = left;
+			t->rightNode = right;
+			Update(t);
+			return t;
+		}
+
+		// Else, walk down the inner edge of the taller side until the subtree there is
+		// about as tall as the shorter side, and hang t there instead.
+		bool leftTaller = HeightOf(left) > HeightOf(right);
+		NodeType* taller = leftTaller ? left : right;
+		int shorterHeight = leftTaller ? HeightOf(right) : HeightOf(left);
+		std::vector<NodeType**> edge;
+		NodeType** slot = &taller;
+		while (HeightOf(*slot) > shorterHeight + 1)
+		{
+			edge.push_back(slot);
+			slot = leftTaller ? &(*slot)->rightNode : &(*slot)->leftNode;
+		}
+		t->leftNode = leftTaller ? *slot : left;
+		t->rightNode = leftTaller ? right : *slot;
+		Update(t);
+		*slot = t;
+
+		// Each node above t grew by at most 1 level, so one rotation each puts it right.
+		while (!edge.empty())
+		{
+			Rebalance(*edge.back());
+			edge.pop_back();
+		}
+		return taller;
+	}
+
+	/// <summary>
+	/// Links left and right (every value in left less than every value in right) into
+	/// one subtree and returns its root. The minimum of right is taken out and used as
+	/// the node between them. (Private)
+	/// </summary>
+	/// <param name="left"> The subtree of smaller values.</param>
+	/// <param name="right"> The subtree of larger values.</param>
+	/// <returns></returns>
+	NodeType* JoinSubtrees(NodeType* left, NodeType* right)
+	{
+		// If either side is empty, the other side is the whole subtree.
+		if (left == nullptr)
+		{
+			return right;
+		}
+		if (right == nullptr)
+		{
+			return left;
+		}
+
+		// Unlink the minimum of right, bringing the path above it up to date.
+		std::vector<NodeType**> edge;
+		NodeType** slot = &right;
+		while ((*slot)->leftNode != nullptr)
+		{
+			edge.push_back(slot);
+			slot = &(*slot)->leftNode;
+		}
+		NodeType* minimum = *slot;
+		*slot = minimum->rightNode;
+		while (!edge.empty())
 		{
-			// then recursively call the private Clear on that leftNode.
-			Clear(t->leftNode);
+			if (mode == BalanceMode::AVL)
+			{
+				Rebalance(*edge.back());
+			}
+			else
+			{
+				Update(*edge.back());
+			}
+			edge.pop_back();
 		}
 
-		// RIGHT
-		// This node has no left child, or it did and it was deleted.
-		// If it has a right child,
+		return Join(left, minimum, right);
+	}
+
+	/// <summary>
+	/// Returns the height of the subtree rooted at t (0 for nullptr).
+	/// </summary>
+	/// <param name="t"> The root of the subtree.</param>
+	/// <returns></returns>
+	static int HeightOf(const NodeType* t)
+	{
+		return (t == nullptr) ? 0 : t->height;
+	}
+
+	/// <summary>
+	/// Returns the total quantity stored in the subtree rooted at t (0 for nullptr).
+	/// </summary>
+	/// <param name="t"> The root of the subtree.</param>
+	/// <returns></returns>
+	static Quantity SizeOf(const NodeType* t)
+	{
+		return (t == nullptr) ? 0 : t->subtreeSize;
+	}
+
+	/// <summary>
+	/// Recomputes the stored height and size of t from its children, and points the
+	/// children back at t.
+	/// </summary>
+	/// <param name="t"> The node to update. Must not be nullptr.</param>
+	static void Update(NodeType* t)
+	{
+		t->height = 1 + std::max(HeightOf(t->leftNode), HeightOf(t->rightNode));
+		t->subtreeSize = SizeOf(t->leftNode) + t->quantity + SizeOf(t->rightNode);
+		// Every change of a child passes through here, so this keeps the parent pointers right.
+		if (t->leftNode != nullptr)
+		{
+			t->leftNode->parentNode = t;
+		}
 		if (t->rightNode != nullptr)
 		{
-			// then recursively call the private Clear on that rightNode.
-			Clear(t->rightNode);
+			t->rightNode->parentNode = t;
+		}
+		// Trees without an augmentation skip this entirely.
+		if constexpr (!std::is_empty<AggregateType>::value)
+		{
+			t->SetAggregate(Augment::Combine(Augment::Combine(AggregateOf(t->leftNode), Augment::Of(t->value, t->quantity)),
+				AggregateOf(t->rightNode)));
+		}
+	}
+
+	/// <summary>
+	/// Returns the aggregate of the subtree t, or the identity if t is nullptr.
+	/// </summary>
+	/// <param name="t"> The root of the subtree.</param>
+	/// <returns></returns>
+	static AggregateType AggregateOf(const NodeType* t)
+	{
+		return (t != nullptr) ? AggregateType(t->Aggregate()) : Augment::Identity();
+	}
+
+	/// <summary>
+	/// Returns true if nothing a node holds (its value or its aggregate) needs destroying,
+	/// so that the pool may forget the nodes without visiting them.
+	/// </summary>
+	/// <returns></returns>
+	static constexpr bool NodesAreTrivial()
+	{
+		return std::is_trivially_destructible<Key>::value && std::is_trivially_destructible<AggregateType>::value;
+	}
+
+	/// <summary>
+	/// Returns the number of stored values (counting duplicates) that are less than
+	/// val, or less than or equal to val if inclusive is true.
+	/// </summary>
+	/// <param name="val"> The value to count up to.</param>
+	/// <param name="inclusive"> Whether copies of val itself are counted.</param>
+	/// <returns></returns>
+	Quantity CountBelow(const Key& val, bool inclusive) const
+	{
+		Quantity below = 0;
+		const NodeType* t = root;
+		while (t != nullptr)
+		{
+			// If val is less than this value, nothing here or to the right counts.
+			if (compare(val, t->value))
+			{
+				t = t->leftNode;
+			}
+			// Else, if this value is less than val, this node and everything to its
+			// left counts.
+			else if (compare(t->value, val))
+			{
+				below += SizeOf(t->leftNode) + t->quantity;
+				t = t->rightNode;
+			}
+			// Else, this node holds val. Everything to its left counts, and so do
+			// its own copies if inclusive.
+			else
+			{
+				below += SizeOf(t->leftNode) + (inclusive ? t->quantity : 0);
+				break;
+			}
+		}
+		return below;
+	}
+
+	/// <summary>
+	/// Rotates the subtree rooted at t to the left, so that t's rightNode becomes
+	/// the new root of the subtree and t becomes its leftNode.
+	/// </summary>
+	/// <param name="t"> The parent's pointer to the root of the subtree.</param>
+	static void RotateLeft(NodeType* &t)
+	{
+		NodeType* pivot = t->rightNode;
+		t->rightNode = pivot->leftNode;
+		pivot->leftNode = t;
+		// t is now below pivot, so update it first.
+		Update(t);
+		Update(pivot);
+		t = pivot;
+	}
+
+	/// <summary>
+	/// Rotates the subtree rooted at t to the right, so that t's leftNode becomes
+	/// the new root of the subtree and t becomes its rightNode.
+	/// </summary>
+	/// <param name="t"> The parent's pointer to the root of the subtree.</param>
+	static void RotateRight(NodeType* &t)
+	{
+		NodeType* pivot = t->leftNode;
+		t->leftNode = pivot->rightNode;
+		pivot->rightNode = t;
+		// t is now below pivot, so update it first.
+		Update(t);
+		Update(pivot);
+		t = pivot;
+	}
+
+	/// <summary>
+	/// Restores the AVL property at t, assuming both of its subtrees are already balanced.
+	/// Also brings the height and size of t up to date.
+	/// </summary>
+	/// <param name="t"> The parent's pointer to the root of the subtree.</param>
+	static void Rebalance(NodeType* &t)
+	{
+
+		Update(t);
+		int balance = HeightOf(t->leftNode) - HeightOf(t->rightNode);
+
+		// If the left side is too tall,
+		if (balance > 1)
+		{
+			// then a left-right case must first be turned into a left-left case.
+			if (HeightOf(t->leftNode->leftNode) < HeightOf(t->leftNode->rightNode))
+			{
+				RotateLeft(t->leftNode);
+			}
+			RotateRight(t);
+		}
+		// Else, if the right side is too tall,
+		else if (balance < -1)
+		{
+			// then a right-left case must first be turned into a right-right case.
+			if (HeightOf(t->rightNode->rightNode) < HeightOf(t->rightNode->leftNode))
+			{
+				RotateRight(t->rightNode);
+			}
+			RotateLeft(t);
+		}
+	}
+
+	/// <summary>
+	/// Finds the node with the minimum value at or below node t.
+	/// </summary>
+	/// <param name="t"> The node to start the search for the minimum value.</param>
+	/// <returns></returns>
+	NodeType* FindMin(NodeType* t)
+	{
+		// If this node it nullptr,
+		if (t == nullptr)
+		{
+			// then the BST (or subtree provided) is empty. Return NULL.
+			return nullptr;
+		}
+		// Follow leftNodes until there are none left. That node holds the minimum.
+		while (t->leftNode != nullptr)
+		{
+			t = t->leftNode;
+		}
+		return t;
+	}
+
+	/// <summary>
+	/// Finds the node with the maximum value at or below node t.
+	/// </summary>
+	/// <param name="t"> The node to start the search for the maximum value.</param>
+	/// <returns></returns>
+	NodeType* FindMax(NodeType* t)
+	{
+		// If this node it nullptr,
+		if (t == nullptr)
+		{
+			// then the BST (or subtree provided) is empty. Return NULL.
+			return nullptr;
+		}
+		// Follow rightNodes until there are none left. That node holds the maximum.
+		while (t->rightNode != nullptr)
+		{
+			t = t->rightNode;
+		}
+		return t;
+	}
+
+	/// <summary>
+	/// Traverses the BST in an INORDER path and returns the resulting string. (Private)
+	/// </summary>
+	/// <param name="str"> The string being manipulated.</param>
+	/// <param name="t">The node acting as root of the subtree being traversed.</param>
+	/// <returns></returns>
+	std::string Traverse(std::string &str, NodeType* t, int &depth)
+	{
+		VisitInOrder(t, [&](const NodeType* node)
+			{
+				// Add this node's value and quantity to the string.
+				str += "Value: " + ToString(node->value) + " - Quantity: " + std::to_string(node->quantity);
+				// Add a newline character and 3 spaces, and then
+				// a number of additional spaces equal to depth.
+				str += "\n   ";
+				str.append(depth, ' ');
+				// Increment depth.
+				depth++;
+			});
+
+		// Return the manipulated string.
+		return str;
+	}
+
+	/// <summary>
+	/// Calls visit(node) for every node in the subtree t, following the INORDER path.
+	/// </summary>
+	/// <param name="t"> The root of the subtree being visited.</param>
+	/// <param name="visit"> Called once per node, from the smallest value to the largest.</param>
+	template <typename NodePointer, typename Visitor>
+	static void VisitInOrder(NodePointer t, Visitor&& visit)
+	{
+		/* This follows the INORDER path, meaning left, node, right.
+		* The left-most node will be processed, then its parent node, then the process
+		* starts over with the node to the right of that parent node.
+		* Instead of recursing, the nodes whose left side is still being processed are
+		* kept on an explicit stack, so deep trees cannot overflow the call stack. */
+		std::vector<NodePointer> stack;
+
+		// While there is a node to descend into or a node waiting on the stack,
+		while (t != nullptr || !stack.empty())
+		{
+			// LEFT
+			// Push this node and all of its left-side descendents onto the stack.
+			while (t != nullptr)
+			{
+				stack.push_back(t);
+				t = t->leftNode;
+			}
+
+			// NODE
+			/* The top of the stack is either a leaf, or all of its left-side
+			* decendents have been processed already. */
+			t = stack.back();
+			stack.pop_back();
+			visit(t);
+
+			// RIGHT
+			// Continue with this node's rightNode (which may be nullptr).
+			t = t->rightNode;
+		}
+	}
+
+	// Enough room for one "Value: X - Quantity: Y" line with any number in it.
+	static const int MaxLineLength = 128;
+
+	/// <summary>
+	/// Writes "Value: X - Quantity: Y\n" into line using std::to_chars and returns its
+	/// length. Only used for numeric values.
+	/// </summary>
+	/// <param name="line"> A buffer of at least MaxLineLength characters.</param>
+	/// <param name="val"> The value of the node.</param>
+	/// <param name="quant"> The quantity of the node.</param>
+	/// <returns></returns>
+	template <typename Number>
+	static std::size_t FormatLine(char* line, Number val, Quantity quant)
+	{
+		// Each number gets half of the line, which is far more than any number needs,
+		// and the text around them always has room left over.
+		const int half = MaxLineLength / 2;
+		char* cursor = AppendText(line, "Value: ");
+		cursor = std::to_chars(cursor, line + half, val).ptr;
+		cursor = AppendText(cursor, " - Quantity: ");
+		cursor = std::to_chars(cursor, cursor + half - 16, quant).ptr;
+		*cursor++ = '\n';
+		return cursor - line;
+	}
+
+	/// <summary>
+	/// Copies the text (a string literal) to cursor and returns the end of it.
+	/// </summary>
+	template <std::size_t Length>
+	static char* AppendText(char* cursor, const char (&text)[Length])
+	{
+		std::memcpy(cursor, text, Length - 1);
+		return cursor + Length - 1;
+	}
+
+	/// <summary>
+	/// Copies as much of text as still fits into buffer, starting at offset.
+	/// </summary>
+	static void CopyInto(char* buffer, std::size_t size, std::size_t offset, const char* text, std::size_t length)
+	{
+		if (offset < size)
+		{
+			std::memcpy(buffer + offset, text, std::min(length, size - offset));
+		}
+	}
+
+	/// <summary>
+	/// Turns a value into a string for Traverse(). Numbers use std::to_string, and
+	/// anything else uses its << operator.
+	/// </summary>
+	/// <param name="val"> The value to be turned into a string.</param>
+	/// <returns></returns>
+	static std::string ToString(const Key& val)
+	{
+		if constexpr (std::is_arithmetic<Key>::value)
+		{
+			return std::to_string(val);
+		}
+		else
+		{
+			std::ostringstream stream;
+			stream << val;
+			return stream.str();
+		}
+	}
+
+	/// <summary>
+	/// Clears the subtree that has t as the root by deleting it and all of its
+	/// descendants. False is failed to clear, true is clear successful.
+	/// </summary>
+	/// <param name="t"> The root of the subtree being cleared.</param>
+	bool Clear(NodeType* &t)
+	{
+		// Double check we are not on an invalid node.
+		if (t == nullptr)
+		{
+			// If so, return false.
+			return false;
 		}
 
-		// NODE
-		// This node has no children, or it did and they have been deleted.
-		// It is safe to delete this node.
-		delete t;
+		// Free every node back into the pool.
+		DestroySubtree(t, [this](NodeType* node) { pool.Free(node); });
 		t = nullptr;
 		return true;
 	}
+
+	/// <summary>
+	/// Calls freeNode on every node of the subtree t, each after the last pointer to
+	/// it has been dropped, and returns the number of nodes freed.
+	/// </summary>
+	/// <param name="t"> The root of the subtree being destroyed.</param>
+	/// <param name="freeNode"> Destroys and frees one node.</param>
+	/// <returns></returns>
+	template <typename FreeNode>
+	static std::size_t DestroySubtree(NodeType* t, FreeNode&& freeNode)
+	{
+		std::size_t count = 0;
+
+		/* Rather than recursing (or keeping a stack), rotate the tree as we go. While
+		* the current node has a leftNode, rotate right so that leftNode moves up above
+		* it. Once the current node has no leftNode, nothing else points at it, so it is
+		* safe to delete it and move on to its rightNode. Every node is rotated at most
+		* once and deleted once, so this takes O(n) time and no extra memory. */
+		while (t != nullptr)
+		{
+			// LEFT
+			// If this node has a left child,
+			if (t->leftNode != nullptr)
+			{
+				// then rotate it up so it becomes the current node.
+				NodeType* left = t->leftNode;
+				t->leftNode = left->rightNode;
+				left->rightNode = t;
+				t = left;
+			}
+			// NODE, then RIGHT
+			// Else, this node has no left child. It is safe to delete this node.
+			else
+			{
+				NodeType* right = t->rightNode;
+				freeNode(t);
+				t = right;
+				count++;
+			}
+		}
+		return count;
+	}
+
+	// What the parallel operations hand out to threads: either a whole subtree, or
+	// just one node without its children.
+	struct Chunk
+	{
+		// The root of the subtree, or the single node.
+		NodeType* node;
+		// True if the whole subtree below node is part of the chunk.
+		bool wholeSubtree;
+	};
+
+	// The number of chunks the parallel operations aim to split a tree into.
+	static const int ParallelChunks = 256;
+	// No chunk is split up below this size, so small trees stay in one chunk.
+	static const int MinimumChunkSize = 2048;
+
+	/// <summary>
+	/// Splits the BST into chunks that, read one after the other, follow the INORDER
+	/// path. A subtree is split into its left subtree, its own node and its right
+	/// subtree until it holds at most Size() / ParallelChunks values. The split only
+	/// depends on the shape of the tree. (Private)
+	/// </summary>
+	/// <returns></returns>
+	std::vector<Chunk> SplitInOrder() const
+	{
+		std::vector<Chunk> chunks;
+		if (root == nullptr)
+		{
+			return chunks;
+		}
+
+		const Quantity limit = std::max<Quantity>(SizeOf(root) / ParallelChunks, MinimumChunkSize);
+		// Chunks still to be looked at, with the next one in order on top.
+		std::vector<Chunk> stack = { { root, true } };
+		while (!stack.empty())
+		{
+			Chunk chunk = stack.back();
+			stack.pop_back();
+
+			// If this is a subtree that is still too large,
+			if (chunk.wholeSubtree && SizeOf(chunk.node) > limit)
+			{
+				// then split it. RIGHT goes on the stack first, so that LEFT comes off first.
+				if (chunk.node->rightNode != nullptr)
+				{
+					stack.push_back({ chunk.node->rightNode, true });
+				}
+				stack.push_back({ chunk.node, false });
+				if (chunk.node->leftNode != nullptr)
+				{
+					stack.push_back({ chunk.node->leftNode, true });
+				}
+			}
+			// Else, it is the next chunk in order.
+			else
+			{
+				chunks.push_back(chunk);
+			}
+		}
+		return chunks;
+	}
+
+	/// <summary>
+	/// Calls visit(node) for every node of chunk, following the INORDER path.
+	/// </summary>
+	template <typename Visitor>
+	static void VisitChunk(const Chunk& chunk, Visitor&& visit)
+	{
+		if (chunk.wholeSubtree)
+		{
+			VisitInOrder(static_cast<const NodeType*>(chunk.node), visit);
+		}
+		else
+		{
+			visit(static_cast<const NodeType*>(chunk.node));
+		}
+	}
+
+	/// <summary>
+	/// Returns the number of threads to use when the caller asked for threads.
+	/// 0 means one per core.
+	/// </summary>
+	static unsigned ThreadCount(unsigned threads)
+	{
+		if (threads == 0)
+		{
+			threads = std::thread::hardware_concurrency();
+		}
+		return std::max(threads, 1u);
+	}
+
+	/// <summary>
+	/// Calls work(i) once for every i below count, spread over up to threads threads
+	/// (the calling thread being one of them). Threads take the next i off a shared
+	/// counter, so a thread that finishes early simply takes more. If work throws,
+	/// no more work is handed out and the first exception is rethrown at the end.
+	/// </summary>
+	/// <param name="count"> The number of pieces of work.</param>
+	/// <param name="threads"> The number of threads to use. 0 uses one per core.</param>
+	/// <param name="work"> Does one piece of work.</param>
+	template <typename Work>
+	static void RunChunks(std::size_t count, unsigned threads, Work&& work)
+	{
+		threads = static_cast<unsigned>(std::min<std::size_t>(ThreadCount(threads), count));
+		// With one thread (or one piece of work), just do it here.
+		if (threads <= 1)
+		{
+			for (std::size_t i = 0; i < count; i++)
+			{
+				work(i);
+			}
+			return;
+		}
+
+		std::atomic<std::size_t> next(0);
+		std::mutex failureLock;
+		std::exception_ptr failure;
+		auto worker = [&]()
+		{
+			for (std::size_t i = next++; i < count; i = next++)
+			{
+				try
+				{
+					work(i);
+				}
+				catch (...)
+				{
+					// Keep the first exception, and stop every thread early.
+					std::lock_guard<std::mutex> lock(failureLock);
+					if (!failure)
+					{
+						failure = std::current_exception();
+					}
+					next = count;
+				}
+			}
+		};
+
+		// Start the helpers. If the system runs out of threads, fewer do the work.
+		std::vector<std::thread> helpers;
+		helpers.reserve(threads - 1);
+		try
+		{
+			for (unsigned i = 1; i < threads; i++)
+			{
+				helpers.emplace_back(worker);
+			}
+		}
+		catch (const std::system_error&)
+		{
+		}
+
+		// The calling thread works too, then waits for the rest.
+		worker();
+		for (std::thread& helper : helpers)
+		{
+			helper.join();
+		}
+		if (failure)
+		{
+			std::rethrow_exception(failure);
+		}
+	}
 };
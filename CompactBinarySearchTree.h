@@ -0,0 +1,727 @@
+/*
+* This file defines the CompactBinarySearchTree class, an AVL tree that holds the same
+* (value, quantity) pairs as a Binary Search Tree (BST) in far less memory, for trees
+* with hundreds of millions of keys.
+*
+* A Node of the BST holds its value, two 64-bit pointers, a 64-bit quantity, its height
+* and the 64-bit size of its subtree, which comes to 48 bytes for an int. Here every
+* node lives in one contiguous array and refers to its children by their 32-bit index
+* in that array instead:
+*   - the top 2 bits of the left index hold the node's AVL balance (-1, 0 or +1),
+*   - the top bit of the right index says whether the quantity is more than 1, and
+*   - quantities above 1 are kept out of line in a hash map, so the common case of a
+*     value stored once costs nothing extra.
+* That leaves 30 bits per index, so one tree holds up to 2^30 - 1 (about a billion)
+* distinct values, and an int costs 12 bytes. Subtree sizes are not kept, so there is
+* no Rank() or Select().
+*
+* The array only grows. Deleted nodes are kept on a free list (linked through their
+* left index) and reused by the next inserts. Heights are never stored, only balance
+* factors, so Insert and Delete pass "did this subtree get taller/shorter" back up.
+* The tree is at most about 1.44 * log2(n) tall, so they simply recurse.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows the use of fixed width integers.
+#include <cstdint>
+// Allows the use of size_t.
+#include <cstddef>
+// Allows the use of std::less.
+#include <functional>
+// Allows the use of std::optional.
+#include <optional>
+// Allows the use of std::length_error.
+#include <stdexcept>
+// Allows quantities above 1 to be kept out of line.
+#include <unordered_map>
+// Allows the use of std::move and std::forward.
+#include <utility>
+// Allows the use of vectors.
+#include <vector>
+// Quantity, the type the BST counts copies of a value with.
+#include "BinarySearchTree.h"
+#pragma endregion Preprocessor Directives
+
+// Define the CompactNode struct.
+// One node of a CompactBinarySearchTree: the value and two packed 32-bit child links.
+template <typename Key>
+struct CompactNode
+{
+	// The value held by this node.
+	Key value;
+	// The index of the left child (low 30 bits) and the balance factor plus 1 (top 2 bits).
+	std::uint32_t left;
+	// The index of the right child (low 30 bits) and the "quantity is above 1" flag (top bit).
+	std::uint32_t right;
+};
+
+// Define the CompactBinarySearchTree class.
+template <typename Key, typename Compare = std::less<Key>>
+class CompactBinarySearchTree
+{
+public:
+	// The type of node this tree is made of.
+	using NodeType = CompactNode<Key>;
+
+	// The largest number of distinct values one tree can hold.
+	static constexpr std::size_t MaxNodes = (std::size_t(1) << 30) - 1;
+
+	/// <summary>
+	/// Constructor for the CompactBinarySearchTree. Starts empty.
+	/// </summary>
+	/// <param name="comp"> The comparator that decides which values are smaller.</param>
+	CompactBinarySearchTree(const Compare& comp = Compare())
+		: compare(comp)
+	{
+		// Intentionally left blank.
+	}
+
+	/// <summary>
+	/// Makes room for count distinct values, so the array does not have to grow (and
+	/// briefly hold two copies of itself) while they are inserted.
+	/// </summary>
+	/// <param name="count"> The number of distinct values to make room for.</param>
+	void Reserve(std::size_t count)
+	{
+		nodes.reserve(count);
+	}
+
+	/// <summary>
+	/// Insert the value provided into the tree count times.
+	/// </summary>
+	/// <param name="val"> The value to be stored.</param>
+	/// <param name="count"> The number of copies to add.</param>
+	void Insert(const Key& val, Quantity count = 1)
+	{
+		InsertValue(val, count);
+	}
+
+	/// <summary>
+	/// Insert the value provided into the tree count times, moving it in if a new node
+	/// is needed.
+	/// </summary>
+	/// <param name="val"> The value to be stored.</param>
+	/// <param name="count"> The number of copies to add.</param>
+	void Insert(Key&& val, Quantity count = 1)
+	{
+		InsertValue(std::move(val), count);
+	}
+
+	/// <summary>
+	/// Deletes one copy of val. Returns true if val was stored.
+	/// </summary>
+	/// <param name="val"> The value to be deleted.</param>
+	/// <returns></returns>
+	bool Delete(const Key& val)
+	{
+		return Delete(val, 1) == 1;
+	}
+
+	/// <summary>
+	/// Deletes up to count copies of val and returns the number actually removed.
+	/// The node goes once its last copy does.
+	/// </summary>
+	/// <param name="val"> The value to be deleted.</param>
+	/// <param name="count"> The most copies to remove.</param>
+	/// <returns></returns>
+	Quantity Delete(const Key& val, Quantity count)
+	{
+		if (count == 0)
+		{
+			return 0;
+		}
+		Quantity removed = 0;
+		bool shrunk = false;
+		root = Delete(root, val, count, removed, shrunk);
+		size -= removed;
+		return removed;
+	}
+
+	/// <summary>
+	/// Returns the number of times val is stored, or 0.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	Quantity Count(const Key& val) const
+	{
+		std::uint32_t t = Find(val);
+		return (t == Null) ? 0 : QuantityOf(t);
+	}
+
+	/// <summary>
+	/// Returns true if val is stored in the tree.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	bool Contains(const Key& val) const
+	{
+		return Find(val) != Null;
+	}
+
+	/// <summary>
+	/// Returns the smallest value stored, or nothing if the tree is empty.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> Minimum() const
+	{
+		if (root == Null)
+		{
+			return std::nullopt;
+		}
+		std::uint32_t t = root;
+		while (Left(t) != Null)
+		{
+			t = Left(t);
+		}
+		return nodes[t].value;
+	}
+
+	/// <summary>
+	/// Returns the largest value stored, or nothing if the tree is empty.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> Maximum() const
+	{
+		if (root == Null)
+		{
+			return std::nullopt;
+		}
+		std::uint32_t t = root;
+		while (Right(t) != Null)
+		{
+			t = Right(t);
+		}
+		return nodes[t].value;
+	}
+
+	/// <summary>
+	/// Returns the total number of values stored, counting every duplicate.
+	/// </summary>
+	/// <returns></returns>
+	Quantity Size() const
+	{
+		return size;
+	}
+
+	/// <summary>
+	/// Returns the number of distinct values stored.
+	/// </summary>
+	/// <returns></returns>
+	std::size_t NodeCount() const
+	{
+		return nodeCount;
+	}
+
+	/// <summary>
+	/// Returns the height of the tree (0 when empty). Walks down the taller side of
+	/// every node, which the balance factors point out, so this takes O(log n).
+	/// </summary>
+	/// <returns></returns>
+	int Height() const
+	{
+		int height = 0;
+		for (std::uint32_t t = root; t != Null; t = (BalanceOf(t) < 0) ? Left(t) : Right(t))
+		{
+			height++;
+		}
+		return height;
+	}
+
+	/// <summary>
+	/// Visits every value in order, calling visit(value, quantity) once per node.
+	/// </summary>
+	/// <param name="visit"> Called with each value and its quantity.</param>
+	template <typename Visitor>
+	void ForEach(Visitor&& visit) const
+	{
+		// The same INORDER walk as the BST's: left, node, right, with an explicit stack.
+		std::vector<std::uint32_t> stack;
+		std::uint32_t t = root;
+		while (t != Null || !stack.empty())
+		{
+			while (t != Null)
+			{
+				stack.push_back(t);
+				t = Left(t);
+			}
+			t = stack.back();
+			stack.pop_back();
+			visit(static_cast<const Key&>(nodes[t].value), QuantityOf(t));
+			t = Right(t);
+		}
+	}
+
+	/// <summary>
+	/// Removes every value. The array keeps its memory for the next inserts.
+	/// </summary>
+	void Clear()
+	{
+		nodes.clear();
+		quantities.clear();
+		root = Null;
+		freeList = Null;
+		size = 0;
+		nodeCount = 0;
+	}
+
+	/// <summary>
+	/// Returns the number of bytes this tree holds on to: the node array (including
+	/// spare capacity) and an estimate of the hash map of quantities above 1.
+	/// </summary>
+	/// <returns></returns>
+	std::size_t MemoryUsage() const
+	{
+		// Each map entry is a heap node holding the pair and a next pointer (plus its
+		// cached hash), and each bucket is one pointer.
+		std::size_t mapBytes = quantities.bucket_count() * sizeof(void*)
+			+ quantities.size() * (sizeof(std::pair<const std::uint32_t, Quantity>) + 2 * sizeof(void*));
+		return nodes.capacity() * sizeof(NodeType) + mapBytes;
+	}
+
+	// Private members.
+private:
+	// The index that means "no node". Every bit of a 30-bit index is set.
+	static constexpr std::uint32_t Null = (std::uint32_t(1) << 30) - 1;
+	// The bits of a link word that hold the index.
+	static constexpr std::uint32_t IndexMask = Null;
+	// Where the balance factor (plus 1) sits in the left word.
+	static constexpr int BalanceShift = 30;
+	// The bit of the right word that says the quantity is above 1.
+	static constexpr std::uint32_t ManyFlag = std::uint32_t(1) << 31;
+
+	// Every node ever created, including freed ones waiting to be reused.
+	std::vector<NodeType> nodes;
+	// The quantity of every node whose quantity is above 1, by index.
+	std::unordered_map<std::uint32_t, Quantity> quantities;
+	// The index of the root node. Null when the tree is empty.
+	std::uint32_t root = Null;
+	// The most recently freed node, which links to the one freed before it.
+	std::uint32_t freeList = Null;
+	// The total number of values stored, counting every duplicate.
+	Quantity size = 0;
+	// The number of nodes in use.
+	std::size_t nodeCount = 0;
+	// Decides whether one value is smaller than another.
+	Compare compare;
+
+	/// <summary>
+	/// Returns the index of the left child of t (Null if there is none).
+	/// </summary>
+	std::uint32_t Left(std::uint32_t t) const
+	{
+		return nodes[t].left & IndexMask;
+	}
+
+	/// <summary>
+	/// Returns the index of the right child of t (Null if there is none).
+	/// </summary>
+	std::uint32_t Right(std::uint32_t t) const
+	{
+		return nodes[t].right & IndexMask;
+	}
+
+	/// <summary>
+	/// Makes child the left child of t, keeping t's balance factor.
+	/// </summary>
+	void SetLeft(std::uint32_t t, std::uint32_t child)
+	{
+		nodes[t].left = (nodes[t].left & ~IndexMask) | child;
+	}
+
+	/// <summary>
+	/// Makes child the right child of t, keeping t's quantity flag.
+	/// </summary>
+	void SetRight(std::uint32_t t, std::uint32_t child)
+	{
+		nodes[t].right = (nodes[t].right & ~IndexMask) | child;
+	}
+
+	/// <summary>
+	/// Returns the balance factor of t: the height of its right subtree minus the
+	/// height of its left subtree (-1, 0 or +1).
+	/// </summary>
+	int BalanceOf(std::uint32_t t) const
+	{
+		return static_cast<int>(nodes[t].left >> BalanceShift) - 1;
+	}
+
+	/// <summary>
+	/// Stores the balance factor of t (-1, 0 or +1).
+	/// </summary>
+	void SetBalance(std::uint32_t t, int balance)
+	{
+		nodes[t].left = (nodes[t].left & IndexMask) | (static_cast<std::uint32_t>(balance + 1) << BalanceShift);
+	}
+
+	/// <summary>
+	/// Returns the quantity of t: 1, unless its flag says to look in the map.
+	/// </summary>
+	Quantity QuantityOf(std::uint32_t t) const
+	{
+		return (nodes[t].right & ManyFlag) ? quantities.find(t)->second : 1;
+	}
+
+	/// <summary>
+	/// Stores the quantity of t. Only quantities above 1 take up room in the map.
+	/// </summary>
+	void SetQuantity(std::uint32_t t, Quantity quant)
+	{
+		if (quant > 1)
+		{
+			quantities[t] = quant;
+			nodes[t].right |= ManyFlag;
+		}
+		else if (nodes[t].right & ManyFlag)
+		{
+			quantities.erase(t);
+			nodes[t].right &= ~ManyFlag;
+		}
+	}
+
+	/// <summary>
+	/// Returns the index of the node holding val, or Null.
+	/// </summary>
+	std::uint32_t Find(const Key& val) const
+	{
+		std::uint32_t t = root;
+		while (t != Null)
+		{
+			// Smaller values are to the left, larger values are to the right.
+			if (compare(val, nodes[t].value))
+			{
+				t = Left(t);
+			}
+			else if (compare(nodes[t].value, val))
+			{
+				t = Right(t);
+			}
+			// Else, this node holds val.
+			else
+			{
+				break;
+			}
+		}
+		return t;
+	}
+
+	/// <summary>
+	/// Inserts count copies of val, starting at the root.
+	/// </summary>
+	template <typename K>
+	void InsertValue(K&& val, Quantity count)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		bool grew = false;
+		root = Insert(root, std::forward<K>(val), count, grew);
+		size += count;
+	}
+
+	/// <summary>
+	/// Returns the index of a new node holding val, reusing a freed node if there is one.
+	/// </summary>
+	template <typename K>
+	std::uint32_t NewNode(K&& val, Quantity count)
+	{
+		std::uint32_t t;
+		// If a freed node is waiting on the free list,
+		if (freeList != Null)
+		{
+			// then reuse it.
+			t = freeList;
+			freeList = Left(t);
+			nodes[t].value = std::forward<K>(val);
+		}
+		// Else, add a node to the end of the array.
+		else
+		{
+			if (nodes.size() >= MaxNodes)
+			{
+				throw std::length_error("CompactBinarySearchTree is full");
+			}
+			t = static_cast<std::uint32_t>(nodes.size());
+			nodes.push_back(NodeType{ std::forward<K>(val), 0, 0 });
+		}
+		// No children, balanced, quantity 1 until SetQuantity says otherwise.
+		nodes[t].left = Null;
+		nodes[t].right = Null;
+		SetBalance(t, 0);
+		SetQuantity(t, count);
+		nodeCount++;
+		return t;
+	}
+
+	/// <summary>
+	/// Puts node t on the free list.
+	/// </summary>
+	void FreeNode(std::uint32_t t)
+	{
+		SetQuantity(t, 1);
+		nodes[t].left = freeList;
+		freeList = t;
+		nodeCount--;
+	}
+
+	/// <summary>
+	/// Rotates the subtree t to the right and returns its new root. Balance factors
+	/// are left for the caller to set.
+	/// </summary>
+	std::uint32_t RotateRight(std::uint32_t t)
+	{
+		std::uint32_t l = Left(t);
+		SetLeft(t, Right(l));
+		SetRight(l, t);
+		return l;
+	}
+
+	/// <summary>
+	/// Rotates the subtree t to the left and returns its new root. Balance factors
+	/// are left for the caller to set.
+	/// </summary>
+	std::uint32_t RotateLeft(std::uint32_t t)
+	{
+		std::uint32_t r = Right(t);
+		SetRight(t, Left(r));
+		SetLeft(r, t);
+		return r;
+	}
+
+	/// <summary>
+	/// Rebalances t when its left side has become 2 levels taller than its right (a
+	/// balance of -2, which is never stored). Returns the new root of the subtree, and
+	/// sets shorter to whether the subtree is now 1 level shorter than it was at -2.
+	/// </summary>
+	std::uint32_t FixLeftHeavy(std::uint32_t t, bool& shorter)
+	{
+		std::uint32_t l = Left(t);
+		int leftBalance = BalanceOf(l);
+		// If the left child leans left (or not at all), one rotation is enough.
+		if (leftBalance <= 0)
+		{
+			std::uint32_t top = RotateRight(t);
+			// A left child with no lean can only happen after a delete, and then the
+			// height stays the same.
+			SetBalance(t, (leftBalance == 0) ? -1 : 0);
+			SetBalance(top, (leftBalance == 0) ? 1 : 0);
+			shorter = (leftBalance != 0);
+			return top;
+		}
+
+		// Else, it leans right, so its right child comes up two levels.
+		std::uint32_t middle = Right(l);
+		int middleBalance = BalanceOf(middle);
+		SetLeft(t, RotateLeft(l));
+		std::uint32_t top = RotateRight(t);
+		SetBalance(t, (middleBalance == -1) ? 1 : 0);
+		SetBalance(l, (middleBalance == 1) ? -1 : 0);
+		SetBalance(top, 0);
+		shorter = true;
+		return top;
+	}
+
+	/// <summary>
+	/// The mirror image of FixLeftHeavy(), for a right side 2 levels taller.
+	/// </summary>
+	std::uint32_t FixRightHeavy(std::uint32_t t, bool& shorter)
+	{
+		std::uint32_t r = Right(t);
+		int rightBalance = BalanceOf(r);
+		if (rightBalance >= 0)
+		{
+			std::uint32_t top = RotateLeft(t);
+			SetBalance(t, (rightBalance == 0) ? 1 : 0);
+			SetBalance(top, (rightBalance == 0) ? -1 : 0);
+			shorter = (rightBalance != 0);
+			return top;
+		}
+
+		std::uint32_t middle = Left(r);
+		int middleBalance = BalanceOf(middle);
+		SetRight(t, RotateRight(r));
+		std::uint32_t top = RotateLeft(t);
+		SetBalance(t, (middleBalance == 1) ? -1 : 0);
+		SetBalance(r, (middleBalance == -1) ? 1 : 0);
+		SetBalance(top, 0);
+		shorter = true;
+		return top;
+	}
+
+	/// <summary>
+	/// Called when the left subtree of t got 1 level taller. Returns the new root of
+	/// the subtree and sets grew to whether the whole subtree got taller.
+	/// </summary>
+	std::uint32_t LeftGrew(std::uint32_t t, bool& grew)
+	{
+		int balance = BalanceOf(t) - 1;
+		if (balance < -1)
+		{
+			// After an insert, the rotation always brings the height back down.
+			bool shorter;
+			grew = false;
+			return FixLeftHeavy(t, shorter);
+		}
+		SetBalance(t, balance);
+		grew = (balance == -1);
+		return t;
+	}
+
+	/// <summary>
+	/// Called when the right subtree of t got 1 level taller.
+	/// </summary>
+	std::uint32_t RightGrew(std::uint32_t t, bool& grew)
+	{
+		int balance = BalanceOf(t) + 1;
+		if (balance > 1)
+		{
+			bool shorter;
+			grew = false;
+			return FixRightHeavy(t, shorter);
+		}
+		SetBalance(t, balance);
+		grew = (balance == 1);
+		return t;
+	}
+
+	/// <summary>
+	/// Called when the left subtree of t got 1 level shorter. Returns the new root of
+	/// the subtree and sets shrunk to whether the whole subtree got shorter.
+	/// </summary>
+	std::uint32_t LeftShrank(std::uint32_t t, bool& shrunk)
+	{
+		int balance = BalanceOf(t) + 1;
+		if (balance > 1)
+		{
+			return FixRightHeavy(t, shrunk);
+		}
+		SetBalance(t, balance);
+		shrunk = (balance == 0);
+		return t;
+	}
+
+	/// <summary>
+	/// Called when the right subtree of t got 1 level shorter.
+	/// </summary>
+	std::uint32_t RightShrank(std::uint32_t t, bool& shrunk)
+	{
+		int balance = BalanceOf(t) - 1;
+		if (balance < -1)
+		{
+			return FixLeftHeavy(t, shrunk);
+		}
+		SetBalance(t, balance);
+		shrunk = (balance == 0);
+		return t;
+	}
+
+	/// <summary>
+	/// Inserts count copies of val into the subtree t and returns its new root. grew
+	/// is set to whether the subtree got taller.
+	/// </summary>
+	template <typename K>
+	std::uint32_t Insert(std::uint32_t t, K&& val, Quantity count, bool& grew)
+	{
+		// An empty spot gets a new node.
+		if (t == Null)
+		{
+			grew = true;
+			return NewNode(std::forward<K>(val), count);
+		}
+
+		// Smaller values go left, larger values go right.
+		if (compare(val, nodes[t].value))
+		{
+			SetLeft(t, Insert(Left(t), std::forward<K>(val), count, grew));
+			return grew ? LeftGrew(t, grew) : t;
+		}
+		if (compare(nodes[t].value, val))
+		{
+			SetRight(t, Insert(Right(t), std::forward<K>(val), count, grew));
+			return grew ? RightGrew(t, grew) : t;
+		}
+
+		// Else, val is already stored, so only its quantity goes up.
+		SetQuantity(t, QuantityOf(t) + count);
+		grew = false;
+		return t;
+	}
+
+	/// <summary>
+	/// Deletes up to count copies of val from the subtree t and returns its new root.
+	/// removed is set to the number of copies removed, and shrunk to whether the
+	/// subtree got shorter.
+	/// </summary>
+	std::uint32_t Delete(std::uint32_t t, const Key& val, Quantity count, Quantity& removed, bool& shrunk)
+	{
+		// If we ran out of nodes, val is not stored.
+		if (t == Null)
+		{
+			shrunk = false;
+			return Null;
+		}
+
+		if (compare(val, nodes[t].value))
+		{
+			SetLeft(t, Delete(Left(t), val, count, removed, shrunk));
+			return shrunk ? LeftShrank(t, shrunk) : t;
+		}
+		if (compare(nodes[t].value, val))
+		{
+			SetRight(t, Delete(Right(t), val, count, removed, shrunk));
+			return shrunk ? RightShrank(t, shrunk) : t;
+		}
+
+		// This node holds val. If it has more copies than are being removed, only its
+		// quantity goes down.
+		Quantity quant = QuantityOf(t);
+		if (quant > count)
+		{
+			SetQuantity(t, quant - count);
+			removed = count;
+			shrunk = false;
+			return t;
+		}
+
+		// Else, the node itself goes.
+		removed = quant;
+		std::uint32_t left = Left(t);
+		std::uint32_t right = Right(t);
+		// With at most 1 child, that child simply takes its place.
+		if (left == Null || right == Null)
+		{
+			FreeNode(t);
+			shrunk = true;
+			return (left != Null) ? left : right;
+		}
+
+		// Else, the smallest node of the right subtree is unlinked and put in its place.
+		// Nodes are relinked rather than having their values moved, so every index in
+		// the quantity map stays right.
+		std::uint32_t successor = Null;
+		right = RemoveMinimum(right, successor, shrunk);
+		SetLeft(successor, left);
+		SetRight(successor, right);
+		SetBalance(successor, BalanceOf(t));
+		FreeNode(t);
+		return shrunk ? RightShrank(successor, shrunk) : successor;
+	}
+
+	/// <summary>
+	/// Unlinks the smallest node of the subtree t, stores its index in minimum, and
+	/// returns the new root of the subtree. shrunk is set to whether it got shorter.
+	/// </summary>
+	std::uint32_t RemoveMinimum(std::uint32_t t, std::uint32_t& minimum, bool& shrunk)
+	{
+		if (Left(t) == Null)
+		{
+			minimum = t;
+			shrunk = true;
+			return Right(t);
+		}
+		SetLeft(t, RemoveMinimum(Left(t), minimum, shrunk));
+		return shrunk ? LeftShrank(t, shrunk) : t;
+	}
+};
@@ -0,0 +1,420 @@
+/*
+* This file defines the ConcurrentBinarySearchTree class, a Binary Search Tree (BST)
+* that many threads can use at the same time without any locks.
+*
+* It keeps the same rules as the BinarySearchTree: smaller values to the left, larger
+* values to the right, and each node holds a quantity instead of storing duplicates.
+* What changes is how nodes are added and removed:
+*
+*   - Every child pointer and every quantity is atomic. Readers simply walk down the
+*     tree. They never lock, never write, and never wait for a writer.
+*   - Insert walks down the same way. If the value is already stored, its quantity is
+*     atomically incremented. Otherwise a new node is swapped into the empty child
+*     pointer with a single compare-and-swap. If another thread filled that spot
+*     first, the walk simply continues from there. Only the one pointer being changed
+*     is ever contended, which is as fine-grained as locking can get.
+*   - Delete atomically decrements the quantity, but never below 0. A node whose
+*     quantity reaches 0 stays in the tree as a "tombstone" that every query treats
+*     as missing, and inserting its value again simply brings it back.
+*
+* Because nodes are never unlinked or freed while the tree is in use, a reader can
+* never land on freed memory, so no epochs or hazard pointers are needed. The cost is
+* that tombstones use memory and the tree is not rebalanced as it goes. Compact()
+* fixes both, by dropping every tombstone and relinking the rest into a perfectly
+* balanced tree, but it must only be called while no other thread is using the tree
+* (for example between batches of work).
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows the use of atomics.
+#include <atomic>
+// Allows the use of size_t.
+#include <cstddef>
+// Allows the use of std::less.
+#include <functional>
+// Allows optional return values.
+#include <optional>
+// Allows the use of std::move and std::forward.
+#include <utility>
+// Allows the use of vectors.
+#include <vector>
+// Quantity, the type the BST counts copies of a value with.
+#include "BinarySearchTree.h"
+#pragma endregion Preprocessor Directives
+
+// Define the ConcurrentNode struct.
+template <typename Key>
+struct ConcurrentNode
+{
+	// The value of this node. Never changes once the node is published.
+	const Key value;
+	// A pointer to the node that is to this node's bottom-left.
+	std::atomic<ConcurrentNode*> leftNode;
+	// A pointer to the node that is to this node's bottom-right.
+	std::atomic<ConcurrentNode*> rightNode;
+	// The number of times this value has been included. 0 means it was deleted.
+	std::atomic<Quantity> quantity;
+
+	/// <summary>
+	/// Constructor for ConcurrentNode struct.
+	/// </summary>
+	/// <param name="val"> The value this node will hold.</param>
+	template <typename K>
+	explicit ConcurrentNode(K&& val)
+		: value(std::forward<K>(val)), leftNode(nullptr), rightNode(nullptr), quantity(1)
+	{
+		// Intentionally left blank.
+	}
+};
+
+// Define the ConcurrentBinarySearchTree class.
+template <typename Key, typename Compare = std::less<Key>>
+class ConcurrentBinarySearchTree
+{
+public:
+	// The type of node this BST is made of.
+	using NodeType = ConcurrentNode<Key>;
+
+	/// <summary>
+	/// Constructor for the ConcurrentBinarySearchTree.
+	/// </summary>
+	/// <param name="comp"> The comparator that decides which values are smaller.</param>
+	ConcurrentBinarySearchTree(const Compare& comp = Compare())
+		: compare(comp)
+	{
+		// Intentionally left blank.
+	}
+
+	// The tree owns its nodes and other threads may hold pointers into it,
+	// so it must never be copied or moved.
+	ConcurrentBinarySearchTree(const ConcurrentBinarySearchTree&) = delete;
+	ConcurrentBinarySearchTree& operator=(const ConcurrentBinarySearchTree&) = delete;
+
+	// The destructor. No other thread may be using the tree by now.
+	~ConcurrentBinarySearchTree()
+	{
+		std::vector<NodeType*> nodes;
+		CollectNodes(nodes);
+		for (NodeType* node : nodes)
+		{
+			delete node;
+		}
+	}
+
+	/// <summary>
+	/// Insert the value provided into the BST. Safe to call from any thread.
+	/// </summary>
+	/// <param name="val"> The value to be stored in the BST.</param>
+	void Insert(const Key& val)
+	{
+		InsertValue(val);
+	}
+
+	/// <summary>
+	/// Insert the value provided into the BST, moving it into a new node if needed.
+	/// Safe to call from any thread.
+	/// </summary>
+	/// <param name="val"> The value to be stored in the BST.</param>
+	void Insert(Key&& val)
+	{
+		InsertValue(std::move(val));
+	}
+
+	/// <summary>
+	/// Delete one copy of val from the BST. Safe to call from any thread.
+	/// Returns true if deletion was successful, false is nothing was removed.
+	/// </summary>
+	/// <param name="val"> The value to be deleted from the BST.</param>
+	bool Delete(const Key& val)
+	{
+		NodeType* node = Find(val);
+		// If there has never been a node for val, there is nothing to delete.
+		if (node == nullptr)
+		{
+			return false;
+		}
+
+		// Lower the quantity by 1, unless another thread got it down to 0 first.
+		Quantity quantity = node->quantity.load(std::memory_order_relaxed);
+		while (quantity > 0)
+		{
+			if (node->quantity.compare_exchange_weak(quantity, quantity - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// Returns the number of times val is stored, or 0. Never blocks.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	Quantity Count(const Key& val) const
+	{
+		const NodeType* node = Find(val);
+		return (node != nullptr) ? node->quantity.load(std::memory_order_acquire) : 0;
+	}
+
+	/// <summary>
+	/// Returns true if val is stored in the BST. Never blocks.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	bool Contains(const Key& val) const
+	{
+		return Count(val) > 0;
+	}
+
+	/// <summary>
+	/// Returns the smallest stored value, or nothing if the BST is empty.
+	/// Tombstones are skipped, so this can take longer after many deletions.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> Minimum() const
+	{
+		std::optional<Key> result;
+		VisitLive([&result](const NodeType* node)
+			{
+				result = node->value;
+				// Stop at the first live node.
+				return false;
+			});
+		return result;
+	}
+
+	/// <summary>
+	/// Returns the largest stored value, or nothing if the BST is empty.
+	/// Tombstones are skipped, so this can take longer after many deletions.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> Maximum() const
+	{
+		// Walk down the right side, remembering the path so we can back up past tombstones.
+		std::optional<Key> result;
+		std::vector<const NodeType*> stack;
+		const NodeType* t = root.load(std::memory_order_acquire);
+		while (t != nullptr || !stack.empty())
+		{
+			while (t != nullptr)
+			{
+				stack.push_back(t);
+				t = t->rightNode.load(std::memory_order_acquire);
+			}
+			t = stack.back();
+			stack.pop_back();
+			if (t->quantity.load(std::memory_order_acquire) > 0)
+			{
+				result = t->value;
+				break;
+			}
+			t = t->leftNode.load(std::memory_order_acquire);
+		}
+		return result;
+	}
+
+	/// <summary>
+	/// Visits every stored value in sorted order, calling visit(value, quantity).
+	/// Other threads may keep inserting and deleting while this runs. Values that
+	/// are not changed during the walk are always seen exactly once.
+	/// </summary>
+	/// <param name="visit"> Called with each value and its quantity.</param>
+	template <typename Visitor>
+	void ForEach(Visitor&& visit) const
+	{
+		VisitLive([&visit](const NodeType* node)
+			{
+				visit(node->value, node->quantity.load(std::memory_order_acquire));
+				return true;
+			});
+	}
+
+	/// <summary>
+	/// Drops every tombstone and relinks the remaining nodes into a perfectly balanced
+	/// BST. Returns the number of tombstones removed. NOT thread-safe: no other thread
+	/// may use the BST while this runs.
+	/// </summary>
+	/// <returns></returns>
+	std::size_t Compact()
+	{
+		std::vector<NodeType*> nodes;
+		CollectNodes(nodes);
+
+		// Keep the live nodes in order and free the tombstones.
+		std::vector<NodeType*> live;
+		live.reserve(nodes.size());
+		for (NodeType* node : nodes)
+		{
+			if (node->quantity.load(std::memory_order_relaxed) > 0)
+			{
+				live.push_back(node);
+			}
+			else
+			{
+				delete node;
+			}
+		}
+
+		root.store(LinkBalanced(live, 0, live.size()), std::memory_order_release);
+		return nodes.size() - live.size();
+	}
+
+private:
+	// A pointer to the root node for this BST. nullptr when tree is empty.
+	std::atomic<NodeType*> root{ nullptr };
+	// Decides whether one value is smaller than another.
+	Compare compare;
+
+	/// <summary>
+	/// Adds one copy of val, creating a node only if val has never been stored. (Private)
+	/// </summary>
+	/// <param name="val"> The value to be stored in the BST.</param>
+	template <typename K>
+	void InsertValue(K&& val)
+	{
+		// A node made for val that has not been linked in yet.
+		NodeType* fresh = nullptr;
+		std::atomic<NodeType*>* slot = &root;
+		while (true)
+		{
+			NodeType* node = slot->load(std::memory_order_acquire);
+
+			// If this spot is empty,
+			if (node == nullptr)
+			{
+				// then try to put a new node here.
+				if (fresh == nullptr)
+				{
+					fresh = new NodeType(std::forward<K>(val));
+				}
+				if (slot->compare_exchange_strong(node, fresh, std::memory_order_release, std::memory_order_acquire))
+				{
+					return;
+				}
+				// Another thread filled this spot first. node is now that thread's
+				// node, so carry on comparing against it.
+			}
+
+			// From here on, compare against the node's value (val may have been moved).
+			const Key& value = (fresh != nullptr) ? fresh->value : val;
+			if (compare(value, node->value))
+			{
+				slot = &node->leftNode;
+			}
+			else if (compare(node->value, value))
+			{
+				slot = &node->rightNode;
+			}
+			// Else, this node holds val already. Add to its quantity.
+			else
+			{
+				node->quantity.fetch_add(1, std::memory_order_acq_rel);
+				// The node we made (if any) was never published, so nobody can see it.
+				delete fresh;
+				return;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Returns the node for val, even if it is a tombstone, or nullptr. (Private)
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	NodeType* Find(const Key& val) const
+	{
+		NodeType* t = root.load(std::memory_order_acquire);
+		while (t != nullptr)
+		{
+			if (compare(val, t->value))
+			{
+				t = t->leftNode.load(std::memory_order_acquire);
+			}
+			else if (compare(t->value, val))
+			{
+				t = t->rightNode.load(std::memory_order_acquire);
+			}
+			else
+			{
+				return t;
+			}
+		}
+		return nullptr;
+	}
+
+	/// <summary>
+	/// Calls visit(node) for every live node in sorted order until visit returns false.
+	/// </summary>
+	/// <param name="visit"> Returns true to keep going.</param>
+	template <typename Visitor>
+	void VisitLive(Visitor&& visit) const
+	{
+		std::vector<const NodeType*> stack;
+		const NodeType* t = root.load(std::memory_order_acquire);
+		while (t != nullptr || !stack.empty())
+		{
+			// LEFT
+			while (t != nullptr)
+			{
+				stack.push_back(t);
+				t = t->leftNode.load(std::memory_order_acquire);
+			}
+
+			// NODE (skipping tombstones)
+			t = stack.back();
+			stack.pop_back();
+			if (t->quantity.load(std::memory_order_acquire) > 0 && !visit(t))
+			{
+				return;
+			}
+
+			// RIGHT
+			t = t->rightNode.load(std::memory_order_acquire);
+		}
+	}
+
+	/// <summary>
+	/// Collects every node, tombstones included, in sorted order. (Private)
+	/// Only used when no other thread is using the BST.
+	/// </summary>
+	/// <param name="nodes"> Receives the nodes.</param>
+	void CollectNodes(std::vector<NodeType*>& nodes)
+	{
+		std::vector<NodeType*> stack;
+		NodeType* t = root.load(std::memory_order_acquire);
+		while (t != nullptr || !stack.empty())
+		{
+			while (t != nullptr)
+			{
+				stack.push_back(t);
+				t = t->leftNode.load(std::memory_order_relaxed);
+			}
+			t = stack.back();
+			stack.pop_back();
+			nodes.push_back(t);
+			t = t->rightNode.load(std::memory_order_relaxed);
+		}
+	}
+
+	/// <summary>
+	/// Links nodes[low .. high) into a perfectly balanced subtree and returns its root.
+	/// Only recurses log2(n) deep. (Private)
+	/// </summary>
+	static NodeType* LinkBalanced(const std::vector<NodeType*>& nodes, std::size_t low, std::size_t high)
+	{
+		// An empty range makes an empty subtree.
+		if (low >= high)
+		{
+			return nullptr;
+		}
+
+		std::size_t middle = low + (high - low) / 2;
+		NodeType* t = nodes[middle];
+		t->leftNode.store(LinkBalanced(nodes, low, middle), std::memory_order_relaxed);
+		t->rightNode.store(LinkBalanced(nodes, middle + 1, high), std::memory_order_relaxed);
+		return t;
+	}
+};
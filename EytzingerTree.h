@@ -0,0 +1,233 @@
+/*
+* This file defines the EytzingerTree class, a read-only copy of a Binary Search Tree
+* (BST) that is laid out for fast lookups instead of cheap updates.
+*
+* Searching a BST means following one pointer per level, and each of those pointers
+* leads to a node somewhere else on the heap, so every level usually costs a cache
+* miss that cannot start until the previous one has finished. The EytzingerTree keeps
+* the same values in one flat array, stored in the order a breadth-first walk of a
+* perfectly balanced tree would visit them: the root at index 1, and the children of
+* index k at indices 2k and 2k+1. No pointers are needed to find a child, so:
+*   - the top levels of the tree share a handful of cache lines,
+*   - the search loop has no unpredictable branch (it just computes 2k or 2k+1), and
+*   - the nodes a few levels further down can be prefetched before they are needed.
+*
+* Values are never changed after the array is built. To pick up changes made to the
+* BST, build a new EytzingerTree from it.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows the use of std::min.
+#include <algorithm>
+// Allows the use of size_t.
+#include <cstddef>
+// Allows the use of std::less.
+#include <functional>
+// Allows the use of vectors.
+#include <vector>
+// The BST class this tree is built from.
+#include "BinarySearchTree.h"
+// Allows prefetching on Visual Studio.
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+#pragma endregion Preprocessor Directives
+
+// Define the EytzingerTree class.
+template <typename Key, typename Compare = std::less<Key>>
+class EytzingerTree
+{
+public:
+	/// <summary>
+	/// Constructor for an empty EytzingerTree.
+	/// </summary>
+	EytzingerTree(const Compare& comp = Compare())
+		: compare(comp)
+	{
+		// Intentionally left blank.
+	}
+
+	/// <summary>
+	/// Constructor for an EytzingerTree holding every value of tree, searched with tree's
+	/// comparator. The tree's aggregates (if it has an augmentation) are not copied.
+	/// </summary>
+	/// <param name="tree"> The BST to copy the values and quantities from.</param>
+	template <typename Allocator, typename Augment>
+	explicit EytzingerTree(const BinarySearchTree<Key, Compare, Allocator, Augment>& tree)
+		: compare(tree.Comparator())
+	{
+		Build(tree);
+	}
+
+	/// <summary>
+	/// Replaces the contents of this tree with every value of tree. O(n). The values are
+	/// laid out in tree's order, so tree's comparator is taken over as well.
+	/// </summary>
+	/// <param name="tree"> The BST to copy the values and quantities from.</param>
+	template <typename Allocator, typename Augment>
+	void Build(const BinarySearchTree<Key, Compare, Allocator, Augment>& tree)
+	{
+		compare = tree.Comparator();
+
+		// Collect the values in sorted order first.
+		std::vector<Key> sortedKeys;
+		std::vector<Quantity> sortedQuantities;
+		tree.ForEach([&](const Key& value, Quantity quantity)
+			{
+				sortedKeys.push_back(value);
+				sortedQuantities.push_back(quantity);
+			});
+
+		std::size_t count = sortedKeys.size();
+		keys.clear();
+		quantities.clear();
+		// An empty BST gives an empty array.
+		if (count == 0)
+		{
+			return;
+		}
+		// Index 0 is never used, so that the children of k are always 2k and 2k+1.
+		keys.resize(count + 1, sortedKeys[0]);
+		quantities.assign(count + 1, 0);
+
+		/* Visiting the indices 1 .. count in the INORDER path of the implicit tree
+		* gives the position of each sorted value. Start at the left-most index, then
+		* keep stepping to the in-order successor. */
+		std::size_t k = 1;
+		while (2 * k <= count)
+		{
+			k = 2 * k;
+		}
+		for (std::size_t i = 0; i < count; i++)
+		{
+			keys[k] = std::move(sortedKeys[i]);
+			quantities[k] = sortedQuantities[i];
+
+			// If k has a right child, the successor is the left-most index below it.
+			if (2 * k + 1 <= count)
+			{
+				k = 2 * k + 1;
+				while (2 * k <= count)
+				{
+					k = 2 * k;
+				}
+			}
+			// Else, climb while k is a right child, then once more to its parent.
+			else
+			{
+				while (k & 1)
+				{
+					k >>= 1;
+				}
+				k >>= 1;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Returns the number of distinct values stored.
+	/// </summary>
+	/// <returns></returns>
+	std::size_t Size() const
+	{
+		return keys.empty() ? 0 : keys.size() - 1;
+	}
+
+	/// <summary>
+	/// Returns true if val is stored.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	bool Contains(const Key& val) const
+	{
+		return Count(val) > 0;
+	}
+
+	/// <summary>
+	/// Returns the number of times val was inserted, or 0 if it is not stored.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	Quantity Count(const Key& val) const
+	{
+		std::size_t k = LowerBoundIndex(val);
+		// The lower bound is val itself only if val is not smaller than it.
+		if (k != 0 && !compare(val, keys[k]))
+		{
+			return quantities[k];
+		}
+		return 0;
+	}
+
+	/// <summary>
+	/// Returns a pointer to the smallest stored value that is not less than val, or
+	/// nullptr if every stored value is less than val.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	const Key* LowerBound(const Key& val) const
+	{
+		std::size_t k = LowerBoundIndex(val);
+		return (k != 0) ? &keys[k] : nullptr;
+	}
+
+private:
+	// The values, in breadth-first order starting at index 1.
+	std::vector<Key> keys;
+	// The quantity of the value at the same index in keys.
+	std::vector<Quantity> quantities;
+	// Decides whether one value is smaller than another.
+	Compare compare;
+
+	// How many values fit in a 64-byte cache line. The descendants of k that are
+	// log2(KeysPerCacheLine) levels down sit side by side starting at k * this, so
+	// prefetching that one address loads all of them at once.
+	static constexpr std::size_t KeysPerCacheLine = (sizeof(Key) < 64) ? 64 / sizeof(Key) : 1;
+
+	/// <summary>
+	/// Returns the index of the smallest value that is not less than val, or 0.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	std::size_t LowerBoundIndex(const Key& val) const
+	{
+		std::size_t count = Size();
+		const Key* base = keys.data();
+		std::size_t k = 1;
+
+		/* Go right when the value at k is less than val, else go left. The choice is
+		* turned into 0 or 1 and added in, rather than branched on. */
+		while (k <= count)
+		{
+			// Near the bottom the block is past the end of the array. Forming a pointer
+			// there is undefined, so the index is clamped to the last key instead.
+			Prefetch(base + std::min(k * KeysPerCacheLine, count));
+			k = 2 * k + static_cast<std::size_t>(compare(base[k], val));
+		}
+
+		/* k has now fallen off the bottom of the tree. Each 1 bit at the end of k is a
+		* step to the right (past values less than val), so strip those, and then the
+		* last step to the left, which is where the lower bound was. */
+		while (k & 1)
+		{
+			k >>= 1;
+		}
+		return k >> 1;
+	}
+
+	/// <summary>
+	/// Asks the CPU to start loading the cache line at address, without waiting.
+	/// </summary>
+	/// <param name="address"> An address inside the array. Prefetching never faults, so
+	/// the line does not have to be loaded yet.</param>
+	static void Prefetch(const void* address)
+	{
+#if defined(_MSC_VER)
+		_mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+		__builtin_prefetch(address);
+#endif
+	}
+};
@@ -8,12 +8,34 @@
 #pragma region Preprocessor Directives
 // Includes the AppDriver class.
 #include "AppDriver.h"
+// Includes the BenchmarkDriver class.
+#include "BenchmarkDriver.h"
 #pragma endregion Preprocessor Directives
 
-int main()
+int main(int argc, char* argv[])
 {
+    // If the program was started with --benchmark,
+    if (argc > 1 && std::string(argv[1]) == "--benchmark")
+    {
+        // then skip the showcase and run the benchmarks instead.
+        BenchmarkDriver benchmarkDriver = BenchmarkDriver();
+        benchmarkDriver.Run();
+        return 0;
+    }
+    // If the program was started with --stress (and optionally the chain length),
+    if (argc > 1 && std::string(argv[1]) == "--stress")
+    {
+        // then run the deep tree stress test instead, failing if it did.
+        BenchmarkDriver benchmarkDriver = BenchmarkDriver();
+        bool passed = argc > 2 ? benchmarkDriver.RunStress(std::stoi(argv[2])) : benchmarkDriver.RunStress();
+        return passed ? 0 : 1;
+    }
+
+    // If the program was started with --no-pause, run the showcase without waiting.
+    bool interactive = !(argc > 1 && std::string(argv[1]) == "--no-pause");
+
     // Create an AppDriver object to run the show.
-    AppDriver appDriver = AppDriver();
+    AppDriver appDriver = AppDriver(interactive);
     // Run the Intro scenario, then the RunTests scenario.
     appDriver.Intro();
     appDriver.RunTests();
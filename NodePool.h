@@ -0,0 +1,461 @@
+/*
+* This file defines the NodePool class, which hands out the Nodes used by a Binary
+* Search Tree (BST). Asking the heap for every node one at a time (with "new" and
+* "delete") is slow and scatters the nodes all over memory, so by default the pool
+* carves nodes out of large blocks of memory called slabs instead.
+*
+* Nodes that are freed are kept on a free list (linked together through the memory
+* the nodes used to live in) and handed out again before any fresh memory is used.
+* Clearing a tree does not need to visit its nodes at all: the pool can simply forget
+* every node it has handed out and start again from the beginning of its first slab.
+*
+* The pool can also run in Heap mode, where it asks for every node on its own. This
+* is mostly kept around so the two can be compared.
+*
+* Either way, the memory itself comes from Allocator, which is rebound to NodeType.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows for certain math functions.
+#include <algorithm>
+// Allows the use of size_t.
+#include <cstddef>
+// Allows the use of std::allocator and std::allocator_traits.
+#include <memory>
+// Allows the use of placement new.
+#include <new>
+// Allows the use of pairs.
+#include <utility>
+// Allows the use of vectors.
+#include <vector>
+#pragma endregion Preprocessor Directives
+
+// How a Binary Search Tree gets the memory for its nodes.
+enum class AllocationMode
+{
+	// Every node is allocated and freed on its own.
+	Heap,
+	// Nodes are carved out of large slabs and recycled through a free list.
+	Arena
+};
+
+// Counters kept by a NodePool, so allocation behaviour can be reported.
+struct NodePoolStats
+{
+	// The number of nodes the tree asked for.
+	std::size_t allocations = 0;
+	// The number of nodes the tree gave back.
+	std::size_t frees = 0;
+	// The number of nodes that were handed out again from the free list.
+	std::size_t recycled = 0;
+	// The number of times the pool had to ask the heap for memory.
+	std::size_t heapAllocations = 0;
+	// The number of bytes the pool is currently holding on to.
+	std::size_t bytesReserved = 0;
+};
+
+// Define the NodePool class.
+template <typename NodeType, typename Allocator = std::allocator<NodeType>>
+class NodePool
+{
+public:
+	/// <summary>
+	/// Constructor for the NodePool.
+	/// </summary>
+	/// <param name="allocationMode"> Whether to use slabs or one allocation per node.</param>
+	/// <param name="alloc"> The allocator the memory comes from.</param>
+	NodePool(AllocationMode allocationMode = AllocationMode::Arena, const Allocator& alloc = Allocator())
+		: mode(allocationMode), allocator(alloc)
+	{
+		// Intentionally left blank.
+	}
+
+	// The pool owns its slabs, so it must never be copied.
+	NodePool(const NodePool&) = delete;
+	NodePool& operator=(const NodePool&) = delete;
+
+	/// <summary>
+	/// Move constructor. Takes over every slab and node of other in O(1), leaving
+	/// other empty.
+	/// </summary>
+	/// <param name="other"> The pool to take over.</param>
+	NodePool(NodePool&& other) noexcept
+		: mode(other.mode), allocator(other.allocator)
+	{
+		Swap(other);
+	}
+
+	/// <summary>
+	/// Move assignment. Returns this pool's slabs to the heap (any nodes still in them
+	/// must already be destroyed), then takes over every slab and node of other.
+	/// </summary>
+	/// <param name="other"> The pool to take over.</param>
+	NodePool& operator=(NodePool&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Release();
+			stats = NodePoolStats();
+			Swap(other);
+		}
+		return *this;
+	}
+
+	/// <summary>
+	/// Swaps everything this pool owns with other in O(1).
+	/// </summary>
+	/// <param name="other"> The pool to swap with.</param>
+	void Swap(NodePool& other) noexcept
+	{
+		std::swap(mode, other.mode);
+		std::swap(allocator, other.allocator);
+		slabs.swap(other.slabs);
+		std::swap(currentSlab, other.currentSlab);
+		std::swap(slabUsed, other.slabUsed);
+		std::swap(freeList, other.freeList);
+		std::swap(stats, other.stats);
+	}
+
+	/// <summary>
+	/// Returns a copy of the allocator the memory comes from.
+	/// </summary>
+	/// <returns></returns>
+	Allocator GetAllocator() const
+	{
+		return Allocator(allocator);
+	}
+
+	// The destructor for the NodePool. Returns every slab to the heap.
+	~NodePool()
+	{
+		Release();
+	}
+
+	/// <summary>
+	/// Returns the allocation mode of this pool.
+	/// </summary>
+	/// <returns></returns>
+	AllocationMode Mode() const
+	{
+		return mode;
+	}
+
+	/// <summary>
+	/// Returns the allocation counters of this pool.
+	/// </summary>
+	/// <returns></returns>
+	const NodePoolStats& Stats() const
+	{
+		return stats;
+	}
+
+	/// <summary>
+	/// Returns the number of nodes handed out that have not been freed yet.
+	/// </summary>
+	/// <returns></returns>
+	std::size_t LiveNodes() const
+	{
+		return stats.allocations - stats.frees;
+	}
+
+	/// <summary>
+	/// Creates a new node, passing args on to the node's constructor.
+	/// </summary>
+	/// <returns></returns>
+	template <typename... Args>
+	NodeType* Allocate(Args&&... args)
+	{
+		stats.allocations++;
+
+		void* memory;
+		// In Heap mode, simply ask the allocator for the node.
+		if (mode == AllocationMode::Heap)
+		{
+			stats.heapAllocations++;
+			NodeType* node = Traits::allocate(allocator, 1);
+			try
+			{
+				return new (static_cast<void*>(node)) NodeType(std::forward<Args>(args)...);
+			}
+			catch (...)
+			{
+				// The node could not be built, so give its memory straight back.
+				Traits::deallocate(allocator, node, 1);
+				throw;
+			}
+		}
+
+		// If a freed node is waiting on the free list,
+		if (freeList != nullptr)
+		{
+			// then reuse it.
+			memory = freeList;
+			freeList = freeList->next;
+			stats.recycled++;
+		}
+		// Else, take the next unused node from the slabs.
+		else
+		{
+			memory = NextFromSlabs();
+		}
+
+		// Construct the node in the memory we found.
+		try
+		{
+			return new (memory) NodeType(std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			// The node could not be built, so put its memory on the free list.
+			PushFree(memory);
+			throw;
+		}
+	}
+
+	/// <summary>
+	/// Destroys a node that was created by Allocate() and recycles its memory.
+	/// </summary>
+	/// <param name="node"> The node to free. Must not be nullptr.</param>
+	void Free(NodeType* node)
+	{
+		stats.frees++;
+
+		// Destroy the node first either way.
+		node->~NodeType();
+
+		// In Heap mode, simply give the node back to the allocator.
+		if (mode == AllocationMode::Heap)
+		{
+			Traits::deallocate(allocator, node, 1);
+			return;
+		}
+
+		// Else, push its memory onto the free list.
+		PushFree(node);
+	}
+
+	/// <summary>
+	/// Destroys a node like Free() does, but without touching the free list or the
+	/// counters, so many threads can call it at once on different nodes. In Arena mode
+	/// the memory is only reclaimed by a later Reset(). In Heap mode it goes straight
+	/// back to the allocator, which must then be thread-safe (std::allocator is).
+	/// Call RecordFrees() once every thread is done.
+	/// </summary>
+	/// <param name="node"> The node to free. Must not be nullptr.</param>
+	void FreeConcurrently(NodeType* node)
+	{
+		node->~NodeType();
+		if (mode == AllocationMode::Heap)
+		{
+			NodeAllocator copy(allocator);
+			Traits::deallocate(copy, node, 1);
+		}
+	}
+
+	/// <summary>
+	/// Adds nodes freed through FreeConcurrently() to the counters.
+	/// </summary>
+	/// <param name="count"> The number of nodes that were freed.</param>
+	void RecordFrees(std::size_t count)
+	{
+		stats.frees += count;
+	}
+
+	/// <summary>
+	/// Makes sure the next count nodes can be handed out without asking the heap more
+	/// than once, by adding a single slab big enough for whatever the spare slabs
+	/// cannot hold. Does nothing in Heap mode.
+	/// </summary>
+	/// <param name="count"> The number of nodes about to be allocated.</param>
+	void Reserve(std::size_t count)
+	{
+		if (mode == AllocationMode::Heap)
+		{
+			return;
+		}
+
+		// Count the room left in the current slab and in the spare slabs after it.
+		std::size_t room = 0;
+		for (std::size_t i = currentSlab; i < slabs.size(); i++)
+		{
+			room += slabs[i].second - ((i == currentSlab) ? slabUsed : 0);
+		}
+
+		// If that is not enough, add one slab for the rest.
+		if (room < count)
+		{
+			std::size_t nodes = std::max(MinSlabNodes, count - room);
+			slabs.push_back({ Traits::allocate(allocator, nodes), nodes });
+			stats.heapAllocations++;
+			stats.bytesReserved += nodes * sizeof(NodeType);
+		}
+	}
+
+	/// <summary>
+	/// Returns true if Adopt(other) can hand other's nodes over to this pool: both
+	/// pools must use the same mode, and memory from one allocator must be freeable by
+	/// the other.
+	/// </summary>
+	/// <param name="other"> The pool whose nodes would be handed over.</param>
+	/// <returns></returns>
+	bool CanAdopt(const NodePool& other) const
+	{
+		return mode == other.mode && allocator == other.allocator;
+	}
+
+	/// <summary>
+	/// Takes over every slab (or, in Heap mode, every node) of other without touching
+	/// a single node, so nodes that were handed out by other can from now on be freed
+	/// into this pool. other is left empty. Costs O(slabs) plus the length of other's
+	/// free list. Only allowed when CanAdopt(other) is true.
+	/// </summary>
+	/// <param name="other"> The pool to take over.</param>
+	void Adopt(NodePool& other)
+	{
+		if (mode == AllocationMode::Arena)
+		{
+			/* Slabs before currentSlab are full, and slabs after it are spare. The slabs
+			* other has used (including its current one, which may only be partly used)
+			* go in front of this pool's current slab, so they count as full from now on.
+			* The part other never used is wasted until the next Reset(). Other's spare
+			* slabs go at the end, so they are used once this pool runs out. */
+			std::size_t used = std::min(other.slabs.size(), other.currentSlab + ((other.slabUsed > 0) ? 1 : 0));
+			slabs.insert(slabs.begin() + currentSlab, other.slabs.begin(), other.slabs.begin() + used);
+			currentSlab += used;
+			slabs.insert(slabs.end(), other.slabs.begin() + used, other.slabs.end());
+			other.slabs.clear();
+
+			// Hang this pool's free list off the end of other's.
+			if (other.freeList != nullptr)
+			{
+				FreeSlot* last = other.freeList;
+				while (last->next != nullptr)
+				{
+					last = last->next;
+				}
+				last->next = freeList;
+				freeList = other.freeList;
+			}
+		}
+
+		// The counters now cover both pools.
+		stats.allocations += other.stats.allocations;
+		stats.frees += other.stats.frees;
+		stats.recycled += other.stats.recycled;
+		stats.heapAllocations += other.stats.heapAllocations;
+		stats.bytesReserved += other.stats.bytesReserved;
+
+		// Leave other empty.
+		other.stats = NodePoolStats();
+		other.freeList = nullptr;
+		other.currentSlab = 0;
+		other.slabUsed = 0;
+	}
+
+	/// <summary>
+	/// Returns true if Reset() can be used to forget every node at once.
+	/// Only Arena pools can do this; Heap pools must Free() each node.
+	/// </summary>
+	/// <returns></returns>
+	bool CanReset() const
+	{
+		return mode == AllocationMode::Arena;
+	}
+
+	/// <summary>
+	/// Forgets every node handed out so far in O(1), without visiting them. The slabs
+	/// are kept so that the next nodes can reuse them. Node destructors are NOT run.
+	/// </summary>
+	void Reset()
+	{
+		stats.frees = stats.allocations;
+		freeList = nullptr;
+		currentSlab = 0;
+		slabUsed = 0;
+	}
+
+	/// <summary>
+	/// Forgets every node handed out so far and returns all slabs to the heap.
+	/// </summary>
+	void Release()
+	{
+		for (std::pair<NodeType*, std::size_t>& slab : slabs)
+		{
+			Traits::deallocate(allocator, slab.first, slab.second);
+		}
+		slabs.clear();
+		stats.bytesReserved = 0;
+		Reset();
+	}
+
+private:
+	// The allocator, rebound so that it hands out whole nodes.
+	using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<NodeType>;
+	using Traits = std::allocator_traits<NodeAllocator>;
+
+	// What a freed node's memory holds while it waits on the free list.
+	struct FreeSlot
+	{
+		// The node freed before this one.
+		FreeSlot* next;
+	};
+	static_assert(sizeof(FreeSlot) <= sizeof(NodeType), "A node must be able to hold a free list link.");
+
+	// The smallest and largest number of nodes in a single slab.
+	static constexpr std::size_t MinSlabNodes = 64;
+	static constexpr std::size_t MaxSlabNodes = 65536;
+
+	// Whether this pool uses slabs or one allocation per node.
+	AllocationMode mode;
+	// Where the memory comes from.
+	NodeAllocator allocator;
+	// Every slab owned by this pool, along with how many nodes fit in it.
+	std::vector<std::pair<NodeType*, std::size_t>> slabs;
+	// The slab that new nodes are currently being taken from.
+	std::size_t currentSlab = 0;
+	// The number of nodes already taken from the current slab.
+	std::size_t slabUsed = 0;
+	// The most recently freed node, which links to the one freed before it.
+	FreeSlot* freeList = nullptr;
+	// The allocation counters.
+	NodePoolStats stats;
+
+	/// <summary>
+	/// Returns memory for one node from the slabs, adding a new slab if they are full.
+	/// </summary>
+	/// <returns></returns>
+	void* NextFromSlabs()
+	{
+		// Move past any slabs that are already full.
+		while (currentSlab < slabs.size() && slabUsed == slabs[currentSlab].second)
+		{
+			currentSlab++;
+			slabUsed = 0;
+		}
+
+		// If every slab is full,
+		if (currentSlab == slabs.size())
+		{
+			// then add a new one, twice as big as the last (within limits).
+			std::size_t nodes = slabs.empty() ? MinSlabNodes : std::min(MaxSlabNodes, slabs.back().second * 2);
+			slabs.push_back({ Traits::allocate(allocator, nodes), nodes });
+			stats.heapAllocations++;
+			stats.bytesReserved += nodes * sizeof(NodeType);
+		}
+
+		return slabs[currentSlab].first + slabUsed++;
+	}
+
+	/// <summary>
+	/// Pushes the memory of one node onto the free list.
+	/// </summary>
+	/// <param name="memory"> The memory of a node that is no longer in use.</param>
+	void PushFree(void* memory)
+	{
+		FreeSlot* freed = new (memory) FreeSlot;
+		freed->next = freeList;
+		freeList = freed;
+	}
+};
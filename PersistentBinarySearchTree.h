@@ -0,0 +1,513 @@
+/*
+* This file defines the PersistentBinarySearchTree class, a Binary Search Tree (BST)
+* whose nodes are never changed once they are built.
+*
+* Instead of changing the nodes on the way to a value, every Insert and Delete builds
+* new copies of just those nodes (the "path" from the root down to the change) and
+* points the copies at the old, untouched subtrees on either side. The result is a
+* new version of the tree that shares almost every node with the old one:
+*
+*   - An update allocates O(log n) new nodes. The tree is always AVL balanced (the
+*     rotations happen while the path is being copied), so the path is always short.
+*   - Snapshot() hands out the current version in O(1), by copying one pointer. A
+*     snapshot never changes, no matter what writers do afterwards, so a reader can
+*     take its time over it without holding any lock.
+*   - Nodes are reference counted (std::shared_ptr), so a node is freed as soon as
+*     the last version that can reach it is dropped.
+*
+* Writers are serialized by a mutex, so only one update is built at a time. Taking a
+* snapshot never waits for that mutex.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows for certain math functions.
+#include <algorithm>
+// Allows the use of size_t.
+#include <cstddef>
+// Allows the use of std::less.
+#include <functional>
+// Allows the use of numeric_limits.
+#include <limits>
+// Allows the use of shared pointers and their atomic load and store.
+#include <memory>
+// Allows the use of mutexes.
+#include <mutex>
+// Allows optional return values.
+#include <optional>
+// Allows the use of vectors.
+#include <vector>
+// The BST class, for the Quantity type.
+#include "BinarySearchTree.h"
+#pragma endregion Preprocessor Directives
+
+// Define the PersistentNode struct.
+template <typename Key>
+struct PersistentNode
+{
+	// The type of pointer that links the nodes. A node lives as long as any version can reach it.
+	using Pointer = std::shared_ptr<const PersistentNode>;
+
+	// The value of this node.
+	Key value;
+	// The number of times this value has been included.
+	Quantity quantity;
+	// The height of the subtree rooted at this node (a leaf has height 1).
+	int height;
+	// The total quantity of every value in the subtree rooted at this node.
+	Quantity subtreeSize;
+	// The node that is to this node's bottom-left.
+	Pointer leftNode;
+	// The node that is to this node's bottom-right.
+	Pointer rightNode;
+
+	/// <summary>
+	/// Constructor for PersistentNode struct. Works out the height and size from the children.
+	/// </summary>
+	/// <param name="val"> The value this node will hold.</param>
+	/// <param name="quant"> The number of times this value has been included.</param>
+	/// <param name="left"> The subtree of smaller values.</param>
+	/// <param name="right"> The subtree of larger values.</param>
+	PersistentNode(const Key& val, Quantity quant, Pointer left, Pointer right)
+		: value(val), quantity(quant), leftNode(std::move(left)), rightNode(std::move(right))
+	{
+		height = 1 + std::max(HeightOf(leftNode), HeightOf(rightNode));
+		subtreeSize = SizeOf(leftNode) + quantity + SizeOf(rightNode);
+	}
+
+	/// <summary>
+	/// Returns the height of the subtree rooted at t (0 for nullptr).
+	/// </summary>
+	static int HeightOf(const Pointer& t)
+	{
+		return (t == nullptr) ? 0 : t->height;
+	}
+
+	/// <summary>
+	/// Returns the total quantity stored in the subtree rooted at t (0 for nullptr).
+	/// </summary>
+	static Quantity SizeOf(const Pointer& t)
+	{
+		return (t == nullptr) ? 0 : t->subtreeSize;
+	}
+};
+
+// Define the PersistentBinarySearchTree class.
+template <typename Key, typename Compare = std::less<Key>>
+class PersistentBinarySearchTree
+{
+public:
+	// The type of node this BST is made of.
+	using NodeType = PersistentNode<Key>;
+	using NodePointer = typename NodeType::Pointer;
+
+	// One version of the tree. It never changes, and can be read from any thread.
+	class Version
+	{
+	public:
+		/// <summary>
+		/// Constructor for an empty Version.
+		/// </summary>
+		Version(const Compare& comp = Compare())
+			: compare(comp)
+		{
+			// Intentionally left blank.
+		}
+
+		/// <summary>
+		/// Returns the total number of values stored, counting every duplicate. O(1).
+		/// </summary>
+		/// <returns></returns>
+		Quantity Size() const
+		{
+			return NodeType::SizeOf(root);
+		}
+
+		/// <summary>
+		/// Returns the height of the BST (0 when empty, 1 for a single node).
+		/// </summary>
+		/// <returns></returns>
+		int Height() const
+		{
+			return NodeType::HeightOf(root);
+		}
+
+		/// <summary>
+		/// Returns the number of times val is stored, or 0.
+		/// </summary>
+		/// <param name="val"> The value to look for.</param>
+		/// <returns></returns>
+		Quantity Count(const Key& val) const
+		{
+			const NodeType* t = root.get();
+			while (t != nullptr)
+			{
+				if (compare(val, t->value))
+				{
+					t = t->leftNode.get();
+				}
+				else if (compare(t->value, val))
+				{
+					t = t->rightNode.get();
+				}
+				else
+				{
+					return t->quantity;
+				}
+			}
+			return 0;
+		}
+
+		/// <summary>
+		/// Returns true if val is stored.
+		/// </summary>
+		/// <param name="val"> The value to look for.</param>
+		/// <returns></returns>
+		bool Contains(const Key& val) const
+		{
+			return Count(val) > 0;
+		}
+
+		/// <summary>
+		/// Returns the smallest stored value, or nothing if this version is empty.
+		/// </summary>
+		/// <returns></returns>
+		std::optional<Key> Minimum() const
+		{
+			const NodeType* t = root.get();
+			if (t == nullptr)
+			{
+				return std::nullopt;
+			}
+			while (t->leftNode != nullptr)
+			{
+				t = t->leftNode.get();
+			}
+			return t->value;
+		}
+
+		/// <summary>
+		/// Returns the largest stored value, or nothing if this version is empty.
+		/// </summary>
+		/// <returns></returns>
+		std::optional<Key> Maximum() const
+		{
+			const NodeType* t = root.get();
+			if (t == nullptr)
+			{
+				return std::nullopt;
+			}
+			while (t->rightNode != nullptr)
+			{
+				t = t->rightNode.get();
+			}
+			return t->value;
+		}
+
+		/// <summary>
+		/// Visits every value in sorted order, calling visit(value, quantity).
+		/// </summary>
+		/// <param name="visit"> Called with each value and its quantity.</param>
+		template <typename Visitor>
+		void ForEach(Visitor&& visit) const
+		{
+			std::vector<const NodeType*> stack;
+			const NodeType* t = root.get();
+			while (t != nullptr || !stack.empty())
+			{
+				// LEFT
+				while (t != nullptr)
+				{
+					stack.push_back(t);
+					t = t->leftNode.get();
+				}
+
+				// NODE
+				t = stack.back();
+				stack.pop_back();
+				visit(t->value, t->quantity);
+
+				// RIGHT
+				t = t->rightNode.get();
+			}
+		}
+
+	private:
+		// Only the tree can make non-empty versions.
+		friend class PersistentBinarySearchTree;
+
+		// The root of this version. nullptr when empty.
+		NodePointer root;
+		// Decides whether one value is smaller than another.
+		Compare compare;
+
+		Version(NodePointer versionRoot, const Compare& comp)
+			: root(std::move(versionRoot)), compare(comp)
+		{
+			// Intentionally left blank.
+		}
+	};
+
+	/// <summary>
+	/// Constructor for the PersistentBinarySearchTree.
+	/// </summary>
+	/// <param name="comp"> The comparator that decides which values are smaller.</param>
+	PersistentBinarySearchTree(const Compare& comp = Compare())
+		: compare(comp)
+	{
+		// Intentionally left blank.
+	}
+
+	// Writers share the mutex, so the tree itself is never copied. Snapshot() is the copy.
+	PersistentBinarySearchTree(const PersistentBinarySearchTree&) = delete;
+	PersistentBinarySearchTree& operator=(const PersistentBinarySearchTree&) = delete;
+
+	/// <summary>
+	/// Returns the current version in O(1). Safe to call from any thread, at any time.
+	/// The version never changes, even while writers keep updating the tree.
+	/// </summary>
+	/// <returns></returns>
+	Version Snapshot() const
+	{
+		return Version(std::atomic_load(&root), compare);
+	}
+
+	/// <summary>
+	/// Insert the value provided into the BST count times. Builds a new version that
+	/// shares every node except the O(log n) on the path to val.
+	/// </summary>
+	/// <param name="val"> The value to be stored in the BST.</param>
+	/// <param name="count"> The number of copies to add.</param>
+	void Insert(const Key& val, Quantity count = 1)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> guard(writeLock);
+		std::atomic_store(&root, Insert(root, val, count));
+	}
+
+	/// <summary>
+	/// Delete one copy of val from the BST.
+	/// Returns true if deletion was successful, false is nothing was removed.
+	/// </summary>
+	/// <param name="val"> The value to be deleted from the BST.</param>
+	bool Delete(const Key& val)
+	{
+		return Delete(val, 1) == 1;
+	}
+
+	/// <summary>
+	/// Delete up to count copies of val from the BST. If nothing is removed, no new
+	/// version is made. Returns the number of copies removed.
+	/// </summary>
+	/// <param name="val"> The value to be deleted from the BST.</param>
+	/// <param name="count"> The most copies to remove.</param>
+	/// <returns></returns>
+	Quantity Delete(const Key& val, Quantity count)
+	{
+		if (count == 0)
+		{
+			return 0;
+		}
+		std::lock_guard<std::mutex> guard(writeLock);
+		Quantity removed = 0;
+		NodePointer updated = Delete(root, val, count, removed);
+		if (removed > 0)
+		{
+			std::atomic_store(&root, std::move(updated));
+		}
+		return removed;
+	}
+
+	/// <summary>
+	/// Delete every copy of val from the BST. Returns the number of copies removed.
+	/// </summary>
+	/// <param name="val"> The value to be deleted from the BST.</param>
+	/// <returns></returns>
+	Quantity EraseAll(const Key& val)
+	{
+		return Delete(val, std::numeric_limits<Quantity>::max());
+	}
+
+	/// <summary>
+	/// Drops the current version. Nodes still reachable from older snapshots stay alive
+	/// until those snapshots are dropped too.
+	/// </summary>
+	void Clear()
+	{
+		std::lock_guard<std::mutex> guard(writeLock);
+		std::atomic_store(&root, NodePointer());
+	}
+
+	/// <summary>
+	/// Returns the total number of values stored, counting every duplicate. O(1).
+	/// </summary>
+	/// <returns></returns>
+	Quantity Size() const
+	{
+		return Snapshot().Size();
+	}
+
+	/// <summary>
+	/// Returns the number of times val is stored, or 0.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	Quantity Count(const Key& val) const
+	{
+		return Snapshot().Count(val);
+	}
+
+	/// <summary>
+	/// Returns true if val is stored.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	bool Contains(const Key& val) const
+	{
+		return Count(val) > 0;
+	}
+
+private:
+	// The root of the current version. Only read and written with atomic_load/atomic_store.
+	NodePointer root;
+	// Decides whether one value is smaller than another.
+	Compare compare;
+	// Only one writer builds a new version at a time.
+	std::mutex writeLock;
+
+	/// <summary>
+	/// Returns a new subtree equal to t with count more copies of val. (Private)
+	/// Only recurses as deep as the AVL tree is tall.
+	/// </summary>
+	NodePointer Insert(const NodePointer& t, const Key& val, Quantity count) const
+	{
+		// If we fell off the tree, val gets a brand new leaf.
+		if (t == nullptr)
+		{
+			return std::make_shared<const NodeType>(val, count, nullptr, nullptr);
+		}
+		if (compare(val, t->value))
+		{
+			return Balance(t->value, t->quantity, Insert(t->leftNode, val, count), t->rightNode);
+		}
+		if (compare(t->value, val))
+		{
+			return Balance(t->value, t->quantity, t->leftNode, Insert(t->rightNode, val, count));
+		}
+		// Else, this node holds val, so its copy gets the extra quantity.
+		return std::make_shared<const NodeType>(t->value, t->quantity + count, t->leftNode, t->rightNode);
+	}
+
+	/// <summary>
+	/// Returns a new subtree equal to t with up to count copies of val removed, and sets
+	/// removed to the number of copies removed. If nothing is removed, t itself is
+	/// returned and nothing is copied. (Private)
+	/// </summary>
+	NodePointer Delete(const NodePointer& t, const Key& val, Quantity count, Quantity& removed) const
+	{
+		// If we fell off the tree, val is not stored.
+		if (t == nullptr)
+		{
+			return t;
+		}
+		if (compare(val, t->value))
+		{
+			NodePointer left = Delete(t->leftNode, val, count, removed);
+			return (removed == 0) ? t : Balance(t->value, t->quantity, std::move(left), t->rightNode);
+		}
+		if (compare(t->value, val))
+		{
+			NodePointer right = Delete(t->rightNode, val, count, removed);
+			return (removed == 0) ? t : Balance(t->value, t->quantity, t->leftNode, std::move(right));
+		}
+
+		// Else, this node holds val. If copies will be left, only the quantity changes.
+		if (t->quantity > count)
+		{
+			removed = count;
+			return std::make_shared<const NodeType>(t->value, t->quantity - count, t->leftNode, t->rightNode);
+		}
+
+		// Else, the node goes. With fewer than 2 children, the other child takes its place.
+		removed = t->quantity;
+		if (t->leftNode == nullptr)
+		{
+			return t->rightNode;
+		}
+		if (t->rightNode == nullptr)
+		{
+			return t->leftNode;
+		}
+		// Else, the minimum of the right side takes its place.
+		const NodeType* minimum = t->rightNode.get();
+		while (minimum->leftNode != nullptr)
+		{
+			minimum = minimum->leftNode.get();
+		}
+		return Balance(minimum->value, minimum->quantity, t->leftNode, RemoveMinimum(t->rightNode));
+	}
+
+	/// <summary>
+	/// Returns a new subtree equal to t without its minimum node. (Private)
+	/// </summary>
+	NodePointer RemoveMinimum(const NodePointer& t) const
+	{
+		if (t->leftNode == nullptr)
+		{
+			return t->rightNode;
+		}
+		return Balance(t->value, t->quantity, RemoveMinimum(t->leftNode), t->rightNode);
+	}
+
+	/// <summary>
+	/// Builds a node for value over left and right, rotating if one side is 2 levels
+	/// taller than the other, and returns the root of the result. Only the nodes that
+	/// move get new copies. (Private)
+	/// </summary>
+	static NodePointer Balance(const Key& value, Quantity quantity, NodePointer left, NodePointer right)
+	{
+		int balance = NodeType::HeightOf(left) - NodeType::HeightOf(right);
+
+		// If the left side is too tall,
+		if (balance > 1)
+		{
+			// then either rotate right once (left-left case),
+			if (NodeType::HeightOf(left->leftNode) >= NodeType::HeightOf(left->rightNode))
+			{
+				return Make(left->value, left->quantity, left->leftNode,
+					Make(value, quantity, left->rightNode, std::move(right)));
+			}
+			// or lift the left side's right child above both (left-right case).
+			const NodeType* middle = left->rightNode.get();
+			return Make(middle->value, middle->quantity,
+				Make(left->value, left->quantity, left->leftNode, middle->leftNode),
+				Make(value, quantity, middle->rightNode, std::move(right)));
+		}
+		// Else, if the right side is too tall, do the mirror image.
+		if (balance < -1)
+		{
+			if (NodeType::HeightOf(right->rightNode) >= NodeType::HeightOf(right->leftNode))
+			{
+				return Make(right->value, right->quantity,
+					Make(value, quantity, std::move(left), right->leftNode), right->rightNode);
+			}
+			const NodeType* middle = right->leftNode.get();
+			return Make(middle->value, middle->quantity,
+				Make(value, quantity, std::move(left), middle->leftNode),
+				Make(right->value, right->quantity, middle->rightNode, right->rightNode));
+		}
+		return Make(value, quantity, std::move(left), std::move(right));
+	}
+
+	/// <summary>
+	/// Allocates a new node. (Private)
+	/// </summary>
+	static NodePointer Make(const Key& value, Quantity quantity, NodePointer left, NodePointer right)
+	{
+		return std::make_shared<const NodeType>(value, quantity, std::move(left), std::move(right));
+	}
+};
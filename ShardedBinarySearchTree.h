@@ -0,0 +1,511 @@
+/*
+* This file defines the ShardedBinarySearchTree class, which splits the values it holds
+* into N ranges ("shards") that each have their own BinarySearchTree and their own lock.
+*
+* A single locked tree lets only one writer in at a time, no matter how far apart the
+* values being written are. Here a write only locks the shard its value falls into, so
+* writers working in different ranges never wait for each other.
+*
+*   - The ranges are decided by N - 1 sorted boundaries. Shard i holds every value from
+*     boundary i - 1 (included) up to boundary i (not included); the first and last shards
+*     have no lower and upper end. Finding the shard is a binary search over the
+*     boundaries, done under a shared lock that is only held for the search.
+*   - Each shard also remembers its own range, guarded by its own lock. After locking the
+*     shard, a write checks that its value still falls inside it, and if a boundary moved
+*     in the meantime it simply searches again.
+*   - Every shard counts the operations it serves. If one shard gets much more than its
+*     share, Rebalance() moves parts of the busiest ranges over to quieter neighbours,
+*     using Split() and Merge() on the two trees, while every other shard keeps working.
+*     Lookups and writes both count, but only a write runs Rebalance() on its own, once
+*     its shard has served rebalanceInterval operations. It can also be called by hand.
+*   - Minimum(), Maximum(), Size() and ForEach() go through the shards in order. They
+*     stop boundaries from moving while they run, so every value is seen exactly once,
+*     but writes to shards that were already visited (or not visited yet) can carry on.
+*
+* Locks are always taken in the same order (layout, then shards one at a time or the two
+* neighbours being rebalanced, then routing), so no two threads can ever wait on each other.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows the use of std::upper_bound and std::max.
+#include <algorithm>
+// Allows the operation counters to be shared between threads.
+#include <atomic>
+// Allows the use of fixed width integers.
+#include <cstdint>
+// Allows the use of std::less.
+#include <functional>
+// Allows the shards to be kept behind pointers (they hold locks, so they cannot move).
+#include <memory>
+// Allows the use of mutexes.
+#include <mutex>
+// Allows optional return values.
+#include <optional>
+// Allows locks that many readers can hold at once.
+#include <shared_mutex>
+// Allows the use of std::invalid_argument.
+#include <stdexcept>
+// Allows the use of vectors.
+#include <vector>
+// Each shard is a BinarySearchTree.
+#include "BinarySearchTree.h"
+#pragma endregion Preprocessor Directives
+
+// Define the ShardedBinarySearchTree class.
+template <typename Key, typename Compare = std::less<Key>>
+class ShardedBinarySearchTree
+{
+public:
+	// The tree every shard keeps its values in.
+	using TreeType = BinarySearchTree<Key, Compare>;
+
+	/// <summary>
+	/// Constructor for the ShardedBinarySearchTree. There is one shard more than there are
+	/// boundaries.
+	/// </summary>
+	/// <param name="shardBoundaries"> The sorted values where one shard ends and the next begins.</param>
+	/// <param name="balanceMode"> The balancing policy of every shard's tree.</param>
+	/// <param name="rebalanceInterval"> How many operations of one shard go by between
+	/// checks for a hot shard. 0 turns automatic rebalancing off.</param>
+	/// <param name="comp"> The comparator that decides which values are smaller.</param>
+	ShardedBinarySearchTree(const std::vector<Key>& shardBoundaries, BalanceMode balanceMode = BalanceMode::AVL,
+		std::uint64_t rebalanceInterval = 1 << 16, const Compare& comp = Compare())
+		: boundaries(shardBoundaries), interval(rebalanceInterval), compare(comp)
+	{
+		// The boundaries must be strictly increasing, or some shard would have no range.
+		for (std::size_t i = 1; i < boundaries.size(); i++)
+		{
+			if (!compare(boundaries[i - 1], boundaries[i]))
+			{
+				throw std::invalid_argument("ShardedBinarySearchTree boundaries must be strictly increasing.");
+			}
+		}
+
+		// Give every shard its tree and its range.
+		for (std::size_t i = 0; i <= boundaries.size(); i++)
+		{
+			shards.push_back(std::make_unique<Shard>(balanceMode, comp));
+			if (i > 0)
+			{
+				shards[i]->low = boundaries[i - 1];
+			}
+			if (i < boundaries.size())
+			{
+				shards[i]->high = boundaries[i];
+			}
+		}
+	}
+
+	// Other threads may be holding the shards' locks, so the tree is never copied or moved.
+	ShardedBinarySearchTree(const ShardedBinarySearchTree&) = delete;
+	ShardedBinarySearchTree& operator=(const ShardedBinarySearchTree&) = delete;
+
+	/// <summary>
+	/// Insert count copies of val. Only locks the shard val falls into. Safe to call from
+	/// any thread.
+	/// </summary>
+	/// <param name="val"> The value to be stored.</param>
+	/// <param name="count"> The number of copies to add.</param>
+	void Insert(const Key& val, Quantity count = 1)
+	{
+		WithShard(val, [&val, count](TreeType& tree)
+			{
+				tree.Insert(val, count);
+				return true;
+			});
+	}
+
+	/// <summary>
+	/// Delete one copy of val. Returns true if a copy was removed. Safe to call from any thread.
+	/// </summary>
+	/// <param name="val"> The value to be deleted.</param>
+	/// <returns></returns>
+	bool Delete(const Key& val)
+	{
+		return WithShard(val, [&val](TreeType& tree)
+			{
+				return tree.Delete(val);
+			});
+	}
+
+	/// <summary>
+	/// Returns the number of times val is stored, or 0. Safe to call from any thread.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	Quantity Count(const Key& val) const
+	{
+		return WithShard(val, [&val](const TreeType& tree)
+			{
+				return tree.Count(val);
+			});
+	}
+
+	/// <summary>
+	/// Returns true if val is stored. Safe to call from any thread.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	bool Contains(const Key& val) const
+	{
+		return Count(val) > 0;
+	}
+
+	/// <summary>
+	/// Returns the smallest stored value, or nothing if every shard is empty.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> Minimum() const
+	{
+		std::shared_lock<std::shared_mutex> layout(layoutLock);
+		// The first shard that holds anything holds the smallest value.
+		for (const std::unique_ptr<Shard>& shard : shards)
+		{
+			std::lock_guard<std::mutex> guard(shard->lock);
+			if (std::optional<Key> value = shard->tree.TryMinimum())
+			{
+				return value;
+			}
+		}
+		return std::nullopt;
+	}
+
+	/// <summary>
+	/// Returns the largest stored value, or nothing if every shard is empty.
+	/// </summary>
+	/// <returns></returns>
+	std::optional<Key> Maximum() const
+	{
+		std::shared_lock<std::shared_mutex> layout(layoutLock);
+		// The last shard that holds anything holds the largest value.
+		for (std::size_t i = shards.size(); i-- > 0;)
+		{
+			std::lock_guard<std::mutex> guard(shards[i]->lock);
+			if (std::optional<Key> value = shards[i]->tree.TryMaximum())
+			{
+				return value;
+			}
+		}
+		return std::nullopt;
+	}
+
+	/// <summary>
+	/// Returns the number of stored values, counting duplicates, added up shard by shard.
+	/// </summary>
+	/// <returns></returns>
+	Quantity Size() const
+	{
+		std::shared_lock<std::shared_mutex> layout(layoutLock);
+		Quantity size = 0;
+		for (const std::unique_ptr<Shard>& shard : shards)
+		{
+			std::lock_guard<std::mutex> guard(shard->lock);
+			size += shard->tree.Size();
+		}
+		return size;
+	}
+
+	/// <summary>
+	/// Visits every stored value in sorted order, calling visit(value, quantity). Each
+	/// shard is locked while it is visited, so visit must not use this tree.
+	/// </summary>
+	/// <param name="visit"> Called with each value and its quantity.</param>
+	template <typename Visitor>
+	void ForEach(Visitor&& visit) const
+	{
+		std::shared_lock<std::shared_mutex> layout(layoutLock);
+		// The shards hold consecutive ranges, so visiting them in order keeps values sorted.
+		for (const std::unique_ptr<Shard>& shard : shards)
+		{
+			std::lock_guard<std::mutex> guard(shard->lock);
+			shard->tree.ForEach(visit);
+		}
+	}
+
+	/// <summary>
+	/// Returns the number of shards.
+	/// </summary>
+	/// <returns></returns>
+	std::size_t ShardCount() const
+	{
+		return shards.size();
+	}
+
+	/// <summary>
+	/// Returns a copy of the boundaries between the shards as they are right now.
+	/// </summary>
+	/// <returns></returns>
+	std::vector<Key> Boundaries() const
+	{
+		std::shared_lock<std::shared_mutex> route(routeLock);
+		return boundaries;
+	}
+
+	/// <summary>
+	/// Returns the number of values (counting duplicates) in each shard, in order.
+	/// </summary>
+	/// <returns></returns>
+	std::vector<Quantity> ShardSizes() const
+	{
+		std::shared_lock<std::shared_mutex> layout(layoutLock);
+		std::vector<Quantity> sizes;
+		for (const std::unique_ptr<Shard>& shard : shards)
+		{
+			std::lock_guard<std::mutex> guard(shard->lock);
+			sizes.push_back(shard->tree.Size());
+		}
+		return sizes;
+	}
+
+	/// <summary>
+	/// Looks for a shard that served more than twice its share of the operations since the
+	/// last check, and if there is one, evens the load out between neighbouring shards: in
+	/// one sweep along the shards, every shard that was much busier than the next one hands
+	/// it part of its range, sized so both would serve about as many operations if the
+	/// traffic were spread evenly over the values. Load only moves between neighbours, so a
+	/// hot range spreads out a few shards further on every call; the sweeps go left and
+	/// right in turn. Only the two shards involved are locked while values move. Returns
+	/// true if a boundary moved, false if nothing was hot enough or another thread is
+	/// rebalancing or reading every shard.
+	/// </summary>
+	/// <returns></returns>
+	bool Rebalance()
+	{
+		// Only one thread rebalances at a time, and never while a walk over every shard
+		// is going on. Rather than wait, let whoever holds the lock finish.
+		std::unique_lock<std::shared_mutex> layout(layoutLock, std::try_to_lock);
+		if (!layout.owns_lock() || shards.size() < 2)
+		{
+			return false;
+		}
+
+		// Read how busy every shard has been, and start counting again from zero.
+		std::vector<std::uint64_t> heat(shards.size());
+		std::uint64_t total = 0;
+		std::uint64_t hottest = 0;
+		for (std::size_t i = 0; i < shards.size(); i++)
+		{
+			heat[i] = shards[i]->operations.exchange(0, std::memory_order_relaxed);
+			total += heat[i];
+			hottest = std::max(hottest, heat[i]);
+		}
+
+		// A shard is only hot if it served more than twice its share.
+		if (hottest * shards.size() <= 2 * total)
+		{
+			return false;
+		}
+
+		// Sweep along the shards, one neighbouring pair at a time.
+		bool moved = false;
+		sweepRight = !sweepRight;
+		for (std::size_t step = 0; step + 1 < shards.size(); step++)
+		{
+			std::size_t left = sweepRight ? step : shards.size() - 2 - step;
+			std::size_t busy = (heat[left] >= heat[left + 1]) ? left : left + 1;
+			std::size_t quiet = (busy == left) ? left + 1 : left;
+			// Leave pairs alone that are already close, so ranges do not go back and forth.
+			if (heat[busy] * 2 <= heat[quiet] * 3 || !MoveRange(busy, quiet, heat[busy], heat[quiet]))
+			{
+				continue;
+			}
+			// The part that moved should now bring its operations along with it.
+			std::uint64_t share = (heat[busy] - heat[quiet]) / 2;
+			heat[busy] -= share;
+			heat[quiet] += share;
+			moved = true;
+		}
+		return moved;
+	}
+
+private:
+	// Define the Shard struct.
+	// One range of values, with its own tree and lock. Each shard gets its own cache lines,
+	// so threads busy in neighbouring shards do not slow each other down.
+	struct alignas(64) Shard
+	{
+		// Guards everything else in the shard.
+		mutable std::mutex lock;
+		// The values in this shard's range.
+		TreeType tree;
+		// The smallest value this shard may hold, or nothing for the first shard.
+		std::optional<Key> low;
+		// The value this shard's range stops just short of, or nothing for the last shard.
+		std::optional<Key> high;
+		// The operations served since the last Rebalance().
+		std::atomic<std::uint64_t> operations{ 0 };
+
+		Shard(BalanceMode balanceMode, const Compare& comp)
+			: tree(balanceMode, AllocationMode::Arena, comp)
+		{
+			// Intentionally left blank.
+		}
+	};
+
+	// The shards, in order of their ranges.
+	std::vector<std::unique_ptr<Shard>> shards;
+	// The values where one shard ends and the next begins. Guarded by routeLock.
+	std::vector<Key> boundaries;
+	// Held shared while a shard is looked up, and exclusively while boundaries change.
+	mutable std::shared_mutex routeLock;
+	// Held shared by walks over every shard, and exclusively by Rebalance().
+	mutable std::shared_mutex layoutLock;
+	// Operations of one shard between checks for a hot shard. 0 means never check.
+	std::uint64_t interval;
+	// Which way the last Rebalance() swept. Guarded by layoutLock.
+	bool sweepRight = false;
+	// Decides whether one value is smaller than another.
+	Compare compare;
+
+	/// <summary>
+	/// Returns the index of the shard val falls into, according to the boundaries right
+	/// now. (Private)
+	/// </summary>
+	/// <param name="val"> The value to place.</param>
+	/// <returns></returns>
+	std::size_t Route(const Key& val) const
+	{
+		std::shared_lock<std::shared_mutex> route(routeLock);
+		return std::upper_bound(boundaries.begin(), boundaries.end(), val, compare) - boundaries.begin();
+	}
+
+	/// <summary>
+	/// Returns true if val falls inside the range of shard. The shard must be locked. (Private)
+	/// </summary>
+	/// <param name="shard"> The shard to check.</param>
+	/// <param name="val"> The value to place.</param>
+	/// <returns></returns>
+	bool Holds(const Shard& shard, const Key& val) const
+	{
+		return (!shard.low || !compare(val, *shard.low)) && (!shard.high || compare(val, *shard.high));
+	}
+
+	/// <summary>
+	/// Locks the shard val falls into and returns apply(tree) for its tree, counting the
+	/// operation towards the shard's heat. If a boundary moved between finding the shard
+	/// and locking it, looks again. Lookups go through here, so they never move a range
+	/// themselves. (Private)
+	/// </summary>
+	/// <param name="val"> The value the operation is about.</param>
+	/// <param name="apply"> The operation to run on the shard's tree.</param>
+	/// <returns></returns>
+	template <typename Apply>
+	auto WithShard(const Key& val, Apply&& apply) const
+	{
+		std::uint64_t served;
+		auto lookup = [&apply](const TreeType& tree) { return apply(tree); };
+		return Serve(val, lookup, served);
+	}
+
+	/// <summary>
+	/// Like the const WithShard(), for writes. Afterwards, checks for a hot shard if this
+	/// one has served at least another interval of operations, lookups included. (Private)
+	/// </summary>
+	/// <param name="val"> The value the operation is about.</param>
+	/// <param name="apply"> The operation to run on the shard's tree.</param>
+	/// <returns></returns>
+	template <typename Apply>
+	auto WithShard(const Key& val, Apply&& apply)
+	{
+		std::uint64_t served;
+		auto result = Serve(val, apply, served);
+		// Lookups also count, so the count may have gone past the interval since the last
+		// write. Rebalance() starts counting from zero again.
+		if (interval != 0 && served >= interval && shards.size() > 1)
+		{
+			Rebalance();
+		}
+		return result;
+	}
+
+	/// <summary>
+	/// Runs apply(tree) on the locked shard val falls into, and sets served to the
+	/// operations that shard has served since the last Rebalance(). (Private)
+	/// </summary>
+	/// <param name="val"> The value the operation is about.</param>
+	/// <param name="apply"> The operation to run on the shard's tree.</param>
+	/// <param name="served"> Receives the shard's operation count.</param>
+	/// <returns></returns>
+	template <typename Apply>
+	auto Serve(const Key& val, Apply& apply, std::uint64_t& served) const
+	{
+		while (true)
+		{
+			Shard& shard = *shards[Route(val)];
+			std::lock_guard<std::mutex> guard(shard.lock);
+			if (!Holds(shard, val))
+			{
+				continue;
+			}
+			auto result = apply(shard.tree);
+			served = shard.operations.fetch_add(1, std::memory_order_relaxed) + 1;
+			return result;
+		}
+	}
+
+	/// <summary>
+	/// Moves part of shard from's range into its neighbour shard to, so that both would
+	/// serve about the same number of operations. The caller holds layoutLock. Returns
+	/// true if a boundary moved. (Private)
+	/// </summary>
+	/// <param name="from"> The index of the hot shard.</param>
+	/// <param name="to"> The index of a neighbouring shard.</param>
+	/// <param name="fromHeat"> The operations the hot shard served.</param>
+	/// <param name="toHeat"> The operations the neighbour served.</param>
+	/// <returns></returns>
+	bool MoveRange(std::size_t from, std::size_t to, std::uint64_t fromHeat, std::uint64_t toHeat)
+	{
+		Shard& source = *shards[from];
+		Shard& target = *shards[to];
+		std::scoped_lock<std::mutex, std::mutex> guard(source.lock, target.lock);
+
+		// Assuming the hot shard's operations are spread evenly over its values, moving
+		// this share of them leaves both shards equally busy.
+		Quantity size = source.tree.Size();
+		if (size < 2)
+		{
+			return false;
+		}
+		Quantity moving = (Quantity)((double)size * (double)(fromHeat - toHeat) / (2.0 * (double)fromHeat));
+		moving = std::min<Quantity>(std::max<Quantity>(moving, 1), size - 1);
+
+		// If the neighbour is to the right, the largest values move: every value from the
+		// cut up. Split() hands them over, and since they are all smaller than anything in
+		// the neighbour, Merge() simply joins the two trees.
+		const Key cut = source.tree.Select((to > from) ? size - moving : moving);
+
+		// With many copies of one value the cut can land on the smallest value of the
+		// shard. Cutting there would move everything (or nothing) and leave one of the
+		// two shards an empty range, so only cut strictly above it. Since the cut is a
+		// stored value, it is then strictly inside the source's range, and no boundary
+		// ever ends up equal to its neighbour.
+		if (!compare(source.tree.Minimum(), cut))
+		{
+			return false;
+		}
+		if (to > from)
+		{
+			TreeType upper = source.tree.Split(cut);
+			target.tree.Merge(upper);
+			source.high = cut;
+			target.low = cut;
+		}
+		// Else, the smallest values move: everything below the cut.
+		else
+		{
+			TreeType upper = source.tree.Split(cut);
+			source.tree.Swap(upper);
+			target.tree.Merge(upper);
+			source.low = cut;
+			target.high = cut;
+		}
+
+		// Finally, let new lookups see the new boundary. Lookups that found the old one
+		// will notice once they get the lock, and look again.
+		std::unique_lock<std::shared_mutex> route(routeLock);
+		boundaries[std::min(from, to)] = cut;
+		return true;
+	}
+};
@@ -0,0 +1,836 @@
+/*
+* This file defines the SimdBPlusTree class, a B+ tree of int values with the same
+* Insert/Delete/Minimum/Maximum/quantity behaviour as a Binary Search Tree (BST) of int,
+* built so that the search inside each node can use SIMD instructions.
+*
+* A BST makes one comparison per node and then follows a pointer to a node that is
+* probably not in the cache. Here every node holds up to Order sorted values in one
+* 64-byte aligned array, so one AVX2 instruction compares the value being looked for
+* against 8 of them at once (16 with AVX-512), and the tree is only a handful of levels
+* deep. Every value sits in a leaf, next to its quantity. The inner nodes only hold
+* copies of values that steer the search: child i holds the values below keys[i], and
+* child i + 1 those from keys[i] up.
+*
+* Which instructions are used is decided when the tree is constructed. CPUID is asked
+* which of AVX-512 and AVX2 this processor (and operating system) supports, and the best
+* one is used. Processors with neither, and compilers or targets without the x86
+* intrinsics, get a scalar binary search instead. The instructions are enabled per
+* function, so no special compiler flags are needed.
+*
+* Nodes that drop below half full after a delete borrow a value from a neighbour or are
+* merged with it, so every node except the root stays at least half full.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows the use of std::lower_bound, std::copy and std::min.
+#include <algorithm>
+// Allows the use of fixed width integers.
+#include <cstdint>
+// Allows the use of size_t.
+#include <cstddef>
+// Allows the use of INT_MAX.
+#include <climits>
+// Allows the use of numeric_limits.
+#include <limits>
+// Allows the use of std::out_of_range.
+#include <stdexcept>
+// Allows the use of std::swap.
+#include <utility>
+// Allows the use of vectors.
+#include <vector>
+// Quantity, the type the BST counts copies of a value with.
+#include "BinarySearchTree.h"
+
+// The SIMD searches are only built for x86 with GCC, Clang or MSVC. GCC and Clang enable
+// the instructions per function with the target attribute; MSVC allows them anywhere.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_BPLUS_X86 1
+#define SIMD_BPLUS_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define SIMD_BPLUS_X86 1
+#define SIMD_BPLUS_TARGET(isa)
+#endif
+
+#ifdef SIMD_BPLUS_X86
+// Allows the use of the AVX2 and AVX-512 intrinsics.
+#include <immintrin.h>
+#ifdef _MSC_VER
+// Allows the use of __cpuid and __cpuidex.
+#include <intrin.h>
+#endif
+#endif
+#pragma endregion Preprocessor Directives
+
+// The instructions a SimdBPlusTree searches its nodes with, from slowest to fastest.
+enum class SimdLevel
+{
+	// A binary search, one comparison at a time.
+	Scalar,
+	// 8 values per comparison.
+	AVX2,
+	// 16 values per comparison.
+	AVX512
+};
+
+// Define the SimdBPlusTree class.
+class SimdBPlusTree
+{
+public:
+	// The most values one node holds.
+	static constexpr int Order = 32;
+
+	/// <summary>
+	/// Constructor for the SimdBPlusTree. Starts empty.
+	/// </summary>
+	/// <param name="requested"> The fastest instructions to search with. Lowered to what
+	/// the processor supports, so the default simply uses the best available.</param>
+	SimdBPlusTree(SimdLevel requested = SimdLevel::AVX512)
+		: level(std::min(requested, DetectSimdLevel()))
+	{
+		// Pick the search that matches the level.
+		switch (level)
+		{
+#ifdef SIMD_BPLUS_X86
+		case SimdLevel::AVX512:
+			countLess = &CountLessAVX512;
+			break;
+		case SimdLevel::AVX2:
+			countLess = &CountLessAVX2;
+			break;
+#endif
+		default:
+			countLess = &CountLessScalar;
+			break;
+		}
+	}
+
+	// The tree owns its nodes, so it cannot be copied. Moving it hands them over.
+	SimdBPlusTree(const SimdBPlusTree&) = delete;
+	SimdBPlusTree& operator=(const SimdBPlusTree&) = delete;
+
+	/// <summary>
+	/// Move constructor. Takes over every node of other, leaving other empty.
+	/// </summary>
+	/// <param name="other"> The tree to take the nodes from.</param>
+	SimdBPlusTree(SimdBPlusTree&& other) noexcept
+		: level(other.level), countLess(other.countLess)
+	{
+		Swap(other);
+	}
+
+	/// <summary>
+	/// Move assignment. Frees this tree's nodes, then takes over those of other.
+	/// </summary>
+	/// <param name="other"> The tree to take the nodes from.</param>
+	/// <returns></returns>
+	SimdBPlusTree& operator=(SimdBPlusTree&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Clear();
+			Swap(other);
+		}
+		return *this;
+	}
+
+	/// <summary>
+	/// Destructor. Frees every node.
+	/// </summary>
+	~SimdBPlusTree()
+	{
+		Clear();
+	}
+
+	/// <summary>
+	/// Exchanges the contents of this tree and other.
+	/// </summary>
+	/// <param name="other"> The tree to swap with.</param>
+	void Swap(SimdBPlusTree& other) noexcept
+	{
+		std::swap(root, other.root);
+		std::swap(height, other.height);
+		std::swap(size, other.size);
+		std::swap(keyCount, other.keyCount);
+		std::swap(level, other.level);
+		std::swap(countLess, other.countLess);
+	}
+
+	/// <summary>
+	/// Returns the fastest instructions this processor supports, asking CPUID.
+	/// </summary>
+	/// <returns></returns>
+	static SimdLevel DetectSimdLevel()
+	{
+#if defined(SIMD_BPLUS_X86) && defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+		{
+			return SimdLevel::Scalar;
+		}
+		// The operating system must also save the wide registers (OSXSAVE, then XCR0).
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) == 0)
+		{
+			return SimdLevel::Scalar;
+		}
+		unsigned long long enabled = _xgetbv(0);
+		__cpuidex(info, 7, 0);
+		if ((info[1] & (1 << 16)) != 0 && (enabled & 0xE6) == 0xE6)
+		{
+			return SimdLevel::AVX512;
+		}
+		if ((info[1] & (1 << 5)) != 0 && (enabled & 0x6) == 0x6)
+		{
+			return SimdLevel::AVX2;
+		}
+#elif defined(SIMD_BPLUS_X86)
+		// These run CPUID (and check the operating system supports the registers).
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+		{
+			return SimdLevel::AVX512;
+		}
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return SimdLevel::AVX2;
+		}
+#endif
+		return SimdLevel::Scalar;
+	}
+
+	/// <summary>
+	/// Returns the instructions this tree searches its nodes with.
+	/// </summary>
+	/// <returns></returns>
+	SimdLevel Level() const
+	{
+		return level;
+	}
+
+	/// <summary>
+	/// Insert the value provided into the tree count times.
+	/// </summary>
+	/// <param name="val"> The value to be stored.</param>
+	/// <param name="count"> The number of copies to add.</param>
+	void Insert(int val, Quantity count = 1)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		// An empty tree starts as a single leaf.
+		if (root == nullptr)
+		{
+			root = new LeafNode();
+			height = 1;
+		}
+
+		// Walk down to the leaf val belongs in, remembering the way.
+		PathStep path[MaxHeight];
+		LeafNode* leaf = DescendToLeaf(val, path);
+		int depth = height - 1;
+
+		// If val is already stored, only its quantity goes up.
+		int pos = static_cast<int>(countLess(leaf->keys, leaf->count, val));
+		size += count;
+		if (pos < leaf->count && leaf->keys[pos] == val)
+		{
+			leaf->quantities[pos] += count;
+			return;
+		}
+
+		// Else, make room for it in the leaf.
+		std::copy_backward(leaf->keys + pos, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+		std::copy_backward(leaf->quantities + pos, leaf->quantities + leaf->count, leaf->quantities + leaf->count + 1);
+		leaf->keys[pos] = val;
+		leaf->quantities[pos] = count;
+		leaf->count++;
+		keyCount++;
+		if (leaf->count <= Order)
+		{
+			return;
+		}
+
+		// The leaf is one over full, so its upper half moves to a new leaf, and the
+		// first value of that leaf goes up to the parent to steer searches there.
+		LeafNode* right = new LeafNode();
+		int keep = leaf->count - leaf->count / 2;
+		right->count = leaf->count - keep;
+		std::copy(leaf->keys + keep, leaf->keys + leaf->count, right->keys);
+		std::copy(leaf->quantities + keep, leaf->quantities + leaf->count, right->quantities);
+		leaf->count = keep;
+		right->next = leaf->next;
+		leaf->next = right;
+		int separator = right->keys[0];
+		Node* newChild = right;
+
+		// Add the new node to each parent up the path, splitting every parent that overflows.
+		while (depth > 0)
+		{
+			PathStep step = path[--depth];
+			InnerNode* parent = step.node;
+			int i = step.index;
+			std::copy_backward(parent->keys + i, parent->keys + parent->count, parent->keys + parent->count + 1);
+			std::copy_backward(parent->children + i + 1, parent->children + parent->count + 1, parent->children + parent->count + 2);
+			parent->keys[i] = separator;
+			parent->children[i + 1] = newChild;
+			parent->count++;
+			if (parent->count <= Order)
+			{
+				return;
+			}
+
+			// The middle value moves up, and everything after it goes to a new node.
+			InnerNode* sibling = new InnerNode();
+			int middle = parent->count / 2;
+			separator = parent->keys[middle];
+			sibling->count = parent->count - middle - 1;
+			std::copy(parent->keys + middle + 1, parent->keys + parent->count, sibling->keys);
+			std::copy(parent->children + middle + 1, parent->children + parent->count + 1, sibling->children);
+			parent->count = middle;
+			newChild = sibling;
+		}
+
+		// The root itself was split, so the tree grows a new root above it.
+		InnerNode* top = new InnerNode();
+		top->count = 1;
+		top->keys[0] = separator;
+		top->children[0] = root;
+		top->children[1] = newChild;
+		root = top;
+		height++;
+	}
+
+	/// <summary>
+	/// Delete one copy of val. Returns true if val was stored.
+	/// </summary>
+	/// <param name="val"> The value to be deleted.</param>
+	/// <returns></returns>
+	bool Delete(int val)
+	{
+		return Delete(val, 1) == 1;
+	}
+
+	/// <summary>
+	/// Delete up to count copies of val. Returns the number actually removed. The value
+	/// leaves its leaf once its last copy does.
+	/// </summary>
+	/// <param name="val"> The value to be deleted.</param>
+	/// <param name="count"> The most copies to remove.</param>
+	/// <returns></returns>
+	Quantity Delete(int val, Quantity count)
+	{
+		if (root == nullptr || count == 0)
+		{
+			return 0;
+		}
+		PathStep path[MaxHeight];
+		LeafNode* leaf = DescendToLeaf(val, path);
+
+		// If val is not stored, there is nothing to remove.
+		int pos = static_cast<int>(countLess(leaf->keys, leaf->count, val));
+		if (pos == leaf->count || leaf->keys[pos] != val)
+		{
+			return 0;
+		}
+		// If more copies are stored than are being removed, only the quantity goes down.
+		if (leaf->quantities[pos] > count)
+		{
+			leaf->quantities[pos] -= count;
+			size -= count;
+			return count;
+		}
+
+		// Else, the value leaves the leaf.
+		Quantity removed = leaf->quantities[pos];
+		std::copy(leaf->keys + pos + 1, leaf->keys + leaf->count, leaf->keys + pos);
+		std::copy(leaf->quantities + pos + 1, leaf->quantities + leaf->count, leaf->quantities + pos);
+		leaf->count--;
+		size -= removed;
+		keyCount--;
+		Refill(leaf, path, height - 1);
+		return removed;
+	}
+
+	/// <summary>
+	/// Delete every copy of val. Returns the number of copies removed.
+	/// </summary>
+	/// <param name="val"> The value to be deleted.</param>
+	/// <returns></returns>
+	Quantity EraseAll(int val)
+	{
+		return Delete(val, std::numeric_limits<Quantity>::max());
+	}
+
+	/// <summary>
+	/// Returns the smallest value stored. Throws std::out_of_range if the tree is empty.
+	/// </summary>
+	/// <returns></returns>
+	const int& Minimum() const
+	{
+		if (root == nullptr)
+		{
+			throw std::out_of_range("SimdBPlusTree is empty");
+		}
+		// Follow the first child down to the first leaf.
+		const Node* t = root;
+		for (int depth = 1; depth < height; depth++)
+		{
+			t = static_cast<const InnerNode*>(t)->children[0];
+		}
+		return t->keys[0];
+	}
+
+	/// <summary>
+	/// Returns the largest value stored. Throws std::out_of_range if the tree is empty.
+	/// </summary>
+	/// <returns></returns>
+	const int& Maximum() const
+	{
+		if (root == nullptr)
+		{
+			throw std::out_of_range("SimdBPlusTree is empty");
+		}
+		// Follow the last child down to the last leaf.
+		const Node* t = root;
+		for (int depth = 1; depth < height; depth++)
+		{
+			t = static_cast<const InnerNode*>(t)->children[t->count];
+		}
+		return t->keys[t->count - 1];
+	}
+
+	/// <summary>
+	/// Returns the number of times val is stored, or 0.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	Quantity Count(int val) const
+	{
+		if (root == nullptr)
+		{
+			return 0;
+		}
+		const Node* t = root;
+		for (int depth = 1; depth < height; depth++)
+		{
+			t = static_cast<const InnerNode*>(t)->children[ChildFor(t, val)];
+		}
+		const LeafNode* leaf = static_cast<const LeafNode*>(t);
+		int pos = static_cast<int>(countLess(leaf->keys, leaf->count, val));
+		return (pos < leaf->count && leaf->keys[pos] == val) ? leaf->quantities[pos] : 0;
+	}
+
+	/// <summary>
+	/// Returns true if val is stored in the tree.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	bool Contains(int val) const
+	{
+		return Count(val) != 0;
+	}
+
+	/// <summary>
+	/// Returns the total number of values stored, counting every duplicate.
+	/// </summary>
+	/// <returns></returns>
+	Quantity Size() const
+	{
+		return size;
+	}
+
+	/// <summary>
+	/// Returns the number of distinct values stored.
+	/// </summary>
+	/// <returns></returns>
+	std::size_t KeyCount() const
+	{
+		return keyCount;
+	}
+
+	/// <summary>
+	/// Returns the number of levels of nodes (0 when empty). Every leaf is this deep.
+	/// </summary>
+	/// <returns></returns>
+	int Height() const
+	{
+		return height;
+	}
+
+	/// <summary>
+	/// Visits every value in order, calling visit(value, quantity) once per distinct
+	/// value. Walks the chain of leaves from left to right.
+	/// </summary>
+	/// <param name="visit"> Called with each value and its quantity.</param>
+	template <typename Visitor>
+	void ForEach(Visitor&& visit) const
+	{
+		if (root == nullptr)
+		{
+			return;
+		}
+		const Node* t = root;
+		for (int depth = 1; depth < height; depth++)
+		{
+			t = static_cast<const InnerNode*>(t)->children[0];
+		}
+		for (const LeafNode* leaf = static_cast<const LeafNode*>(t); leaf != nullptr; leaf = leaf->next)
+		{
+			for (int i = 0; i < leaf->count; i++)
+			{
+				visit(static_cast<const int&>(leaf->keys[i]), leaf->quantities[i]);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Removes every value and frees every node.
+	/// </summary>
+	void Clear()
+	{
+		if (root == nullptr)
+		{
+			return;
+		}
+		// Free level by level, so no recursion is needed.
+		std::vector<Node*> levelNodes(1, root);
+		for (int depth = 1; depth < height; depth++)
+		{
+			std::vector<Node*> below;
+			for (Node* t : levelNodes)
+			{
+				InnerNode* inner = static_cast<InnerNode*>(t);
+				below.insert(below.end(), inner->children, inner->children + inner->count + 1);
+				delete inner;
+			}
+			levelNodes.swap(below);
+		}
+		for (Node* t : levelNodes)
+		{
+			delete static_cast<LeafNode*>(t);
+		}
+		root = nullptr;
+		height = 0;
+		size = 0;
+		keyCount = 0;
+	}
+
+	// Private members.
+private:
+	// The fewest values a node other than the root may hold.
+	static constexpr int MinKeys = Order / 2;
+	// Room for one value over Order (held briefly before a split), rounded up so that a
+	// 16-wide load never reads past the end of the array.
+	static constexpr int KeySlots = Order + 16;
+	// More levels than any tree could need: each level multiplies the values by at least 17.
+	static constexpr int MaxHeight = 16;
+
+	// The part every node has: its sorted values, aligned for SIMD loads.
+	struct Node
+	{
+		// The values of a leaf, or the values that steer searches in an inner node.
+		alignas(64) int keys[KeySlots] = {};
+		// The number of values in use.
+		int count = 0;
+	};
+
+	// A node at the bottom of the tree. Holds the values themselves and their quantities.
+	struct LeafNode : Node
+	{
+		// quantities[i] is the number of times keys[i] is stored.
+		Quantity quantities[Order + 1] = {};
+		// The leaf holding the next larger values, or nullptr.
+		LeafNode* next = nullptr;
+	};
+
+	// A node above the leaves. Has one more child than it has values.
+	struct InnerNode : Node
+	{
+		// children[i] holds the values from keys[i - 1] up to (but not including) keys[i].
+		Node* children[Order + 2] = {};
+	};
+
+	// One step of the way down: the inner node passed through and the child taken.
+	struct PathStep
+	{
+		InnerNode* node;
+		int index;
+	};
+
+	// The function that counts how many of a node's values are below a value.
+	using CountLessFunction = std::size_t(*)(const int* keys, int count, int val);
+
+	// The root node. nullptr when the tree is empty.
+	Node* root = nullptr;
+	// The number of levels of nodes.
+	int height = 0;
+	// The total number of values stored, counting every duplicate.
+	Quantity size = 0;
+	// The number of distinct values stored.
+	std::size_t keyCount = 0;
+	// The instructions the nodes are searched with.
+	SimdLevel level;
+	// The search for that level.
+	CountLessFunction countLess;
+
+	/// <summary>
+	/// Returns the child of inner node t that val belongs in: the number of its
+	/// values that are not above val.
+	/// </summary>
+	std::size_t ChildFor(const Node* t, int val) const
+	{
+		// "Not above val" is "below val + 1", except for the largest int.
+		return (val == INT_MAX) ? t->count : countLess(t->keys, t->count, val + 1);
+	}
+
+	/// <summary>
+	/// Walks from the root to the leaf val belongs in, storing each inner node passed
+	/// through (and the child taken) in path, and returns the leaf.
+	/// </summary>
+	LeafNode* DescendToLeaf(int val, PathStep* path)
+	{
+		Node* t = root;
+		for (int depth = 0; depth < height - 1; depth++)
+		{
+			InnerNode* inner = static_cast<InnerNode*>(t);
+			int i = static_cast<int>(ChildFor(inner, val));
+			path[depth] = { inner, i };
+			t = inner->children[i];
+		}
+		return static_cast<LeafNode*>(t);
+	}
+
+	/// <summary>
+	/// Called after a value left node t, which is depth levels below the root. If t is
+	/// now under half full, it borrows from or merges with a neighbour, which may leave
+	/// its parent under half full in turn. Finally a root with a single child is removed.
+	/// </summary>
+	void Refill(Node* t, PathStep* path, int depth)
+	{
+		bool isLeaf = true;
+		while (depth > 0 && t->count < MinKeys)
+		{
+			PathStep step = path[--depth];
+			if (isLeaf)
+			{
+				RefillLeaf(step.node, step.index);
+			}
+			else
+			{
+				RefillInner(step.node, step.index);
+			}
+			t = step.node;
+			isLeaf = false;
+		}
+
+		// An inner root left with one child hands the root to that child.
+		if (height > 1 && root->count == 0)
+		{
+			InnerNode* oldRoot = static_cast<InnerNode*>(root);
+			root = oldRoot->children[0];
+			delete oldRoot;
+			height--;
+		}
+		// An empty leaf root means the tree is empty.
+		else if (height == 1 && root->count == 0)
+		{
+			delete static_cast<LeafNode*>(root);
+			root = nullptr;
+			height = 0;
+		}
+	}
+
+	/// <summary>
+	/// Refills the under-full leaf parent->children[i] from a neighbour.
+	/// </summary>
+	void RefillLeaf(InnerNode* parent, int i)
+	{
+		LeafNode* leaf = static_cast<LeafNode*>(parent->children[i]);
+		// If the left neighbour can spare a value, take its largest.
+		if (i > 0)
+		{
+			LeafNode* left = static_cast<LeafNode*>(parent->children[i - 1]);
+			if (left->count > MinKeys)
+			{
+				std::copy_backward(leaf->keys, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+				std::copy_backward(leaf->quantities, leaf->quantities + leaf->count, leaf->quantities + leaf->count + 1);
+				left->count--;
+				leaf->keys[0] = left->keys[left->count];
+				leaf->quantities[0] = left->quantities[left->count];
+				leaf->count++;
+				parent->keys[i - 1] = leaf->keys[0];
+				return;
+			}
+		}
+		// Else, if the right neighbour can spare a value, take its smallest.
+		if (i < parent->count)
+		{
+			LeafNode* right = static_cast<LeafNode*>(parent->children[i + 1]);
+			if (right->count > MinKeys)
+			{
+				leaf->keys[leaf->count] = right->keys[0];
+				leaf->quantities[leaf->count] = right->quantities[0];
+				leaf->count++;
+				std::copy(right->keys + 1, right->keys + right->count, right->keys);
+				std::copy(right->quantities + 1, right->quantities + right->count, right->quantities);
+				right->count--;
+				parent->keys[i] = right->keys[0];
+				return;
+			}
+		}
+
+		// Else, neither can spare one, so the leaf and a neighbour become one leaf.
+		int j = (i > 0) ? i - 1 : i;
+		LeafNode* left = static_cast<LeafNode*>(parent->children[j]);
+		LeafNode* right = static_cast<LeafNode*>(parent->children[j + 1]);
+		std::copy(right->keys, right->keys + right->count, left->keys + left->count);
+		std::copy(right->quantities, right->quantities + right->count, left->quantities + left->count);
+		left->count += right->count;
+		left->next = right->next;
+		delete right;
+		RemoveChild(parent, j);
+	}
+
+	/// <summary>
+	/// Refills the under-full inner node parent->children[i] from a neighbour. Values
+	/// rotate through the parent, since an inner node's values are separators.
+	/// </summary>
+	void RefillInner(InnerNode* parent, int i)
+	{
+		InnerNode* node = static_cast<InnerNode*>(parent->children[i]);
+		// If the left neighbour can spare a child, its last child moves over.
+		if (i > 0)
+		{
+			InnerNode* left = static_cast<InnerNode*>(parent->children[i - 1]);
+			if (left->count > MinKeys)
+			{
+				std::copy_backward(node->keys, node->keys + node->count, node->keys + node->count + 1);
+				std::copy_backward(node->children, node->children + node->count + 1, node->children + node->count + 2);
+				node->keys[0] = parent->keys[i - 1];
+				node->children[0] = left->children[left->count];
+				node->count++;
+				left->count--;
+				parent->keys[i - 1] = left->keys[left->count];
+				return;
+			}
+		}
+		// Else, if the right neighbour can spare a child, its first child moves over.
+		if (i < parent->count)
+		{
+			InnerNode* right = static_cast<InnerNode*>(parent->children[i + 1]);
+			if (right->count > MinKeys)
+			{
+				node->keys[node->count] = parent->keys[i];
+				node->children[node->count + 1] = right->children[0];
+				node->count++;
+				parent->keys[i] = right->keys[0];
+				std::copy(right->keys + 1, right->keys + right->count, right->keys);
+				std::copy(right->children + 1, right->children + right->count + 1, right->children);
+				right->count--;
+				return;
+			}
+		}
+
+		// Else, the node and a neighbour become one node, with the parent's separator
+		// between them coming down.
+		int j = (i > 0) ? i - 1 : i;
+		InnerNode* left = static_cast<InnerNode*>(parent->children[j]);
+		InnerNode* right = static_cast<InnerNode*>(parent->children[j + 1]);
+		left->keys[left->count] = parent->keys[j];
+		std::copy(right->keys, right->keys + right->count, left->keys + left->count + 1);
+		std::copy(right->children, right->children + right->count + 1, left->children + left->count + 1);
+		left->count += right->count + 1;
+		delete right;
+		RemoveChild(parent, j);
+	}
+
+	/// <summary>
+	/// Removes keys[j] and children[j + 1] from parent, after children[j + 1] was merged
+	/// into children[j].
+	/// </summary>
+	static void RemoveChild(InnerNode* parent, int j)
+	{
+		std::copy(parent->keys + j + 1, parent->keys + parent->count, parent->keys + j);
+		std::copy(parent->children + j + 2, parent->children + parent->count + 1, parent->children + j + 1);
+		parent->count--;
+	}
+
+	/// <summary>
+	/// Returns how many of the count sorted keys are below val, with a binary search.
+	/// </summary>
+	static std::size_t CountLessScalar(const int* keys, int count, int val)
+	{
+		return static_cast<std::size_t>(std::lower_bound(keys, keys + count, val) - keys);
+	}
+
+#ifdef SIMD_BPLUS_X86
+	/// <summary>
+	/// Returns how many of the count sorted keys are below val, comparing 8 at a time.
+	/// keys must be 32-byte aligned with room to read up to 7 past count.
+	/// </summary>
+	SIMD_BPLUS_TARGET("avx2")
+	static std::size_t CountLessAVX2(const int* keys, int count, int val)
+	{
+		const __m256i target = _mm256_set1_epi32(val);
+		std::size_t below = 0;
+		for (int i = 0; i < count; i += 8)
+		{
+			// One bit per key that is below val.
+			__m256i block = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys + i));
+			unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(target, block))));
+			// Ignore the slots past count.
+			if (count - i < 8)
+			{
+				mask &= (1u << (count - i)) - 1;
+			}
+			// The keys are sorted, so the bits set are always the lowest ones.
+			below += CountBits(mask);
+			if (mask != 0xFF)
+			{
+				break;
+			}
+		}
+		return below;
+	}
+
+	/// <summary>
+	/// Returns how many of the count sorted keys are below val, comparing 16 at a time.
+	/// keys must be 64-byte aligned with room to read up to 15 past count.
+	/// </summary>
+	SIMD_BPLUS_TARGET("avx512f")
+	static std::size_t CountLessAVX512(const int* keys, int count, int val)
+	{
+		const __m512i target = _mm512_set1_epi32(val);
+		std::size_t below = 0;
+		for (int i = 0; i < count; i += 16)
+		{
+			// Only compare the slots before count.
+			__mmask16 valid = (count - i < 16) ? static_cast<__mmask16>((1u << (count - i)) - 1) : static_cast<__mmask16>(0xFFFF);
+			__m512i block = _mm512_load_si512(keys + i);
+			unsigned mask = _mm512_mask_cmpgt_epi32_mask(valid, target, block);
+			below += CountBits(mask);
+			if (mask != 0xFFFF)
+			{
+				break;
+			}
+		}
+		return below;
+	}
+
+	/// <summary>
+	/// Returns the number of set bits in mask.
+	/// </summary>
+	static std::size_t CountBits(unsigned mask)
+	{
+#ifdef _MSC_VER
+		return __popcnt(mask);
+#else
+		return static_cast<std::size_t>(__builtin_popcount(mask));
+#endif
+	}
+#endif
+};
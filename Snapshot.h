@@ -0,0 +1,507 @@
+/*
+* This file defines the binary snapshot format for a Binary Search Tree (BST), along
+* with the functions that save a BST to a snapshot and load one back in.
+*
+* A snapshot is laid out as:
+*
+*   SnapshotHeader                      magic, version, key size, count, sequence
+*   SnapshotRecord<Key> x count         (value, quantity), sorted by value
+*   std::uint64_t                       checksum of everything before it
+*
+* Every part is 8-byte aligned, so once the file is memory-mapped the records can be
+* used right where they are, as one sorted array. That allows two ways of loading:
+*
+*   - LoadSnapshot() maps the file and hands the sorted records to BuildFromCounts(),
+*     which builds a perfectly balanced BST in linear time, with no sorting and no
+*     rebalancing (instead of millions of Insert() calls).
+*   - SnapshotView answers read-only queries with a binary search over the mapped
+*     records, without building a BST at all. Only the pages that are touched are read,
+*     so opening one only checks the header and the size; Verify() reads the whole file
+*     to check the checksum, for callers that want to know it is intact first.
+*
+* Values are stored exactly as they sit in memory, so Key must be trivially copyable,
+* and a snapshot can only be read on a machine with the same byte order. The sequence
+* number is not used by the snapshot itself. It records how far the saved state got
+* (for example, the last log entry applied), so the caller knows where to resume.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows for certain math functions.
+#include <algorithm>
+// Allows the use of fixed width integers.
+#include <cstdint>
+// Allows the use of memcpy, memset and size_t.
+#include <cstring>
+// Allows files to be written.
+#include <fstream>
+// Allows the use of std::less.
+#include <functional>
+// Allows snapshots to be streamed to any output stream.
+#include <ostream>
+// Allows the use of std::runtime_error.
+#include <stdexcept>
+// Allow for use of strings.
+#include <string>
+// Allows the use of type traits.
+#include <type_traits>
+// Allows the use of std::swap.
+#include <utility>
+// The BST class.
+#include "BinarySearchTree.h"
+// Allows files to be memory-mapped.
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#pragma endregion Preprocessor Directives
+
+// The first bytes of every snapshot.
+static constexpr char SnapshotMagic[8] = { 'B', 'S', 'T', 'S', 'N', 'A', 'P', '\0' };
+// The version of the format written by SaveSnapshot().
+static constexpr std::uint32_t SnapshotVersion = 1;
+
+// The start of every snapshot file.
+struct SnapshotHeader
+{
+	// Always SnapshotMagic.
+	char magic[8];
+	// The format version. Also reads wrong on a machine with a different byte order.
+	std::uint32_t version;
+	// sizeof(Key) of the tree that was saved.
+	std::uint32_t keySize;
+	// The number of records (distinct values) that follow.
+	std::uint64_t count;
+	// A number chosen by the caller, such as the last log entry the snapshot includes.
+	std::uint64_t sequence;
+};
+
+// One stored value and the number of times it was inserted. The members are named
+// like those of std::pair, so records can be handed straight to BuildFromCounts().
+template <typename Key>
+struct SnapshotRecord
+{
+	// The value.
+	Key first;
+	// The quantity.
+	std::uint64_t second;
+};
+
+/// <summary>
+/// Adds size bytes at data to a running 64-bit FNV-1a hash and returns the new hash.
+/// Start with SnapshotChecksumSeed.
+/// </summary>
+/// <param name="hash"> The hash of everything before data.</param>
+/// <param name="data"> The bytes to add.</param>
+/// <param name="size"> The number of bytes to add.</param>
+/// <returns></returns>
+inline std::uint64_t SnapshotChecksum(std::uint64_t hash, const void* data, std::size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (std::size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+static constexpr std::uint64_t SnapshotChecksumSeed = 14695981039346656037ULL;
+
+/// <summary>
+/// Writes tree to out as a snapshot, one record per distinct value, in sorted order.
+/// Records are streamed out in small batches, so no copy of the tree is made.
+/// Throws std::runtime_error if out fails. Returns the number of bytes written.
+/// </summary>
+/// <param name="tree"> The BST to save.</param>
+/// <param name="out"> The stream to write to. Should be opened in binary mode.</param>
+/// <param name="sequence"> Stored in the header and returned by LoadSnapshot().</param>
+/// <returns></returns>
+template <typename Key, typename Compare, typename Allocator, typename Augment>
+std::uint64_t SaveSnapshot(const BinarySearchTree<Key, Compare, Allocator, Augment>& tree, std::ostream& out, std::uint64_t sequence = 0)
+{
+	static_assert(std::is_trivially_copyable<Key>::value, "Snapshots store keys byte for byte, so Key must be trivially copyable.");
+	static_assert(alignof(Key) <= 8, "Snapshot records are only 8-byte aligned.");
+	using Record = SnapshotRecord<Key>;
+
+	// The header needs the number of records before any of them are written.
+	std::uint64_t count = 0;
+	tree.ForEach([&count](const Key&, Quantity)
+		{
+			count++;
+		});
+
+	SnapshotHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+	header.version = SnapshotVersion;
+	header.keySize = static_cast<std::uint32_t>(sizeof(Key));
+	header.count = count;
+	header.sequence = sequence;
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	std::uint64_t checksum = SnapshotChecksum(SnapshotChecksumSeed, &header, sizeof(header));
+
+	// Fill a small batch of records at a time and write each batch out when it is full.
+	// The batch is zeroed first so that padding bytes are always the same.
+	const std::size_t BatchSize = 1024;
+	Record batch[BatchSize];
+	std::size_t used = 0;
+	auto flush = [&]()
+		{
+			out.write(reinterpret_cast<const char*>(batch), used * sizeof(Record));
+			checksum = SnapshotChecksum(checksum, batch, used * sizeof(Record));
+			used = 0;
+		};
+	std::memset(static_cast<void*>(batch), 0, sizeof(batch));
+	tree.ForEach([&](const Key& value, Quantity quantity)
+		{
+			std::memcpy(static_cast<void*>(&batch[used].first), &value, sizeof(Key));
+			batch[used].second = quantity;
+			if (++used == BatchSize)
+			{
+				flush();
+			}
+		});
+	flush();
+
+	out.write(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+	if (!out)
+	{
+		throw std::runtime_error("SaveSnapshot: failed to write the snapshot.");
+	}
+	return sizeof(header) + count * sizeof(Record) + sizeof(checksum);
+}
+
+/// <summary>
+/// Writes tree to the file at path as a snapshot, replacing the file if it exists.
+/// Throws std::runtime_error if the file cannot be written.
+/// </summary>
+/// <param name="tree"> The BST to save.</param>
+/// <param name="path"> The file to write.</param>
+/// <param name="sequence"> Stored in the header and returned by LoadSnapshot().</param>
+/// <returns></returns>
+template <typename Key, typename Compare, typename Allocator, typename Augment>
+std::uint64_t SaveSnapshot(const BinarySearchTree<Key, Compare, Allocator, Augment>& tree, const std::string& path, std::uint64_t sequence = 0)
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		throw std::runtime_error("SaveSnapshot: could not open " + path);
+	}
+	std::uint64_t written = SaveSnapshot(tree, out, sequence);
+	out.close();
+	if (!out)
+	{
+		throw std::runtime_error("SaveSnapshot: failed to finish writing " + path);
+	}
+	return written;
+}
+
+// Define the MappedFile class, a whole file mapped read-only into memory.
+class MappedFile
+{
+public:
+	/// <summary>
+	/// Maps the file at path. Throws std::runtime_error if it cannot be opened.
+	/// </summary>
+	/// <param name="path"> The file to map.</param>
+	explicit MappedFile(const std::string& path)
+	{
+#if defined(_WIN32)
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER fileSize;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize))
+		{
+			Unmap();
+			throw std::runtime_error("MappedFile: could not open " + path);
+		}
+		size = static_cast<std::size_t>(fileSize.QuadPart);
+		// An empty file cannot be mapped, but there is nothing to map anyway.
+		if (size == 0)
+		{
+			return;
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		data = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+		file = open(path.c_str(), O_RDONLY);
+		struct stat status;
+		if (file < 0 || fstat(file, &status) != 0)
+		{
+			Unmap();
+			throw std::runtime_error("MappedFile: could not open " + path);
+		}
+		size = static_cast<std::size_t>(status.st_size);
+		// An empty file cannot be mapped, but there is nothing to map anyway.
+		if (size == 0)
+		{
+			return;
+		}
+		data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data == MAP_FAILED)
+		{
+			data = nullptr;
+		}
+#endif
+		if (data == nullptr)
+		{
+			Unmap();
+			throw std::runtime_error("MappedFile: could not map " + path);
+		}
+	}
+
+	// The mapping is owned by this object, so it must never be copied.
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// The destructor. Unmaps and closes the file.
+	~MappedFile()
+	{
+		Unmap();
+	}
+
+	/// <summary>
+	/// Returns the first byte of the file (nullptr for an empty file).
+	/// </summary>
+	/// <returns></returns>
+	const void* Data() const
+	{
+		return data;
+	}
+
+	/// <summary>
+	/// Returns the size of the file in bytes.
+	/// </summary>
+	/// <returns></returns>
+	std::size_t Size() const
+	{
+		return size;
+	}
+
+private:
+	// The first byte of the mapped file.
+	void* data = nullptr;
+	// The size of the file in bytes.
+	std::size_t size = 0;
+#if defined(_WIN32)
+	// The open file.
+	HANDLE file = INVALID_HANDLE_VALUE;
+	// The file mapping object the view was made from.
+	HANDLE mapping = nullptr;
+#else
+	// The open file descriptor.
+	int file = -1;
+#endif
+
+	/// <summary>
+	/// Releases whatever part of the mapping has been set up so far.
+	/// </summary>
+	void Unmap()
+	{
+#if defined(_WIN32)
+		if (data != nullptr)
+		{
+			UnmapViewOfFile(data);
+		}
+		if (mapping != nullptr)
+		{
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data != nullptr)
+		{
+			munmap(data, size);
+		}
+		if (file >= 0)
+		{
+			close(file);
+		}
+		file = -1;
+#endif
+		data = nullptr;
+	}
+};
+
+// Define the SnapshotView class, which answers queries straight from a mapped snapshot.
+template <typename Key, typename Compare = std::less<Key>>
+class SnapshotView
+{
+public:
+	// The type of record this view is made of.
+	using Record = SnapshotRecord<Key>;
+
+	/// <summary>
+	/// Maps the snapshot at path and checks its header and size, without reading the
+	/// records (call Verify() for that). Throws std::runtime_error if the file cannot be
+	/// mapped, was saved for a different Key, or is truncated.
+	/// </summary>
+	/// <param name="path"> The snapshot file.</param>
+	/// <param name="comp"> Must order values the same way as the tree that was saved.</param>
+	explicit SnapshotView(const std::string& path, const Compare& comp = Compare())
+		: file(path), compare(comp)
+	{
+		static_assert(std::is_trivially_copyable<Key>::value, "Snapshots store keys byte for byte, so Key must be trivially copyable.");
+		const char* bytes = static_cast<const char*>(file.Data());
+		std::size_t size = file.Size();
+
+		// Check the header before trusting anything it says.
+		if (size < sizeof(SnapshotHeader) + sizeof(std::uint64_t))
+		{
+			throw std::runtime_error("SnapshotView: " + path + " is too small to be a snapshot.");
+		}
+		std::memcpy(&header, bytes, sizeof(header));
+		if (std::memcmp(header.magic, SnapshotMagic, sizeof(header.magic)) != 0 || header.version != SnapshotVersion)
+		{
+			throw std::runtime_error("SnapshotView: " + path + " is not a snapshot this version can read.");
+		}
+		if (header.keySize != sizeof(Key))
+		{
+			throw std::runtime_error("SnapshotView: " + path + " was saved with a different key type.");
+		}
+		std::uint64_t recordBytes = size - sizeof(SnapshotHeader) - sizeof(std::uint64_t);
+		if (header.count != recordBytes / sizeof(Record) || recordBytes % sizeof(Record) != 0)
+		{
+			throw std::runtime_error("SnapshotView: " + path + " is truncated.");
+		}
+
+		records = reinterpret_cast<const Record*>(bytes + sizeof(SnapshotHeader));
+	}
+
+	/// <summary>
+	/// Returns true if the checksum at the end of the snapshot matches the header and
+	/// every record. Reads the whole file, so it costs as much as a scan of it.
+	/// </summary>
+	/// <returns></returns>
+	bool Verify() const
+	{
+		// The checksum covers the header and every record.
+		const char* bytes = static_cast<const char*>(file.Data());
+		std::size_t size = file.Size();
+		std::uint64_t stored;
+		std::memcpy(&stored, bytes + size - sizeof(stored), sizeof(stored));
+		return SnapshotChecksum(SnapshotChecksumSeed, bytes, size - sizeof(stored)) == stored;
+	}
+
+	/// <summary>
+	/// Returns the sequence number the snapshot was saved with.
+	/// </summary>
+	/// <returns></returns>
+	std::uint64_t Sequence() const
+	{
+		return header.sequence;
+	}
+
+	/// <summary>
+	/// Returns the number of distinct values in the snapshot.
+	/// </summary>
+	/// <returns></returns>
+	std::size_t Size() const
+	{
+		return static_cast<std::size_t>(header.count);
+	}
+
+	/// <summary>
+	/// Returns the first record. The records are sorted by value.
+	/// </summary>
+	/// <returns></returns>
+	const Record* begin() const
+	{
+		return records;
+	}
+
+	/// <summary>
+	/// Returns one past the last record.
+	/// </summary>
+	/// <returns></returns>
+	const Record* end() const
+	{
+		return records + Size();
+	}
+
+	/// <summary>
+	/// Returns true if val is in the snapshot.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	bool Contains(const Key& val) const
+	{
+		return Count(val) > 0;
+	}
+
+	/// <summary>
+	/// Returns the number of times val was stored when the snapshot was saved, or 0.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	std::uint64_t Count(const Key& val) const
+	{
+		const Record* record = LowerBound(val);
+		// The lower bound is val itself only if val is not smaller than it.
+		if (record != end() && !compare(val, record->first))
+		{
+			return record->second;
+		}
+		return 0;
+	}
+
+	/// <summary>
+	/// Returns the first record whose value is not less than val, or end().
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	const Record* LowerBound(const Key& val) const
+	{
+		return std::lower_bound(begin(), end(), val, [this](const Record& record, const Key& value)
+			{
+				return compare(record.first, value);
+			});
+	}
+
+private:
+	// The mapped snapshot file.
+	MappedFile file;
+	// A copy of the header.
+	SnapshotHeader header;
+	// The first record, inside the mapping.
+	const Record* records = nullptr;
+	// Decides whether one value is smaller than another.
+	Compare compare;
+};
+
+/// <summary>
+/// Adds every value in the snapshot at path to tree in linear time (see BuildFromCounts())
+/// and returns the sequence number it was saved with. Every record is read anyway, so the
+/// checksum is verified first. Throws std::runtime_error if the snapshot cannot be read
+/// or is damaged. Usually called on an empty tree.
+/// </summary>
+/// <param name="tree"> The BST to load into.</param>
+/// <param name="path"> The snapshot file.</param>
+/// <returns></returns>
+template <typename Key, typename Compare, typename Allocator, typename Augment>
+std::uint64_t LoadSnapshot(BinarySearchTree<Key, Compare, Allocator, Augment>& tree, const std::string& path)
+{
+	// The records are in the order of the tree that saved them, so search with its comparator.
+	SnapshotView<Key, Compare> view(path, tree.Comparator());
+	if (!view.Verify())
+	{
+		throw std::runtime_error("LoadSnapshot: " + path + " is damaged (checksum mismatch).");
+	}
+	tree.BuildFromCounts(view.begin(), view.end());
+	return view.Sequence();
+}
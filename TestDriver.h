@@ -0,0 +1,1375 @@
+/*
+* This file defines the TestDriver class, which checks the Binary Search Tree (BST) and
+* the structures built on it against simple reference models (std::map), and counts
+* every check that does not hold. Where the BenchmarkDriver measures how fast the tree
+* is, the TestDriver only cares whether it is right, so it keeps its trees small.
+*
+* Build with the BST_SANITIZE CMake option to also have AddressSanitizer report any
+* node or value that a check leaves behind (leaks) or touches after freeing it.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows use of console (cout).
+#include <iostream>
+// Allows the use of std::upper_bound and std::reverse.
+#include <algorithm>
+// Allows the use of std::log2 and std::ceil.
+#include <cmath>
+// Allows the use of std::function and std::greater.
+#include <functional>
+// Allows values to be read from a single-pass input stream.
+#include <iterator>
+// Allows the use of std::map, the reference every tree is compared with.
+#include <map>
+// Allows the use of random number generation.
+#include <random>
+// Allows values to be written to a stream and read back.
+#include <sstream>
+// Allow for use of strings.
+#include <string>
+// Allows the use of std::out_of_range.
+#include <stdexcept>
+// Allows the use of std::move.
+#include <utility>
+// Allows the use of vectors.
+#include <vector>
+// The BST class.
+#include "BinarySearchTree.h"
+// The augmentations a BST can keep.
+#include "Augment.h"
+// The read-optimized array layout of a BST.
+#include "EytzingerTree.h"
+// The write-ahead log and the durable tree built on it.
+#include "WriteAheadLog.h"
+// The range-partitioned tree with one lock per shard.
+#include "ShardedBinarySearchTree.h"
+// Saving and loading binary snapshots of a BST.
+#include "Snapshot.h"
+// Allows the log files to be measured.
+#include <fstream>
+// Allows the log files to be removed.
+#include <cstdio>
+// The BST that many threads can use at once.
+#include "ConcurrentBinarySearchTree.h"
+// Allows the use of threads.
+#include <thread>
+#pragma endregion Preprocessor Directives
+
+// Define the TestDriver class.
+class TestDriver
+{
+public:
+	/// <summary>
+	/// Constructor for the TestDriver class.
+	/// </summary>
+	/// <param name="seed"> The seed of the random values used by the checks.</param>
+	TestDriver(unsigned seed = 12345) : generator(seed)
+	{
+		// Intentionally left blank.
+	}
+
+	/// <summary>
+	/// Runs every check, prints each one that fails, and returns the number of failures.
+	/// </summary>
+	/// <returns></returns>
+	int Run()
+	{
+		RunOwnershipTests();
+		RunAugmentTests();
+		RunWriteAheadLogTests();
+		RunShardedTests();
+		RunSnapshotTests();
+		RunIteratorTests();
+		RunBalanceModeTests();
+		RunBatchTests();
+		RunQueryTests();
+		RunPopTests();
+		RunWeightedTests();
+		RunBuildTests();
+		RunConcurrentTests();
+		std::cout << checks << " checks, " << failures << " failed\n";
+		return failures;
+	}
+
+	/// <summary>
+	/// Checks the destructor, moves, Clone(), Swap(), Merge() and Split() of the BST, with
+	/// both node pools and both a trivial (int) and a non-trivial (std::string) key.
+	/// </summary>
+	void RunOwnershipTests()
+	{
+		for (AllocationMode allocation : { AllocationMode::Arena, AllocationMode::Heap })
+		{
+			for (BalanceMode balance : BalanceModes)
+			{
+				RunOwnershipTests<int>(balance, allocation, [](int i) { return i; });
+				RunOwnershipTests<std::string>(balance, allocation,
+					[](int i) { return "a string long enough to live on the heap " + std::to_string(100000 + i); });
+			}
+		}
+	}
+
+	/// <summary>
+	/// Checks the range aggregates of augmented trees, and that clearing a tree whose
+	/// aggregates own memory (strings) destroys every one of them.
+	/// </summary>
+	void RunAugmentTests()
+	{
+		for (AllocationMode allocation : { AllocationMode::Arena, AllocationMode::Heap })
+		{
+			BinarySearchTree<int, std::less<int>, std::allocator<int>, SumAugment<int>> sums(BalanceMode::AVL, allocation);
+			BinarySearchTree<int, std::less<int>, std::allocator<int>, ConcatAugment> strings(BalanceMode::AVL, allocation);
+			Model<int> model;
+			for (int round = 0; round < 2; round++)
+			{
+				Fill(sums, model, 1000, 500, [](int i) { return i; });
+				for (const std::pair<const int, Quantity>& entry : model)
+				{
+					strings.Insert(entry.first, entry.second);
+				}
+				std::string name = std::string("augment ") + (allocation == AllocationMode::Arena ? "arena" : "heap");
+				for (int low = 0; low < 500; low += 37)
+				{
+					int high = low + 120;
+					long long sum = 0;
+					std::string concatenated;
+					for (auto entry = model.lower_bound(low); entry != model.end() && entry->first <= high; ++entry)
+					{
+						sum += static_cast<long long>(entry->first) * entry->second;
+						concatenated += ConcatAugment::Of(entry->first, entry->second);
+					}
+					Check(sums.AggregateInRange(low, high) == sum, name + " sum in range " + std::to_string(low));
+					Check(strings.AggregateInRange(low, high) == concatenated, name + " concatenation in range " + std::to_string(low));
+				}
+
+				// An augmented tree can be flattened like any other.
+				EytzingerTree<int> flat(sums);
+				bool counts = flat.Size() == model.size();
+				for (int value = -1; value <= 500; value++)
+				{
+					auto entry = model.find(value);
+					counts = counts && flat.Count(value) == (entry == model.end() ? 0 : entry->second);
+				}
+				Check(counts, name + " flattened into an EytzingerTree");
+
+				// Both Clear() and ParallelClear() must destroy the strings (ASan reports them if not).
+				if (round == 0)
+				{
+					strings.Clear();
+				}
+				else
+				{
+					strings.ParallelClear(2);
+				}
+				sums.Clear();
+				Check(strings.Size() == 0 && strings.Aggregate().empty(), name + " cleared");
+				model.clear();
+			}
+		}
+	}
+
+	/// <summary>
+	/// Checks that a DurableBinarySearchTree rebuilds the same values from its log (and
+	/// from a checkpoint) with every sync policy, and that with Never every record is
+	/// already in the file before the tree is closed.
+	/// </summary>
+	void RunWriteAheadLogTests()
+	{
+		const std::string snapshotPath = "bst_tests_wal.snapshot";
+		const std::string logPath = "bst_tests.wal";
+		const std::pair<SyncPolicy, std::string> policies[] = {
+			{ SyncPolicy::Never, "never" }, { SyncPolicy::Always, "always" },
+			{ SyncPolicy::Group, "group" }, { SyncPolicy::Periodic, "periodic" } };
+		std::uniform_int_distribution<int> pick(0, 199);
+
+		for (const std::pair<SyncPolicy, std::string>& policy : policies)
+		{
+			std::string name = "write-ahead log " + policy.second;
+			std::remove(snapshotPath.c_str());
+			std::remove(logPath.c_str());
+			Model<int> model;
+			{
+				DurableBinarySearchTree<int> durable(snapshotPath, logPath, policy.first);
+				for (int i = 0; i < 1000; i++)
+				{
+					int value = pick(generator);
+					if (i % 3 == 0)
+					{
+						Quantity removed = durable.Delete(value, 2);
+						Quantity expected = std::min<Quantity>(model[value], 2);
+						Check(removed == expected, name + " delete returns what it removed");
+						if ((model[value] -= expected) == 0)
+						{
+							model.erase(value);
+						}
+					}
+					else
+					{
+						durable.Insert(value, (i % 5 == 0) ? 4 : 1);
+						model[value] += (i % 5 == 0) ? 4 : 1;
+					}
+
+					// Half way through, save a checkpoint, so the rest comes from the log.
+					if (i == 500)
+					{
+						durable.Checkpoint();
+					}
+				}
+				CheckValues(durable, model, name + " before reopening");
+
+				// With Never nothing waits in memory, so the file already holds every record.
+				if (policy.first == SyncPolicy::Never)
+				{
+					std::ifstream file(logPath, std::ios::binary | std::ios::ate);
+					Check(static_cast<std::uint64_t>(file.tellg()) == durable.Log().Bytes(), name + " records written before returning");
+				}
+			}
+
+			DurableBinarySearchTree<int> reopened(snapshotPath, logPath, policy.first);
+			CheckValues(reopened, model, name + " after reopening");
+		}
+		std::remove(snapshotPath.c_str());
+		std::remove(logPath.c_str());
+	}
+
+	/// <summary>
+	/// Checks that Rebalance() of a ShardedBinarySearchTree keeps every value, keeps the
+	/// boundaries strictly increasing with every value in the right shard, and stops
+	/// moving boundaries when all the load is on a single value it cannot split.
+	/// </summary>
+	void RunShardedTests()
+	{
+		// All the load on one value: no boundary can help, so none may move.
+		{
+			ShardedBinarySearchTree<int> sharded({ 100, 200, 300 }, BalanceMode::AVL, 0);
+			Model<int> model;
+			for (int value : { 50, 250, 350 })
+			{
+				sharded.Insert(value);
+				model[value]++;
+			}
+			for (int round = 0; round < 4; round++)
+			{
+				for (int i = 0; i < 1000; i++)
+				{
+					sharded.Insert(150);
+					model[150]++;
+				}
+				Check(!sharded.Rebalance(), "sharded single hot key: no boundary moves");
+				CheckSharded(sharded, model, "sharded single hot key");
+			}
+		}
+
+		// The load crowded into a range with a hot value inside it: boundaries move, but
+		// every shard keeps a range of its own.
+		{
+			ShardedBinarySearchTree<int> sharded({ 1000, 2000, 3000, 4000, 5000, 6000, 7000 }, BalanceMode::AVL, 0);
+			Model<int> model;
+			std::uniform_int_distribution<int> pick(0, 7999);
+			std::uniform_int_distribution<int> crowded(2000, 2999);
+			bool moved = false;
+			for (int round = 0; round < 8; round++)
+			{
+				for (int i = 0; i < 2000; i++)
+				{
+					int value = (i % 4 == 0) ? pick(generator) : (i % 4 == 1) ? 2500 : crowded(generator);
+					sharded.Insert(value);
+					model[value]++;
+				}
+				moved = sharded.Rebalance() || moved;
+				CheckSharded(sharded, model, "sharded crowded range round " + std::to_string(round));
+			}
+			Check(moved, "sharded crowded range: boundaries moved");
+		}
+
+		// Lookups heat a shard up, but only the next write moves its range.
+		{
+			ShardedBinarySearchTree<int> sharded({ 100, 200, 300 }, BalanceMode::AVL, 1000);
+			Model<int> model;
+			for (int value = 0; value < 400; value += 2)
+			{
+				sharded.Insert(value);
+				model[value]++;
+			}
+			std::vector<int> before = sharded.Boundaries();
+			for (int i = 0; i < 5000; i++)
+			{
+				sharded.Count(100 + i % 100);
+			}
+			Check(sharded.Boundaries() == before, "sharded lookups: no boundary moves");
+			sharded.Insert(151);
+			model[151]++;
+			Check(sharded.Boundaries() != before, "sharded lookups: the next write moves a boundary");
+			CheckSharded(sharded, model, "sharded lookups");
+		}
+	}
+
+	/// <summary>
+	/// Checks that a snapshot loads back the same values, that a SnapshotView answers the
+	/// same counts, and that a damaged record is only noticed by Verify() and LoadSnapshot().
+	/// </summary>
+	void RunSnapshotTests()
+	{
+		const std::string path = "bst_tests.snapshot";
+		BinarySearchTree<int> tree(BalanceMode::AVL);
+		Model<int> model;
+		Fill(tree, model, 3000, 2000, [](int i) { return i; });
+		SaveSnapshot(tree, path, 42);
+
+		BinarySearchTree<int> loaded(BalanceMode::AVL);
+		Check(LoadSnapshot(loaded, path) == 42, "snapshot sequence");
+		CheckMatches(loaded, model, "snapshot load");
+		{
+			SnapshotView<int> view(path);
+			Check(view.Verify(), "snapshot view: intact");
+			Check(view.Size() == model.size(), "snapshot view: size");
+			bool counts = true;
+			for (int value = -1; value <= 2000; value++)
+			{
+				auto entry = model.find(value);
+				counts = counts && view.Count(value) == (entry == model.end() ? 0 : entry->second);
+			}
+			Check(counts, "snapshot view: counts");
+		}
+
+		// Damage the quantity of the last record.
+		{
+			std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+			file.seekp(-static_cast<std::streamoff>(sizeof(std::uint64_t) * 2), std::ios::end);
+			file.put(0x7F);
+		}
+		{
+			SnapshotView<int> view(path);
+			Check(!view.Verify(), "snapshot view: damage found by Verify()");
+		}
+		bool threw = false;
+		try
+		{
+			BinarySearchTree<int> damaged(BalanceMode::AVL);
+			LoadSnapshot(damaged, path);
+		}
+		catch (const std::runtime_error&)
+		{
+			threw = true;
+		}
+		Check(threw, "snapshot load: damage found");
+
+		// A tree ordered by another comparator saves its records in that order, and loads
+		// and searches them back with the same comparator.
+		{
+			using Descending = std::function<bool(const int&, const int&)>;
+			BinarySearchTree<int, Descending> descending(BalanceMode::AVL, AllocationMode::Arena, std::greater<int>());
+			for (const std::pair<const int, Quantity>& entry : model)
+			{
+				descending.Insert(entry.first, entry.second);
+			}
+			SaveSnapshot(descending, path, 7);
+			BinarySearchTree<int, Descending> reloaded(BalanceMode::AVL, AllocationMode::Arena, std::greater<int>());
+			Check(LoadSnapshot(reloaded, path) == 7, "snapshot descending: sequence");
+			std::vector<std::pair<int, Quantity>> values;
+			reloaded.ForEach([&values](const int& value, Quantity quantity) { values.push_back({ value, quantity }); });
+			Check(values == std::vector<std::pair<int, Quantity>>(model.rbegin(), model.rend()), "snapshot descending: values");
+			SnapshotView<int, Descending> view(path, std::greater<int>());
+			bool counts = true;
+			for (int value = -1; value <= 2000; value++)
+			{
+				auto entry = model.find(value);
+				counts = counts && view.Count(value) == (entry == model.end() ? 0 : entry->second);
+			}
+			Check(counts, "snapshot descending: view counts");
+		}
+		std::remove(path.c_str());
+	}
+
+	/// <summary>
+	/// Checks forward and backward iteration, rbegin()/rend(), --end(), Find() and the
+	/// walks from LowerBound() and UpperBound() against the model, in every balance mode,
+	/// after rounds of inserts and deletes have rotated the nodes (and their parent
+	/// pointers) around.
+	/// </summary>
+	void RunIteratorTests()
+	{
+		for (BalanceMode balance : BalanceModes)
+		{
+			std::string name = "iterators " + ModeName(balance);
+			BinarySearchTree<int> tree(balance);
+			Model<int> model;
+			CheckIterators(tree, model, name + " empty");
+			for (int round = 0; round < 6; round++)
+			{
+				Churn(tree, model, 400, 300);
+				CheckIterators(tree, model, name + " round " + std::to_string(round));
+			}
+
+			// Take the values away from both ends, so the cached ends move too.
+			while (!model.empty())
+			{
+				auto entry = (model.size() % 2 == 0) ? model.begin() : std::prev(model.end());
+				tree.EraseAll(entry->first);
+				model.erase(entry);
+			}
+			CheckIterators(tree, model, name + " emptied");
+		}
+	}
+
+	/// <summary>
+	/// Checks Count(), Minimum()/Maximum(), in-order iteration and Rank() against the
+	/// model after mixed inserts and deletes in every balance mode, and that Splay and
+	/// Frequency pull a value that keeps being inserted up towards the root.
+	/// </summary>
+	void RunBalanceModeTests()
+	{
+		for (BalanceMode balance : BalanceModes)
+		{
+			std::string name = "balance mode " + ModeName(balance);
+			BinarySearchTree<int> tree(balance);
+			Model<int> model;
+			for (int round = 0; round < 5; round++)
+			{
+				Churn(tree, model, 1000, 400);
+				std::string what = name + " round " + std::to_string(round);
+				CheckMatches(tree, model, what);
+				CheckCounts(tree, model, -1, 401, what);
+			}
+		}
+
+		// Splay: whatever was inserted last is at the root, however deep it was before.
+		{
+			BinarySearchTree<int> tree(BalanceMode::Splay);
+			std::vector<int> values(500);
+			for (int i = 0; i < 500; i++)
+			{
+				values[i] = i;
+			}
+			std::shuffle(values.begin(), values.end(), generator);
+			for (int value : values)
+			{
+				tree.Insert(value);
+			}
+			int deepest = values[0];
+			for (int value : values)
+			{
+				deepest = (tree.Depth(value) > tree.Depth(deepest)) ? value : deepest;
+			}
+			Check(tree.Depth(deepest) > 1, "splay: some value below the root");
+			tree.Insert(deepest);
+			Check(tree.Depth(deepest) == 1, "splay: inserted value at the root");
+		}
+
+		// Frequency: sorted inserts make a chain. A value inserted more often than any
+		// other climbs past every parent, all the way up.
+		{
+			BinarySearchTree<int> tree(BalanceMode::Frequency);
+			Model<int> model;
+			for (int i = 0; i < 200; i++)
+			{
+				tree.Insert(i);
+				model[i]++;
+			}
+			Check(tree.Depth(150) == 151, "frequency: sorted inserts make a chain");
+			tree.Insert(150);
+			model[150]++;
+			Check(tree.Depth(150) == 1, "frequency: most frequent value at the root");
+			int before = tree.Depth(40);
+			tree.Insert(40);
+			model[40]++;
+			Check(tree.Depth(40) < before && tree.Depth(40) > 1, "frequency: repeated value moves up, below a more frequent one");
+			tree.Insert(40, 5);
+			model[40] += 5;
+			Check(tree.Depth(40) == 1, "frequency: new most frequent value at the root");
+			CheckMatches(tree, model, "frequency after moving values up");
+		}
+	}
+
+	/// <summary>
+	/// Checks the per-value results of InsertBatch() and DeleteBatch() (batches with
+	/// repeated values, and deletes of values that are not stored) against applying the
+	/// same values one at a time to the model, in every balance mode, and that a large
+	/// sorted batch keeps an AVL tree balanced.
+	/// </summary>
+	void RunBatchTests()
+	{
+		std::uniform_int_distribution<int> pick(0, 299);
+		for (BalanceMode balance : BalanceModes)
+		{
+			std::string name = "batch " + ModeName(balance);
+			BinarySearchTree<int> tree(balance);
+			Model<int> model;
+			for (int round = 0; round < 6; round++)
+			{
+				// A value only counts as new the first time it shows up in the batch.
+				std::vector<int> batch(200);
+				std::vector<bool> expected;
+				for (int& value : batch)
+				{
+					value = pick(generator);
+					expected.push_back(model[value]++ == 0);
+				}
+				Check(tree.InsertBatch(batch) == expected, name + " insert results round " + std::to_string(round));
+				CheckMatches(tree, model, name + " after insert batch " + std::to_string(round));
+
+				// Half of these are not stored, and some are listed more times than they are stored.
+				batch.assign(150, 0);
+				expected.clear();
+				for (int& value : batch)
+				{
+					value = pick(generator) * 2;
+					auto entry = model.find(value);
+					expected.push_back(entry != model.end());
+					if (entry != model.end() && --entry->second == 0)
+					{
+						model.erase(entry);
+					}
+				}
+				Check(tree.DeleteBatch(batch) == expected, name + " delete results round " + std::to_string(round));
+				CheckMatches(tree, model, name + " after delete batch " + std::to_string(round));
+			}
+
+			// Deleting only values that are not stored changes nothing.
+			std::vector<int> missing = { -5, 1000, 1001, -5 };
+			Check(tree.DeleteBatch(missing) == std::vector<bool>(4, false), name + " delete of missing values");
+			CheckMatches(tree, model, name + " after deleting missing values");
+		}
+
+		// A large sorted batch, first into an empty AVL tree, then on top of it.
+		BinarySearchTree<int> tree(BalanceMode::AVL);
+		std::vector<int> sorted(100000);
+		for (int i = 0; i < 100000; i++)
+		{
+			sorted[i] = i * 2;
+		}
+		tree.InsertBatch(sorted);
+		for (int& value : sorted)
+		{
+			value++;
+		}
+		std::vector<bool> results = tree.InsertBatch(sorted);
+		Check(std::count(results.begin(), results.end(), true) == 100000, "batch sorted: every value new");
+		Check(tree.Size() == 200000, "batch sorted: size");
+		// An AVL tree of n nodes is never taller than 1.44 log2(n + 2).
+		Check(tree.Height() <= 1.44 * std::log2(200000.0 + 2), "batch sorted: AVL height bound");
+		Check(tree.Stats().maxBalanceFactor <= 1, "batch sorted: AVL balance");
+	}
+
+	/// <summary>
+	/// Checks Rank(), Select(), CountInRange(), LowerBound() and UpperBound() against the
+	/// model in every balance mode, with values stored many times, including the edges:
+	/// Select(Size()) throws, and a range whose high end is below its low end is empty.
+	/// </summary>
+	void RunQueryTests()
+	{
+		for (BalanceMode balance : BalanceModes)
+		{
+			std::string name = "queries " + ModeName(balance);
+			BinarySearchTree<int> tree(balance);
+			Model<int> model;
+
+			// Nothing is stored yet.
+			Check(tree.Rank(5) == 0 && tree.CountInRange(0, 10) == 0 && tree.LowerBound(5) == tree.end(), name + " empty");
+			Check(Throws([&tree]() { tree.Select(0); }), name + " empty Select(0) throws");
+
+			// Every value is stored several times, so positions fall inside the copies.
+			Churn(tree, model, 1500, 200);
+			tree.Insert(100, 50);
+			model[100] += 50;
+			CheckCounts(tree, model, -1, 201, name);
+
+			// Select(k) is the value whose copies cover position k.
+			std::vector<int> positions;
+			for (const std::pair<const int, Quantity>& entry : model)
+			{
+				positions.insert(positions.end(), entry.second, entry.first);
+			}
+			bool selects = tree.Size() == positions.size();
+			for (std::size_t k = 0; selects && k < positions.size(); k++)
+			{
+				selects = tree.Select(k) == positions[k];
+			}
+			Check(selects, name + " Select() of every position");
+			Check(Throws([&tree]() { tree.Select(tree.Size()); }), name + " Select(Size()) throws");
+			Check(tree.Rank(tree.Select(0)) == 0 && tree.Rank(1000) == tree.Size(), name + " Rank() at the ends");
+
+			// Ranges below, across and above the values, reversed, and of a single value.
+			bool ranges = true;
+			for (int low = -3; low <= 203; low += 7)
+			{
+				for (int high = low - 10; high <= 210; high += 13)
+				{
+					Quantity expected = 0;
+					for (auto entry = model.lower_bound(low); high >= low && entry != model.end() && entry->first <= high; ++entry)
+					{
+						expected += entry->second;
+					}
+					ranges = ranges && tree.CountInRange(low, high) == expected;
+				}
+				auto entry = model.find(low);
+				ranges = ranges && tree.CountInRange(low, low) == ((entry == model.end()) ? 0 : entry->second);
+			}
+			Check(ranges, name + " CountInRange()");
+			Check(tree.CountInRange(150, 50) == 0, name + " CountInRange() with high below low");
+			Check(tree.CountInRange(100, 100) == model[100], name + " CountInRange() of a value stored many times");
+
+			// The bounds land on the first value not less (LowerBound) or greater (UpperBound).
+			bool bounds = true;
+			for (int value = -2; value <= 202; value++)
+			{
+				auto lower = model.lower_bound(value);
+				auto upper = model.upper_bound(value);
+				auto treeLower = tree.LowerBound(value);
+				auto treeUpper = tree.UpperBound(value);
+				bounds = bounds && ((lower == model.end()) ? treeLower == tree.end() : (treeLower != tree.end() && treeLower->value == lower->first && treeLower->quantity == lower->second));
+				bounds = bounds && ((upper == model.end()) ? treeUpper == tree.end() : (treeUpper != tree.end() && treeUpper->value == upper->first));
+			}
+			Check(bounds, name + " LowerBound() and UpperBound()");
+		}
+
+		// A flattened tree is searched in its source tree's order. A default constructed
+		// std::function would throw if it were used instead.
+		using Descending = std::function<bool(const int&, const int&)>;
+		BinarySearchTree<int, Descending> descending(BalanceMode::AVL, AllocationMode::Arena, std::greater<int>());
+		for (int value = 0; value < 100; value += 3)
+		{
+			descending.Insert(value, 1 + value % 2);
+		}
+		EytzingerTree<int, Descending> flat(descending);
+		EytzingerTree<int, Descending> rebuilt;
+		rebuilt.Build(descending);
+		bool flatCounts = true;
+		for (int value = -1; value <= 100; value++)
+		{
+			Quantity expected = (value >= 0 && value % 3 == 0) ? 1 + value % 2 : 0;
+			flatCounts = flatCounts && flat.Count(value) == expected && rebuilt.Count(value) == expected;
+		}
+		Check(flatCounts, "flattened with the tree's comparator: counts");
+		Check(flat.LowerBound(50) != nullptr && *flat.LowerBound(50) == 48, "flattened with the tree's comparator: lower bound");
+	}
+
+	/// <summary>
+	/// Checks PopMin(), PopMax(), TryPopMin() and TryPopMax() against the model in every
+	/// balance mode: a value stored several times is popped once per copy, the cached ends
+	/// move on once the last copy is gone, and an empty tree throws or returns nothing.
+	/// </summary>
+	void RunPopTests()
+	{
+		for (BalanceMode balance : BalanceModes)
+		{
+			std::string name = "pop " + ModeName(balance);
+			BinarySearchTree<int> tree(balance);
+			Model<int> model;
+			Churn(tree, model, 1500, 300);
+
+			// Pop from alternating ends, checking the new ends after every pop.
+			bool pops = true;
+			bool ends = true;
+			for (int i = 0; !model.empty(); i++)
+			{
+				bool fromMin = (i % 3 != 0);
+				auto entry = fromMin ? model.begin() : std::prev(model.end());
+				int expected = entry->first;
+				int popped = (i % 2 == 0) ? (fromMin ? tree.PopMin() : tree.PopMax()) : *(fromMin ? tree.TryPopMin() : tree.TryPopMax());
+				pops = pops && popped == expected;
+				if (--entry->second == 0)
+				{
+					model.erase(entry);
+				}
+				ends = ends && tree.Size() == SizeOf(model)
+					&& tree.TryMinimum() == (model.empty() ? std::optional<int>() : model.begin()->first)
+					&& tree.TryMaximum() == (model.empty() ? std::optional<int>() : model.rbegin()->first)
+					&& (model.empty() || tree.begin()->value == model.begin()->first);
+			}
+			Check(pops, name + " popped values");
+			Check(ends, name + " ends after every pop");
+			CheckMatches(tree, model, name + " emptied");
+
+			// An empty tree has nothing to pop.
+			Check(Throws([&tree]() { tree.PopMin(); }) && Throws([&tree]() { tree.PopMax(); }), name + " empty Pop throws");
+			Check(!tree.TryPopMin() && !tree.TryPopMax(), name + " empty TryPop returns nothing");
+			Check(Throws([&tree]() { tree.Minimum(); }) && Throws([&tree]() { tree.Maximum(); }), name + " empty Minimum/Maximum throw");
+
+			// The tree can be used again, and the ends are found afresh.
+			tree.Insert(7, 2);
+			tree.Insert(3);
+			Check(tree.PopMin() == 3 && tree.Minimum() == 7 && tree.PopMax() == 7 && tree.PopMax() == 7 && !tree.TryMinimum(),
+				name + " refilled");
+		}
+	}
+
+	/// <summary>
+	/// Checks weighted Delete(val, count) and EraseAll() in every balance mode: removing
+	/// part of a value's copies, more copies than are stored (clamped), a value that is not
+	/// stored, and the quantities each one returns.
+	/// </summary>
+	void RunWeightedTests()
+	{
+		for (BalanceMode balance : BalanceModes)
+		{
+			std::string name = "weighted " + ModeName(balance);
+			BinarySearchTree<int> tree(balance);
+			Model<int> model;
+			Churn(tree, model, 800, 200);
+
+			std::uniform_int_distribution<int> pick(-5, 205);
+			std::uniform_int_distribution<int> howMany(0, 6);
+			bool results = true;
+			for (int i = 0; i < 1500; i++)
+			{
+				int value = pick(generator);
+				auto entry = model.find(value);
+				Quantity stored = (entry == model.end()) ? 0 : entry->second;
+				Quantity removed;
+				Quantity expected;
+				if (i % 4 == 0)
+				{
+					removed = tree.EraseAll(value);
+					expected = stored;
+				}
+				else
+				{
+					Quantity count = howMany(generator);
+					removed = tree.Delete(value, count);
+					expected = std::min(stored, count);
+				}
+				results = results && removed == expected;
+				if (stored != 0 && (entry->second -= expected) == 0)
+				{
+					model.erase(entry);
+				}
+
+				// Keep values coming back, some of them many times over.
+				Quantity added = (i % 3 == 0) ? 5 : 1;
+				tree.Insert(value, added);
+				model[value] += added;
+			}
+			Check(results, name + " removed quantities");
+			CheckMatches(tree, model, name + " after weighted deletes");
+
+			// The exact cases, one at a time.
+			tree.Insert(1000, 10);
+			Check(tree.Delete(1000, 4) == 4 && tree.Count(1000) == 6, name + " partial delete");
+			Check(tree.Delete(1000, 0) == 0 && tree.Count(1000) == 6, name + " delete of no copies");
+			Check(tree.Delete(1000, 100) == 6 && !tree.Contains(1000), name + " delete clamped to the stored quantity");
+			Check(tree.Delete(1000, 3) == 0 && tree.EraseAll(1000) == 0, name + " delete of a value that is not stored");
+			tree.Insert(1000, 7);
+			Check(tree.EraseAll(1000) == 7 && !tree.Contains(1000) && tree.TryMaximum() != 1000, name + " EraseAll()");
+			CheckMatches(tree, model, name + " after the exact cases");
+		}
+	}
+
+	/// <summary>
+	/// Checks BuildFrom() and BuildFromCounts() in every balance mode: from sorted and
+	/// unsorted values, from a single-pass input stream, and merged into a tree that
+	/// already holds values. Duplicates must end up as quantities, and the tree must come
+	/// out perfectly balanced, no taller than ceil(log2(n + 1)) for n distinct values.
+	/// </summary>
+	void RunBuildTests()
+	{
+		std::uniform_int_distribution<int> pick(0, 999);
+		for (BalanceMode balance : BalanceModes)
+		{
+			std::string name = "build " + ModeName(balance);
+
+			// Unsorted values, many of them repeated.
+			std::vector<int> values(3000);
+			Model<int> model;
+			for (int& value : values)
+			{
+				value = pick(generator);
+				model[value]++;
+			}
+			BinarySearchTree<int> unsorted(balance);
+			unsorted.BuildFrom(values);
+			CheckBuilt(unsorted, model, name + " unsorted");
+
+			// The same values sorted, so they are used straight from the vector.
+			std::sort(values.begin(), values.end());
+			BinarySearchTree<int> sorted(balance);
+			sorted.BuildFrom(values.begin(), values.end());
+			CheckBuilt(sorted, model, name + " sorted");
+
+			// Values that can only be read once.
+			std::stringstream stream;
+			for (int value : values)
+			{
+				stream << value << ' ';
+			}
+			BinarySearchTree<int> streamed(balance);
+			streamed.BuildFrom(std::istream_iterator<int>(stream), std::istream_iterator<int>());
+			CheckBuilt(streamed, model, name + " from an input stream");
+
+			// Merged into a tree that already holds values, some of them the same.
+			BinarySearchTree<int> merged(balance);
+			Model<int> mergedModel;
+			Churn(merged, mergedModel, 500, 2000);
+			merged.BuildFrom(values);
+			for (const std::pair<const int, Quantity>& entry : model)
+			{
+				mergedModel[entry.first] += entry.second;
+			}
+			CheckBuilt(merged, mergedModel, name + " merged into a tree");
+
+			// Pairs, sorted (a map) and unsorted with the same value listed more than once.
+			BinarySearchTree<int> counted(balance);
+			counted.BuildFromCounts(model.begin(), model.end());
+			CheckBuilt(counted, model, name + " counts from a map");
+			std::vector<std::pair<int, Quantity>> pairs(model.rbegin(), model.rend());
+			pairs.push_back({ 500, 4 });
+			pairs.push_back({ 5000, 2 });
+			pairs.push_back({ 500, 1 });
+			Model<int> pairModel = model;
+			pairModel[500] += 5;
+			pairModel[5000] += 2;
+			BinarySearchTree<int> pairTree(balance);
+			pairTree.BuildFromCounts(pairs.begin(), pairs.end());
+			CheckBuilt(pairTree, pairModel, name + " counts from unsorted pairs");
+
+			// Nothing to build from.
+			BinarySearchTree<int> empty(balance);
+			empty.BuildFrom(std::vector<int>());
+			CheckBuilt(empty, Model<int>(), name + " empty");
+		}
+	}
+
+	/// <summary>
+	/// Checks the ConcurrentBinarySearchTree with several writer threads inserting,
+	/// deleting and counting the same values at once, then checks the totals once they
+	/// are done and again after Compact() has dropped the tombstones.
+	/// </summary>
+	/// <param name="threadCount"> The number of writer threads.</param>
+	/// <param name="valueCount"> The number of values every thread writes.</param>
+	void RunConcurrentTests(int threadCount = 8, int valueCount = 2000)
+	{
+		// Every thread inserts each value 2 to 4 times, in its own order, then deletes
+		// every copy of the even values but only one of the odd ones. A thread only
+		// deletes copies it inserted, so every delete must find something to remove.
+		auto inserted = [](int value) { return Quantity(2 + value % 3); };
+		auto deleted = [&inserted](int value) { return (value % 2 == 0) ? inserted(value) : Quantity(1); };
+
+		ConcurrentBinarySearchTree<int> tree;
+		std::vector<Quantity> removed(threadCount, 0);
+		std::vector<int> missed(threadCount, 0);
+		std::vector<std::thread> writers;
+		for (int w = 0; w < threadCount; w++)
+		{
+			writers.emplace_back([&, w]()
+				{
+					std::vector<int> values(valueCount);
+					for (int i = 0; i < valueCount; i++)
+					{
+						values[i] = i;
+					}
+					std::shuffle(values.begin(), values.end(), std::mt19937(w));
+					for (int value : values)
+					{
+						for (Quantity q = 0; q < inserted(value); q++)
+						{
+							tree.Insert(value);
+						}
+					}
+					for (int value : values)
+					{
+						// This thread's own copies are still there.
+						missed[w] += tree.Count(value) < inserted(value);
+						for (Quantity q = 0; q < deleted(value); q++)
+						{
+							removed[w] += tree.Delete(value);
+						}
+					}
+				});
+		}
+		for (std::thread& writer : writers)
+		{
+			writer.join();
+		}
+
+		Model<int> model;
+		Quantity expectedRemoved = 0;
+		for (int value = 0; value < valueCount; value++)
+		{
+			Quantity left = threadCount * (inserted(value) - deleted(value));
+			if (left > 0)
+			{
+				model[value] = left;
+			}
+			expectedRemoved += threadCount * deleted(value);
+		}
+		Quantity totalRemoved = 0;
+		int totalMissed = 0;
+		for (int w = 0; w < threadCount; w++)
+		{
+			totalRemoved += removed[w];
+			totalMissed += missed[w];
+		}
+		Check(totalRemoved == expectedRemoved, "concurrent: every delete removed a copy");
+		Check(totalMissed == 0, "concurrent: a writer always counts its own copies");
+		CheckConcurrent(tree, model, "concurrent after the writers");
+
+		// Every even value is a tombstone now.
+		Check(tree.Compact() == static_cast<std::size_t>((valueCount + 1) / 2), "concurrent: Compact drops every tombstone");
+		CheckConcurrent(tree, model, "concurrent after Compact");
+		Check(tree.Compact() == 0, "concurrent: nothing left to compact");
+	}
+
+private:
+	// Every balance mode, for the checks that run in each of them.
+	static constexpr BalanceMode BalanceModes[] = { BalanceMode::Unbalanced, BalanceMode::AVL, BalanceMode::Splay, BalanceMode::Frequency };
+
+	// An augmentation whose aggregates own memory: the values of a subtree in order,
+	// each followed by a comma, and long enough that the strings live on the heap.
+	struct ConcatAugment
+	{
+		using Value = std::string;
+
+		static Value Identity()
+		{
+			return Value();
+		}
+
+		static Value Of(int key, std::uint64_t quantity)
+		{
+			return "value " + std::to_string(key) + " x " + std::to_string(quantity) + ",";
+		}
+
+		static Value Combine(const Value& left, const Value& right)
+		{
+			return left + right;
+		}
+	};
+
+	// The reference model: every value and the number of times it is stored.
+	template <typename Key>
+	using Model = std::map<Key, Quantity>;
+
+	// Generates the random values.
+	std::mt19937 generator;
+	// The number of checks run so far.
+	int checks = 0;
+	// The number of checks that did not hold.
+	int failures = 0;
+
+	/// <summary>
+	/// Counts one check, and reports it if it did not hold.
+	/// </summary>
+	/// <param name="holds"> Whether the check held.</param>
+	/// <param name="what"> What was checked, printed if it did not hold.</param>
+	void Check(bool holds, const std::string& what)
+	{
+		checks++;
+		if (!holds)
+		{
+			failures++;
+			std::cout << "FAILED: " << what << "\n";
+		}
+	}
+
+	/// <summary>
+	/// Checks that tree holds exactly the values of model, in order, and that its size
+	/// agrees. Works for anything with ForEach() and Size().
+	/// </summary>
+	/// <param name="tree"> The tree to check.</param>
+	/// <param name="model"> The values it should hold.</param>
+	/// <param name="what"> What is being checked, printed with any failure.</param>
+	template <typename Tree, typename Key>
+	void CheckValues(const Tree& tree, const Model<Key>& model, const std::string& what)
+	{
+		std::vector<std::pair<Key, Quantity>> stored;
+		tree.ForEach([&stored](const Key& value, Quantity quantity) { stored.push_back({ value, quantity }); });
+		Check(stored == std::vector<std::pair<Key, Quantity>>(model.begin(), model.end()), what + ": values");
+
+		Check(tree.Size() == SizeOf(model), what + ": size");
+	}
+
+	/// <summary>
+	/// Checks that a BST holds exactly the values of model, and that its ends and (in
+	/// AVL mode) balance agree.
+	/// </summary>
+	/// <param name="tree"> The tree to check.</param>
+	/// <param name="model"> The values it should hold.</param>
+	/// <param name="what"> What is being checked, printed with any failure.</param>
+	template <typename Tree, typename Key>
+	void CheckMatches(const Tree& tree, const Model<Key>& model, const std::string& what)
+	{
+		CheckValues(tree, model, what);
+		Check(tree.TryMinimum() == (model.empty() ? std::optional<Key>() : model.begin()->first), what + ": minimum");
+		Check(tree.TryMaximum() == (model.empty() ? std::optional<Key>() : model.rbegin()->first), what + ": maximum");
+		if (tree.Mode() == BalanceMode::AVL)
+		{
+			Check(tree.Stats().maxBalanceFactor <= 1, what + ": balance");
+		}
+	}
+
+	/// <summary>
+	/// Checks that a tree built in one pass holds the values of model and is as short as
+	/// any binary tree of that many nodes can be.
+	/// </summary>
+	template <typename Tree>
+	void CheckBuilt(const Tree& tree, const Model<int>& model, const std::string& what)
+	{
+		CheckMatches(tree, model, what);
+		int shortest = static_cast<int>(std::ceil(std::log2(static_cast<double>(model.size()) + 1)));
+		Check(tree.Height() <= shortest, what + ": height " + std::to_string(tree.Height()) + " <= " + std::to_string(shortest));
+	}
+
+	/// <summary>
+	/// Checks every way of iterating over tree against model. (Each probe walks from
+	/// LowerBound() to the end, so keep the trees small.)
+	/// </summary>
+	/// <param name="tree"> The tree to check.</param>
+	/// <param name="model"> The values it should hold.</param>
+	/// <param name="what"> What is being checked, printed with any failure.</param>
+	template <typename Tree, typename Key>
+	void CheckIterators(const Tree& tree, const Model<Key>& model, const std::string& what)
+	{
+		using Entries = std::vector<std::pair<Key, Quantity>>;
+		Entries expected(model.begin(), model.end());
+
+		Entries forward;
+		for (typename Tree::Entry entry : tree)
+		{
+			forward.push_back({ entry.value, entry.quantity });
+		}
+		Check(forward == expected, what + ": forward");
+
+		std::reverse(expected.begin(), expected.end());
+		Entries reverse;
+		for (auto it = tree.rbegin(); it != tree.rend(); ++it)
+		{
+			reverse.push_back({ it->value, it->quantity });
+		}
+		Check(reverse == expected, what + ": rbegin to rend");
+
+		Entries backward;
+		for (auto it = tree.end(); it != tree.begin();)
+		{
+			--it;
+			backward.push_back({ it->value, it->quantity });
+		}
+		Check(backward == expected, what + ": end back to begin");
+		Check((tree.begin() == tree.end()) == model.empty(), what + ": empty range");
+
+		if (!model.empty())
+		{
+			Check((--tree.end())->value == model.rbegin()->first, what + ": --end()");
+			auto it = tree.begin();
+			auto before = it++;
+			Check(before->value == model.begin()->first && (it == tree.end() || it->value == std::next(model.begin())->first),
+				what + ": post-increment");
+		}
+
+		// Probe below, between, on and above the stored values.
+		Key low = model.empty() ? Key() : model.begin()->first;
+		Key high = model.empty() ? Key() : model.rbegin()->first;
+		bool bounds = true;
+		bool finds = true;
+		for (Key probe = low - 1; probe <= high + 1; probe++)
+		{
+			auto found = tree.Find(probe);
+			auto entry = model.find(probe);
+			finds = finds && ((entry == model.end()) ? found == tree.end() : (found != tree.end() && found->quantity == entry->second));
+
+			Entries fromLower;
+			for (auto it = tree.LowerBound(probe); it != tree.end(); ++it)
+			{
+				fromLower.push_back({ it->value, it->quantity });
+			}
+			bounds = bounds && fromLower == Entries(model.lower_bound(probe), model.end());
+			auto upper = tree.UpperBound(probe);
+			auto modelUpper = model.upper_bound(probe);
+			bounds = bounds && ((modelUpper == model.end()) ? upper == tree.end() : (upper != tree.end() && upper->value == modelUpper->first));
+		}
+		Check(finds, what + ": Find()");
+		Check(bounds, what + ": LowerBound() and UpperBound() walks");
+	}
+
+	/// <summary>
+	/// Checks Count() and Rank() of every value from low to high against model.
+	/// </summary>
+	template <typename Tree>
+	void CheckCounts(const Tree& tree, const Model<int>& model, int low, int high, const std::string& what)
+	{
+		bool counts = true;
+		bool ranks = true;
+		Quantity below = 0;
+		for (int value = low; value <= high; value++)
+		{
+			auto entry = model.find(value);
+			Quantity quantity = (entry == model.end()) ? 0 : entry->second;
+			counts = counts && tree.Count(value) == quantity && tree.Contains(value) == (quantity != 0);
+			ranks = ranks && tree.Rank(value) == below;
+			below += quantity;
+		}
+		Check(counts, what + ": Count()");
+		Check(ranks, what + ": Rank()");
+	}
+
+	/// <summary>
+	/// Makes count random changes to tree and model: inserts of one or three copies, and
+	/// deletes of single copies (of values that may or may not be stored).
+	/// </summary>
+	template <typename Tree>
+	void Churn(Tree& tree, Model<int>& model, int count, int limit)
+	{
+		std::uniform_int_distribution<int> pick(0, limit - 1);
+		for (int i = 0; i < count; i++)
+		{
+			int value = pick(generator);
+			if (i % 5 < 3)
+			{
+				Quantity quantity = (i % 7 == 0) ? 3 : 1;
+				tree.Insert(value, quantity);
+				model[value] += quantity;
+			}
+			else
+			{
+				auto entry = model.find(value);
+				Check(tree.Delete(value) == (entry != model.end()), "churn: Delete() result");
+				if (entry != model.end() && --entry->second == 0)
+				{
+					model.erase(entry);
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// Returns the number of values in model, counting duplicates.
+	/// </summary>
+	template <typename Key>
+	static Quantity SizeOf(const Model<Key>& model)
+	{
+		Quantity size = 0;
+		for (const std::pair<const Key, Quantity>& entry : model)
+		{
+			size += entry.second;
+		}
+		return size;
+	}
+
+	/// <summary>
+	/// Returns true if calling run throws std::out_of_range.
+	/// </summary>
+	template <typename Run>
+	static bool Throws(Run run)
+	{
+		try
+		{
+			run();
+		}
+		catch (const std::out_of_range&)
+		{
+			return true;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// Returns the name of a balance mode, for the failure messages.
+	/// </summary>
+	static std::string ModeName(BalanceMode mode)
+	{
+		switch (mode)
+		{
+		case BalanceMode::AVL:
+			return "avl";
+		case BalanceMode::Splay:
+			return "splay";
+		case BalanceMode::Frequency:
+			return "frequency";
+		default:
+			return "unbalanced";
+		}
+	}
+
+	/// <summary>
+	/// Checks that a ShardedBinarySearchTree holds exactly the values of model, that its
+	/// boundaries are strictly increasing, and that every shard holds exactly the values
+	/// of model that fall into its range.
+	/// </summary>
+	/// <param name="sharded"> The tree to check.</param>
+	/// <param name="model"> The values it should hold.</param>
+	/// <param name="what"> What is being checked, printed with any failure.</param>
+	template <typename Key>
+	void CheckSharded(const ShardedBinarySearchTree<Key>& sharded, const Model<Key>& model, const std::string& what)
+	{
+		CheckValues(sharded, model, what);
+		std::vector<Key> boundaries = sharded.Boundaries();
+		for (std::size_t i = 1; i < boundaries.size(); i++)
+		{
+			Check(boundaries[i - 1] < boundaries[i], what + ": boundaries strictly increasing");
+		}
+		std::vector<Quantity> expected(sharded.ShardCount(), 0);
+		for (const std::pair<const Key, Quantity>& entry : model)
+		{
+			expected[std::upper_bound(boundaries.begin(), boundaries.end(), entry.first) - boundaries.begin()] += entry.second;
+		}
+		Check(sharded.ShardSizes() == expected, what + ": every value in its shard");
+	}
+
+	/// <summary>
+	/// Checks that a ConcurrentBinarySearchTree holds exactly the values of model, in
+	/// order, that Count() agrees with model, and that Minimum() and Maximum() skip the
+	/// tombstones.
+	/// </summary>
+	/// <param name="tree"> The tree to check.</param>
+	/// <param name="model"> The values it should hold.</param>
+	/// <param name="what"> What is being checked, printed with any failure.</param>
+	template <typename Key>
+	void CheckConcurrent(const ConcurrentBinarySearchTree<Key>& tree, const Model<Key>& model, const std::string& what)
+	{
+		std::vector<std::pair<Key, Quantity>> values;
+		tree.ForEach([&values](const Key& value, Quantity quantity) { values.push_back({ value, quantity }); });
+		Check(values == std::vector<std::pair<Key, Quantity>>(model.begin(), model.end()), what + ": values");
+		bool counts = true;
+		for (const std::pair<const Key, Quantity>& entry : model)
+		{
+			counts = counts && tree.Count(entry.first) == entry.second;
+		}
+		Check(counts, what + ": counts");
+		Check(model.empty() ? !tree.Minimum() && !tree.Maximum()
+			: tree.Minimum() == model.begin()->first && tree.Maximum() == model.rbegin()->first, what + ": min and max");
+	}
+
+	/// <summary>
+	/// Fills tree and model with count random values below limit, some of them more
+	/// than once.
+	/// </summary>
+	template <typename Tree, typename Key, typename MakeKey>
+	void Fill(Tree& tree, Model<Key>& model, int count, int limit, MakeKey makeKey)
+	{
+		std::uniform_int_distribution<int> pick(0, limit - 1);
+		for (int i = 0; i < count; i++)
+		{
+			Key value = makeKey(pick(generator));
+			Quantity quantity = (i % 7 == 0) ? 3 : 1;
+			tree.Insert(value, quantity);
+			model[value] += quantity;
+		}
+	}
+
+	/// <summary>
+	/// Runs the ownership checks for one key type and one pair of modes.
+	/// </summary>
+	/// <param name="balance"> The balancing policy of every tree.</param>
+	/// <param name="allocation"> Where every tree gets its nodes.</param>
+	/// <param name="makeKey"> Turns an int into a Key, keeping the order.</param>
+	template <typename Key, typename MakeKey>
+	void RunOwnershipTests(BalanceMode balance, AllocationMode allocation, MakeKey makeKey)
+	{
+		using Tree = BinarySearchTree<Key>;
+		std::string name = "ownership " + ModeName(balance) + " "
+			+ (allocation == AllocationMode::Arena ? "arena" : "heap") + (sizeof(Key) == sizeof(int) ? " int" : " string");
+
+		// A tree that is simply destroyed must free everything (ASan reports it if not).
+		{
+			Tree tree(balance, allocation);
+			Model<Key> model;
+			Fill(tree, model, 500, 1000, makeKey);
+			CheckMatches(tree, model, name + " fill");
+		}
+
+		Tree tree(balance, allocation);
+		Model<Key> model;
+		Fill(tree, model, 2000, 1500, makeKey);
+
+		// Clone() copies every value and leaves the original alone.
+		Tree clone = tree.Clone();
+		CheckMatches(clone, model, name + " clone");
+		Check(clone.Height() == tree.Height(), name + " clone: same shape");
+		clone.Insert(makeKey(5000));
+		Check(!tree.Contains(makeKey(5000)), name + " clone: independent");
+		clone.Delete(makeKey(5000));
+
+		// Moving takes every node and leaves the source empty but usable.
+		Tree moved(std::move(clone));
+		CheckMatches(moved, model, name + " move construct");
+		CheckMatches(clone, Model<Key>(), name + " moved-from");
+		clone.Insert(makeKey(1));
+		CheckMatches(clone, Model<Key>{ { makeKey(1), 1 } }, name + " moved-from reuse");
+
+		// Move assignment frees what the target held before.
+		clone = std::move(moved);
+		CheckMatches(clone, model, name + " move assign");
+		CheckMatches(moved, Model<Key>(), name + " move-assigned-from");
+
+		// Swap() trades the contents both ways.
+		Tree other(balance, allocation);
+		Model<Key> otherModel;
+		Fill(other, otherModel, 300, 1500, makeKey);
+		swap(clone, other);
+		CheckMatches(clone, otherModel, name + " swap (left)");
+		CheckMatches(other, model, name + " swap (right)");
+
+		// Merge() of values that are all larger joins the trees.
+		Tree above(balance, allocation);
+		Model<Key> merged = model;
+		for (int i = 0; i < 400; i++)
+		{
+			above.Insert(makeKey(2000 + i), 2);
+			merged[makeKey(2000 + i)] += 2;
+		}
+		other.Merge(above);
+		CheckMatches(other, merged, name + " merge (disjoint)");
+		CheckMatches(above, Model<Key>(), name + " merged-from (disjoint)");
+
+		// Merge() of overlapping values adds up the quantities of values on both sides.
+		for (const std::pair<const Key, Quantity>& entry : otherModel)
+		{
+			merged[entry.first] += entry.second;
+		}
+		other.Merge(clone);
+		CheckMatches(other, merged, name + " merge (overlapping)");
+		CheckMatches(clone, Model<Key>(), name + " merged-from (overlapping)");
+
+		// Merge() of a tree from a different pool copies the values over.
+		Tree heap(balance, allocation == AllocationMode::Arena ? AllocationMode::Heap : AllocationMode::Arena);
+		Model<Key> heapModel;
+		Fill(heap, heapModel, 200, 3000, makeKey);
+		for (const std::pair<const Key, Quantity>& entry : heapModel)
+		{
+			merged[entry.first] += entry.second;
+		}
+		other.Merge(heap);
+		CheckMatches(other, merged, name + " merge (other pool)");
+		CheckMatches(heap, Model<Key>(), name + " merged-from (other pool)");
+
+		// Split() at a stored value, a value that is not stored, and past both ends.
+		for (int cut : { 700, 1500, -1, 5000 })
+		{
+			Key at = makeKey(cut);
+			Tree lower = other.Clone();
+			Tree upper = lower.Split(at);
+			Model<Key> lowerModel(merged.begin(), merged.lower_bound(at));
+			Model<Key> upperModel(merged.lower_bound(at), merged.end());
+			CheckMatches(lower, lowerModel, name + " split " + std::to_string(cut) + " (lower)");
+			CheckMatches(upper, upperModel, name + " split " + std::to_string(cut) + " (upper)");
+
+			// Merging the two halves back gives the whole tree again.
+			lower.Merge(upper);
+			CheckMatches(lower, merged, name + " split " + std::to_string(cut) + " (merged back)");
+		}
+
+		// Merge() into a tree of every other balance mode, empty and then not: an AVL tree
+		// rebalances what it takes in, the other modes keep it as it is.
+		for (BalanceMode target : BalanceModes)
+		{
+			std::string into = name + " merge into " + ModeName(target);
+			Tree mixed(target, allocation);
+			Tree copy = other.Clone();
+			mixed.Merge(copy);
+			CheckMatches(mixed, merged, into + " (empty)");
+			Tree more(balance, allocation);
+			Model<Key> mixedModel = merged;
+			Fill(more, mixedModel, 300, 3000, makeKey);
+			mixed.Merge(more);
+			CheckMatches(mixed, mixedModel, into);
+			CheckMatches(more, Model<Key>(), into + " (merged-from)");
+		}
+
+		// Clear() empties the tree, and it can be filled again afterwards.
+		other.Clear();
+		CheckMatches(other, Model<Key>(), name + " clear");
+		Model<Key> refill;
+		Fill(other, refill, 100, 100, makeKey);
+		CheckMatches(other, refill, name + " refill");
+	}
+};
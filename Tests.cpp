@@ -0,0 +1,18 @@
+/*
+*   Binary Search Tree Tests
+*   Runs the TestDriver checks and exits with 1 if any of them failed.
+*
+*   Usage: BinarySearchTreeTests
+*/
+
+#pragma region Preprocessor Directives
+// Includes the TestDriver class.
+#include "TestDriver.h"
+#pragma endregion Preprocessor Directives
+
+int main()
+{
+    TestDriver testDriver = TestDriver();
+    // Every failed check has already been printed, so only the exit code is left.
+    return (testDriver.Run() == 0) ? 0 : 1;
+}
@@ -0,0 +1,382 @@
+/*
+* This file defines what a Binary Search Tree (BST) can report about itself, so a tree
+* that is misbehaving can be looked at while it runs.
+*
+* TreeStats describes the shape of a tree: its height, how many nodes and values it
+* holds, how deep the average search has to go, and how lopsided it is. A tree built
+* from sorted input without balancing turns into a long chain, which shows up here as
+* a height far above the best possible height and a skew close to +1 or -1.
+*
+* The per-operation counters are opt-in. They are only compiled in when
+* BST_ENABLE_STATS is defined before this file is included (it must be defined the
+* same way in every file of a program). Then every Insert, Delete and lookup records
+* how many comparisons it made, how deep it went and how long it took into a
+* histogram. Without BST_ENABLE_STATS the SearchProbe below is empty and every call on
+* it does nothing, so the compiler removes the counting entirely.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows the counters to be updated from several threads at once.
+#include <atomic>
+// Allows operations to be timed.
+#include <chrono>
+// Allows the use of size_t.
+#include <cstddef>
+// Allows the use of fixed width integers.
+#include <cstdint>
+// Allows the use of numeric_limits.
+#include <limits>
+// Allows the counters to be written to any output stream.
+#include <ostream>
+#pragma endregion Preprocessor Directives
+
+// The shape of a Binary Search Tree at one moment, as returned by Stats().
+struct TreeStats
+{
+	// The number of nodes on the longest path from the root down (0 when empty).
+	int height = 0;
+	// The smallest height any binary tree with this many nodes could have.
+	int minimumHeight = 0;
+	// The number of nodes, so the number of distinct values.
+	std::size_t nodeCount = 0;
+	// The number of values, counting every duplicate.
+	std::uint64_t totalQuantity = 0;
+	// The number of nodes a search visits on average to find a stored value.
+	double averageDepth = 0;
+	// Like averageDepth, but each value counts as often as it is stored.
+	double weightedAverageDepth = 0;
+	// The largest difference between the heights of a node's two subtrees.
+	int maxBalanceFactor = 0;
+	// The share of nodes that have exactly one child. Close to 1 for a chain.
+	double oneChildShare = 0;
+	// Between -1 and +1. The share of nodes whose right subtree is taller, minus the
+	// share whose left subtree is taller. Sorted input gives +1, reverse sorted -1.
+	double skew = 0;
+
+	/// <summary>
+	/// Returns how many times taller the tree is than it needs to be (1 is perfect).
+	/// An AVL tree always stays below about 1.44.
+	/// </summary>
+	/// <returns></returns>
+	double HeightRatio() const
+	{
+		return (minimumHeight == 0) ? 1.0 : static_cast<double>(height) / minimumHeight;
+	}
+
+	/// <summary>
+	/// Returns true if the tree has grown more than twice as tall as it needs to be,
+	/// which is the usual sign that sorted input has turned it into a chain.
+	/// </summary>
+	/// <returns></returns>
+	bool Degenerate() const
+	{
+		return HeightRatio() > 2.0;
+	}
+};
+
+// Writes a TreeStats as one line of "name value" pairs.
+inline std::ostream& operator<<(std::ostream& out, const TreeStats& stats)
+{
+	return out << "height " << stats.height << " (best " << stats.minimumHeight << ")"
+		<< ", nodes " << stats.nodeCount << ", values " << stats.totalQuantity
+		<< ", average depth " << stats.averageDepth << " (weighted " << stats.weightedAverageDepth << ")"
+		<< ", max balance " << stats.maxBalanceFactor << ", one child " << stats.oneChildShare
+		<< ", skew " << stats.skew;
+}
+
+// The operations that are counted when BST_ENABLE_STATS is defined.
+enum class TreeOperation
+{
+	// Insert() and Emplace().
+	Insert,
+	// Delete() and EraseAll().
+	Delete,
+	// Find(), Contains() and Count().
+	Lookup
+};
+
+// The number of values in TreeOperation.
+const int TreeOperationCount = 3;
+
+// Define the StatsHistogram class.
+// Counts values into power-of-two buckets: bucket 0 holds 0, and bucket i holds the
+// values from 2^(i-1) up to 2^i - 1. Every update is a relaxed atomic add, so several
+// threads can record into one histogram.
+class StatsHistogram
+{
+public:
+	// One bucket for 0, and one for each bit a 64-bit value can have.
+	static const int BucketCount = 65;
+
+	// The constructor for the StatsHistogram. Starts with every bucket empty.
+	StatsHistogram()
+	{
+		Reset();
+	}
+
+	// Copies the counts of another histogram (atomics cannot be copied directly).
+	StatsHistogram(const StatsHistogram& other)
+	{
+		*this = other;
+	}
+
+	// Copies the counts of another histogram.
+	StatsHistogram& operator=(const StatsHistogram& other)
+	{
+		for (int i = 0; i < BucketCount; i++)
+		{
+			buckets[i].store(other.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+		sum.store(other.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		return *this;
+	}
+
+	/// <summary>
+	/// Adds one value to the histogram.
+	/// </summary>
+	/// <param name="value"> The value to record.</param>
+	void Record(std::uint64_t value)
+	{
+		buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+		sum.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Returns the number of values recorded.
+	/// </summary>
+	/// <returns></returns>
+	std::uint64_t Count() const
+	{
+		std::uint64_t count = 0;
+		for (int i = 0; i < BucketCount; i++)
+		{
+			count += buckets[i].load(std::memory_order_relaxed);
+		}
+		return count;
+	}
+
+	/// <summary>
+	/// Returns the number of values recorded into bucket i.
+	/// </summary>
+	/// <param name="i"> The bucket, from 0 to BucketCount - 1.</param>
+	/// <returns></returns>
+	std::uint64_t Bucket(int i) const
+	{
+		return buckets[i].load(std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Returns the average of every value recorded (0 if there are none).
+	/// </summary>
+	/// <returns></returns>
+	double Mean() const
+	{
+		std::uint64_t count = Count();
+		return (count == 0) ? 0.0 : static_cast<double>(sum.load(std::memory_order_relaxed)) / count;
+	}
+
+	/// <summary>
+	/// Returns a value that at least fraction of the recorded values are not above:
+	/// the largest value of the bucket that holds that percentile. So the answer is
+	/// never more than about twice the true percentile.
+	/// </summary>
+	/// <param name="fraction"> The percentile, from 0 to 1 (0.99 for p99).</param>
+	/// <returns></returns>
+	std::uint64_t Percentile(double fraction) const
+	{
+		std::uint64_t count = Count();
+		if (count == 0)
+		{
+			return 0;
+		}
+		// The number of values that must be at or below the answer.
+		std::uint64_t needed = static_cast<std::uint64_t>(fraction * count);
+		needed = (needed == 0) ? 1 : needed;
+
+		std::uint64_t seen = 0;
+		for (int i = 0; i < BucketCount; i++)
+		{
+			seen += buckets[i].load(std::memory_order_relaxed);
+			if (seen >= needed)
+			{
+				return UpperOf(i);
+			}
+		}
+		return UpperOf(BucketCount - 1);
+	}
+
+	/// <summary>
+	/// Empties every bucket.
+	/// </summary>
+	void Reset()
+	{
+		for (int i = 0; i < BucketCount; i++)
+		{
+			buckets[i].store(0, std::memory_order_relaxed);
+		}
+		sum.store(0, std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Returns the bucket that value goes into.
+	/// </summary>
+	/// <param name="value"> The value being recorded.</param>
+	/// <returns></returns>
+	static int BucketOf(std::uint64_t value)
+	{
+		// Count the bits needed to write value down.
+		int bits = 0;
+		while (value != 0)
+		{
+			value >>= 1;
+			bits++;
+		}
+		return bits;
+	}
+
+	/// <summary>
+	/// Returns the largest value that goes into bucket i.
+	/// </summary>
+	/// <param name="i"> The bucket.</param>
+	/// <returns></returns>
+	static std::uint64_t UpperOf(int i)
+	{
+		return (i >= 64) ? std::numeric_limits<std::uint64_t>::max() : (std::uint64_t(1) << i) - 1;
+	}
+
+	// Private members.
+private:
+	// The number of values recorded into each bucket.
+	std::atomic<std::uint64_t> buckets[BucketCount];
+	// The sum of every value recorded, for Mean().
+	std::atomic<std::uint64_t> sum;
+};
+
+// The histograms kept for one TreeOperation.
+struct OperationStats
+{
+	// How many comparisons each call made.
+	StatsHistogram comparisons;
+	// How many nodes each call walked through.
+	StatsHistogram depth;
+	// How long each call took, in nanoseconds.
+	StatsHistogram latency;
+
+	/// <summary>
+	/// Returns the number of calls recorded.
+	/// </summary>
+	/// <returns></returns>
+	std::uint64_t Calls() const
+	{
+		return comparisons.Count();
+	}
+};
+
+// Writes the calls, mean comparisons, mean depth and latency percentiles of one operation.
+inline std::ostream& operator<<(std::ostream& out, const OperationStats& stats)
+{
+	return out << stats.Calls() << " calls, " << stats.comparisons.Mean() << " comparisons (p99 <= "
+		<< stats.comparisons.Percentile(0.99) << "), depth " << stats.depth.Mean() << " (max bucket <= "
+		<< stats.depth.Percentile(1.0) << "), latency p50 <= " << stats.latency.Percentile(0.5)
+		<< " ns, p99 <= " << stats.latency.Percentile(0.99) << " ns";
+}
+
+// Define the SearchProbe struct.
+// Counts the work of one operation while it walks down the tree. With BST_ENABLE_STATS
+// it also notes when the operation started. Without it, it holds nothing at all.
+struct SearchProbe
+{
+#ifdef BST_ENABLE_STATS
+	// The number of comparisons made so far.
+	std::uint64_t comparisons = 0;
+	// The number of nodes walked through so far.
+	std::uint64_t depth = 0;
+	// When the operation started.
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#endif
+
+	/// <summary>
+	/// Notes that one more node was walked through.
+	/// </summary>
+	void Visit()
+	{
+#ifdef BST_ENABLE_STATS
+		depth++;
+#endif
+	}
+
+	/// <summary>
+	/// Returns compare(a, b), counting the comparison.
+	/// </summary>
+	template <typename Compare, typename A, typename B>
+	bool Less(const Compare& compare, const A& a, const B& b)
+	{
+#ifdef BST_ENABLE_STATS
+		comparisons++;
+#endif
+		return compare(a, b);
+	}
+};
+
+// Define the TreeCounters class.
+// The histograms for every TreeOperation of one tree.
+class TreeCounters
+{
+public:
+	/// <summary>
+	/// Returns the histograms kept for operation.
+	/// </summary>
+	/// <param name="operation"> The operation to look up.</param>
+	/// <returns></returns>
+	const OperationStats& operator[](TreeOperation operation) const
+	{
+		return operations[static_cast<int>(operation)];
+	}
+
+	/// <summary>
+	/// Records one finished operation. Does nothing without BST_ENABLE_STATS.
+	/// </summary>
+	/// <param name="operation"> The operation that finished.</param>
+	/// <param name="probe"> The probe it counted its work with.</param>
+	void Record(TreeOperation operation, const SearchProbe& probe)
+	{
+#ifdef BST_ENABLE_STATS
+		OperationStats& stats = operations[static_cast<int>(operation)];
+		stats.comparisons.Record(probe.comparisons);
+		stats.depth.Record(probe.depth);
+		stats.latency.Record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - probe.start).count()));
+#else
+		(void)operation;
+		(void)probe;
+#endif
+	}
+
+	/// <summary>
+	/// Empties every histogram.
+	/// </summary>
+	void Reset()
+	{
+		for (OperationStats& stats : operations)
+		{
+			stats.comparisons.Reset();
+			stats.depth.Reset();
+			stats.latency.Reset();
+		}
+	}
+
+	// Private members.
+private:
+	// One set of histograms per TreeOperation.
+	OperationStats operations[TreeOperationCount];
+};
+
+// Writes one line per operation.
+inline std::ostream& operator<<(std::ostream& out, const TreeCounters& counters)
+{
+	return out << "Insert: " << counters[TreeOperation::Insert] << '\n'
+		<< "Delete: " << counters[TreeOperation::Delete] << '\n'
+		<< "Lookup: " << counters[TreeOperation::Lookup] << '\n';
+}
@@ -0,0 +1,983 @@
+/*
+* This file defines a write-ahead log for a Binary Search Tree (BST), and the
+* DurableBinarySearchTree class that uses one (together with snapshots, see Snapshot.h)
+* so that no acknowledged Insert or Delete is lost if the process or the machine stops.
+*
+* A log file is laid out as:
+*
+*   WriteAheadLogHeader                 magic, version, key size, start sequence
+*   record, record, record ...
+*
+* and each record is only as long as it needs to be:
+*
+*   std::uint8_t                        the operation (LogOperation)
+*   Key                                 the value, byte for byte
+*   1 to 10 bytes                       the quantity, 7 bits per byte (1 byte up to 127)
+*   std::uint32_t                       checksum of the record and its sequence number
+*
+* Records are numbered one after the other, starting just after the header's start
+* sequence, so the numbers themselves are never written. Since the checksum covers the
+* number too, a record torn in half by a crash (or left over from an older log) does not
+* check out, and the log is cut off just before it.
+*
+* Writing a record is cheap, but making sure it reached the disk (fsync) is not, so how
+* often that happens is up to the SyncPolicy:
+*
+*   - Never:    every record is handed to the operating system (written, not synced)
+*               before Append() returns. Survives the process crashing, but not the machine.
+*   - Always:   every record is written and synced on its own before the next one
+*               starts. The slowest, and the simplest.
+*   - Group:    records from every thread are gathered, and one thread writes and syncs
+*               them all at once while the others wait (group commit). Each caller still
+*               waits until its own record is on disk, but one fsync covers many of them.
+*   - Periodic: a background thread writes and syncs whatever has gathered every few
+*               milliseconds. Callers never wait, but a crash loses that last stretch.
+*
+* On startup DurableBinarySearchTree loads the newest snapshot, then replays every
+* record of the log numbered after the snapshot's sequence. Checkpoint() saves a new
+* snapshot (synced, then renamed over the old one) and starts the log over, so replay
+* never has to go back further than the last checkpoint.
+*
+* Like snapshots, records store keys exactly as they sit in memory, so Key must be
+* trivially copyable and the log can only be read on a machine with the same byte order.
+*/
+
+#pragma region Preprocessor Directives
+// This file will only be included once.
+#pragma once
+// Allows the use of std::min.
+#include <algorithm>
+// Allows the use of std::chrono::milliseconds.
+#include <chrono>
+// Allows the flusher thread and waiting callers to be woken up.
+#include <condition_variable>
+// Allows the use of fixed width integers.
+#include <cstdint>
+// Allows the use of std::rename and std::remove.
+#include <cstdio>
+// Allows the use of memcpy and size_t.
+#include <cstring>
+// Allows the snapshot file to be looked for.
+#include <fstream>
+// Allows the use of std::less.
+#include <functional>
+// Allows the use of mutexes.
+#include <mutex>
+// Allows the use of std::runtime_error.
+#include <stdexcept>
+// Allow for use of strings.
+#include <string>
+// Allows the periodic flusher to run in the background.
+#include <thread>
+// Allows the use of type traits.
+#include <type_traits>
+// Allows the use of vectors.
+#include <vector>
+// The BST class.
+#include "BinarySearchTree.h"
+// The snapshots the log continues from.
+#include "Snapshot.h"
+// Allows files to be written and synced.
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#pragma endregion Preprocessor Directives
+
+// The first bytes of every log file.
+static constexpr char WriteAheadLogMagic[8] = { 'B', 'S', 'T', 'W', 'A', 'L', '\0', '\0' };
+// The version of the format written by WriteAheadLog.
+static constexpr std::uint32_t WriteAheadLogVersion = 1;
+
+// The start of every log file.
+struct WriteAheadLogHeader
+{
+	// Always WriteAheadLogMagic.
+	char magic[8];
+	// The format version. Also reads wrong on a machine with a different byte order.
+	std::uint32_t version;
+	// sizeof(Key) of the tree the log belongs to.
+	std::uint32_t keySize;
+	// The sequence number just before the first record, usually that of the snapshot
+	// the log continues from.
+	std::uint64_t startSequence;
+};
+
+// What a log record does to the tree.
+enum class LogOperation : std::uint8_t
+{
+	// Insert the value quantity times.
+	Insert = 1,
+	// Delete up to quantity copies of the value.
+	Delete = 2
+};
+
+// When the log makes sure its records have reached the disk. See the top of this file.
+enum class SyncPolicy
+{
+	// Never sync. Every record is written right away and left to the operating system.
+	Never,
+	// Write and sync every record on its own.
+	Always,
+	// Write and sync every waiting record at once, and let each caller wait for its own.
+	Group,
+	// Write and sync on a background thread every few milliseconds. Callers never wait.
+	Periodic
+};
+
+// Define the LogFile class, a file that is only ever appended to, read in full, synced
+// or cut short.
+class LogFile
+{
+public:
+	/// <summary>
+	/// Opens the file at path for reading and appending, creating it if it does not
+	/// exist. Throws std::runtime_error if it cannot be opened.
+	/// </summary>
+	/// <param name="path"> The file to open.</param>
+	explicit LogFile(const std::string& path)
+		: path(path)
+	{
+#if defined(_WIN32)
+		file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+#else
+		descriptor = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (descriptor < 0)
+#endif
+		{
+			throw std::runtime_error("LogFile: could not open " + path);
+		}
+	}
+
+	// The file is closed exactly once, so it is never copied.
+	LogFile(const LogFile&) = delete;
+	LogFile& operator=(const LogFile&) = delete;
+
+	// The destructor. Closes the file (without syncing it).
+	~LogFile()
+	{
+#if defined(_WIN32)
+		CloseHandle(file);
+#else
+		close(descriptor);
+#endif
+	}
+
+	/// <summary>
+	/// Returns every byte of the file.
+	/// </summary>
+	/// <returns></returns>
+	std::vector<char> ReadAll()
+	{
+		std::vector<char> bytes;
+		char chunk[1 << 16];
+		std::uint64_t offset = 0;
+		while (true)
+		{
+#if defined(_WIN32)
+			OVERLAPPED at = {};
+			at.Offset = (DWORD)offset;
+			at.OffsetHigh = (DWORD)(offset >> 32);
+			DWORD got = 0;
+			if (!ReadFile(file, chunk, sizeof(chunk), &got, &at) && GetLastError() != ERROR_HANDLE_EOF)
+			{
+				throw std::runtime_error("LogFile: could not read " + path);
+			}
+#else
+			ssize_t got = pread(descriptor, chunk, sizeof(chunk), (off_t)offset);
+			if (got < 0)
+			{
+				throw std::runtime_error("LogFile: could not read " + path);
+			}
+#endif
+			if (got == 0)
+			{
+				return bytes;
+			}
+			bytes.insert(bytes.end(), chunk, chunk + got);
+			offset += got;
+		}
+	}
+
+	/// <summary>
+	/// Appends size bytes at data to the end of the file. Throws std::runtime_error if
+	/// they cannot all be written.
+	/// </summary>
+	/// <param name="data"> The bytes to write.</param>
+	/// <param name="size"> The number of bytes to write.</param>
+	void Append(const char* data, std::size_t size)
+	{
+		while (size > 0)
+		{
+#if defined(_WIN32)
+			DWORD wrote = 0;
+			OVERLAPPED at = {};
+			at.Offset = 0xFFFFFFFF;
+			at.OffsetHigh = 0xFFFFFFFF;
+			if (!WriteFile(file, data, (DWORD)std::min<std::size_t>(size, 1 << 30), &wrote, &at))
+#else
+			ssize_t wrote = write(descriptor, data, size);
+			if (wrote < 0)
+#endif
+			{
+				throw std::runtime_error("LogFile: could not write " + path);
+			}
+			data += wrote;
+			size -= wrote;
+		}
+	}
+
+	/// <summary>
+	/// Waits until everything written so far has reached the disk.
+	/// </summary>
+	void Sync()
+	{
+#if defined(_WIN32)
+		if (!FlushFileBuffers(file))
+#elif defined(__APPLE__)
+		if (fsync(descriptor) != 0)
+#else
+		if (fdatasync(descriptor) != 0)
+#endif
+		{
+			throw std::runtime_error("LogFile: could not sync " + path);
+		}
+	}
+
+	/// <summary>
+	/// Cuts the file down to its first size bytes. Later appends go after them.
+	/// </summary>
+	/// <param name="size"> The number of bytes to keep.</param>
+	void Truncate(std::uint64_t size)
+	{
+#if defined(_WIN32)
+		LARGE_INTEGER at;
+		at.QuadPart = (LONGLONG)size;
+		if (!SetFilePointerEx(file, at, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+#else
+		if (ftruncate(descriptor, (off_t)size) != 0 || lseek(descriptor, 0, SEEK_END) < 0)
+#endif
+		{
+			throw std::runtime_error("LogFile: could not truncate " + path);
+		}
+	}
+
+	/// <summary>
+	/// Syncs the file at path, then renames it to target, replacing target if it exists,
+	/// so target is always either the old file or the whole new one.
+	/// </summary>
+	/// <param name="path"> The finished file.</param>
+	/// <param name="target"> The name it should have.</param>
+	static void SyncAndReplace(const std::string& path, const std::string& target)
+	{
+		{
+			LogFile finished(path);
+			finished.Sync();
+		}
+#if defined(_WIN32)
+		if (!MoveFileExA(path.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		{
+			throw std::runtime_error("LogFile: could not replace " + target);
+		}
+#else
+		if (std::rename(path.c_str(), target.c_str()) != 0)
+		{
+			throw std::runtime_error("LogFile: could not replace " + target);
+		}
+		// The rename itself is only on disk once the directory is synced.
+		std::string::size_type slash = target.find_last_of('/');
+		std::string directory = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : target.substr(0, slash));
+		int folder = open(directory.c_str(), O_RDONLY);
+		if (folder >= 0)
+		{
+			fsync(folder);
+			close(folder);
+		}
+#endif
+	}
+
+private:
+	// The path, for error messages.
+	std::string path;
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+#else
+	int descriptor = -1;
+#endif
+};
+
+// Define the WriteAheadLog class.
+template <typename Key>
+class WriteAheadLog
+{
+public:
+	/// <summary>
+	/// Opens the log at path, or starts a new one there. Records already in the log are
+	/// checked, and anything after the last whole record (left by a crash) is cut off.
+	/// Throws std::runtime_error if the file is not a log for this Key.
+	/// </summary>
+	/// <param name="path"> The log file.</param>
+	/// <param name="syncPolicy"> When records are synced to disk.</param>
+	/// <param name="period"> How often the Periodic policy syncs.</param>
+	WriteAheadLog(const std::string& path, SyncPolicy syncPolicy = SyncPolicy::Group,
+		std::chrono::milliseconds period = std::chrono::milliseconds(10))
+		: file(path), policy(syncPolicy), path(path)
+	{
+		static_assert(std::is_trivially_copyable<Key>::value, "The log stores keys byte for byte, so Key must be trivially copyable.");
+
+		// A new (or empty) file gets a header. Else, find where the whole records end.
+		std::vector<char> bytes = file.ReadAll();
+		if (bytes.size() < sizeof(WriteAheadLogHeader))
+		{
+			StartOver(0);
+		}
+		else
+		{
+			std::uint64_t end = Scan(bytes, [](LogOperation, const Key&, Quantity, std::uint64_t) {});
+			file.Truncate(end);
+		}
+
+		// The Periodic policy gets a thread that syncs in the background.
+		if (policy == SyncPolicy::Periodic)
+		{
+			flusher = std::thread([this, period]()
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					while (!stopping)
+					{
+						wake.wait_for(guard, period);
+						if (!writing && !failed && durable < appended)
+						{
+							try
+							{
+								WriteOut(guard, true);
+							}
+							catch (const std::runtime_error&)
+							{
+								// WriteOut() marked the log as failed; the next caller finds out.
+							}
+						}
+					}
+				});
+		}
+	}
+
+	// The log owns a file and maybe a thread, so it is never copied.
+	WriteAheadLog(const WriteAheadLog&) = delete;
+	WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+	// The destructor. Writes and syncs whatever is still waiting.
+	~WriteAheadLog()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		if (flusher.joinable())
+		{
+			flusher.join();
+		}
+		try
+		{
+			Sync();
+		}
+		catch (const std::runtime_error&)
+		{
+			// Destructors must not throw. Whatever could not be written is lost either way.
+		}
+	}
+
+	/// <summary>
+	/// Adds a record to the log and returns its sequence number. With the Always policy
+	/// the record is on disk before this returns, and with Never it has at least been
+	/// handed to the operating system; with Group, call WaitDurable() with the
+	/// number. Records are numbered in the order Append() is called, so callers that need
+	/// the log to match the tree must call it in the same order they change the tree.
+	/// </summary>
+	/// <param name="operation"> What the record does.</param>
+	/// <param name="val"> The value it does it to.</param>
+	/// <param name="count"> How many copies.</param>
+	/// <returns></returns>
+	std::uint64_t Append(LogOperation operation, const Key& val, Quantity count = 1)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		if (failed)
+		{
+			throw std::runtime_error("WriteAheadLog: an earlier write to " + path + " failed.");
+		}
+		std::uint64_t sequence = ++appended;
+		Encode(pending, sequence, operation, val, count);
+
+		// Always writes and syncs this record right away, and Never only writes it, both
+		// keeping the lock the whole time.
+		if (policy == SyncPolicy::Always || policy == SyncPolicy::Never)
+		{
+			WriteOut(guard, policy == SyncPolicy::Always);
+		}
+		return sequence;
+	}
+
+	/// <summary>
+	/// With the Group policy, waits until the record numbered sequence is on disk. If no
+	/// other thread is writing, this thread writes and syncs every waiting record itself;
+	/// else it waits for that thread, whose sync may well cover this record too. With any
+	/// other policy, returns right away.
+	/// </summary>
+	/// <param name="sequence"> A number returned by Append().</param>
+	void WaitDurable(std::uint64_t sequence)
+	{
+		if (policy != SyncPolicy::Group)
+		{
+			return;
+		}
+		std::unique_lock<std::mutex> guard(lock);
+		while (durable < sequence)
+		{
+			if (failed)
+			{
+				throw std::runtime_error("WriteAheadLog: an earlier write to " + path + " failed.");
+			}
+			if (writing)
+			{
+				wake.wait(guard);
+			}
+			else
+			{
+				WriteOut(guard, true);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Writes and syncs every record appended so far, whatever the policy.
+	/// </summary>
+	void Sync()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (writing)
+		{
+			wake.wait(guard);
+		}
+		if (failed)
+		{
+			throw std::runtime_error("WriteAheadLog: an earlier write to " + path + " failed.");
+		}
+		if (durable < appended)
+		{
+			WriteOut(guard, true);
+		}
+	}
+
+	/// <summary>
+	/// Calls apply(operation, value, quantity) for every record in the log numbered after
+	/// sequence, in order, and returns the number of the last record in the log.
+	/// </summary>
+	/// <param name="sequence"> Records up to this number are skipped.</param>
+	/// <param name="apply"> Called with each record.</param>
+	/// <returns></returns>
+	template <typename Apply>
+	std::uint64_t Replay(std::uint64_t sequence, Apply&& apply)
+	{
+		Sync();
+		std::unique_lock<std::mutex> guard(lock);
+		std::vector<char> bytes = file.ReadAll();
+		Scan(bytes, [sequence, &apply](LogOperation operation, const Key& val, Quantity count, std::uint64_t number)
+			{
+				if (number > sequence)
+				{
+					apply(operation, val, count);
+				}
+			});
+		return appended;
+	}
+
+	/// <summary>
+	/// Throws every record away and starts the log over, numbering the next record
+	/// sequence + 1. Called once a snapshot holds everything up to sequence.
+	/// </summary>
+	/// <param name="sequence"> The sequence number the log now starts after.</param>
+	void Reset(std::uint64_t sequence)
+	{
+		Sync();
+		std::unique_lock<std::mutex> guard(lock);
+		StartOver(sequence);
+	}
+
+	/// <summary>
+	/// Returns the number of the last record appended.
+	/// </summary>
+	/// <returns></returns>
+	std::uint64_t LastSequence() const
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return appended;
+	}
+
+	/// <summary>
+	/// Returns the number the log started after (the first record is numbered one more).
+	/// </summary>
+	/// <returns></returns>
+	std::uint64_t StartSequence() const
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return start;
+	}
+
+	/// <summary>
+	/// Returns how many times the log has synced, to see how many records each sync covered.
+	/// </summary>
+	/// <returns></returns>
+	std::uint64_t SyncCount() const
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return syncs;
+	}
+
+	/// <summary>
+	/// Returns the number of bytes in the log file, including the header.
+	/// </summary>
+	/// <returns></returns>
+	std::uint64_t Bytes() const
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return written + inFlight.size() + pending.size();
+	}
+
+private:
+	// The most bytes one record can take: the operation, the value, a 64-bit quantity at
+	// 7 bits per byte, and the checksum.
+	static constexpr std::size_t MaxRecordBytes = 1 + sizeof(Key) + 10 + sizeof(std::uint32_t);
+
+	// The log file.
+	LogFile file;
+	// When records are synced.
+	SyncPolicy policy;
+	// The path, for error messages.
+	std::string path;
+	// Guards everything below.
+	mutable std::mutex lock;
+	// Wakes the flusher thread and the callers waiting for a write to finish.
+	std::condition_variable wake;
+	// Records appended but not yet handed to the file.
+	std::vector<char> pending;
+	// The records being written right now (kept to reuse its memory).
+	std::vector<char> inFlight;
+	// The number the log started after.
+	std::uint64_t start = 0;
+	// The number of the last record appended.
+	std::uint64_t appended = 0;
+	// The number of the last record known to be on disk.
+	std::uint64_t durable = 0;
+	// The bytes handed to the file so far.
+	std::uint64_t written = 0;
+	// The number of syncs so far.
+	std::uint64_t syncs = 0;
+	// True while a thread is writing with the lock let go.
+	bool writing = false;
+	// True once a write has failed. Nothing more is written after that.
+	bool failed = false;
+	// Tells the flusher thread to stop.
+	bool stopping = false;
+	// Syncs in the background for the Periodic policy.
+	std::thread flusher;
+
+	/// <summary>
+	/// Writes (and if sync is true, syncs) every pending record. The lock is let go while
+	/// the file is written, except with the Always and Never policies, so more records can
+	/// gather in the meantime; they go in the next batch. Must be called holding guard,
+	/// with no other write going on. (Private)
+	/// </summary>
+	/// <param name="guard"> The held lock.</param>
+	/// <param name="sync"> Whether to sync the file after writing.</param>
+	void WriteOut(std::unique_lock<std::mutex>& guard, bool sync)
+	{
+		std::uint64_t upTo = appended;
+		inFlight.swap(pending);
+		writing = true;
+		bool keepLock = (policy == SyncPolicy::Always || policy == SyncPolicy::Never);
+		if (!keepLock)
+		{
+			guard.unlock();
+		}
+		try
+		{
+			file.Append(inFlight.data(), inFlight.size());
+			if (sync)
+			{
+				file.Sync();
+			}
+		}
+		catch (...)
+		{
+			if (!keepLock)
+			{
+				guard.lock();
+			}
+			writing = false;
+			failed = true;
+			wake.notify_all();
+			throw;
+		}
+		if (!keepLock)
+		{
+			guard.lock();
+		}
+		written += inFlight.size();
+		inFlight.clear();
+		writing = false;
+		if (sync)
+		{
+			durable = upTo;
+			syncs++;
+		}
+		wake.notify_all();
+	}
+
+	/// <summary>
+	/// Empties the file and writes a new header that starts after sequence. (Private)
+	/// </summary>
+	/// <param name="sequence"> The number the log starts after.</param>
+	void StartOver(std::uint64_t sequence)
+	{
+		WriteAheadLogHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, WriteAheadLogMagic, sizeof(header.magic));
+		header.version = WriteAheadLogVersion;
+		header.keySize = sizeof(Key);
+		header.startSequence = sequence;
+
+		file.Truncate(0);
+		file.Append(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.Sync();
+		start = sequence;
+		appended = sequence;
+		durable = sequence;
+		written = sizeof(header);
+	}
+
+	/// <summary>
+	/// Checks the header of bytes, then calls visit(operation, value, quantity, number)
+	/// for each whole record, and returns where the last one ends. Also sets the sequence
+	/// numbers to carry on after it. (Private)
+	/// </summary>
+	/// <param name="bytes"> The whole log file.</param>
+	/// <param name="visit"> Called with each record.</param>
+	/// <returns></returns>
+	template <typename Visitor>
+	std::uint64_t Scan(const std::vector<char>& bytes, Visitor&& visit)
+	{
+		WriteAheadLogHeader header;
+		std::memcpy(&header, bytes.data(), sizeof(header));
+		if (std::memcmp(header.magic, WriteAheadLogMagic, sizeof(header.magic)) != 0 || header.version != WriteAheadLogVersion)
+		{
+			throw std::runtime_error("WriteAheadLog: " + path + " is not a log this version can read.");
+		}
+		if (header.keySize != sizeof(Key))
+		{
+			throw std::runtime_error("WriteAheadLog: " + path + " was written with a different key type.");
+		}
+
+		std::size_t offset = sizeof(header);
+		std::uint64_t number = header.startSequence;
+		while (true)
+		{
+			std::size_t length = Decode(bytes, offset, number + 1, visit);
+			// A record that is cut short or does not check out ends the log.
+			if (length == 0)
+			{
+				break;
+			}
+			offset += length;
+			number++;
+		}
+		start = header.startSequence;
+		appended = number;
+		durable = number;
+		written = offset;
+		return offset;
+	}
+
+	/// <summary>
+	/// Adds the record for (operation, val, count), numbered sequence, to the end of out.
+	/// (Private)
+	/// </summary>
+	static void Encode(std::vector<char>& out, std::uint64_t sequence, LogOperation operation, const Key& val, Quantity count)
+	{
+		char record[MaxRecordBytes];
+		std::size_t length = 0;
+		record[length++] = (char)operation;
+		std::memcpy(record + length, &val, sizeof(Key));
+		length += sizeof(Key);
+		// 7 bits of the quantity per byte, with the top bit set on every byte but the last.
+		do
+		{
+			unsigned char part = (unsigned char)(count & 0x7F);
+			count >>= 7;
+			record[length++] = (char)(part | (count != 0 ? 0x80 : 0));
+		} while (count != 0);
+		std::uint32_t checksum = Checksum(sequence, record, length);
+		std::memcpy(record + length, &checksum, sizeof(checksum));
+		length += sizeof(checksum);
+		out.insert(out.end(), record, record + length);
+	}
+
+	/// <summary>
+	/// Reads the record at offset, expecting it to be numbered sequence. If it is whole
+	/// and checks out, calls visit with it and returns its length; else returns 0. (Private)
+	/// </summary>
+	template <typename Visitor>
+	static std::size_t Decode(const std::vector<char>& bytes, std::size_t offset, std::uint64_t sequence, Visitor&& visit)
+	{
+		std::size_t length = 1 + sizeof(Key);
+		if (offset + length > bytes.size())
+		{
+			return 0;
+		}
+		const char* record = bytes.data() + offset;
+		LogOperation operation = (LogOperation)(unsigned char)record[0];
+		if (operation != LogOperation::Insert && operation != LogOperation::Delete)
+		{
+			return 0;
+		}
+
+		// Read the quantity back, 7 bits at a time.
+		Quantity count = 0;
+		for (int shift = 0; ; shift += 7)
+		{
+			if (offset + length >= bytes.size() || shift > 63)
+			{
+				return 0;
+			}
+			unsigned char part = (unsigned char)record[length++];
+			count |= (Quantity)(part & 0x7F) << shift;
+			if ((part & 0x80) == 0)
+			{
+				break;
+			}
+		}
+
+		std::uint32_t stored;
+		if (offset + length + sizeof(stored) > bytes.size())
+		{
+			return 0;
+		}
+		std::memcpy(&stored, record + length, sizeof(stored));
+		if (stored != Checksum(sequence, record, length))
+		{
+			return 0;
+		}
+
+		Key val;
+		std::memcpy(&val, record + 1, sizeof(Key));
+		visit(operation, static_cast<const Key&>(val), count, sequence);
+		return length + sizeof(stored);
+	}
+
+	/// <summary>
+	/// The checksum of one record: the snapshot hash of its number and bytes, folded down
+	/// to 32 bits. (Private)
+	/// </summary>
+	static std::uint32_t Checksum(std::uint64_t sequence, const char* record, std::size_t length)
+	{
+		std::uint64_t hash = SnapshotChecksum(SnapshotChecksumSeed, &sequence, sizeof(sequence));
+		hash = SnapshotChecksum(hash, record, length);
+		return (std::uint32_t)(hash ^ (hash >> 32));
+	}
+};
+
+// Define the DurableBinarySearchTree class.
+// A BinarySearchTree whose every Insert and Delete is logged, so it can be rebuilt after a
+// crash from the last snapshot plus the log. Safe to use from many threads: changes to the
+// tree take turns, but with the Group policy their syncs are shared.
+template <typename Key, typename Compare = std::less<Key>>
+class DurableBinarySearchTree
+{
+public:
+	// The tree the values are kept in.
+	using TreeType = BinarySearchTree<Key, Compare>;
+
+	/// <summary>
+	/// Rebuilds the tree from the snapshot at snapshotPath (if there is one) and every
+	/// record of the log at logPath that came after it, then carries on logging there.
+	/// Throws std::runtime_error if either file cannot be read, or if the log starts
+	/// after the snapshot ends (records would be missing).
+	/// </summary>
+	/// <param name="snapshotPath"> Where Checkpoint() saves snapshots.</param>
+	/// <param name="logPath"> The log file.</param>
+	/// <param name="syncPolicy"> When log records are synced to disk.</param>
+	/// <param name="balanceMode"> The balancing policy of the tree.</param>
+	DurableBinarySearchTree(const std::string& snapshotPath, const std::string& logPath,
+		SyncPolicy syncPolicy = SyncPolicy::Group, BalanceMode balanceMode = BalanceMode::AVL)
+		: tree(balanceMode), log(logPath, syncPolicy), snapshotPath(snapshotPath)
+	{
+		// Load the snapshot, if one has been saved.
+		std::uint64_t sequence = 0;
+		if (std::ifstream(snapshotPath, std::ios::binary).good())
+		{
+			sequence = LoadSnapshot(tree, snapshotPath);
+		}
+		if (log.StartSequence() > sequence)
+		{
+			throw std::runtime_error("DurableBinarySearchTree: " + logPath + " starts after the snapshot " + snapshotPath + " ends.");
+		}
+
+		// Then redo everything logged after it.
+		std::uint64_t last = log.Replay(sequence, [this](LogOperation operation, const Key& val, Quantity count)
+			{
+				if (operation == LogOperation::Insert)
+				{
+					tree.Insert(val, count);
+				}
+				else
+				{
+					tree.Delete(val, count);
+				}
+			});
+
+		// If the snapshot is newer than the whole log (a crash hit between saving it and
+		// starting the log over), start the log over now.
+		if (last < sequence)
+		{
+			log.Reset(sequence);
+		}
+	}
+
+	// The tree owns its log file, so it is never copied.
+	DurableBinarySearchTree(const DurableBinarySearchTree&) = delete;
+	DurableBinarySearchTree& operator=(const DurableBinarySearchTree&) = delete;
+
+	/// <summary>
+	/// Insert count copies of val. Once this returns, the insert is on disk as far as the
+	/// sync policy promises.
+	/// </summary>
+	/// <param name="val"> The value to be stored.</param>
+	/// <param name="count"> The number of copies to add.</param>
+	void Insert(const Key& val, Quantity count = 1)
+	{
+		// Log the change before making it, so a log that fails (and throws) leaves the
+		// tree as it was, then wait for the disk without holding up the other threads.
+		std::uint64_t sequence;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			sequence = log.Append(LogOperation::Insert, val, count);
+			tree.Insert(val, count);
+		}
+		log.WaitDurable(sequence);
+	}
+
+	/// <summary>
+	/// Delete up to count copies of val and return the number removed. Only deletes that
+	/// removed something are logged.
+	/// </summary>
+	/// <param name="val"> The value to be deleted.</param>
+	/// <param name="count"> The most copies to remove.</param>
+	/// <returns></returns>
+	Quantity Delete(const Key& val, Quantity count = 1)
+	{
+		std::uint64_t sequence = 0;
+		Quantity removed;
+		{
+			// Like Insert(), log the delete first, so work out beforehand how much it removes.
+			std::lock_guard<std::mutex> guard(lock);
+			removed = std::min(tree.Count(val), count);
+			if (removed != 0)
+			{
+				sequence = log.Append(LogOperation::Delete, val, removed);
+				tree.Delete(val, removed);
+			}
+		}
+		if (removed != 0)
+		{
+			log.WaitDurable(sequence);
+		}
+		return removed;
+	}
+
+	/// <summary>
+	/// Returns the number of times val is stored, or 0.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	Quantity Count(const Key& val) const
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return tree.Count(val);
+	}
+
+	/// <summary>
+	/// Returns true if val is stored.
+	/// </summary>
+	/// <param name="val"> The value to look for.</param>
+	/// <returns></returns>
+	bool Contains(const Key& val) const
+	{
+		return Count(val) > 0;
+	}
+
+	/// <summary>
+	/// Returns the number of stored values, counting duplicates.
+	/// </summary>
+	/// <returns></returns>
+	Quantity Size() const
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return tree.Size();
+	}
+
+	/// <summary>
+	/// Visits every stored value in sorted order, calling visit(value, quantity). The tree
+	/// is locked meanwhile, so visit must not use it.
+	/// </summary>
+	/// <param name="visit"> Called with each value and its quantity.</param>
+	template <typename Visitor>
+	void ForEach(Visitor&& visit) const
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		tree.ForEach(visit);
+	}
+
+	/// <summary>
+	/// Saves a snapshot of the tree, then starts the log over after it. The snapshot is
+	/// written next to the old one, synced, and only then renamed over it, so a crash at
+	/// any point leaves a snapshot and a log that rebuild the tree. Writers wait meanwhile.
+	/// </summary>
+	void Checkpoint()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::uint64_t sequence = log.LastSequence();
+		std::string temporary = snapshotPath + ".tmp";
+		SaveSnapshot(tree, temporary, sequence);
+		LogFile::SyncAndReplace(temporary, snapshotPath);
+		log.Reset(sequence);
+	}
+
+	/// <summary>
+	/// Returns the log, for its statistics.
+	/// </summary>
+	/// <returns></returns>
+	const WriteAheadLog<Key>& Log() const
+	{
+		return log;
+	}
+
+private:
+	// Lets one thread at a time change (or read) the tree.
+	mutable std::mutex lock;
+	// The values.
+	TreeType tree;
+	// The log of every change since the last snapshot.
+	WriteAheadLog<Key> log;
+	// Where snapshots are saved.
+	std::string snapshotPath;
+};